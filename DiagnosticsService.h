@@ -0,0 +1,293 @@
+#ifndef __BLE_DIAGNOSTICS_SERVICE_H__
+#define __BLE_DIAGNOSTICS_SERVICE_H__
+
+#include "BLE.h"
+#include "HIDService.h"
+#include "USBHost.h"
+#include "USBHostLatency.h"
+#include "USBHostMonitor.h"
+
+#if USBHOST_DIAGNOSTICS
+
+/**
+* @class Diagnostics Service
+* @brief BLE service exposing the performance counters of the bridge, for a phone app in the field.<br>
+* The characteristics are little endian binary records, each one fits in a notification (20 bytes).
+* They are computed when read and notified by update().
+*
+* USB (20 bytes), counters of the connected devices and pools of the host (USBHOST_STATS):
+*   transfers u32, errors u32, naks u32, timeouts u16, stalls u16,
+*   ED max u8, TD max u8, mail max u8, lost events u8 (saturated)
+* Latency (20 bytes), keystroke from the USB ISR to the BLE notification, in us (USBHOST_LATENCY):
+*   count u32, p50 u32, p90 u32, p99 u32, max u32
+*   the percentiles are the upper bounds of the log2 buckets of the histogram
+* BLE (12 bytes), notifications:
+*   queued u8, queued max u8, rejected u16, accepted u32, sent u32
+*   queued: notifications of the characteristics enabled by the client (HID report and
+*   this service) not yet sent, since the connection. accepted: HID reports accepted by the stack
+* Threads (up to 19 bytes), in the order of the RTOS (USBHOST_MONITOR):
+*   count u8, then for each thread: CPU share u8 in 0.5 %, stack high-water u8 in % (0xFF if unknown)
+*/
+class DiagnosticsService {
+public:
+    DiagnosticsService(BLEDevice &_ble, HIDService * _hid):
+        ble(_ble),
+        hid(_hid),
+        sent(0),
+        expected(0),
+        hidNotifications(0),
+        subscriptions(0),
+        queuedMax(0),
+        USB_Counters(UUID("a7c40001-5b1e-4f3a-9d2c-3e8f6b1d0c21"), usbValue, sizeof(usbValue), sizeof(usbValue), GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ|GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        Key_Latency(UUID("a7c40002-5b1e-4f3a-9d2c-3e8f6b1d0c21"), latencyValue, sizeof(latencyValue), sizeof(latencyValue), GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ|GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        BLE_Notifications(UUID("a7c40003-5b1e-4f3a-9d2c-3e8f6b1d0c21"), bleValue, sizeof(bleValue), sizeof(bleValue), GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ|GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
+        Thread_Load(UUID("a7c40004-5b1e-4f3a-9d2c-3e8f6b1d0c21"), threadsValue, 1, sizeof(threadsValue), GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ|GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY)
+        {
+            memset(usbValue, 0, sizeof(usbValue));
+            memset(latencyValue, 0, sizeof(latencyValue));
+            memset(bleValue, 0, sizeof(bleValue));
+            memset(threadsValue, 0, sizeof(threadsValue));
+
+            static bool serviceAdded = false; /* We should only ever need to add the diagnostics service once. */
+            if (serviceAdded) {
+            return;
+            }
+            GattCharacteristic *charTable[] = {&USB_Counters, &Key_Latency, &BLE_Notifications, &Thread_Load};
+            for (unsigned i = 0; i < sizeof(charTable) / sizeof(GattCharacteristic *); i++) {
+                charTable[i]->setReadAuthorizationCallback(this, &DiagnosticsService::onDataRead);
+            }
+            GattService         DiagnosticsGattService(UUID("a7c40000-5b1e-4f3a-9d2c-3e8f6b1d0c21"), charTable, sizeof(charTable) / sizeof(GattCharacteristic *));
+            ble.addService(DiagnosticsGattService);
+            serviceAdded = true;
+            ble.gattServer().onDataSent(this, &DiagnosticsService::onDataSent);
+            ble.gattServer().onUpdatesEnabled(GattServer::EventCallback_t(this, &DiagnosticsService::onUpdatesEnabled));
+            ble.gattServer().onUpdatesDisabled(GattServer::EventCallback_t(this, &DiagnosticsService::onUpdatesDisabled));
+            ble.gap().onDisconnection(this, &DiagnosticsService::onDisconnection);
+        }
+
+public:
+    /**
+    * Refresh the characteristics and notify the subscribed clients, to be called periodically
+    */
+    void update() {
+        notify(USB_Counters, usbValue, fillUSB());
+        notify(Key_Latency, latencyValue, fillLatency());
+        notify(BLE_Notifications, bleValue, fillNotifications());
+        notify(Thread_Load, threadsValue, fillThreads());
+    }
+
+    /** Notifications sent by the BLE stack, all the services together */
+    void onDataSent(unsigned count) {
+        sent += count;
+    }
+
+    /** A client enabled the notifications of a characteristic (CCCD) */
+    void onUpdatesEnabled(GattAttribute::Handle_t handle) {
+        countReports();
+        subscriptions |= subscription(handle);
+    }
+
+    /** A client disabled the notifications of a characteristic (CCCD) */
+    void onUpdatesDisabled(GattAttribute::Handle_t handle) {
+        countReports();
+        subscriptions &= ~subscription(handle);
+    }
+
+    /** The notifications not sent are lost with the connection */
+    void onDisconnection(const Gap::DisconnectionCallbackParams_t *params) {
+        countReports();
+        subscriptions = 0;
+        expected = 0;
+        sent = 0;
+    }
+
+    /** Fresh value for a read of a client */
+    void onDataRead(GattReadAuthCallbackParams *params) {
+        if (params->handle == USB_Counters.getValueAttribute().getHandle()) {
+            params->data = usbValue;
+            params->len = fillUSB();
+        } else if (params->handle == Key_Latency.getValueAttribute().getHandle()) {
+            params->data = latencyValue;
+            params->len = fillLatency();
+        } else if (params->handle == BLE_Notifications.getValueAttribute().getHandle()) {
+            params->data = bleValue;
+            params->len = fillNotifications();
+        } else if (params->handle == Thread_Load.getValueAttribute().getHandle()) {
+            params->data = threadsValue;
+            params->len = fillThreads();
+        }
+        params->authorizationReply = AUTH_CALLBACK_REPLY_SUCCESS;
+    }
+
+private:
+    void notify(GattCharacteristic &characteristic, uint8_t *value, uint16_t len) {
+        // the value is also updated when no client is notified
+        if ((ble.updateCharacteristicValue(characteristic.getValueAttribute().getHandle(), value, len) == BLE_ERROR_NONE) &&
+            (subscriptions & subscription(characteristic.getValueAttribute().getHandle()))) {
+            expected++;
+        }
+    }
+
+    // bit of a notified characteristic in subscriptions
+    uint8_t subscription(GattAttribute::Handle_t handle) {
+        if (handle == hid->getReportHandle()) {
+            return SUBSCRIBED_HID;
+        }
+        GattCharacteristic *charTable[] = {&USB_Counters, &Key_Latency, &BLE_Notifications, &Thread_Load};
+        for (unsigned i = 0; i < sizeof(charTable) / sizeof(GattCharacteristic *); i++) {
+            if (handle == charTable[i]->getValueAttribute().getHandle()) {
+                return 1 << i;
+            }
+        }
+        return 0;
+    }
+
+    // HID reports accepted since the last call, notified if the client enabled them
+    void countReports() {
+        uint32_t notifications = hid->getNotifications();
+        if (subscriptions & SUBSCRIBED_HID) {
+            expected += notifications - hidNotifications;
+        }
+        hidNotifications = notifications;
+    }
+
+    static uint8_t *put8(uint8_t *p, uint32_t v) {
+        *p++ = (v > 0xFF) ? 0xFF : v;
+        return p;
+    }
+
+    static uint8_t *put16(uint8_t *p, uint32_t v) {
+        if (v > 0xFFFF) {
+            v = 0xFFFF;
+        }
+        *p++ = v;
+        *p++ = v >> 8;
+        return p;
+    }
+
+    static uint8_t *put32(uint8_t *p, uint32_t v) {
+        p = put16(p, v & 0xFFFF);
+        return put16(p, v >> 16);
+    }
+
+    uint16_t fillUSB() {
+        uint8_t *p = usbValue;
+#if USBHOST_STATS
+        USBHost *host = USBHost::getHostInst();
+        USBEndpointStats total;
+        USBDeviceStats stats;
+        USBPoolStats pool;
+
+        memset(&total, 0, sizeof(total));
+        for (uint8_t i = 0; i < MAX_DEVICE_CONNECTED; i++) {
+            USBDeviceConnected *dev = host->getDevice(i);
+            if ((dev != NULL) && host->getDeviceStats(dev, &stats)) {
+                total.transfers += stats.total.transfers;
+                total.errors += stats.total.errors;
+                total.naks += stats.total.naks;
+                total.timeouts += stats.total.timeouts;
+                total.stalls += stats.total.stalls;
+            }
+        }
+        host->getPoolStats(&pool);
+
+        p = put32(p, total.transfers);
+        p = put32(p, total.errors);
+        p = put32(p, total.naks);
+        p = put16(p, total.timeouts);
+        p = put16(p, total.stalls);
+        p = put8(p, pool.eds.max);
+        p = put8(p, pool.tds.max);
+        p = put8(p, pool.mails.max);
+        p = put8(p, pool.mail_failures);
+#endif
+        return sizeof(usbValue);
+    }
+
+    uint16_t fillLatency() {
+        uint8_t *p = latencyValue;
+#if USBHOST_LATENCY
+        USBLatencyStats stats;
+        USBHostLatency::getStats(USB_LATENCY_ISR, &stats);
+
+        p = put32(p, stats.count);
+        p = put32(p, percentile(stats, 50));
+        p = put32(p, percentile(stats, 90));
+        p = put32(p, percentile(stats, 99));
+        p = put32(p, stats.max);
+#endif
+        return sizeof(latencyValue);
+    }
+
+#if USBHOST_LATENCY
+    // upper bound of the bucket holding the percentile, the maximum for the last bucket
+    static uint32_t percentile(const USBLatencyStats &stats, uint32_t percent) {
+        uint32_t rank = (stats.count * percent + 99) / 100;
+        uint32_t sum = 0;
+        for (uint8_t i = 0; (i < USB_LATENCY_BUCKETS - 1) && rank; i++) {
+            sum += stats.histogram[i];
+            if (sum >= rank) {
+                return (1UL << i) < stats.max ? (1UL << i) : stats.max;
+            }
+        }
+        return stats.max;
+    }
+#endif
+
+    uint16_t fillNotifications() {
+        countReports();
+        uint32_t queued = (expected > sent) ? expected - sent : 0;
+        uint8_t *p = bleValue;
+
+        if (queued > queuedMax) {
+            queuedMax = queued;
+        }
+        p = put8(p, queued);
+        p = put8(p, queuedMax);
+        p = put16(p, hid->getRejected());
+        p = put32(p, hid->getNotifications());
+        p = put32(p, sent);
+        return sizeof(bleValue);
+    }
+
+    uint16_t fillThreads() {
+        uint8_t *p = threadsValue;
+#if USBHOST_MONITOR
+        USBThreadStats stats[(sizeof(threadsValue) - 1) / 2];
+        uint32_t samples;
+        int nb = USBHostMonitor::getStats(stats, sizeof(stats) / sizeof(stats[0]), &samples);
+
+        p = put8(p, nb);
+        for (int i = 0; i < nb; i++) {
+            p = put8(p, samples ? (uint32_t)(((uint64_t)stats[i].samples * 200) / samples) : 0);
+            p = put8(p, (stats[i].stack_max && stats[i].stack_size) ? (stats[i].stack_max * 100) / stats[i].stack_size : 0xFF);
+        }
+#else
+        p = put8(p, 0);
+#endif
+        return p - threadsValue;
+    }
+
+private:
+    static const uint8_t SUBSCRIBED_HID = 1 << 4;
+
+    BLEDevice           &ble;
+    HIDService          *hid;
+    uint32_t            sent;                   // notifications sent on the connection
+    uint32_t            expected;               // notifications to the clients which enabled them
+    uint32_t            hidNotifications;       // HID reports already counted
+    uint8_t             subscriptions;          // characteristics enabled by the client
+    uint32_t            queuedMax;
+    uint8_t             usbValue[20];
+    uint8_t             latencyValue[20];
+    uint8_t             bleValue[12];
+    uint8_t             threadsValue[19];
+    GattCharacteristic      USB_Counters;
+    GattCharacteristic      Key_Latency;
+    GattCharacteristic      BLE_Notifications;
+    GattCharacteristic      Thread_Load;
+};
+
+#endif
+
+#endif /* #ifndef __BLE_DIAGNOSTICS_SERVICE_H__*/
@@ -2,6 +2,8 @@
 #define __BLE_HID_SERVICE_H__
 
 #include "BLE.h"
+#include "USBHostTrace.h"
+#include "USBHostLatency.h"
 /**
 * @class Human Interface Device Service
 * @brief BLE Human Interface Device Service. This service displays the Glucose measurement value represented as a 16bit Float format.<br>
@@ -21,7 +23,9 @@ public:
         ReportMap(GattCharacteristic::UUID_REPORT_MAP_CHAR, KeyboardMap.getPointer(), 76, sizeof(KeyboardMap), GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ |GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY),
         Report(GattCharacteristic::UUID_REPORT_CHAR, reportValue.getPointer(), 8, 8, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_NOTIFY|GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ),
         HID_Information(GattCharacteristic::UUID_HID_INFORMATION_CHAR, hidInformation.getPointer(), 4, 4, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_READ),
-        HID_Control_Point(GattCharacteristic::UUID_HID_CONTROL_POINT_CHAR, &hidcontrolPointer, 1, 1, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE)
+        HID_Control_Point(GattCharacteristic::UUID_HID_CONTROL_POINT_CHAR, &hidcontrolPointer, 1, 1, GattCharacteristic::BLE_GATT_CHAR_PROPERTIES_WRITE_WITHOUT_RESPONSE),
+        notifications(0),
+        rejected(0)
         {
             static bool serviceAdded = false; /* We should only ever need to add the heart rate service once. */
             if (serviceAdded) {
@@ -36,9 +40,25 @@ public:
         }
 public:
     void updateReport(uint8_t modifydata, uint8_t data) {
+        USB_TRACE_SCOPE("hid_update_report");
+        USB_LATENCY_STAMP(USB_LATENCY_REPORT);
         reportValue.updateReportValue(modifydata, data);
-        ble.updateCharacteristicValue(Report.getValueAttribute().getHandle(), reportValue.getPointer(), 8);
+        if (ble.updateCharacteristicValue(Report.getValueAttribute().getHandle(), reportValue.getPointer(), 8) == BLE_ERROR_NONE) {
+            USB_LATENCY_STAMP(USB_LATENCY_BLE);
+            notifications++;
+        } else {
+            rejected++;
+        }
     }
+
+    /** Number of reports accepted by the BLE stack */
+    uint32_t getNotifications() const { return notifications; }
+
+    /** Number of reports rejected by the BLE stack (no buffer or not connected) */
+    uint32_t getRejected() const { return rejected; }
+
+    /** Handle of the report value, notified to the clients which enabled it */
+    GattAttribute::Handle_t getReportHandle() { return Report.getValueAttribute().getHandle(); }
     
     virtual void onDataWritten(const GattWriteCallbackParams *params) {
         if (params->handle == HID_Control_Point.getValueAttribute().getHandle()) {
@@ -120,5 +140,7 @@ private:
 //    ReadOnlyGattCharacteristic         Boot_Mouse_Input_Report;
     GattCharacteristic      HID_Information;
     GattCharacteristic      HID_Control_Point;
+    uint32_t                notifications;
+    uint32_t                rejected;
 };
 #endif /* #ifndef __BLE_GLUCOSE_SERVICE_H__*/
\ No newline at end of file
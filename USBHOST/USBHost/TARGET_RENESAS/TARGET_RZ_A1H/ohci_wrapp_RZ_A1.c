@@ -19,6 +19,7 @@
 #include <string.h>
 #include "cmsis.h"
 #include "cmsis_os.h"
+#include "us_ticker_api.h"
 #include "ohci_wrapp_RZ_A1.h"
 #include "ohci_wrapp_RZ_A1_local.h"
 #include "rza_io_regrw.h"
@@ -70,7 +71,8 @@
 #define TD_CTL_SHFT_EC                  (26)
 #define TD_CTL_SHFT_T                   (24)
 #define ED_SHFT_TOGLE_CARRY             (1)
-#define SIG_GEN_LIST_REQ                (1)
+#define SIG_SCHED_REQ                   (1)
+#define SIG_SCAN_REQ                    (2)
 #if (ISO_TRANS_MAX_NUM > 0)
 #define TD_PSW_MSK_CC                   (0xF000)
 #define TD_PSW_SHFT_CC                  (12)
@@ -80,11 +82,27 @@
 
 #define CTL_TRANS_TIMEOUT               (1000)
 #define BLK_TRANS_TIMEOUT               (5)
-#define TOTAL_SEM_NUM                   (5 + (2 * INT_TRANS_MAX_NUM) + (2 * ISO_TRANS_MAX_NUM))
+#define INT_SCAN_INTERVAL               (10)
+#define BLK_DMA_ALIGN_OUT               (4)
+#define BLK_DMA_ALIGN_IN                (32)     /* cache line size */
+#define ISO_IDLE_COUNT                  (8)
+
+/* The object names are mapped per channel in usb_host_setting.h, expand */
+/* them before they are pasted by the CMSIS-RTOS definition macros.      */
+#define OHCIWRAPP_THREAD_DEF(name, priority, stacksz)  osThreadDef(name, priority, stacksz)
+#define OHCIWRAPP_THREAD(name)                         osThread(name)
+#define OHCIWRAPP_SEMAPHORE_DEF(name)                  osSemaphoreDef(name)
+#define OHCIWRAPP_SEMAPHORE(name)                      osSemaphore(name)
+#define OHCIWRAPP_MUTEX_DEF(name)                      osMutexDef(name)
+#define OHCIWRAPP_MUTEX(name)                          osMutex(name)
 
 #define PORT_LOW_SPEED                  (0x00000200)
 #define PORT_HIGH_SPEED                 (0x00000400)
 #define PORT_NUM                        (16 + 1) /* num + root(1) */
+#define DEVADD_NUM                      (USB_HOST_DEVICE_10 + 1)
+#define PORT_RESET                      (0x0004)
+#define REQ_TYPE_CLASS_OTHER_OUT        (0x23)
+#define REQ_TYPE_CLASS_OTHER_IN         (0xA3)
 
 typedef struct tag_hctd {
     uint32_t         control;        /* Transfer descriptor control */
@@ -145,17 +163,19 @@ typedef struct tag_usb_ohci_reg {
 } usb_ohci_reg_t;
 
 typedef struct tag_genelal_ed {
-    osThreadId      tskid;
-    osSemaphoreId   semid_wait;
-    osSemaphoreId   semid_list;
     void            *p_curr_td;     /* pointer of hctd_t or hcisotd_t */
     hced_t          *p_curr_ed;
     uint32_t        pipe_no;
-    uint32_t        trans_wait;
+    volatile uint32_t trans_wait;   /* 1:started, cleared by ohciwrappx_loc_TransEnd() */
+    uint32_t        active;         /* 1:waiting for the scheduler to finish it */
+    uint32_t        start_time;     /* us_ticker value when the transfer was started */
     uint32_t        cycle_time;
+    uint32_t        wait_cnt;
     uint8_t         *p_start_buf;
 #if (ISO_TRANS_MAX_NUM > 0)
     uint32_t        psw_idx;
+    uint32_t        frame_wait;
+    uint32_t        frame_no;
 #endif
 } genelal_ed_t;
 
@@ -169,18 +189,24 @@ typedef struct tag_tdinfo {
 } tdinfo_t;
 
 typedef struct tag_split_trans {
-    uint16_t        root_devadr;
-    uint16_t        get_port;
-    uint16_t        port_speed;
+    uint16_t        reset_hub;      /* address of the hub which has reset reset_port */
     uint16_t        reset_port;
+    uint16_t        get_hub;        /* address of the hub which has been asked the status of get_port */
+    uint16_t        get_port;
     uint32_t        seq_cnt;
-    uint32_t        port_sts_bits[PORT_NUM];
+    uint16_t        port_sts_bits[DEVADD_NUM][PORT_NUM];
 } split_trans_t;
 
-static void callback_task(void const * argument);
-static void control_ed_task(void const * argument);
-static void bulk_ed_task(void const * argument);
-static void int_ed_task(void const * argument);
+static void ohciwrappx_callback_task(void const * argument);
+static void ohciwrappx_sched_task(void const * argument);
+static uint32_t sched_timeout(uint32_t now);
+static uint32_t trans_remain(genelal_ed_t *p_g_ed, uint32_t timeout, uint32_t now);
+static void control_list_run(uint32_t now);
+static void control_trans_finish(void);
+static void bulk_list_run(uint32_t now);
+static void bulk_trans_finish(void);
+static void int_ed_run(uint32_t index, uint32_t elapsed, uint32_t scan);
+static void int_trans_finish(genelal_ed_t *p_g_ed);
 static int32_t int_trans_doing(hced_t *p_ed, uint32_t index);
 static int32_t chk_genelal_ed(genelal_ed_t *p_g_ed);
 static void chk_genelal_td_done(genelal_ed_t *p_g_ed);
@@ -188,13 +214,16 @@ static void chk_split_trans_setting(genelal_ed_t *p_g_ed);
 static void set_split_trans_setting(void);
 static void control_trans(genelal_ed_t *p_g_ed);
 static void bulk_trans(genelal_ed_t *p_g_ed);
+#if (BLK_TRANS_DMA != 0)
+static uint16_t blk_fifo_port(tdinfo_t *p_td_info, uint8_t *p_buf);
+#endif
 static void int_trans_setting(genelal_ed_t *p_g_ed, uint32_t index);
 static uint32_t chk_cycle(hced_t *p_ed);
 static void int_trans(genelal_ed_t *p_g_ed);
 static void get_td_info(genelal_ed_t *p_g_ed, tdinfo_t *p_td_info);
 static void set_togle(uint32_t pipe, hctd_t *p_td, hced_t *p_ed);
 #if (ISO_TRANS_MAX_NUM > 0)
-static void iso_ed_task(void const * argument);
+static void iso_ed_run(uint32_t index, uint32_t elapsed, uint32_t scan);
 static int32_t iso_trans_doing(hced_t *p_ed, uint32_t index);
 static void chk_iso_td_done(genelal_ed_t *p_g_ed);
 static int32_t chk_iso_ed(genelal_ed_t *p_g_ed);
@@ -203,16 +232,18 @@ static void iso_trans(genelal_ed_t *p_g_ed);
 #endif
 static void connect_check(void);
 
-extern USB_HOST_CFG_PIPETBL_t  usb_host_blk_ep_tbl1[];
-extern USB_HOST_CFG_PIPETBL_t  usb_host_int_ep_tbl1[];
+extern USB_HOST_CFG_PIPETBL_t  usbx_host_blk_ep_tbl1[];
+extern USB_HOST_CFG_PIPETBL_t  usbx_host_int_ep_tbl1[];
 #if (ISO_TRANS_MAX_NUM > 0)
-extern USB_HOST_CFG_PIPETBL_t  usb_host_iso_ep_tbl1[];
+extern USB_HOST_CFG_PIPETBL_t  usbx_host_iso_ep_tbl1[];
 #endif
 
 static usb_ohci_reg_t usb_reg;
 static usb_ohci_reg_t *p_usb_reg     = &usb_reg;
 static usbisr_fnc_t   *p_usbisr_cb   = NULL;
 static osSemaphoreId  semid_cb       = NULL;
+static osThreadId     tskid_sched    = NULL;
+static osMutexId      mtxid_sched    = NULL;
 static uint32_t       connect_change = 0xFFFFFFFF;
 static uint32_t       connect_status = 0;
 static uint32_t       init_end       = 0;
@@ -225,118 +256,17 @@ static split_trans_t  split_ctl;
 static genelal_ed_t   iso_ed[ISO_TRANS_MAX_NUM];
 #endif
 
-osSemaphoreDef(ohciwrapp_sem_01);
-osSemaphoreDef(ohciwrapp_sem_02);
-osSemaphoreDef(ohciwrapp_sem_03);
-osSemaphoreDef(ohciwrapp_sem_04);
-osSemaphoreDef(ohciwrapp_sem_05);
-osSemaphoreDef(ohciwrapp_sem_06);
-osSemaphoreDef(ohciwrapp_sem_07);
-#if (INT_TRANS_MAX_NUM >= 2)
-osSemaphoreDef(ohciwrapp_sem_08);
-osSemaphoreDef(ohciwrapp_sem_09);
-#endif
-#if (INT_TRANS_MAX_NUM >= 3)
-osSemaphoreDef(ohciwrapp_sem_10);
-osSemaphoreDef(ohciwrapp_sem_11);
-#endif
-#if (INT_TRANS_MAX_NUM >= 4)
-osSemaphoreDef(ohciwrapp_sem_12);
-osSemaphoreDef(ohciwrapp_sem_13);
-#endif
-#if (ISO_TRANS_MAX_NUM >= 1)
-osSemaphoreDef(ohciwrapp_sem_14);
-osSemaphoreDef(ohciwrapp_sem_15);
-#endif
-#if (ISO_TRANS_MAX_NUM >= 2)
-osSemaphoreDef(ohciwrapp_sem_16);
-osSemaphoreDef(ohciwrapp_sem_17);
-#endif
+OHCIWRAPP_SEMAPHORE_DEF(ohciwrappx_sem_cb);
+OHCIWRAPP_MUTEX_DEF(ohciwrappx_mtx_sched);
 
-osThreadDef(callback_task,   osPriorityHigh,        512);
-osThreadDef(control_ed_task, osPriorityNormal,      512);
-osThreadDef(bulk_ed_task,    osPriorityNormal,      512);
-static void int_ed_task_1(void const * argument) {
-    int_ed_task(argument);
-}
-osThreadDef(int_ed_task_1,   osPriorityNormal,      512);
-#if (INT_TRANS_MAX_NUM >= 2)
-static void int_ed_task_2(void const * argument) {
-    int_ed_task(argument);
-}
-osThreadDef(int_ed_task_2,   osPriorityNormal,      512);
-#endif
-#if (INT_TRANS_MAX_NUM >= 3)
-static void int_ed_task_3(void const * argument) {
-    int_ed_task(argument);
-}
-osThreadDef(int_ed_task_3,   osPriorityNormal,      512);
-#endif
-#if (INT_TRANS_MAX_NUM >= 4)
-static void int_ed_task_4(void const * argument) {
-    int_ed_task(argument);
-}
-osThreadDef(int_ed_task_4,   osPriorityNormal,      512);
-#endif
-
-#if (ISO_TRANS_MAX_NUM >= 1)
-static void iso_ed_task_1(void const * argument) {
-    iso_ed_task(argument);
-}
-osThreadDef(iso_ed_task_1,   osPriorityAboveNormal, 512);
-#endif
-#if (ISO_TRANS_MAX_NUM >= 2)
-static void iso_ed_task_2(void const * argument) {
-    iso_ed_task(argument);
-}
-osThreadDef(iso_ed_task_2,   osPriorityAboveNormal, 512);
-#endif
-
-void ohciwrapp_init(usbisr_fnc_t *p_usbisr_fnc) {
-    static const osSemaphoreDef_t * const sem_def_tbl[TOTAL_SEM_NUM] = {
-        osSemaphore(ohciwrapp_sem_01), osSemaphore(ohciwrapp_sem_02), osSemaphore(ohciwrapp_sem_03)
-      , osSemaphore(ohciwrapp_sem_04), osSemaphore(ohciwrapp_sem_05), osSemaphore(ohciwrapp_sem_06)
-      , osSemaphore(ohciwrapp_sem_07)
-#if (INT_TRANS_MAX_NUM >= 2)
-      , osSemaphore(ohciwrapp_sem_08), osSemaphore(ohciwrapp_sem_09)
-#endif
-#if (INT_TRANS_MAX_NUM >= 3)
-      , osSemaphore(ohciwrapp_sem_10), osSemaphore(ohciwrapp_sem_11)
-#endif
-#if (INT_TRANS_MAX_NUM >= 4)
-      , osSemaphore(ohciwrapp_sem_12), osSemaphore(ohciwrapp_sem_13)
-#endif
-#if (ISO_TRANS_MAX_NUM >= 1)
-      , osSemaphore(ohciwrapp_sem_14), osSemaphore(ohciwrapp_sem_15)
-#endif
-#if (ISO_TRANS_MAX_NUM >= 2)
-      , osSemaphore(ohciwrapp_sem_16), osSemaphore(ohciwrapp_sem_17)
-#endif
-    };
-    static const osThreadDef_t * const int_tsk_def_tbl[INT_TRANS_MAX_NUM] = {
-        osThread(int_ed_task_1)
-#if (INT_TRANS_MAX_NUM >= 2)
-      , osThread(int_ed_task_2)
-#endif
-#if (INT_TRANS_MAX_NUM >= 3)
-      , osThread(int_ed_task_3)
-#endif
-#if (INT_TRANS_MAX_NUM >= 4)
-      , osThread(int_ed_task_4)
-#endif
-    };
+OHCIWRAPP_THREAD_DEF(ohciwrappx_callback_task, osPriorityHigh,        512);
 #if (ISO_TRANS_MAX_NUM > 0)
-    static const osThreadDef_t * const iso_tsk_def_tbl[ISO_TRANS_MAX_NUM] = {
-        osThread(iso_ed_task_1)
-#if (ISO_TRANS_MAX_NUM >= 2)
-      , osThread(iso_ed_task_2)
-#endif
-    };
+OHCIWRAPP_THREAD_DEF(ohciwrappx_sched_task,    osPriorityAboveNormal, 1024);
+#else
+OHCIWRAPP_THREAD_DEF(ohciwrappx_sched_task,    osPriorityNormal,      1024);
 #endif
 
-    uint32_t cnt;
-    uint32_t index = 0;
-
+void ohciwrappx_init(usbisr_fnc_t *p_usbisr_fnc) {
     /* Disables interrupt for usb */
     GIC_DisableIRQ(USBIXUSBIX);
 
@@ -394,48 +324,17 @@ void ohciwrapp_init(usbisr_fnc_t *p_usbisr_fnc) {
 #endif
 
         /* callback */
-        semid_cb = osSemaphoreCreate(sem_def_tbl[index], 0);
-        index++;
-        (void)osThreadCreate(osThread(callback_task), 0);
-
-        /* control transfer */
-        ctl_ed.semid_wait = osSemaphoreCreate(sem_def_tbl[index], 0);
-        index++;
-        ctl_ed.semid_list = osSemaphoreCreate(sem_def_tbl[index], 0);
-        index++;
-        ctl_ed.tskid = osThreadCreate(osThread(control_ed_task), 0);
-
-        /* bulk transfer */
-        blk_ed.semid_wait = osSemaphoreCreate(sem_def_tbl[index], 0);
-        index++;
-        blk_ed.semid_list =  osSemaphoreCreate(sem_def_tbl[index], 0);
-        index++;
-        blk_ed.tskid = osThreadCreate(osThread(bulk_ed_task), 0);
-
-        /* interrupt transfer */
-        for (cnt = 0; cnt < INT_TRANS_MAX_NUM; cnt++) {
-            int_ed[cnt].semid_wait = osSemaphoreCreate(sem_def_tbl[index], 0);
-            index++;
-            int_ed[cnt].semid_list = osSemaphoreCreate(sem_def_tbl[index], 0);
-            index++;
-            int_ed[cnt].tskid = osThreadCreate(int_tsk_def_tbl[cnt], (void *)cnt);
-        }
+        semid_cb = osSemaphoreCreate(OHCIWRAPP_SEMAPHORE(ohciwrappx_sem_cb), 0);
+        (void)osThreadCreate(OHCIWRAPP_THREAD(ohciwrappx_callback_task), 0);
 
-#if (ISO_TRANS_MAX_NUM > 0)
-        /* isochronous transfer */
-        for (cnt = 0; cnt < ISO_TRANS_MAX_NUM; cnt++) {
-            iso_ed[cnt].semid_wait = osSemaphoreCreate(sem_def_tbl[index], 0);
-            index++;
-            iso_ed[cnt].semid_list = osSemaphoreCreate(sem_def_tbl[index], 0);
-            index++;
-            iso_ed[cnt].tskid = osThreadCreate(iso_tsk_def_tbl[cnt], (void *)cnt);
-        }
-#endif
+        /* control, bulk, interrupt and isochronous transfer */
+        mtxid_sched = osMutexCreate(OHCIWRAPP_MUTEX(ohciwrappx_mtx_sched));
+        tskid_sched = osThreadCreate(OHCIWRAPP_THREAD(ohciwrappx_sched_task), 0);
         init_end = 1;
     }
 }
 
-uint32_t ohciwrapp_reg_r(uint32_t reg_ofs) {
+uint32_t ohciwrappx_reg_r(uint32_t reg_ofs) {
     if (init_end == 0) {
         return 0;
     }
@@ -443,7 +342,7 @@ uint32_t ohciwrapp_reg_r(uint32_t reg_ofs) {
     return *(uint32_t *)((uint8_t *)p_usb_reg + reg_ofs);
 }
 
-void ohciwrapp_reg_w(uint32_t reg_ofs, uint32_t set_data) {
+void ohciwrappx_reg_w(uint32_t reg_ofs, uint32_t set_data) {
     uint32_t cnt;
     uint32_t last_data;
     hcca_t   *p_hcca;
@@ -454,78 +353,66 @@ void ohciwrapp_reg_w(uint32_t reg_ofs, uint32_t set_data) {
 
     switch (reg_ofs) {
         case OHCI_REG_CONTROL:
+            (void)osMutexWait(mtxid_sched, osWaitForever);
             last_data            = p_usb_reg->HcControl;
             p_usb_reg->HcControl = (set_data & 0x000007FF);
-            if ((last_data & OR_CONTROL_CLE) != (set_data & OR_CONTROL_CLE)) {
-                /* change CLE */
-                if ((set_data & OR_CONTROL_CLE) != 0) {
-                    (void)osSemaphoreRelease(ctl_ed.semid_list);
-                } else {
-                    if (ctl_ed.trans_wait == 1) {
-                        ctl_ed.trans_wait = 0;
-                        (void)osSemaphoreRelease(ctl_ed.semid_wait);
-                    }
-                    (void)osSemaphoreWait(ctl_ed.semid_list, osWaitForever);
+            /* The caller edits a disabled list right away, so its transfer is finished here. */
+            if (((last_data & OR_CONTROL_CLE) != 0) && ((set_data & OR_CONTROL_CLE) == 0)) {
+                if (ctl_ed.active != 0) {
+                    ctl_ed.trans_wait = 0;
+                    control_trans_finish();
                 }
             }
-            if ((last_data & OR_CONTROL_BLE) != (set_data & OR_CONTROL_BLE)) {
-                /* change BLE */
-                if ((set_data & OR_CONTROL_BLE) != 0) {
-                    (void)osSemaphoreRelease(blk_ed.semid_list);
-                } else {
-                    if (blk_ed.trans_wait == 1) {
-                        blk_ed.trans_wait = 0;
-                        (void)osSemaphoreRelease(blk_ed.semid_wait);
-                    }
-                    (void)osSemaphoreWait(blk_ed.semid_list, osWaitForever);
+            if (((last_data & OR_CONTROL_BLE) != 0) && ((set_data & OR_CONTROL_BLE) == 0)) {
+                if (blk_ed.active != 0) {
+                    blk_ed.trans_wait = 0;
+                    bulk_trans_finish();
                 }
             }
 #if (ISO_TRANS_MAX_NUM > 0)
-            if ((last_data & OR_CONTROL_IE) != (set_data & OR_CONTROL_IE)) {
-                /* change IE */
+            if (((last_data & OR_CONTROL_IE) != 0) && ((set_data & OR_CONTROL_IE) == 0)) {
                 for (cnt = 0; cnt < ISO_TRANS_MAX_NUM; cnt++) {
-                    if ((set_data & OR_CONTROL_IE) != 0) {
-                        (void)osSemaphoreRelease(iso_ed[cnt].semid_list);
-                    } else {
-                        if (iso_ed[cnt].trans_wait == 1) {
-                            iso_ed[cnt].trans_wait = 0;
-                            (void)osSemaphoreRelease(iso_ed[cnt].semid_wait);
-                        }
-                        (void)osSemaphoreWait(iso_ed[cnt].semid_list, osWaitForever);
+                    iso_ed[cnt].frame_wait = 0;
+                    if (iso_ed[cnt].active != 0) {
+                        iso_ed[cnt].trans_wait = 0;
+                        iso_ed[cnt].active     = 0;
+                        iso_ed[cnt].wait_cnt   = ISO_IDLE_COUNT;
                     }
                 }
             }
 #endif
-            if ((last_data & OR_CONTROL_PLE) != (set_data & OR_CONTROL_PLE)) {
-                /* change PLE */
+            if (((last_data & OR_CONTROL_PLE) != 0) && ((set_data & OR_CONTROL_PLE) == 0)) {
                 for (cnt = 0; cnt < INT_TRANS_MAX_NUM; cnt++) {
-                    if ((set_data & OR_CONTROL_PLE) != 0) {
-                        (void)osSemaphoreRelease(int_ed[cnt].semid_list);
-                    } else {
-                        if (int_ed[cnt].trans_wait == 1) {
-                            int_ed[cnt].trans_wait = 0;
-                            (void)osSemaphoreRelease(int_ed[cnt].semid_wait);
-                        }
-                        (void)osSemaphoreWait(int_ed[cnt].semid_list, osWaitForever);
+                    if (int_ed[cnt].active != 0) {
+                        int_ed[cnt].trans_wait = 0;
+                        int_trans_finish(&int_ed[cnt]);
                     }
                 }
             }
+            (void)osMutexRelease(mtxid_sched);
+            if ((~last_data & set_data & (OR_CONTROL_PLE | OR_CONTROL_IE)) != 0) {
+                (void)osSignalSet(tskid_sched, SIG_SCAN_REQ);
+            } else if ((~last_data & set_data & (OR_CONTROL_CLE | OR_CONTROL_BLE)) != 0) {
+                (void)osSignalSet(tskid_sched, SIG_SCHED_REQ);
+            } else {
+                /* Do Nothing */
+            }
             break;
         case OHCI_REG_COMMANDSTATUS:
             if ((set_data & OR_CMD_STATUS_HCR) != 0) {    /* HostController Reset */
                 p_usb_reg->HcCommandStatus |= OR_CMD_STATUS_HCR;
                 if (usbx_api_host_init(16, g_usbx_host_SupportUsbDeviceSpeed, USBHCLOCK_X1_48MHZ) == USB_HOST_ATTACH) {
-                    ohciwrapp_loc_Connect(1);
+                    ohciwrappx_loc_Connect(1);
                 }
                 p_usb_reg->HcCommandStatus &= ~OR_CMD_STATUS_HCR;
             }
             if ((set_data & OR_CMD_STATUS_CLF) != 0) {
                 p_usb_reg->HcCommandStatus |= OR_CMD_STATUS_CLF;
-                osSignalSet(ctl_ed.tskid, SIG_GEN_LIST_REQ);
+                (void)osSignalSet(tskid_sched, SIG_SCHED_REQ);
             }
             if ((set_data & OR_CMD_STATUS_BLF) != 0) {
                 p_usb_reg->HcCommandStatus |= OR_CMD_STATUS_BLF;
-                osSignalSet(blk_ed.tskid, SIG_GEN_LIST_REQ);
+                (void)osSignalSet(tskid_sched, SIG_SCHED_REQ);
             }
             if ((set_data & OR_CMD_STATUS_OCR) != 0) {
                 p_usb_reg->HcCommandStatus |= OR_CMD_STATUS_OCR;
@@ -584,7 +471,7 @@ void ohciwrapp_reg_w(uint32_t reg_ofs, uint32_t set_data) {
     }
 }
 
-static void callback_task(void const * argument) {
+static void ohciwrappx_callback_task(void const * argument) {
     usbisr_fnc_t *p_wk_cb = p_usbisr_cb;
 
     if (p_wk_cb == NULL) {
@@ -597,120 +484,242 @@ static void callback_task(void const * argument) {
             connect_change = 0xFFFFFFFF;
             connect_check();
         }
-        p_wk_cb();
+        p_wk_cb(USB_HOST_CH);
     }
 }
 
-static void control_ed_task(void const * argument) {
+static void ohciwrappx_sched_task(void const * argument) {
+    osEvent  evt;
+    uint32_t cnt;
+    uint32_t now;
+    uint32_t elapsed;
+    uint32_t scan;
+    uint32_t scan_cnt  = 0;
+    uint32_t timeout   = osWaitForever;
+    uint32_t last_tick = us_ticker_read();
+
     while (1) {
-        osSignalWait(SIG_GEN_LIST_REQ, osWaitForever);
-        (void)osSemaphoreWait(ctl_ed.semid_list, osWaitForever);
-        while ((p_usb_reg->HcControl & OR_CONTROL_CLE) != 0) {
-            if ((p_usb_reg->HcControlCurrentED == 0)
-             && ((p_usb_reg->HcCommandStatus & OR_CMD_STATUS_CLF) != 0)) {
-                p_usb_reg->HcControlCurrentED =  p_usb_reg->HcControlHeadED;
-                p_usb_reg->HcCommandStatus    &= ~OR_CMD_STATUS_CLF;
-            }
-            if (p_usb_reg->HcControlCurrentED != 0) {
-                ctl_ed.p_curr_ed = (hced_t *)p_usb_reg->HcControlCurrentED;
-                if (chk_genelal_ed(&ctl_ed) != 0) {
-                    control_trans(&ctl_ed);
-                    p_usb_reg->HcCommandStatus |= OR_CMD_STATUS_CLF;
+        evt = osSignalWait(0, timeout);
+        if ((evt.status == osEventSignal) && ((evt.value.signals & SIG_SCAN_REQ) != 0)) {
+            scan_cnt = 0;
+        }
+        (void)osMutexWait(mtxid_sched, osWaitForever);
+        now        = us_ticker_read();
+        elapsed    = (now - last_tick) / 1000;
+        last_tick += elapsed * 1000;
+        if (scan_cnt > elapsed) {
+            scan_cnt -= elapsed;
+            scan      = 0;
+        } else {
+            scan_cnt  = INT_SCAN_INTERVAL;
+            scan      = 1;
+        }
+
+        control_list_run(now);
+        bulk_list_run(now);
+        for (cnt = 0; cnt < INT_TRANS_MAX_NUM; cnt++) {
+            int_ed_run(cnt, elapsed, scan);
+        }
+#if (ISO_TRANS_MAX_NUM > 0)
+        for (cnt = 0; cnt < ISO_TRANS_MAX_NUM; cnt++) {
+            iso_ed_run(cnt, elapsed, scan);
+        }
+#endif
+        timeout = sched_timeout(now);
+        (void)osMutexRelease(mtxid_sched);
+    }
+}
+
+static uint32_t sched_timeout(uint32_t now) {
+    uint32_t cnt;
+    uint32_t remain;
+    uint32_t timeout = osWaitForever;
+
+    /* Pipes that are busy wake the scheduler through ohciwrappx_loc_TransEnd(). */
+    if (ctl_ed.active != 0) {
+        timeout = trans_remain(&ctl_ed, CTL_TRANS_TIMEOUT, now);
+    }
+    if (blk_ed.active != 0) {
+        remain = trans_remain(&blk_ed, BLK_TRANS_TIMEOUT, now);
+        if (remain < timeout) {
+            timeout = remain;
+        }
+    }
+    if ((p_usb_reg->HcControl & OR_CONTROL_PLE) != 0) {
+        for (cnt = 0; cnt < INT_TRANS_MAX_NUM; cnt++) {
+            if (int_ed[cnt].p_curr_ed == NULL) {
+                if (timeout > INT_SCAN_INTERVAL) {
+                    timeout = INT_SCAN_INTERVAL;
                 }
-                p_usb_reg->HcControlCurrentED = (uint32_t)ctl_ed.p_curr_ed->nextED;
-            } else {
-                break;
+            } else if (int_ed[cnt].active == 0) {
+                timeout = 1;
             }
         }
-        if ((p_usb_reg->HcCommandStatus & OR_CMD_STATUS_CLF) != 0) {
-            osSignalSet(ctl_ed.tskid, SIG_GEN_LIST_REQ);
+    }
+#if (ISO_TRANS_MAX_NUM > 0)
+    if ((p_usb_reg->HcControl & OR_CONTROL_IE) != 0) {
+        for (cnt = 0; cnt < ISO_TRANS_MAX_NUM; cnt++) {
+            if (iso_ed[cnt].p_curr_ed == NULL) {
+                if (timeout > INT_SCAN_INTERVAL) {
+                    timeout = INT_SCAN_INTERVAL;
+                }
+            } else if (iso_ed[cnt].active == 0) {
+                timeout = 1;
+            }
         }
-        (void)osSemaphoreRelease(ctl_ed.semid_list);
     }
+#endif
+
+    return timeout;
 }
 
-static void bulk_ed_task(void const * argument) {
-    while (1) {
-        osSignalWait(SIG_GEN_LIST_REQ, osWaitForever);
-        (void)osSemaphoreWait(blk_ed.semid_list, osWaitForever);
-        while ((p_usb_reg->HcControl & OR_CONTROL_BLE) != 0) {
-            if ((p_usb_reg->HcBulkCurrentED == 0)
-             && ((p_usb_reg->HcCommandStatus & OR_CMD_STATUS_BLF) != 0)) {
-                p_usb_reg->HcBulkCurrentED =  p_usb_reg->HcBulkHeadED;
-                p_usb_reg->HcCommandStatus &= ~OR_CMD_STATUS_BLF;
-            }
-            if (p_usb_reg->HcBulkCurrentED != 0) {
-                blk_ed.p_curr_ed = (hced_t *)p_usb_reg->HcBulkCurrentED;
-                if (chk_genelal_ed(&blk_ed) != 0) {
-                    bulk_trans(&blk_ed);
-                    p_usb_reg->HcCommandStatus |= OR_CMD_STATUS_BLF;
+static uint32_t trans_remain(genelal_ed_t *p_g_ed, uint32_t timeout, uint32_t now) {
+    uint32_t passed = now - p_g_ed->start_time;
+
+    if ((p_g_ed->trans_wait == 0) || (passed >= (timeout * 1000))) {
+        return 0;
+    }
+
+    return ((timeout * 1000) - passed + 999) / 1000;
+}
+
+static void control_list_run(uint32_t now) {
+    if (ctl_ed.active != 0) {
+        if (trans_remain(&ctl_ed, CTL_TRANS_TIMEOUT, now) != 0) {
+            return;
+        }
+        if (ctl_ed.trans_wait == 1) {
+            hctd_t *p_td = (hctd_t *)ctl_ed.p_curr_td;
+
+            ctl_ed.trans_wait = 0;
+            RZA_IO_RegWrite_32(&p_td->control, TD_CC_DEVICENOTRESPONDING, TD_CTL_SHFT_CC, TD_CTL_MSK_CC);
+        }
+        control_trans_finish();
+    }
+    while ((p_usb_reg->HcControl & OR_CONTROL_CLE) != 0) {
+        if ((p_usb_reg->HcControlCurrentED == 0)
+         && ((p_usb_reg->HcCommandStatus & OR_CMD_STATUS_CLF) != 0)) {
+            p_usb_reg->HcControlCurrentED =  p_usb_reg->HcControlHeadED;
+            p_usb_reg->HcCommandStatus    &= ~OR_CMD_STATUS_CLF;
+        }
+        if (p_usb_reg->HcControlCurrentED != 0) {
+            ctl_ed.p_curr_ed = (hced_t *)p_usb_reg->HcControlCurrentED;
+            if (chk_genelal_ed(&ctl_ed) != 0) {
+                control_trans(&ctl_ed);
+                if (ctl_ed.trans_wait == 1) {
+                    return;
                 }
-                p_usb_reg->HcBulkCurrentED = (uint32_t)blk_ed.p_curr_ed->nextED;
+                control_trans_finish();
             } else {
-                break;
+                p_usb_reg->HcControlCurrentED = (uint32_t)ctl_ed.p_curr_ed->nextED;
             }
+        } else {
+            break;
         }
-        if ((p_usb_reg->HcCommandStatus & OR_CMD_STATUS_BLF) != 0) {
-            osSignalSet(blk_ed.tskid, SIG_GEN_LIST_REQ);
+    }
+}
+
+static void control_trans_finish(void) {
+    g_usbx_host_CmdStage &= (~USB_HOST_CMD_FIELD);
+    g_usbx_host_CmdStage |= USB_HOST_CMD_IDLE;
+    g_usbx_host_pipe_status[USB_HOST_PIPE0] = USB_HOST_PIPE_IDLE;
+
+    ctl_ed.active                 =  0;
+    p_usb_reg->HcCommandStatus    |= OR_CMD_STATUS_CLF;
+    p_usb_reg->HcControlCurrentED =  (uint32_t)ctl_ed.p_curr_ed->nextED;
+}
+
+static void bulk_list_run(uint32_t now) {
+    if (blk_ed.active != 0) {
+        if (trans_remain(&blk_ed, BLK_TRANS_TIMEOUT, now) != 0) {
+            return;
+        }
+        bulk_trans_finish();
+    }
+    while ((p_usb_reg->HcControl & OR_CONTROL_BLE) != 0) {
+        if ((p_usb_reg->HcBulkCurrentED == 0)
+         && ((p_usb_reg->HcCommandStatus & OR_CMD_STATUS_BLF) != 0)) {
+            p_usb_reg->HcBulkCurrentED =  p_usb_reg->HcBulkHeadED;
+            p_usb_reg->HcCommandStatus &= ~OR_CMD_STATUS_BLF;
+        }
+        if (p_usb_reg->HcBulkCurrentED != 0) {
+            blk_ed.p_curr_ed = (hced_t *)p_usb_reg->HcBulkCurrentED;
+            if (chk_genelal_ed(&blk_ed) != 0) {
+                bulk_trans(&blk_ed);
+                if (blk_ed.trans_wait == 1) {
+                    return;
+                }
+                bulk_trans_finish();
+            } else {
+                p_usb_reg->HcBulkCurrentED = (uint32_t)blk_ed.p_curr_ed->nextED;
+            }
+        } else {
+            break;
         }
-        (void)osSemaphoreRelease(blk_ed.semid_list);
     }
 }
 
-static void int_ed_task(void const * argument) {
-    genelal_ed_t *p_int_ed = &int_ed[(uint32_t)argument];
+static void bulk_trans_finish(void) {
+    /* A transfer that did not end within BLK_TRANS_TIMEOUT is resumed on the next pass. */
+    usbx_host_stop_transfer(blk_ed.pipe_no);
+    blk_ed.trans_wait = 0;
+
+    blk_ed.active              =  0;
+    p_usb_reg->HcCommandStatus |= OR_CMD_STATUS_BLF;
+    p_usb_reg->HcBulkCurrentED =  (uint32_t)blk_ed.p_curr_ed->nextED;
+}
+
+static void int_ed_run(uint32_t index, uint32_t elapsed, uint32_t scan) {
+    genelal_ed_t *p_int_ed = &int_ed[index];
     uint32_t     cnt;
-    uint32_t     wait_cnt = 0;
     hcca_t       *p_hcca;
     hced_t       *p_ed;
 
-    while (1) {
-        (void)osSemaphoreWait(p_int_ed->semid_list, osWaitForever);
-        if (p_int_ed->p_curr_ed == NULL) {
-            for (cnt = 0; (cnt < 32) && ((p_usb_reg->HcControl & OR_CONTROL_PLE) != 0)
-                                                 && (p_int_ed->p_curr_ed == NULL); cnt++) {
-                p_hcca = (hcca_t *)p_usb_reg->HcHCCA;
-                p_ed   = (hced_t *)p_hcca->IntTable[cnt];
-                while ((p_ed != NULL) && ((p_usb_reg->HcControl & OR_CONTROL_PLE) != 0)
-                                                        && (p_int_ed->p_curr_ed == NULL)) {
-                    if (int_trans_doing(p_ed, (uint32_t)argument) == 0) {
-                        p_int_ed->p_curr_ed = p_ed;
-                        if (chk_genelal_ed(p_int_ed) != 0) {
-                            int_trans_setting(p_int_ed, (uint32_t)argument);
-                        } else {
-                            p_int_ed->p_curr_ed = NULL;
-                        }
-                    }
-                    p_ed = p_ed->nextED;
-                }
-            }
+    if (p_int_ed->active != 0) {
+        if (p_int_ed->trans_wait == 1) {
+            return;
         }
-        if (p_int_ed->p_curr_ed != NULL) {
-            while ((p_usb_reg->HcControl & OR_CONTROL_PLE) != 0) {
-                if (chk_genelal_ed(p_int_ed) != 0) {
-                    int_trans(p_int_ed);
-                    (void)osSemaphoreWait(p_int_ed->semid_wait, osWaitForever);
-                    usbx_host_stop_transfer(p_int_ed->pipe_no);
-                    wait_cnt = p_int_ed->cycle_time;
-                } else {
-                    if (wait_cnt > 0) {
-                        wait_cnt--;
+        int_trans_finish(p_int_ed);
+    }
+    if ((p_usb_reg->HcControl & OR_CONTROL_PLE) == 0) {
+        return;
+    }
+    if ((p_int_ed->p_curr_ed == NULL) && (scan != 0)) {
+        for (cnt = 0; (cnt < 32) && (p_int_ed->p_curr_ed == NULL); cnt++) {
+            p_hcca = (hcca_t *)p_usb_reg->HcHCCA;
+            p_ed   = (hced_t *)p_hcca->IntTable[cnt];
+            while ((p_ed != NULL) && (p_int_ed->p_curr_ed == NULL)) {
+                if (int_trans_doing(p_ed, index) == 0) {
+                    p_int_ed->p_curr_ed = p_ed;
+                    if (chk_genelal_ed(p_int_ed) != 0) {
+                        int_trans_setting(p_int_ed, index);
                     } else {
                         p_int_ed->p_curr_ed = NULL;
                     }
-                    break;
                 }
+                p_ed = p_ed->nextED;
             }
         }
-        (void)osSemaphoreRelease(p_int_ed->semid_list);
-        if (p_int_ed->p_curr_ed == NULL) {
-            osDelay(10);
+    }
+    if (p_int_ed->p_curr_ed != NULL) {
+        if (chk_genelal_ed(p_int_ed) != 0) {
+            int_trans(p_int_ed);
+        } else if (p_int_ed->wait_cnt > elapsed) {
+            p_int_ed->wait_cnt -= elapsed;
+        } else if (elapsed != 0) {
+            p_int_ed->p_curr_ed = NULL;
         } else {
-            osDelay(1);
+            /* Do Nothing */
         }
     }
 }
 
+static void int_trans_finish(genelal_ed_t *p_g_ed) {
+    usbx_host_stop_transfer(p_g_ed->pipe_no);
+    p_g_ed->wait_cnt = p_g_ed->cycle_time;
+    p_g_ed->active   = 0;
+}
+
 static int32_t int_trans_doing(hced_t *p_ed, uint32_t index) {
     uint32_t cnt;
     int32_t  ret = 0;
@@ -787,34 +796,45 @@ static void chk_split_trans_setting(genelal_ed_t *p_g_ed) {
     get_td_info(p_g_ed, &td_info);
     p_buf = p_g_ed->p_start_buf;
 
+    if (td_info.devadr >= DEVADD_NUM) {
+        return;
+    }
+
+    /* Any hub is tracked: the requests are recognized from the setup packets */
     if (td_info.direction == 0) {
+        uint8_t  bmRequestType = p_buf[0];
         uint8_t  bRequest = p_buf[1];
         uint16_t wValue   = (p_buf[3] << 8) + p_buf[2];
         uint16_t wIndx    = (p_buf[5] << 8) + p_buf[4];
         uint16_t devadd;
 
         if ((td_info.devadr == 0) && (bRequest == SET_ADDRESS)) {
-            /* SET_ADDRESS */
-            usbx_host_get_devadd(USB_HOST_DEVICE_0, &devadd);
-            usbx_host_set_devadd(wValue, &devadd);
-            if (split_ctl.root_devadr == 0) {
-                split_ctl.root_devadr = wValue; /* New Address */
+            /* SET_ADDRESS: the new address keeps the hub and speed set for the default address */
+            if ((wValue != 0) && (wValue < DEVADD_NUM)) {
+                usbx_host_get_devadd(USB_HOST_DEVICE_0, &devadd);
+                usbx_host_set_devadd(wValue, &devadd);
+                (void)memset(&split_ctl.port_sts_bits[wValue][0], 0, sizeof(split_ctl.port_sts_bits[0]));
             }
-        } else if ((td_info.devadr == split_ctl.root_devadr) && (bRequest == SET_FEATURE)
-                && (wValue == 0x0004) && (split_ctl.root_devadr != 0)) {
+        } else if ((bmRequestType == REQ_TYPE_CLASS_OTHER_OUT) && (bRequest == SET_FEATURE)
+                && (wValue == PORT_RESET) && (td_info.devadr != 0)) {
             /* SET_FEATURE PORT_RESET */
-            split_ctl.reset_port = (wIndx & 0x00FF);
-        } else if ((td_info.devadr == split_ctl.root_devadr) && (bRequest == GET_STATUS)) {
-            /* GET_STATUS */
+            if ((wIndx & 0x00FF) < PORT_NUM) {
+                split_ctl.reset_hub  = td_info.devadr;
+                split_ctl.reset_port = (wIndx & 0x00FF);
+            }
+        } else if ((bmRequestType == REQ_TYPE_CLASS_OTHER_IN) && (bRequest == GET_STATUS)
+                && (td_info.devadr != 0)) {
+            /* GET_STATUS (port) */
+            split_ctl.get_hub  = td_info.devadr;
             split_ctl.get_port = wIndx;
-            split_ctl.seq_cnt = 1;
+            split_ctl.seq_cnt  = 1;
         } else {
             /* Do Nothing */
         }
     } else if (td_info.direction == 2) {
-        if ((td_info.devadr == split_ctl.root_devadr) && (split_ctl.seq_cnt == 1)) {
+        if ((td_info.devadr == split_ctl.get_hub) && (split_ctl.seq_cnt == 1)) {
             if (split_ctl.get_port < PORT_NUM) {
-                split_ctl.port_sts_bits[split_ctl.get_port] = (p_buf[1] << 8) + p_buf[0];
+                split_ctl.port_sts_bits[split_ctl.get_hub][split_ctl.get_port] = (p_buf[1] << 8) + p_buf[0];
             }
             split_ctl.seq_cnt = 0;
         }
@@ -825,19 +845,37 @@ static void chk_split_trans_setting(genelal_ed_t *p_g_ed) {
 
 static void set_split_trans_setting(void) {
     uint16_t port_speed;
+    uint16_t port_sts;
+    uint16_t hub_devadd;
     uint16_t devadd;
+    uint16_t tt_hub;
+    uint16_t tt_port;
 
-    if ((split_ctl.root_devadr != 0) && (split_ctl.reset_port != 0) && (split_ctl.reset_port < PORT_NUM)) {
-        usbx_host_get_devadd(USB_HOST_DEVICE_0, &devadd);
-        RZA_IO_RegWrite_16(&devadd, split_ctl.root_devadr, USB_DEVADDn_UPPHUB_SHIFT, USB_DEVADDn_UPPHUB);
-        RZA_IO_RegWrite_16(&devadd, split_ctl.reset_port, USB_DEVADDn_HUBPORT_SHIFT, USB_DEVADDn_HUBPORT);
-        if ((split_ctl.port_sts_bits[split_ctl.reset_port] & PORT_HIGH_SPEED) != 0) {
+    if ((split_ctl.reset_hub != 0) && (split_ctl.reset_port != 0)) {
+        port_sts = split_ctl.port_sts_bits[split_ctl.reset_hub][split_ctl.reset_port];
+        if ((port_sts & PORT_HIGH_SPEED) != 0) {
             port_speed = USB_HOST_HIGH_SPEED;
-        } else if ((split_ctl.port_sts_bits[split_ctl.reset_port] & PORT_LOW_SPEED) != 0) {
+        } else if ((port_sts & PORT_LOW_SPEED) != 0) {
             port_speed = USB_HOST_LOW_SPEED;
         } else {
             port_speed = USB_HOST_FULL_SPEED;
         }
+
+        /* The split transactions go to the transaction translator of the nearest Hi-Speed hub */
+        usbx_host_get_devadd(split_ctl.reset_hub, &hub_devadd);
+        if ((port_speed == USB_HOST_HIGH_SPEED)
+         || (RZA_IO_RegRead_16(&hub_devadd, USB_DEVADDn_USBSPD_SHIFT, USB_DEVADDn_USBSPD) == USB_HOST_HIGH_SPEED)) {
+            tt_hub  = split_ctl.reset_hub;
+            tt_port = split_ctl.reset_port;
+        } else {
+            /* Full-Speed hub behind a Hi-Speed hub: same translator as the hub itself */
+            tt_hub  = RZA_IO_RegRead_16(&hub_devadd, USB_DEVADDn_UPPHUB_SHIFT, USB_DEVADDn_UPPHUB);
+            tt_port = RZA_IO_RegRead_16(&hub_devadd, USB_DEVADDn_HUBPORT_SHIFT, USB_DEVADDn_HUBPORT);
+        }
+
+        usbx_host_get_devadd(USB_HOST_DEVICE_0, &devadd);
+        RZA_IO_RegWrite_16(&devadd, tt_hub, USB_DEVADDn_UPPHUB_SHIFT, USB_DEVADDn_UPPHUB);
+        RZA_IO_RegWrite_16(&devadd, tt_port, USB_DEVADDn_HUBPORT_SHIFT, USB_DEVADDn_HUBPORT);
         RZA_IO_RegWrite_16(&devadd, port_speed, USB_DEVADDn_USBSPD_SHIFT, USB_DEVADDn_USBSPD);
         usbx_host_set_devadd(USB_HOST_DEVICE_0, &devadd);
         split_ctl.reset_port = 0;
@@ -878,8 +916,10 @@ static void control_trans(genelal_ed_t *p_g_ed) {
     p_g_ed->pipe_no    = USB_HOST_PIPE0;
 
     p_g_ed->trans_wait = 1;
+    p_g_ed->active     = 1;
+    p_g_ed->start_time = us_ticker_read();
     if (connect_status == 0) {
-        ohciwrapp_loc_TransEnd(p_g_ed->pipe_no, TD_CC_DEVICENOTRESPONDING);
+        ohciwrappx_loc_TransEnd(p_g_ed->pipe_no, TD_CC_DEVICENOTRESPONDING);
     } else {
         if (td_info.direction == 0) {
             uint16_t Req  = (p_td->currBufPtr[1] << 8) + p_td->currBufPtr[0];
@@ -894,24 +934,14 @@ static void control_trans(genelal_ed_t *p_g_ed) {
         } else {
             usbx_host_CtrlReadStart(td_info.count, p_td->currBufPtr);
         }
-
-        (void)osSemaphoreWait(p_g_ed->semid_wait, CTL_TRANS_TIMEOUT);
-        if (p_g_ed->trans_wait == 1) {
-            p_g_ed->trans_wait = 0;
-            RZA_IO_RegWrite_32(&p_td->control, TD_CC_DEVICENOTRESPONDING, TD_CTL_SHFT_CC, TD_CTL_MSK_CC);
-        }
     }
-
-    g_usbx_host_CmdStage &= (~USB_HOST_CMD_FIELD);
-    g_usbx_host_CmdStage |= USB_HOST_CMD_IDLE;
-    g_usbx_host_pipe_status[USB_HOST_PIPE0] = USB_HOST_PIPE_IDLE;
 }
 
 static void bulk_trans(genelal_ed_t *p_g_ed) {
     hctd_t                 *p_td = (hctd_t *)p_g_ed->p_curr_td;
     hced_t                 *p_ed = p_g_ed->p_curr_ed;
     tdinfo_t               td_info;
-    USB_HOST_CFG_PIPETBL_t *user_table = &usb_host_blk_ep_tbl1[0];
+    USB_HOST_CFG_PIPETBL_t *user_table = &usbx_host_blk_ep_tbl1[0];
     uint8_t                wk_table[6];
 
     get_td_info(p_g_ed, &td_info);
@@ -925,31 +955,48 @@ static void bulk_trans(genelal_ed_t *p_g_ed) {
     wk_table[3] = USB_HOST_EP_BULK;
     wk_table[4] = (uint8_t)td_info.msp;
     wk_table[5] = (uint8_t)(td_info.msp >> 8);
+#if (BLK_TRANS_DMA != 0)
+    user_table->fifo_port = blk_fifo_port(&td_info, p_td->currBufPtr);
+#endif
     p_g_ed->pipe_no    = user_table->pipe_number;
     usbx_api_host_SetEndpointTable(td_info.devadr, user_table, wk_table);
 
     set_togle(p_g_ed->pipe_no, p_td, p_ed);
 
     p_g_ed->trans_wait = 1;
+    p_g_ed->active     = 1;
+    p_g_ed->start_time = us_ticker_read();
     if (connect_status == 0) {
-        ohciwrapp_loc_TransEnd(p_g_ed->pipe_no, TD_CC_DEVICENOTRESPONDING);
+        ohciwrappx_loc_TransEnd(p_g_ed->pipe_no, TD_CC_DEVICENOTRESPONDING);
     } else {
         if (td_info.direction == 1) {
             usbx_host_start_send_transfer(p_g_ed->pipe_no, td_info.count, p_td->currBufPtr);
         } else {
             usbx_host_start_receive_transfer(p_g_ed->pipe_no, td_info.count, p_td->currBufPtr);
         }
+    }
+}
+
+#if (BLK_TRANS_DMA != 0)
+static uint16_t blk_fifo_port(tdinfo_t *p_td_info, uint8_t *p_buf) {
+    uint32_t align = (p_td_info->direction == 1) ? BLK_DMA_ALIGN_OUT : BLK_DMA_ALIGN_IN;
 
-        (void)osSemaphoreWait(p_g_ed->semid_wait, BLK_TRANS_TIMEOUT);
-        usbx_host_stop_transfer(p_g_ed->pipe_no);
+    /* Short packets and buffers the cache maintenance cannot cover are moved by the CPU. */
+    if ((p_td_info->count < p_td_info->msp)
+     || (((uint32_t)p_buf & (align - 1)) != 0)
+     || ((p_td_info->count & (align - 1)) != 0)) {
+        return USB_HOST_D0USE;
     }
+
+    return USB_HOST_D0DMA;
 }
+#endif
 
 static void int_trans_setting(genelal_ed_t *p_g_ed, uint32_t index) {
     hctd_t                 *p_td = (hctd_t *)p_g_ed->p_curr_td;
     hced_t                 *p_ed = p_g_ed->p_curr_ed;
     tdinfo_t               td_info;
-    USB_HOST_CFG_PIPETBL_t *user_table = &usb_host_int_ep_tbl1[index];
+    USB_HOST_CFG_PIPETBL_t *user_table = &usbx_host_int_ep_tbl1[index];
     uint8_t                wk_table[6];
     uint32_t               cycle_time;
     uint16_t               devadd;
@@ -1030,8 +1077,10 @@ static void int_trans(genelal_ed_t *p_g_ed) {
 
     get_td_info(p_g_ed, &td_info);
     p_g_ed->trans_wait = 1;
+    p_g_ed->active     = 1;
+    p_g_ed->start_time = us_ticker_read();
     if (connect_status == 0) {
-        ohciwrapp_loc_TransEnd(p_g_ed->pipe_no, TD_CC_DEVICENOTRESPONDING);
+        ohciwrappx_loc_TransEnd(p_g_ed->pipe_no, TD_CC_DEVICENOTRESPONDING);
     } else {
         if (td_info.direction == 1) {
             usbx_host_start_send_transfer(p_g_ed->pipe_no, td_info.count, p_td->currBufPtr);
@@ -1097,71 +1146,80 @@ static void set_togle(uint32_t pipe, hctd_t *p_td, hced_t *p_ed) {
 }
 
 #if (ISO_TRANS_MAX_NUM > 0)
-static void iso_ed_task(void const * argument) {
-    genelal_ed_t *p_iso_ed = &iso_ed[(uint32_t)argument];
-    uint32_t     wait_cnt = 0;
+static void iso_ed_run(uint32_t index, uint32_t elapsed, uint32_t scan) {
+    genelal_ed_t *p_iso_ed = &iso_ed[index];
+    hcisotd_t    *p_isotd;
     hcca_t       *p_hcca;
     hced_t       *p_ed;
+    uint32_t     starting_frame;
+    uint32_t     wait_time;
+    uint32_t     wk_HcFmNumber;
 
-    while (1) {
-        (void)osSemaphoreWait(p_iso_ed->semid_list, osWaitForever);
-        if (p_iso_ed->p_curr_ed == NULL) {
-            p_hcca = (hcca_t *)p_usb_reg->HcHCCA;
-            p_ed   = (hced_t *)p_hcca->IntTable[0];
-            while ((p_ed != NULL) && ((p_usb_reg->HcControl & OR_CONTROL_IE) != 0)
-                                                    && (p_iso_ed->p_curr_ed == NULL)) {
-                if (iso_trans_doing(p_ed, (uint32_t)argument) == 0) {
-                    p_iso_ed->p_curr_ed = p_ed;
-                    if (chk_iso_ed(p_iso_ed) != 0) {
-                        iso_trans_setting(p_iso_ed, (uint32_t)argument);
-                    } else {
-                        p_iso_ed->p_curr_ed = NULL;
-                    }
-                }
-                p_ed = p_ed->nextED;
-            }
-            p_iso_ed->psw_idx = 0;
+    if (p_iso_ed->active != 0) {
+        if (p_iso_ed->trans_wait == 1) {
+            return;
         }
-        if (p_iso_ed->p_curr_ed != NULL) {
-            while ((p_usb_reg->HcControl & OR_CONTROL_IE) != 0) {
+        p_iso_ed->wait_cnt = ISO_IDLE_COUNT;
+        p_iso_ed->active   = 0;
+    }
+    if ((p_usb_reg->HcControl & OR_CONTROL_IE) == 0) {
+        return;
+    }
+    if ((p_iso_ed->p_curr_ed == NULL) && (scan != 0)) {
+        p_hcca = (hcca_t *)p_usb_reg->HcHCCA;
+        p_ed   = (hced_t *)p_hcca->IntTable[0];
+        while ((p_ed != NULL) && (p_iso_ed->p_curr_ed == NULL)) {
+            if (iso_trans_doing(p_ed, index) == 0) {
+                p_iso_ed->p_curr_ed = p_ed;
                 if (chk_iso_ed(p_iso_ed) != 0) {
-                    hcisotd_t *p_isotd = (hcisotd_t *)p_iso_ed->p_curr_td;
-                    uint32_t  starting_frame = p_isotd->control & 0x0000FFFF;
-                    uint32_t  wait_time = 0;
-                    uint32_t  wk_HcFmNumber = p_usb_reg->HcFmNumber;
-
-                    if (starting_frame > wk_HcFmNumber) {
-                        wait_time = starting_frame - wk_HcFmNumber;
-                    } else {
-                        wait_time = (0xFFFF - wk_HcFmNumber) + starting_frame;
-                    }
-                    if ((wait_time >= 2) && (wait_time <= 1000)) {
-                        for (int cnt = 0; cnt < (wait_time - 1); cnt++) {
-                            osDelay(1);
-                            p_usb_reg->HcFmNumber = (wk_HcFmNumber + cnt) & 0x0000FFFF;
-                        }
-                    }
-                    p_iso_ed->psw_idx   = 0;
-                    iso_trans(p_iso_ed);
-                    (void)osSemaphoreWait(p_iso_ed->semid_wait, osWaitForever);
-                    wait_cnt = 8;
+                    iso_trans_setting(p_iso_ed, index);
                 } else {
-                    if (wait_cnt > 0) {
-                        wait_cnt--;
-                    } else {
-                        p_iso_ed->p_curr_ed = NULL;
-                    }
-                    break;
+                    p_iso_ed->p_curr_ed = NULL;
                 }
             }
+            p_ed = p_ed->nextED;
         }
-        (void)osSemaphoreRelease(p_iso_ed->semid_list);
-        if (p_iso_ed->p_curr_ed == NULL) {
-            osDelay(10);
+        p_iso_ed->psw_idx = 0;
+    }
+    if (p_iso_ed->p_curr_ed == NULL) {
+        return;
+    }
+    if (p_iso_ed->frame_wait == 0) {
+        if (chk_iso_ed(p_iso_ed) == 0) {
+            if (p_iso_ed->wait_cnt > elapsed) {
+                p_iso_ed->wait_cnt -= elapsed;
+            } else if (elapsed != 0) {
+                p_iso_ed->p_curr_ed = NULL;
+            } else {
+                /* Do Nothing */
+            }
+            return;
+        }
+        p_isotd        = (hcisotd_t *)p_iso_ed->p_curr_td;
+        starting_frame = p_isotd->control & 0x0000FFFF;
+        wk_HcFmNumber  = p_usb_reg->HcFmNumber;
+        if (starting_frame > wk_HcFmNumber) {
+            wait_time = starting_frame - wk_HcFmNumber;
         } else {
-            osDelay(1);
+            wait_time = (0xFFFF - wk_HcFmNumber) + starting_frame;
+        }
+        if ((wait_time >= 2) && (wait_time <= 1000)) {
+            p_iso_ed->frame_wait = wait_time - 1;
+            p_iso_ed->frame_no   = wk_HcFmNumber;
+            elapsed              = 0;
         }
     }
+    /* Step the frame number one frame per millisecond until the starting frame. */
+    while ((p_iso_ed->frame_wait > 0) && (elapsed > 0)) {
+        p_usb_reg->HcFmNumber = p_iso_ed->frame_no & 0x0000FFFF;
+        p_iso_ed->frame_no++;
+        p_iso_ed->frame_wait--;
+        elapsed--;
+    }
+    if (p_iso_ed->frame_wait == 0) {
+        p_iso_ed->psw_idx = 0;
+        iso_trans(p_iso_ed);
+    }
 }
 
 static int32_t iso_trans_doing(hced_t *p_ed, uint32_t index) {
@@ -1225,7 +1283,7 @@ static int32_t chk_iso_ed(genelal_ed_t *p_g_ed){
 
 static void iso_trans_setting(genelal_ed_t *p_g_ed, uint32_t index) {
     tdinfo_t               td_info;
-    USB_HOST_CFG_PIPETBL_t *user_table = &usb_host_iso_ep_tbl1[index];
+    USB_HOST_CFG_PIPETBL_t *user_table = &usbx_host_iso_ep_tbl1[index];
     uint8_t                wk_table[6];
     uint16_t               devadd;
 
@@ -1275,8 +1333,10 @@ static void iso_trans(genelal_ed_t *p_g_ed) {
 
     get_td_info(p_g_ed, &td_info);
     p_g_ed->trans_wait = 1;
+    p_g_ed->active     = 1;
+    p_g_ed->start_time = us_ticker_read();
     if (connect_status == 0) {
-        ohciwrapp_loc_TransEnd(p_g_ed->pipe_no, TD_CC_DEVICENOTRESPONDING);
+        ohciwrappx_loc_TransEnd(p_g_ed->pipe_no, TD_CC_DEVICENOTRESPONDING);
     } else {
         if (td_info.direction == 1) {
             usbx_host_start_send_transfer(p_g_ed->pipe_no, data_size, (uint8_t *)buff_addr);
@@ -1334,21 +1394,21 @@ static void connect_check(void) {
     (void)memset(&split_ctl, 0, sizeof(split_ctl));
 }
 
-void ohciwrapp_loc_Connect(uint32_t type) {
+void ohciwrappx_loc_Connect(uint32_t type) {
     uint32_t cnt;
 
     connect_status = type;
     connect_change = type;
     if (type == 0) {
         if (ctl_ed.trans_wait == 1) {
-            ohciwrapp_loc_TransEnd(ctl_ed.pipe_no, TD_CC_DEVICENOTRESPONDING);
+            ohciwrappx_loc_TransEnd(ctl_ed.pipe_no, TD_CC_DEVICENOTRESPONDING);
         }
         if (blk_ed.trans_wait == 1) {
-            ohciwrapp_loc_TransEnd(blk_ed.pipe_no, TD_CC_DEVICENOTRESPONDING);
+            ohciwrappx_loc_TransEnd(blk_ed.pipe_no, TD_CC_DEVICENOTRESPONDING);
         }
         for (cnt = 0; cnt< INT_TRANS_MAX_NUM; cnt++) {
             if (int_ed[cnt].trans_wait == 1) {
-                ohciwrapp_loc_TransEnd(int_ed[cnt].pipe_no, TD_CC_DEVICENOTRESPONDING);
+                ohciwrappx_loc_TransEnd(int_ed[cnt].pipe_no, TD_CC_DEVICENOTRESPONDING);
             }
         }
 #if (ISO_TRANS_MAX_NUM > 0)
@@ -1357,7 +1417,7 @@ void ohciwrapp_loc_Connect(uint32_t type) {
                 hced_t  *p_ed = iso_ed[cnt].p_curr_ed;
 
                 p_ed->headTD |= ED_HALTED;
-                ohciwrapp_loc_TransEnd(iso_ed[cnt].pipe_no, TD_CC_DEVICENOTRESPONDING);
+                ohciwrappx_loc_TransEnd(iso_ed[cnt].pipe_no, TD_CC_DEVICENOTRESPONDING);
             }
         }
 #endif
@@ -1365,7 +1425,7 @@ void ohciwrapp_loc_Connect(uint32_t type) {
     (void)osSemaphoreRelease(semid_cb);
 }
 
-void ohciwrapp_loc_TransEnd(uint32_t pipe, uint32_t ConditionCode) {
+void ohciwrappx_loc_TransEnd(uint32_t pipe, uint32_t ConditionCode) {
     uint32_t     periodic = 0;
     uint32_t     cnt;
     uint32_t     sqmon;
@@ -1443,11 +1503,11 @@ void ohciwrapp_loc_TransEnd(uint32_t pipe, uint32_t ConditionCode) {
                     int_trans(p_wait_ed);
                 } else {
                     p_wait_ed->trans_wait = 0;
-                    (void)osSemaphoreRelease(p_wait_ed->semid_wait);
+                    (void)osSignalSet(tskid_sched, SIG_SCHED_REQ);
                 }
             } else {
                 p_wait_ed->trans_wait = 0;
-                (void)osSemaphoreRelease(p_wait_ed->semid_wait);
+                (void)osSignalSet(tskid_sched, SIG_SCHED_REQ);
             }
         }
     } else {
@@ -1482,7 +1542,7 @@ void ohciwrapp_loc_TransEnd(uint32_t pipe, uint32_t ConditionCode) {
             }
             if (next_trans == 0) {
                 p_wait_ed->trans_wait = 0;
-                (void)osSemaphoreRelease(p_wait_ed->semid_wait);
+                (void)osSignalSet(tskid_sched, SIG_SCHED_REQ);
             }
         }
 #endif
@@ -46,11 +46,18 @@ extern "C" {
 #define OHCI_REG_RHSTATUS           (0x50)    /* HcRhStatus         */
 #define OHCI_REG_RHPORTSTATUS1      (0x54)    /* HcRhPortStatus1    */
 
-typedef void (usbisr_fnc_t)(void);
+#define OHCIWRAPP_CH_NUM            (2)       /* USB0, USB1 */
 
-extern void ohciwrapp_init(usbisr_fnc_t *p_usbisr_fnc);
-extern uint32_t ohciwrapp_reg_r(uint32_t reg_ofs);
-extern void ohciwrapp_reg_w(uint32_t reg_ofs, uint32_t set_data);
+typedef void (usbisr_fnc_t)(uint32_t ch);
+
+/* USB0 */
+extern void ohciwrapp0_init(usbisr_fnc_t *p_usbisr_fnc);
+extern uint32_t ohciwrapp0_reg_r(uint32_t reg_ofs);
+extern void ohciwrapp0_reg_w(uint32_t reg_ofs, uint32_t set_data);
+/* USB1 */
+extern void ohciwrapp1_init(usbisr_fnc_t *p_usbisr_fnc);
+extern uint32_t ohciwrapp1_reg_r(uint32_t reg_ofs);
+extern void ohciwrapp1_reg_w(uint32_t reg_ofs, uint32_t set_data);
 extern void ohciwrapp_interrupt(uint32_t int_sense);
 
 #ifdef __cplusplus
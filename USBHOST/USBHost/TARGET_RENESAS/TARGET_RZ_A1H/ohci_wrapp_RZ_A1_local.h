@@ -39,8 +39,12 @@ extern "C" {
 #define TD_CC_NOT_ACCESSED_1      (14)
 #define TD_CC_NOT_ACCESSED_2      (15)
 
-extern void ohciwrapp_loc_Connect(uint32_t type);
-extern void ohciwrapp_loc_TransEnd(uint32_t pipe, uint32_t ConditionCode);
+/* USB0 */
+extern void ohciwrapp0_loc_Connect(uint32_t type);
+extern void ohciwrapp0_loc_TransEnd(uint32_t pipe, uint32_t ConditionCode);
+/* USB1 */
+extern void ohciwrapp1_loc_Connect(uint32_t type);
+extern void ohciwrapp1_loc_TransEnd(uint32_t pipe, uint32_t ConditionCode);
 
 #ifdef __cplusplus
 }
@@ -25,6 +25,7 @@
 Includes   <System Includes> , "Project Includes"
 *******************************************************************************/
 #include "devdrv_usb_host_api.h"
+#include "usb_host_setting.h"
 
 
 /*******************************************************************************
@@ -76,7 +77,7 @@ Exported global variables and functions (to be accessed by other files)
 /********************************************************************************************************/
 
 /* Device Address 1 */
-USB_HOST_CFG_PIPETBL_t     usb_host_blk_ep_tbl1[ ] =
+USB_HOST_CFG_PIPETBL_t     usbx_host_blk_ep_tbl1[ ] =
 {
     {
         USB_HOST_PIPE3,
@@ -85,7 +86,7 @@ USB_HOST_CFG_PIPETBL_t     usb_host_blk_ep_tbl1[ ] =
         (uint16_t)((uint16_t)(((1024) / 64) - 1) << 10) | (uint16_t)(8),
         USB_HOST_NONE,
         USB_HOST_NONE,
-        USB_HOST_D0USE
+        USB_HOST_D0DMA
     },
 
     {
@@ -99,7 +100,7 @@ USB_HOST_CFG_PIPETBL_t     usb_host_blk_ep_tbl1[ ] =
     }
 };
 
-USB_HOST_CFG_PIPETBL_t     usb_host_int_ep_tbl1[ ] =
+USB_HOST_CFG_PIPETBL_t     usbx_host_int_ep_tbl1[ ] =
 {
     {
         USB_HOST_PIPE6,
@@ -152,7 +153,7 @@ USB_HOST_CFG_PIPETBL_t     usb_host_int_ep_tbl1[ ] =
     }
 };
 
-USB_HOST_CFG_PIPETBL_t     usb_host_iso_ep_tbl1[ ] =
+USB_HOST_CFG_PIPETBL_t     usbx_host_iso_ep_tbl1[ ] =
 {
     {
         USB_HOST_PIPE1,
@@ -58,13 +58,13 @@ Macro definitions
 *******************************************************************************/
 #define DUMMY_ACCESS OSTM0CNT
 
-/* #define CACHE_WRITEBACK */
+#define CACHE_LINE_SIZE     (32)
+#define CACHE_LINE_MASK     (CACHE_LINE_SIZE - 1)
 
 
 /*******************************************************************************
 Imported global variables and functions (from other files)
 *******************************************************************************/
-extern int32_t io_cwb(unsigned long start, unsigned long end);
 
 
 /*******************************************************************************
@@ -80,6 +80,12 @@ static void Userdef_USB_usb0_host_delay_10us_2(void);
 /*******************************************************************************
 Private global variables and functions
 *******************************************************************************/
+static void usb0_host_dcache_clean(uint32_t addr, uint32_t size);
+static void usb0_host_dcache_clean_inv(uint32_t addr, uint32_t size);
+static void usb0_host_dcache_inv(uint32_t addr, uint32_t size);
+
+static uint32_t usb0_host_dma_inv_addr[2];    /* receive buffer per DMA channel */
+static uint32_t usb0_host_dma_inv_size[2];
 
 
 /*******************************************************************************
@@ -124,7 +130,7 @@ void Userdef_USB_usb0_host_attach (void)
 //    printf("\n");
 //    printf("channel 0 attach device\n");
 //    printf("\n");
-    ohciwrapp_loc_Connect(1);
+    ohciwrapp0_loc_Connect(1);
 }
 
 /*******************************************************************************
@@ -139,7 +145,7 @@ void Userdef_USB_usb0_host_detach (void)
 //    printf("\n");
 //    printf("channel 0 detach device\n");
 //    printf("\n");
-    ohciwrapp_loc_Connect(0);
+    ohciwrapp0_loc_Connect(0);
 }
 
 /*******************************************************************************
@@ -247,9 +253,7 @@ void Userdef_USB_usb0_host_start_dma (USB_HOST_DMA_t * dma, uint16_t dfacc)
     uint32_t dst;
     uint32_t size;
     uint32_t dir;
-#ifdef CACHE_WRITEBACK
-    uint32_t ptr;
-#endif
+    uint32_t ch;
 
     trncount = dma->bytes;
     dir      = dma->dir;
@@ -455,13 +459,20 @@ void Userdef_USB_usb0_host_start_dma (USB_HOST_DMA_t * dma, uint16_t dfacc)
 #endif
     }
 
-#ifdef CACHE_WRITEBACK
-    ptr = (uint32_t)dma->buffer;
-    if ((ptr & 0x20000000ul) == 0)
+    ch = (dma->fifo == USB_HOST_D0FIFO_DMA) ? 0 : 1;
+
+    if (dir == USB_HOST_FIFO2BUF)
     {
-        io_cwb((uint32_t)ptr,(uint32_t)(ptr)+trncount);
+        /* No dirty line may be evicted over the data the DMAC writes */
+        usb0_host_dcache_clean_inv(dma->buffer, trncount);
+        usb0_host_dma_inv_addr[ch] = dma->buffer;
+        usb0_host_dma_inv_size[ch] = trncount;
+    }
+    else
+    {
+        usb0_host_dcache_clean(dma->buffer, trncount);
+        usb0_host_dma_inv_size[ch] = 0;
     }
-#endif
 
     if (dma->fifo == USB_HOST_D0FIFO_DMA)
     {
@@ -725,6 +736,13 @@ uint32_t Userdef_USB_usb0_host_stop_dma0 (void)
     /* ==== DMAC release ==== */
     usb0_host_DMAC1_Close(&remain);
 
+    /* Drop lines the core may have prefetched while the DMAC was writing */
+    if (usb0_host_dma_inv_size[0] != 0)
+    {
+        usb0_host_dcache_inv(usb0_host_dma_inv_addr[0], usb0_host_dma_inv_size[0]);
+        usb0_host_dma_inv_size[0] = 0;
+    }
+
     return remain;
 }
 
@@ -744,9 +762,81 @@ uint32_t Userdef_USB_usb0_host_stop_dma1 (void)
     /* ==== DMAC release ==== */
     usb0_host_DMAC2_Close(&remain);
 
+    if (usb0_host_dma_inv_size[1] != 0)
+    {
+        usb0_host_dcache_inv(usb0_host_dma_inv_addr[1], usb0_host_dma_inv_size[1]);
+        usb0_host_dma_inv_size[1] = 0;
+    }
+
     return remain;
 }
 
+/*******************************************************************************
+* Function Name: usb0_host_dcache_clean
+* Description  : Writes back the data cache lines covering a DMA source buffer.
+* Arguments    : uint32_t addr ; buffer address
+*              : uint32_t size ; buffer size
+* Return Value : none
+*******************************************************************************/
+static void usb0_host_dcache_clean (uint32_t addr, uint32_t size)
+{
+    uint32_t end = addr + size;
+
+    for (addr &= ~CACHE_LINE_MASK; addr < end; addr += CACHE_LINE_SIZE)
+    {
+        L1C_CleanDCacheMVA((void *)addr);
+#if defined(__L2C_PRESENT) && (__L2C_PRESENT == 1U)
+        L2C_CleanPa((void *)addr);
+#endif
+    }
+    __DSB();
+}
+
+/*******************************************************************************
+* Function Name: usb0_host_dcache_clean_inv
+* Description  : Writes back and invalidates the data cache lines covering
+*              : a DMA destination buffer before the transfer is started.
+* Arguments    : uint32_t addr ; buffer address
+*              : uint32_t size ; buffer size
+* Return Value : none
+*******************************************************************************/
+static void usb0_host_dcache_clean_inv (uint32_t addr, uint32_t size)
+{
+    uint32_t end = addr + size;
+
+    for (addr &= ~CACHE_LINE_MASK; addr < end; addr += CACHE_LINE_SIZE)
+    {
+        L1C_CleanInvalidateDCacheMVA((void *)addr);
+#if defined(__L2C_PRESENT) && (__L2C_PRESENT == 1U)
+        L2C_CleanInvPa((void *)addr);
+#endif
+    }
+    __DSB();
+}
+
+/*******************************************************************************
+* Function Name: usb0_host_dcache_inv
+* Description  : Invalidates the data cache lines covering a DMA destination
+*              : buffer after the transfer has ended.
+*              : The buffer should start and end on a cache line boundary.
+* Arguments    : uint32_t addr ; buffer address
+*              : uint32_t size ; buffer size
+* Return Value : none
+*******************************************************************************/
+static void usb0_host_dcache_inv (uint32_t addr, uint32_t size)
+{
+    uint32_t end = addr + size;
+
+    for (addr &= ~CACHE_LINE_MASK; addr < end; addr += CACHE_LINE_SIZE)
+    {
+#if defined(__L2C_PRESENT) && (__L2C_PRESENT == 1U)
+        L2C_InvPa((void *)addr);
+#endif
+        L1C_InvalidateDCacheMVA((void *)addr);
+    }
+    __DSB();
+}
+
 /*******************************************************************************
 * Function Name: Userdef_USB_usb0_host_notice
 * Description  : Notice of USER
@@ -39,6 +39,9 @@ Includes   <System Includes> , "Project Includes"
 *******************************************************************************/
 #include "usb1_host.h"
 /* #include "usb1_host_dmacdrv.h" */
+#if(1) /* ohci_wrapp */
+#include "ohci_wrapp_RZ_A1_local.h"
+#endif
 
 
 /*******************************************************************************
@@ -281,6 +284,9 @@ static void usb1_host_dmaint_fifo2buf (uint16_t pipe)
                 {
                     USB201.D0FIFOCTR = USB_HOST_BITBCLR;
                     g_usb1_host_pipe_status[pipe] = USB_HOST_PIPE_DONE;
+#if(1) /* ohci_wrapp */
+                    ohciwrapp1_loc_TransEnd(pipe, TD_CC_NOERROR);
+#endif
                 }
                 else
                 {
@@ -299,6 +305,9 @@ static void usb1_host_dmaint_fifo2buf (uint16_t pipe)
                 {
                     USB201.D1FIFOCTR = USB_HOST_BITBCLR;
                     g_usb1_host_pipe_status[pipe] = USB_HOST_PIPE_DONE;
+#if(1) /* ohci_wrapp */
+                    ohciwrapp1_loc_TransEnd(pipe, TD_CC_NOERROR);
+#endif
                 }
                 else
                 {
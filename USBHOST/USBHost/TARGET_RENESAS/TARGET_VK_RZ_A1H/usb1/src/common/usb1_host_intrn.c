@@ -146,12 +146,12 @@ void usb1_host_brdy_int (uint16_t status, uint16_t int_enb)
             switch (g_usb1_host_pipe_status[pipe])
             {
                 case USB_HOST_PIPE_DONE:
-                    ohciwrapp_loc_TransEnd(pipe, TD_CC_NOERROR);
+                    ohciwrapp1_loc_TransEnd(pipe, TD_CC_NOERROR);
                 break;
                 case USB_HOST_PIPE_NORES:
                 case USB_HOST_PIPE_STALL:
                 case USB_HOST_PIPE_ERROR:
-                    ohciwrapp_loc_TransEnd(pipe, TD_CC_STALL);
+                    ohciwrapp1_loc_TransEnd(pipe, TD_CC_STALL);
                 break;
                 default:
                     /* Do Nothing */
@@ -202,14 +202,14 @@ void usb1_host_nrdy_int (uint16_t status, uint16_t int_enb)
                     {
                         g_usb1_host_pipe_status[pipe] = USB_HOST_PIPE_STALL;
 #if(1) /* ohci_wrapp */
-                        ohciwrapp_loc_TransEnd(pipe, TD_CC_STALL);
+                        ohciwrapp1_loc_TransEnd(pipe, TD_CC_STALL);
 #endif
                     }
                     else
                     {
 #if(1) /* ohci_wrapp */
                         g_usb1_host_pipe_status[pipe] = USB_HOST_PIPE_NORES;
-                        ohciwrapp_loc_TransEnd(pipe, TD_CC_DEVICENOTRESPONDING);
+                        ohciwrapp1_loc_TransEnd(pipe, TD_CC_DEVICENOTRESPONDING);
 #else
                         g_usb1_host_PipeIgnore[pipe]++;
 
@@ -261,7 +261,7 @@ void usb1_host_bemp_int (uint16_t status, uint16_t int_enb)
             {
                 g_usb1_host_pipe_status[pipe] = USB_HOST_PIPE_STALL;
 #if(1) /* ohci_wrapp */
-                ohciwrapp_loc_TransEnd(pipe, TD_CC_STALL);
+                ohciwrapp1_loc_TransEnd(pipe, TD_CC_STALL);
 #endif
             }
             else
@@ -274,7 +274,7 @@ void usb1_host_bemp_int (uint16_t status, uint16_t int_enb)
                     usb1_host_set_pid_nak(pipe);
                     g_usb1_host_pipe_status[pipe] = USB_HOST_PIPE_DONE;
 #if(1) /* ohci_wrapp */
-                    ohciwrapp_loc_TransEnd(pipe, TD_CC_NOERROR);
+                    ohciwrapp1_loc_TransEnd(pipe, TD_CC_NOERROR);
 #endif
                 }
             }
@@ -140,7 +140,7 @@ void usb1_host_interrupt1 (void)
     {
         USB201.INTSTS1 = (uint16_t)~USB_HOST_BITSACK;
 #if(1) /* ohci_wrapp */
-        ohciwrapp_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
+        ohciwrapp1_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
 #else
         g_usb1_host_CmdStage &= (~USB_HOST_CMD_FIELD);
         g_usb1_host_CmdStage |= USB_HOST_CMD_DONE;
@@ -151,7 +151,7 @@ void usb1_host_interrupt1 (void)
         USB201.INTSTS1 = (uint16_t)~USB_HOST_BITSIGN;
 #if(1) /* ohci_wrapp */
         g_usb1_host_pipe_status[USB_HOST_PIPE0] = USB_HOST_PIPE_NORES;  /* exit NORES */
-        ohciwrapp_loc_TransEnd(USB_HOST_PIPE0, TD_CC_STALL);
+        ohciwrapp1_loc_TransEnd(USB_HOST_PIPE0, TD_CC_STALL);
 #else
         g_usb1_host_CmdStage &= (~USB_HOST_CMD_FIELD);
         g_usb1_host_CmdStage |= USB_HOST_CMD_NORES;
@@ -246,7 +246,7 @@ void usb1_host_BRDYInterrupt (uint16_t Status, uint16_t Int_enbl)
                 usb1_host_disable_brdy_int(USB_HOST_PIPE0);
                 g_usb1_host_CmdStage &= (~USB_HOST_CMD_FIELD);
                 g_usb1_host_CmdStage |= USB_HOST_CMD_DONE;
-                ohciwrapp_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
+                ohciwrapp1_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
             break;
 
             case (USB_HOST_STAGE_DATA | USB_HOST_CMD_DOING):
@@ -261,7 +261,7 @@ void usb1_host_BRDYInterrupt (uint16_t Status, uint16_t Int_enbl)
                         usb1_host_disable_brdy_int(USB_HOST_PIPE0);
                         g_usb1_host_CmdStage &= (~USB_HOST_CMD_FIELD);
                         g_usb1_host_CmdStage |= USB_HOST_CMD_DONE;
-                        ohciwrapp_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
+                        ohciwrapp1_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
                     break;
 
                     case USB_HOST_READOVER:                 /* buffer over */
@@ -269,7 +269,7 @@ void usb1_host_BRDYInterrupt (uint16_t Status, uint16_t Int_enbl)
                         usb1_host_disable_brdy_int(USB_HOST_PIPE0);
                         g_usb1_host_CmdStage &= (~USB_HOST_CMD_FIELD);
                         g_usb1_host_CmdStage |= USB_HOST_CMD_DONE;
-                        ohciwrapp_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
+                        ohciwrapp1_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
                     break;
 
                     case USB_HOST_FIFOERROR:                    /* FIFO access error */
@@ -357,7 +357,7 @@ void usb1_host_NRDYInterrupt (uint16_t Status, uint16_t Int_enbl)
             g_usb1_host_CmdStage |= USB_HOST_CMD_STALL;
 #if(1) /* ohci_wrapp */
             g_usb1_host_pipe_status[USB_HOST_PIPE0] = USB_HOST_PIPE_STALL;
-            ohciwrapp_loc_TransEnd(USB_HOST_PIPE0, TD_CC_STALL);
+            ohciwrapp1_loc_TransEnd(USB_HOST_PIPE0, TD_CC_STALL);
 #endif
 
         }
@@ -367,7 +367,7 @@ void usb1_host_NRDYInterrupt (uint16_t Status, uint16_t Int_enbl)
             g_usb1_host_CmdStage |= USB_HOST_CMD_NORES;
 #if(1) /* ohci_wrapp */
             g_usb1_host_pipe_status[USB_HOST_PIPE0] = USB_HOST_PIPE_NORES;
-            ohciwrapp_loc_TransEnd(USB_HOST_PIPE0, TD_CC_STALL);
+            ohciwrapp1_loc_TransEnd(USB_HOST_PIPE0, TD_CC_STALL);
 #endif
         }
         else
@@ -408,7 +408,7 @@ void usb1_host_BEMPInterrupt (uint16_t Status, uint16_t Int_enbl)
             g_usb1_host_CmdStage |= USB_HOST_CMD_STALL;
 #if(1) /* ohci_wrapp */
             g_usb1_host_pipe_status[USB_HOST_PIPE0] = USB_HOST_PIPE_STALL;      /* exit STALL */
-            ohciwrapp_loc_TransEnd(USB_HOST_PIPE0, TD_CC_STALL);
+            ohciwrapp1_loc_TransEnd(USB_HOST_PIPE0, TD_CC_STALL);
 #endif
         }
         else
@@ -419,7 +419,7 @@ void usb1_host_BEMPInterrupt (uint16_t Status, uint16_t Int_enbl)
                 case (USB_HOST_STAGE_STATUS | USB_HOST_CMD_DOING):
                     g_usb1_host_CmdStage &= (~USB_HOST_CMD_FIELD);
                     g_usb1_host_CmdStage |= USB_HOST_CMD_DONE;
-                    ohciwrapp_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
+                    ohciwrapp1_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
                 break;
 
                 case (USB_HOST_STAGE_DATA | USB_HOST_CMD_DOING):
@@ -433,7 +433,7 @@ void usb1_host_BEMPInterrupt (uint16_t Status, uint16_t Int_enbl)
                         case USB_HOST_WRITESHRT:                    /* End of data write */
                             g_usb1_host_CmdStage &= (~USB_HOST_STAGE_FIELD);
                             g_usb1_host_CmdStage |= USB_HOST_STAGE_STATUS;
-                            ohciwrapp_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
+                            ohciwrapp1_loc_TransEnd(USB_HOST_PIPE0, TD_CC_NOERROR);
                         break;
 
                         case USB_HOST_FIFOERROR:                    /* FIFO access error */
@@ -28,11 +28,15 @@
 extern "C" {
 #endif
 
+/* The wrapper is built once per channel: USB0 by default, USB1 by *_ch1.c */
+#ifndef USB_HOST_CH
 #define USB_HOST_CH                           0
+#endif
 #define USB_HOST_HISPEED                      1
 
 #define INT_TRANS_MAX_NUM                     4    /* min:1 max:4 */
 #define ISO_TRANS_MAX_NUM                     0    /* min:0 max:2 */
+#define BLK_TRANS_DMA                         1    /* 0:CPU(D0FIFO) 1:DMAC(D0FIFO) */
 
 #if (USB_HOST_CH == 0)
 #include "usb0_host.h"
@@ -62,6 +66,18 @@ extern "C" {
 #define usbx_host_UsbAttach                   usb0_host_UsbAttach
 #define usbx_host_init_pipe_status            usb0_host_init_pipe_status
 #define usbx_host_get_sqmon                   usb0_host_get_sqmon
+#define usbx_host_blk_ep_tbl1                 usb0_host_blk_ep_tbl1
+#define usbx_host_int_ep_tbl1                 usb0_host_int_ep_tbl1
+#define usbx_host_iso_ep_tbl1                 usb0_host_iso_ep_tbl1
+#define ohciwrappx_init                       ohciwrapp0_init
+#define ohciwrappx_reg_r                      ohciwrapp0_reg_r
+#define ohciwrappx_reg_w                      ohciwrapp0_reg_w
+#define ohciwrappx_loc_Connect                ohciwrapp0_loc_Connect
+#define ohciwrappx_loc_TransEnd               ohciwrapp0_loc_TransEnd
+#define ohciwrappx_callback_task              ohciwrapp0_callback_task
+#define ohciwrappx_sched_task                 ohciwrapp0_sched_task
+#define ohciwrappx_sem_cb                     ohciwrapp0_sem_cb
+#define ohciwrappx_mtx_sched                  ohciwrapp0_mtx_sched
 #else
 #include "usb1_host.h"
 #define USB20X                                USB201
@@ -90,6 +106,18 @@ extern "C" {
 #define usbx_host_UsbAttach                   usb1_host_UsbAttach
 #define usbx_host_init_pipe_status            usb1_host_init_pipe_status
 #define usbx_host_get_sqmon                   usb1_host_get_sqmon
+#define usbx_host_blk_ep_tbl1                 usb1_host_blk_ep_tbl1
+#define usbx_host_int_ep_tbl1                 usb1_host_int_ep_tbl1
+#define usbx_host_iso_ep_tbl1                 usb1_host_iso_ep_tbl1
+#define ohciwrappx_init                       ohciwrapp1_init
+#define ohciwrappx_reg_r                      ohciwrapp1_reg_r
+#define ohciwrappx_reg_w                      ohciwrapp1_reg_w
+#define ohciwrappx_loc_Connect                ohciwrapp1_loc_Connect
+#define ohciwrappx_loc_TransEnd               ohciwrapp1_loc_TransEnd
+#define ohciwrappx_callback_task              ohciwrapp1_callback_task
+#define ohciwrappx_sched_task                 ohciwrapp1_sched_task
+#define ohciwrappx_sem_cb                     ohciwrapp1_sem_cb
+#define ohciwrappx_mtx_sched                  ohciwrapp1_mtx_sched
 #endif
 
 
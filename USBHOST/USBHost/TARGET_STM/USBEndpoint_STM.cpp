@@ -21,15 +21,15 @@ extern uint32_t HAL_HCD_HC_GetMaxPacket(HCD_HandleTypeDef *hhcd, uint8_t chn_num
 extern uint32_t HAL_HCD_HC_GetType(HCD_HandleTypeDef *hhcd, uint8_t chn_num);
 extern void HAL_HCD_DisableInt(HCD_HandleTypeDef* hhcd, uint8_t chn_num);
 extern void HAL_HCD_EnableInt(HCD_HandleTypeDef* hhcd, uint8_t chn_num);
+extern int HAL_HCD_HC_Claim(HCD_HandleTypeDef *hhcd, HCED *hced);
+extern void HAL_HCD_HC_Cancel(HCD_HandleTypeDef *hhcd, HCED *hced);
+extern HCED * HAL_HCD_HC_Release(HCD_HandleTypeDef *hhcd, HCED *hced);
 
 
 
 
 void USBEndpoint::init(HCED * hced_, ENDPOINT_TYPE type_, ENDPOINT_DIRECTION dir_, uint32_t size, uint8_t ep_number, HCTD* td_list_[2])
 {
-    HCD_HandleTypeDef *hhcd;
-    uint32_t *addr;
-
     hced = hced_;
     type = type_;
     dir = dir_;
@@ -48,17 +48,27 @@ void USBEndpoint::init(HCED * hced_, ENDPOINT_TYPE type_, ENDPOINT_DIRECTION dir
     this->ep_number = ep_number;
     transfer_len = 0;
     transferred = 0;
+    completion_frame = 0;
+#if USBHOST_STATS
+    submit_time = 0;
+    completion_time = 0;
+    memset(&stats, 0, sizeof(stats));
+#endif
     buf_start = 0;
     nextEp = NULL;
 
     td_current = td_list[0];
     td_next = td_list[1];
-    /*  remove potential post pending from previous endpoint */
-    ep_queue.get(0);
+    nb_td = 2;
     intf_nb = 0;
-    hhcd = (HCD_HandleTypeDef*)hced->hhcd;
-    addr = &((uint32_t *)hhcd->pData)[hced->ch_num];
-    *addr = 0;
+    /*  no channel until a transfer is queued */
+    hced->ep = this;
+    hced->ch_num = HC_NO_CHANNEL;
+    hced->toggle_in = 0;
+    hced->toggle_out = 0;
+    hced->periodic = (type == INTERRUPT_ENDPOINT);
+    hced->next_wait = NULL;
+    device_address = 0;
     state = USB_TYPE_IDLE;
     speed =false;
 }
@@ -70,14 +80,14 @@ void USBEndpoint::setSize(uint32_t size)
 
 void USBEndpoint::setDeviceAddress(uint8_t addr)
 {
-    HCD_HandleTypeDef *hhcd;
-    uint8_t hcd_speed = HCD_SPEED_FULL;
-    /* fix me : small speed device with hub not supported
-    if (this->speed) hcd_speed = HCD_SPEED_LOW; */
+    /* fix me : small speed device with hub not supported */
     if (this->speed) USB_WARN("small speed device on hub not supported");
-    MBED_ASSERT(HAL_HCD_HC_Init((HCD_HandleTypeDef*)hced->hhcd,hced->ch_num, address, addr, hcd_speed,  type, size)!=HAL_BUSY);
+    /*  the channel is configured when claimed by queueTransfer */
+    if (this->device_address != addr) {
+        hced->toggle_in = 0;
+        hced->toggle_out = 0;
+    }
     this->device_address = addr;
-
 }
 
 void USBEndpoint::setSpeed(uint8_t speed)
@@ -92,81 +102,109 @@ void USBEndpoint::setState(USB_TYPE st)
     /*  modify this state is possible only with a plug   */
     if ((state == USB_TYPE_FREE)) return;
 
+    HCD_HandleTypeDef *hhcd = (HCD_HandleTypeDef*)hced->hhcd;
+    USB_TYPE previous = state;
+
     state = st;
-    if (st == USB_TYPE_FREE) {
-        HCD_HandleTypeDef *hhcd = (HCD_HandleTypeDef*)hced->hhcd;
+    if ((st != USB_TYPE_FREE) && (st != USB_TYPE_ERROR))
+        return;
+
+    core_util_critical_section_enter();
+    if (hced->ch_num != HC_NO_CHANNEL) {
         uint32_t *addr = &((uint32_t *)hhcd->pData)[hced->ch_num];
-        if ((*addr)&& (type!=INTERRUPT_ENDPOINT)) {
-            this->ep_queue.put((uint8_t*)1);
+        if ((st == USB_TYPE_FREE) && (*addr) && (type != INTERRUPT_ENDPOINT)) {
+            signalTransfer();
+        }
+        MBED_ASSERT(HAL_HCD_HC_Halt(hhcd, hced->ch_num)!=HAL_BUSY);
+        HAL_HCD_DisableInt(hhcd, hced->ch_num);
+        if (st == USB_TYPE_FREE) {
+            HCED *next = HAL_HCD_HC_Release(hhcd, (HCED *)hced);
+            if (next)
+                ((USBEndpoint *)next->ep)->startTransfer();
+        }
+    } else {
+        /*  transfer still waiting for a channel */
+        HAL_HCD_HC_Cancel(hhcd, (HCED *)hced);
+        if ((st == USB_TYPE_FREE) && (previous == USB_TYPE_PROCESSING) && (type != INTERRUPT_ENDPOINT)) {
+            signalTransfer();
         }
-        MBED_ASSERT(HAL_HCD_HC_Halt((HCD_HandleTypeDef*)hced->hhcd, hced->ch_num)!=HAL_BUSY);
-        HAL_HCD_DisableInt((HCD_HandleTypeDef*)hced->hhcd, hced->ch_num);
-        *addr = 0;
-
-    }
-    if ((st == USB_TYPE_ERROR) ) {
-        MBED_ASSERT(HAL_HCD_HC_Halt((HCD_HandleTypeDef*)hced->hhcd, hced->ch_num)!=HAL_BUSY);
-        HAL_HCD_DisableInt((HCD_HandleTypeDef*)hced->hhcd, hced->ch_num);
-
-    }
-    if ((st == USB_TYPE_ERROR) ) {
-        uint8_t hcd_speed = HCD_SPEED_FULL;
-        /* small speed device with hub not supported
-           if (this->speed) hcd_speed = HCD_SPEED_LOW;*/
-        MBED_ASSERT(HAL_HCD_HC_Init((HCD_HandleTypeDef*)hced->hhcd,hced->ch_num, address, 0, hcd_speed,  type, size)!=HAL_BUSY);
     }
+    core_util_critical_section_exit();
 }
 
 
-extern uint32_t HAL_HCD_HC_GetMaxPacket(HCD_HandleTypeDef *hhcd, uint8_t chn_num);
-extern uint32_t HAL_HCD_HC_GetType(HCD_HandleTypeDef *hhcd, uint8_t chn_num);
-
-
 USB_TYPE USBEndpoint::queueTransfer()
 {
     HCD_HandleTypeDef *hhcd = (HCD_HandleTypeDef*)hced->hhcd;
-    uint32_t *addr = &((uint32_t *)hhcd->pData)[hced->ch_num];
-    uint32_t type = HAL_HCD_HC_GetType(hhcd, hced->ch_num);
-    uint32_t max_size =  HAL_HCD_HC_GetMaxPacket(hhcd, hced->ch_num);
     /*  if a packet is queue on disconnected ; no solution for now */
     if ((state == USB_TYPE_FREE) ) {
         td_current->state =  USB_TYPE_FREE;
         return USB_TYPE_FREE;
     }
-    ep_queue.get(0);
-    MBED_ASSERT(*addr ==0);
-    transfer_len =   td_current->size <= max_size ? td_current->size : max_size;
+    MBED_ASSERT(hced->ch_num == HC_NO_CHANNEL);
+    transfer_len =   td_current->size <= size ? td_current->size : size;
     buf_start = (uint8_t *)td_current->currBufPtr;
 
     //Now add this free TD at this end of the queue
     state = USB_TYPE_PROCESSING;
     /*  one request */
-    td_current->nextTD = (hcTd*)0;
+    td_current->nextTD = (HCTD*)0;
 #if defined(MAX_NYET_RETRY)
     td_current->retry = 0;
 #endif
+    td_current->naks = 0;
     td_current->setup = setup;
+
+    /*  start now if a channel is free, otherwise the transfer is started
+     *  when a channel is released */
+    core_util_critical_section_enter();
+    if (HAL_HCD_HC_Claim(hhcd, (HCED *)hced) >= 0)
+        startTransfer();
+    core_util_critical_section_exit();
+
+    return USB_TYPE_PROCESSING;
+}
+
+/*  configure the channel just claimed and submit td_current
+ *  called with the USB interrupt masked */
+void USBEndpoint::startTransfer()
+{
+    HCD_HandleTypeDef *hhcd = (HCD_HandleTypeDef*)hced->hhcd;
+    uint8_t ch_num = hced->ch_num;
+    uint32_t *addr = &((uint32_t *)hhcd->pData)[ch_num];
+    uint8_t hcd_speed = HCD_SPEED_FULL;
+
+    MBED_ASSERT(HAL_HCD_HC_Init(hhcd, ch_num, address, device_address, hcd_speed, type, size)!=HAL_BUSY);
+    hhcd->hc[ch_num].toggle_in = hced->toggle_in;
+    hhcd->hc[ch_num].toggle_out = hced->toggle_out;
+
+    transfer_len = td_current->size <= size ? td_current->size : size;
     *addr = (uint32_t)td_current;
     /*  dir /setup is inverted for ST */
     /* token is useful only ctrl endpoint */
     /*  last parameter is ping ? */
-    MBED_ASSERT(HAL_HCD_HC_SubmitRequest((HCD_HandleTypeDef*)hced->hhcd, hced->ch_num, dir-1, type,!setup,(uint8_t*) td_current->currBufPtr, transfer_len, 0)==HAL_OK);
-    HAL_HCD_EnableInt((HCD_HandleTypeDef*)hced->hhcd, hced->ch_num);
-
-    return USB_TYPE_PROCESSING;
+    MBED_ASSERT(HAL_HCD_HC_SubmitRequest(hhcd, ch_num, dir-1, type,!setup,(uint8_t*) td_current->currBufPtr, transfer_len, 0)==HAL_OK);
+    HAL_HCD_EnableInt(hhcd, ch_num);
 }
 
 void USBEndpoint::unqueueTransfer(volatile HCTD * td)
 {
     if (state==USB_TYPE_FREE) return;
-    uint32_t *addr = &((uint32_t *)((HCD_HandleTypeDef*)hced->hhcd)->pData)[hced->ch_num];
+    HCD_HandleTypeDef *hhcd = (HCD_HandleTypeDef*)hced->hhcd;
     td->state=0;
     td->currBufPtr=0;
     td->size=0;
     td->nextTD=0;
-    *addr = 0;
     td_current = td_next;
     td_next = td;
+    /*  give the channel back, and start the first endpoint waiting for it */
+    if (hced->ch_num != HC_NO_CHANNEL) {
+        HCED *next = HAL_HCD_HC_Release(hhcd, (HCED *)hced);
+        if (next)
+            ((USBEndpoint *)next->ep)->startTransfer();
+    } else {
+        HAL_HCD_HC_Cancel(hhcd, (HCED *)hced);
+    }
 }
 
 void USBEndpoint::queueEndpoint(USBEndpoint * ed)
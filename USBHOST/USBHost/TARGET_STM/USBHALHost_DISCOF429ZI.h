@@ -30,11 +30,13 @@ typedef struct
     /* store the request ongoing on each endpoit  */
     /*  1st field of structure avoid  giving knowledge of all structure to
      *  endpoint */
-    volatile uint32_t addr[MAX_ENDPOINT];
+    volatile uint32_t addr[MAX_HOST_CHANNEL];
+    /*  endpoint owning each host channel, NULL when the channel is free */
+    HCED * volatile owner[MAX_HOST_CHANNEL];
+    /*  endpoints waiting for a free channel, periodic ones are served first */
+    HCED * volatile wait_periodic;
+    HCED * volatile wait_async;
     USBHALHost *inst;
-    void (USBHALHost::*deviceConnected)(int hub, int port, bool lowSpeed, USBHostHub * hub_parent);
-    void (USBHALHost::*deviceDisconnected)(int hub, int port, USBHostHub * hub_parent, volatile uint32_t addr);
-    void (USBHALHost::*transferCompleted)(volatile uint32_t addr);
 }USBHALHost_Private_t;
 /*  CONFIGURATION for USB_VBUS  
  *  on 64 bits board PC_0 is used  (0  VBUS on,  1 VBUS off)
@@ -64,9 +66,10 @@ void  usb_vbus( uint8_t state)
 }
 
 
-USBHALHost::USBHALHost() {
+USBHALHost::USBHALHost(uint8_t controller) {
     gpio_t  pin_vbus;
-    instHost = this;
+    this->controller = controller;
+    instHost[controller] = this;
     HCD_HandleTypeDef *hhcd;
     USBHALHost_Private_t *HALPriv = new(USBHALHost_Private_t);
     memset(HALPriv, 0, sizeof(USBHALHost_Private_t));
@@ -75,19 +78,15 @@ USBHALHost::USBHALHost() {
     hhcd = (HCD_HandleTypeDef *)usb_hcca;
     hhcd->Instance = USB_OTG_HS;
     hhcd->pData = (void*)HALPriv;
-    hhcd->Init.Host_channels = 11;
+    hhcd->Init.Host_channels = MAX_HOST_CHANNEL;
     /*   for now failed with dma */
     hhcd->Init.dma_enable = 0;
     hhcd->Init.speed = HCD_SPEED_HIGH;
     hhcd->Init.phy_itface = HCD_PHY_EMBEDDED;
     hhcd->Init.use_external_vbus = 1;
     HALPriv->inst = this;
-    HALPriv->deviceConnected = &USBHALHost::deviceConnected;
-    HALPriv->deviceDisconnected = &USBHALHost::deviceDisconnected;
-    HALPriv->transferCompleted = &USBHALHost::transferCompleted;
     for (int i = 0; i < MAX_ENDPOINT; i++) {
         edBufAlloc[i] = false;
-        HALPriv->addr[i]=(uint32_t)-1;
     }
     for (int i = 0; i < MAX_TD; i++) {
         tdBufAlloc[i] = false;
@@ -16,7 +16,7 @@
 
 #ifdef TARGET_STM
 #include "mbed.h"
-#include "USBHALHost.h"
+#include "USBHost.h"
 #include "dbg.h"
 #include "pinmap.h"
 
@@ -25,16 +25,17 @@
 void HAL_HCD_Connect_Callback(HCD_HandleTypeDef *hhcd)
 {
     USBHALHost_Private_t *priv=(USBHALHost_Private_t *)(hhcd->pData);
-    USBHALHost *obj= priv->inst;
-    void (USBHALHost::*func)(int hub, int port, bool lowSpeed, USBHostHub * hub_parent ) = priv->deviceConnected;
-    (obj->*func)(0,1,0,NULL);
+    priv->inst->deviceConnected(0,1,0,NULL);
 }
 void HAL_HCD_Disconnect_Callback(HCD_HandleTypeDef *hhcd)
 {
     USBHALHost_Private_t *priv=(USBHALHost_Private_t *)(hhcd->pData);
-    USBHALHost *obj= priv->inst;
-    void (USBHALHost::*func1)(int hub, int port, USBHostHub * hub_parent, volatile uint32_t addr)= priv->deviceDisconnected;
-    (obj->*func1)(0,1,(USBHostHub *)NULL,0);
+    priv->inst->deviceDisconnected(0,1,(USBHostHub *)NULL,0);
+}
+void HAL_HCD_SOF_Callback(HCD_HandleTypeDef *hhcd)
+{
+    USBHALHost_Private_t *priv=(USBHALHost_Private_t *)(hhcd->pData);
+    priv->inst->frameStarted();
 }
 int HAL_HCD_HC_GetDirection(HCD_HandleTypeDef *hhcd,uint8_t chnum)
 {
@@ -66,11 +67,83 @@ uint32_t HAL_HCD_HC_GetType(HCD_HandleTypeDef *hhcd,uint8_t chnum)
     return hhcd->hc[chnum].ep_type;
 }
 
+/*  claim a free host channel for hced, if none is free hced is queued
+ *  and will get the next channel released (periodic endpoints first)
+ *  must be called with the USB interrupt masked */
+int HAL_HCD_HC_Claim(HCD_HandleTypeDef *hhcd, HCED *hced)
+{
+    USBHALHost_Private_t *priv=(USBHALHost_Private_t *)(hhcd->pData);
+    HCED * volatile *tail;
+
+    for (int i = 0; i < MAX_HOST_CHANNEL; i++) {
+        if (priv->owner[i] == NULL) {
+            priv->owner[i] = hced;
+            hced->ch_num = i;
+            return i;
+        }
+    }
+    hced->next_wait = NULL;
+    tail = hced->periodic ? &priv->wait_periodic : &priv->wait_async;
+    while (*tail != NULL)
+        tail = &((*tail)->next_wait);
+    *tail = hced;
+    return -1;
+}
+
+/*  remove hced from the channel waiting lists */
+void HAL_HCD_HC_Cancel(HCD_HandleTypeDef *hhcd, HCED *hced)
+{
+    USBHALHost_Private_t *priv=(USBHALHost_Private_t *)(hhcd->pData);
+    HCED * volatile *list[2] = { &priv->wait_periodic, &priv->wait_async };
+
+    for (int i = 0; i < 2; i++) {
+        HCED * volatile *prev = list[i];
+        while (*prev != NULL) {
+            if (*prev == hced) {
+                *prev = hced->next_wait;
+                hced->next_wait = NULL;
+                return;
+            }
+            prev = &((*prev)->next_wait);
+        }
+    }
+}
+
+/*  release the channel owned by hced, saving its data toggles.
+ *  the channel is handed over to the first waiting endpoint which
+ *  is returned (NULL if nobody is waiting) */
+HCED * HAL_HCD_HC_Release(HCD_HandleTypeDef *hhcd, HCED *hced)
+{
+    USBHALHost_Private_t *priv=(USBHALHost_Private_t *)(hhcd->pData);
+    uint8_t chnum = hced->ch_num;
+    HCED *next;
+
+    if (chnum == HC_NO_CHANNEL)
+        return NULL;
+    hced->toggle_in = hhcd->hc[chnum].toggle_in;
+    hced->toggle_out = hhcd->hc[chnum].toggle_out;
+    hced->ch_num = HC_NO_CHANNEL;
+    priv->addr[chnum] = 0;
+    priv->owner[chnum] = NULL;
+
+    next = priv->wait_periodic;
+    if (next != NULL) {
+        priv->wait_periodic = next->next_wait;
+    } else if ((next = priv->wait_async) != NULL) {
+        priv->wait_async = next->next_wait;
+    } else {
+        return NULL;
+    }
+    next->next_wait = NULL;
+    next->ch_num = chnum;
+    priv->owner[chnum] = next;
+    return next;
+}
+
 void HAL_HCD_HC_NotifyURBChange_Callback(HCD_HandleTypeDef *hhcd,uint8_t chnum, HCD_URBStateTypeDef urb_state)
 {
     USBHALHost_Private_t *priv=(USBHALHost_Private_t *)(hhcd->pData);
     USBHALHost *obj= priv->inst;
-    void (USBHALHost::*func)(volatile uint32_t addr)= priv->transferCompleted;
 
     uint32_t addr = priv->addr[chnum];
     uint32_t max_size = HAL_HCD_HC_GetMaxPacket(hhcd, chnum);
@@ -97,6 +170,7 @@ void HAL_HCD_HC_NotifyURBChange_Callback(HCD_HandleTypeDef *hhcd,uint8_t chnum,
                     }
                     break;
                 case  URB_NOTREADY:
+                    td->naks++;
                     /*  try again  */
                     /*  abritary limit , to avoid dead lock if other error than
                      *  slow response is  */
@@ -125,14 +199,14 @@ void HAL_HCD_HC_NotifyURBChange_Callback(HCD_HandleTypeDef *hhcd,uint8_t chnum,
             td->state = (urb_state == URB_DONE) ?  USB_TYPE_IDLE : USB_TYPE_ERROR;
         }
         td->currBufPtr +=HAL_HCD_HC_GetXferCount(hhcd, chnum);
-        (obj->*func)(addr);
+        obj->transferCompleted(addr);
     } else {
         if (urb_state !=0)
             USB_DBG_EVENT("spurious %d %d",chnum, urb_state);
     }
 }
 
-USBHALHost * USBHALHost::instHost;
+USBHALHost * USBHALHost::instHost[USBHOST_CONTROLLER_NUM];
 
 
 void USBHALHost::init()
@@ -143,6 +217,8 @@ void USBHALHost::init()
     HAL_HCD_Init((HCD_HandleTypeDef *) usb_hcca);
     NVIC_EnableIRQ(USBHAL_IRQn);
     control_disable = 0;
+    /*  the SOF interrupt is enabled by HAL_HCD_Init, keep it only for frame handlers */
+    enableFrameInterrupt(false);
     HAL_HCD_Start((HCD_HandleTypeDef *) usb_hcca);
     usb_vbus(1);
 }
@@ -188,6 +264,30 @@ void USBHALHost::enableList(ENDPOINT_TYPE type)
 }
 
 
+uint32_t USBHALHost::frameNumber()
+{
+    return HAL_HCD_GetCurrentFrame((HCD_HandleTypeDef *) usb_hcca) & FRAME_NUMBER_MASK;
+}
+
+
+void USBHALHost::enableFrameInterrupt(bool enable)
+{
+    USB_OTG_GlobalTypeDef *USBx = ((HCD_HandleTypeDef *) usb_hcca)->Instance;
+    if (enable) {
+        USBx->GINTSTS = USB_OTG_GINTSTS_SOF;
+        USBx->GINTMSK |= USB_OTG_GINTMSK_SOFM;
+    } else {
+        USBx->GINTMSK &= ~USB_OTG_GINTMSK_SOFM;
+    }
+}
+
+
+void USBHALHost::fillList(ENDPOINT_TYPE type)
+{
+    /*  transfers are submitted directly on a channel */
+}
+
+
 bool USBHALHost::disableList(ENDPOINT_TYPE type)
 {
     if (type == CONTROL_ENDPOINT) {
@@ -210,7 +310,7 @@ void USBHALHost::memInit()
     memset((void*)usb_buf,0, TOTAL_SIZE);
     for (int i=0; i < MAX_ENDPOINT; i++) {
         HCED	*hced = (HCED*)(usb_edBuf + i*ED_SIZE);
-        hced->ch_num = i;
+        hced->ch_num = HC_NO_CHANNEL;
         hced->hhcd = (HCCA *) usb_hcca;
     }
 }
@@ -258,16 +358,17 @@ void USBHALHost::freeTD(volatile uint8_t * td)
 
 void USBHALHost::resetRootHub()
 {
-    // Initiate port reset
-    wait(0.2);
+    // Initiate port reset, after the connection debounce
+    Thread::wait(200);
     HAL_HCD_ResetPort((HCD_HandleTypeDef *)usb_hcca);
 }
 
 
 void USBHALHost::_usbisr(void)
 {
-    if (instHost) {
-        instHost->UsbIrqhandler();
+    USB_TRACE_SCOPE("usb_isr");
+    if (instHost[0]) {
+        instHost[0]->UsbIrqhandler();
     }
 }
 
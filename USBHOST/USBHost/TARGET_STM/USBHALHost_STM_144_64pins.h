@@ -30,11 +30,13 @@ typedef struct
 	/* store the request ongoing on each endpoit  */
 	/*  1st field of structure avoid  giving knowledge of all structure to
 	 *  endpoint */
-	volatile uint32_t addr[MAX_ENDPOINT];
+	volatile uint32_t addr[MAX_HOST_CHANNEL];
+	/*  endpoint owning each host channel, NULL when the channel is free */
+	HCED * volatile owner[MAX_HOST_CHANNEL];
+	/*  endpoints waiting for a free channel, periodic ones are served first */
+	HCED * volatile wait_periodic;
+	HCED * volatile wait_async;
 	USBHALHost *inst;
-	void (USBHALHost::*deviceConnected)(int hub, int port, bool lowSpeed, USBHostHub * hub_parent);
-	void (USBHALHost::*deviceDisconnected)(int hub, int port, USBHostHub * hub_parent, volatile uint32_t addr);
-	void (USBHALHost::*transferCompleted)(volatile uint32_t addr);
 }USBHALHost_Private_t;
 
 /*  CONFIGURATION for USB_VBUS  
@@ -72,8 +74,9 @@ void  usb_vbus( uint8_t state)
     wait(0.2);
 }
 
-USBHALHost::USBHALHost() {
-    instHost = this;
+USBHALHost::USBHALHost(uint8_t controller) {
+    this->controller = controller;
+    instHost[controller] = this;
     HCD_HandleTypeDef *hhcd;
     USBHALHost_Private_t *HALPriv = new(USBHALHost_Private_t);
     memset(HALPriv, 0, sizeof(USBHALHost_Private_t));
@@ -82,16 +85,12 @@ USBHALHost::USBHALHost() {
     hhcd = (HCD_HandleTypeDef *)usb_hcca;
     hhcd->Instance = USB_OTG_FS;
     hhcd->pData = (void*)HALPriv;
-    hhcd->Init.Host_channels = 11;
+    hhcd->Init.Host_channels = MAX_HOST_CHANNEL;
     hhcd->Init.speed = HCD_SPEED_FULL; 
     hhcd->Init.phy_itface = HCD_PHY_EMBEDDED;
     HALPriv->inst = this;
-    HALPriv->deviceConnected = &USBHALHost::deviceConnected;
-    HALPriv->deviceDisconnected = &USBHALHost::deviceDisconnected;
-    HALPriv->transferCompleted = &USBHALHost::transferCompleted;
     for (int i = 0; i < MAX_ENDPOINT; i++) {
         edBufAlloc[i] = false;
-        HALPriv->addr[i]=(uint32_t)-1;
     }
     for (int i = 0; i < MAX_TD; i++) {
         tdBufAlloc[i] = false;
@@ -34,6 +34,7 @@ void USBDeviceConnected::init() {
     device_subclass = 0;
     proto = 0;
     speed = false;
+    remote_wakeup = false;
     for (int i = 0; i < MAX_INTF; i++) {
         memset((void *)&intf[i], 0, sizeof(INTERFACE));
         intf[i].in_use = false;
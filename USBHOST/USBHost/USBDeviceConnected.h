@@ -139,6 +139,7 @@ public:
     inline void activeAddress(bool active) { activeAddr = active; };
     inline void setEnumerated() { enumerated = true; };
     inline void setNbIntf(uint8_t nb_intf) {nb_interf = nb_intf; };
+    inline void setRemoteWakeup(bool remote_wakeup_) { remote_wakeup = remote_wakeup_; };
     inline void setHubParent(USBHostHub * hub) { hub_parent = hub; };
     inline void setName(const char * name_, uint8_t intf_nb) { strcpy(intf[intf_nb].name, name_); };
 
@@ -157,6 +158,7 @@ public:
     inline bool        isEnumerated() { return enumerated; };
     inline USBHostHub * getHubParent() { return hub_parent; };
     inline uint8_t      getNbIntf() { return nb_interf; };
+    inline bool         canRemoteWakeup() { return remote_wakeup; };
     inline const char * getName(uint8_t intf_nb) { return intf[intf_nb].name; };
 
     // in case this device is a hub
@@ -179,6 +181,7 @@ private:
     volatile bool activeAddr;
     volatile bool enumerated;
     uint8_t nb_interf;
+    bool remote_wakeup;
 
     void init();
 };
@@ -47,11 +47,20 @@ void USBEndpoint::init(HCED * hced_, ENDPOINT_TYPE type_, ENDPOINT_DIRECTION dir
 
     transfer_len = 0;
     transferred = 0;
+    completion_frame = 0;
+#if USBHOST_STATS
+    submit_time = 0;
+    completion_time = 0;
+    memset(&stats, 0, sizeof(stats));
+#endif
     buf_start = 0;
     nextEp = NULL;
 
+    nb_td = 2;
+    td_head = 0;
+    td_queued = 0;
+    td_last = NULL;
     td_current = td_list[0];
-    td_next = td_list[1];
 
     intf_nb = 0;
 
@@ -131,33 +140,66 @@ void USBEndpoint::setState(uint8_t st) {
     state = type_string[st].type;
 }
 
-USB_TYPE USBEndpoint::queueTransfer()
+bool USBEndpoint::addTD(HCTD * td)
 {
-    transfer_len = (uint32_t)td_current->bufEnd - (uint32_t)td_current->currBufPtr + 1;
+    if ((nb_td == USB_BULK_TDS) || (td_queued != 0)) {
+        return false;
+    }
+    memset(td, 0, sizeof(HCTD));
+    td->ep = this;
+    // the ring is extended behind the dummy tail TD
+    for (uint8_t i = nb_td; i > td_head + 1; i--) {
+        td_list[i] = td_list[i - 1];
+    }
+    td_list[td_head + 1] = td;
+    nb_td++;
+    return true;
+}
+
+USB_TYPE USBEndpoint::queueTransfer(uint8_t nb)
+{
+    volatile HCTD * last = getNextTD(nb - 1);
+    volatile HCTD * tail = getNextTD(nb);
+
+    transfer_len = (uint32_t)last->bufEnd - (uint32_t)td_current->currBufPtr + 1;
     transferred = transfer_len;
     buf_start = (uint8_t *)td_current->currBufPtr;
+    td_queued = nb;
+    td_last = last;
 
-    //Now add this free TD at this end of the queue
+    //Now add these free TDs at this end of the queue
+    //td_current is the dummy tail TD, the HC does not process it until tailTD moves:
+    //the new dummy is linked and the TDs made visible before tailTD is advanced
     state = USB_TYPE_PROCESSING;
-    td_current->nextTD = (hcTd*)td_next;
-    hced->tailTD = td_next;
+    tail->nextTD = 0;
+    for (uint8_t i = 0; i < nb; i++) {
+        getNextTD(i)->nextTD = (HCTD*)getNextTD(i + 1);
+    }
+    __DMB();
+    hced->tailTD = (HCTD*)tail;
     return USB_TYPE_PROCESSING;
 }
 
 void USBEndpoint::unqueueTransfer(volatile HCTD * td)
 {
-    td->control=0;
-    td->currBufPtr=0;
-    td->bufEnd=0;
-    td->nextTD=0;
+    //The TDs after td are still on the ED when it has been halted by an error
+    for (uint8_t i = 0; i < td_queued; i++) {
+        volatile HCTD * t = getNextTD(i);
+        t->control=0;
+        t->currBufPtr=0;
+        t->bufEnd=0;
+        t->nextTD=0;
+    }
     hced->headTD = (HCTD *)((uint32_t)hced->tailTD | ((uint32_t)hced->headTD & 0x2)); //Carry bit
-    td_current = td_next;
-    td_next = td;
+    td_head = (td_head + td_queued) % nb_td;
+    td_current = td_list[td_head];
+    td_queued = 0;
+    td_last = NULL;
 }
 
 void USBEndpoint::queueEndpoint(USBEndpoint * ed)
 {
     nextEp = ed;
-    hced->nextED = (ed == NULL) ? 0 : (hcEd*)(ed->getHCED());
+    hced->nextED = (ed == NULL) ? 0 : (HCED*)(ed->getHCED());
 }
 #endif
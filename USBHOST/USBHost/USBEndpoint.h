@@ -19,6 +19,7 @@
 
 #include "Callback.h"
 #include "USBHostTypes.h"
+#include "USBHostConf.h"
 #include "rtos.h"
 
 class USBDeviceConnected;
@@ -38,6 +39,7 @@ public:
 #endif
         state = USB_TYPE_FREE;
         nextEp = NULL;
+        waiter = NULL;
     };
 
     /**
@@ -68,15 +70,33 @@ public:
     void queueEndpoint(USBEndpoint * endpoint);
 
 
+#ifdef USBHOST_OTHER
     /**
     * Queue a transfer on the endpoint
     */
     USB_TYPE queueTransfer();
+#else
+    /**
+    * Queue a transfer on the endpoint, filled in the TDs returned by getNextTD(0 to nb - 1)
+    *
+    * @param nb number of TDs of the transfer (1 to getMaxTDs())
+    */
+    USB_TYPE queueTransfer(uint8_t nb = 1);
+
+    /**
+    * Add a TD to the endpoint, for the transfers queued on several TDs.
+    * Only when no transfer is queued
+    *
+    * @param td allocated transfer descriptor
+    * @returns false if the endpoint cannot hold more TDs
+    */
+    bool addTD(HCTD * td);
+#endif
 
     /**
-    * Unqueue a transfer from the endpoint
+    * Unqueue a transfer from the endpoint, with all its TDs
     *
-    * @param td hctd which will be unqueued
+    * @param td hctd which ends the transfer
     */
     void unqueueTransfer(volatile HCTD * td);
 
@@ -104,6 +124,35 @@ public:
         }
     }
 
+    /**
+    * Wait for the end of the transfer queued on this endpoint by the calling thread.
+    * The thread is woken up by signalTransfer with the USB_EP_SIGNAL thread signal
+    *
+    * @param millisec timeout
+    * @returns false if the transfer is still processing after the timeout
+    */
+    inline bool waitTransfer(uint32_t millisec = osWaitForever) {
+        waiter = Thread::gettid();
+        // a signal left by a previous transfer only makes the loop run once more
+        while (state == USB_TYPE_PROCESSING) {
+            if (Thread::signal_wait(USB_EP_SIGNAL, millisec).status == osEventTimeout) {
+                waiter = NULL;
+                return false;
+            }
+        }
+        waiter = NULL;
+        return true;
+    };
+
+    /**
+    * Wake up the thread waiting for the end of a transfer on this endpoint (ISR context)
+    */
+    inline void signalTransfer() {
+        osThreadId thread = waiter;
+        if (thread)
+            osSignalSet(thread, USB_EP_SIGNAL);
+    };
+
     /**
     * Call the handler associted to the end of a transfer
     */
@@ -122,10 +171,23 @@ public:
     void setState(uint8_t st);
     void setDeviceAddress(uint8_t addr);
     inline void setLengthTransferred(int len) { transferred = len; };
+    inline void setCompletionFrame(uint32_t frame) { completion_frame = frame; };
+#if USBHOST_STATS
+    inline void setSubmitTime(uint32_t us) { submit_time = us; };
+    inline void setCompletionTime(uint32_t us) { completion_time = us; };
+#endif
     void setSpeed(uint8_t speed);
     void setSize(uint32_t size);
     inline void setDir(ENDPOINT_DIRECTION d) { dir = d; }
     inline void setIntfNb(uint8_t intf_nb_) { intf_nb = intf_nb_; };
+#ifndef USBHOST_OTHER
+    /**
+    * Make the controller skip this endpoint (device suspended), the queued TDs are kept
+    *
+    * @param skip true to skip the endpoint, false to process it again
+    */
+    inline void setSkip(bool skip) { hced->control = skip ? (hced->control | ED_SKIP) : (hced->control & ~ED_SKIP); };
+#endif
 
     // getters
     const char *                getStateString();
@@ -138,23 +200,37 @@ public:
     inline uint8_t              getDeviceAddress() { return hced->control & 0x7f; };
 	inline uint32_t             getSize() { return (hced->control >> 16) & 0x3ff; };
     inline volatile HCTD *      getHeadTD() { return (volatile HCTD*) ((uint32_t)hced->headTD & ~0xF); };
+    inline bool                 isSkipped() { return hced->control & ED_SKIP; };
+    // i-th TD of the next transfer, the first one is the dummy tail TD of the ED
+    inline volatile HCTD*       getNextTD(uint8_t i = 0) { return td_list[(td_head + i) % nb_td]; };
+    // the intermediate TDs of a transfer are reported with its last TD
+    inline bool                 isLastTD(volatile HCTD * td) { return td == td_last; };
 #endif
     inline int                  getLengthTransferred() { return transferred; }
+    inline uint32_t             getCompletionFrame() { return completion_frame; }
+#if USBHOST_STATS
+    inline uint32_t             getSubmitTime() { return submit_time; }
+    inline uint32_t             getCompletionTime() { return completion_time; }
+    inline USBEndpointStats *   getStats() { return &stats; }
+#endif
     inline uint8_t *            getBufStart() { return buf_start; }
     inline uint8_t              getAddress(){ return address; };
     inline volatile HCTD**      getTDList() { return td_list; };
     inline volatile HCED *      getHCED() { return hced; };
     inline ENDPOINT_DIRECTION   getDir() { return dir; }
     inline volatile HCTD *      getProcessedTD() { return td_current; };
+#ifdef USBHOST_OTHER
     inline volatile HCTD*       getNextTD() { return td_current; };
+#endif
+    inline uint8_t              getNbTD() { return nb_td; };
+    // maximum number of TDs of a transfer
+    inline uint8_t              getMaxTDs() { return nb_td - 1; };
     inline bool                 isSetup() { return setup; }
     inline USBEndpoint *        nextEndpoint() { return (USBEndpoint*)nextEp; };
     inline uint8_t              getIntfNb() { return intf_nb; };
 
     USBDeviceConnected * dev;
 
-    Queue<uint8_t, 1> ep_queue;
-
 private:
     ENDPOINT_TYPE type;
     volatile USB_TYPE state;
@@ -164,6 +240,9 @@ private:
 	uint32_t ep_number;
 	uint32_t speed;
     uint8_t device_address;
+
+    // submit td_current on the host channel owned by this endpoint
+    void startTransfer();
 #endif
     bool setup;
 
@@ -171,18 +250,39 @@ private:
 
     int transfer_len;
     int transferred;
+    // USBHost::getFrameNumber() when the last transfer has been completed
+    uint32_t completion_frame;
     uint8_t * buf_start;
 
+#if USBHOST_STATS
+    // us_ticker_read() when the last TD has been queued and completed
+    uint32_t submit_time;
+    uint32_t completion_time;
+    USBEndpointStats stats;
+#endif
+
     Callback<void()> rx;
 
+    // thread blocked in waitTransfer, NULL if the transfer is not waited for
+    volatile osThreadId waiter;
+
     USBEndpoint* nextEp;
 
     // USBEndpoint descriptor
     volatile HCED * hced;
 
-    volatile HCTD * td_list[2];
+    volatile HCTD * td_list[USB_BULK_TDS];
+    uint8_t nb_td;
+    // first TD of the transfer (the dummy tail TD when no transfer is queued)
     volatile HCTD * td_current;
+#ifdef USBHOST_OTHER
     volatile HCTD * td_next;
+#else
+    // td_list index of td_current, TDs of the queued transfer and its last TD
+    uint8_t td_head;
+    uint8_t td_queued;
+    volatile HCTD * td_last;
+#endif
 
     uint8_t intf_nb;
 
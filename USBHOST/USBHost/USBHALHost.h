@@ -21,18 +21,86 @@
 #include "USBHostConf.h"
 
 class USBHostHub;
+class USBHost;
 
 /**
 * USBHALHost class
 */
 class USBHALHost {
+public:
+    /**
+    * Get the index of the host controller driven by this instance
+    *
+    * @returns index of the host controller
+    */
+    inline uint8_t getController() {
+        return controller;
+    };
+
+    /**
+    * Called by the controller driver when a device has been connected (ISR context).
+    * USBHost is the only class derived from USBHALHost: the event is forwarded to
+    * USBHost::deviceConnected with a direct call, see USBHost.h
+    *
+    * @param hub hub number of the device
+    * @param port port number of the device
+    * @param lowSpeed 1 if low speed, 0 otherwise
+    * @param hub_parent reference to the hub where the device is connected (NULL if the hub parent is the root hub)
+    */
+    inline void deviceConnected(int hub, int port, bool lowSpeed, USBHostHub * hub_parent = NULL);
+
+    /**
+    * Called by the controller driver when a device has been disconnected (ISR context),
+    * forwarded to USBHost::deviceDisconnected
+    *
+    * @param hub hub number of the device
+    * @param port port number of the device
+    * @param hub_parent reference to the hub where the device is connected (NULL if the hub parent is the root hub)
+    * @param addr list of the TDs which have been completed to dequeue freed TDs
+    */
+    inline void deviceDisconnected(int hub, int port, USBHostHub * hub_parent, volatile uint32_t addr);
+
+    /**
+    * Called by the controller driver when a transfer has been completed (ISR context),
+    * forwarded to USBHost::transferCompleted
+    *
+    * @param addr list of the TDs which have been completed
+    */
+    inline void transferCompleted(volatile uint32_t addr);
+
+    /**
+    * Called by the controller driver at each start of frame when the frame
+    * interrupt is enabled (ISR context), forwarded to USBHost::frameStarted
+    */
+    inline void frameStarted();
+
+#if USBHOST_SUSPEND
+    /**
+    * Called by the controller driver when the resume of the root port has ended (ISR context),
+    * forwarded to USBHost::deviceResumed
+    *
+    * @param hub hub number of the device
+    * @param port port number of the device
+    * @param hub_parent reference to the hub where the device is connected (NULL if the hub parent is the root hub)
+    */
+    inline void deviceResumed(int hub, int port, USBHostHub * hub_parent);
+
+    /**
+    * Called by the controller driver when a resume has been detected while the controller
+    * is suspended (ISR context), forwarded to USBHost::resumeDetected
+    */
+    inline void resumeDetected();
+#endif
+
 protected:
 
     /**
     * Constructor
     * init variables and memory where will be stored HCCA, ED and TD
+    *
+    * @param controller index of the host controller driven by this instance (0 to USBHOST_CONTROLLER_NUM - 1)
     */
-    USBHALHost();
+    USBHALHost(uint8_t controller = 0);
 
     /**
     * Initialize host controller. Enable USB interrupts. This part is not in the constructor because,
@@ -88,6 +156,14 @@ protected:
     */
     void enableList(ENDPOINT_TYPE type);
 
+    /**
+    * Notify the controller that TDs have been appended to the list of the specified
+    * endpoint type. The list is not stopped, it is enabled if it was not yet
+    *
+    * @param type list of ENDPOINT_TYPE type which has been filled
+    */
+    void fillList(ENDPOINT_TYPE type);
+
     /**
     * Disable List for the specified endpoint type
     *
@@ -96,31 +172,47 @@ protected:
     bool disableList(ENDPOINT_TYPE type);
 
     /**
-    * Virtual method called when a device has been connected
+    * Read the frame number of the controller
     *
-    * @param hub hub number of the device
-    * @param port port number of the device
-    * @param lowSpeed 1 if low speed, 0 otherwise
-    * @param hub_parent reference to the hub where the device is connected (NULL if the hub parent is the root hub)
+    * @returns current frame number, it wraps at FRAME_NUMBER_MASK
     */
-    virtual void deviceConnected(int hub, int port, bool lowSpeed, USBHostHub * hub_parent = NULL) = 0;
+    uint32_t frameNumber();
 
     /**
-    * Virtual method called when a device has been disconnected
+    * Enable or disable the start of frame interrupt
     *
-    * @param hub hub number of the device
-    * @param port port number of the device
-    * @param hub_parent reference to the hub where the device is connected (NULL if the hub parent is the root hub)
-    * @param addr list of the TDs which have been completed to dequeue freed TDs
+    * @param enable true to call frameStarted at each frame
     */
-    virtual void deviceDisconnected(int hub, int port, USBHostHub * hub_parent, volatile uint32_t addr) = 0;
+    void enableFrameInterrupt(bool enable);
 
+#if USBHOST_SUSPEND
     /**
-    * Virtual method called when a transfer has been completed
+    * Suspend the root port (selective suspend of the device connected to the root hub)
     *
-    * @param addr list of the TDs which have been completed
+    * @returns false if the controller cannot suspend its port
+    */
+    bool suspendRootPort();
+
+    /**
+    * Resume the root port, deviceResumed is called at the end of the resume signaling
+    *
+    * @returns false if the controller cannot resume its port
+    */
+    bool resumeRootPort();
+
+    /**
+    * Put the controller in the suspend state: no more frames, a remote
+    * wakeup of the root port is reported with resumeDetected
+    *
+    * @returns false if the controller cannot be suspended
+    */
+    bool suspendController();
+
+    /**
+    * Put the suspended controller back in the operational state (blocking)
     */
-    virtual void transferCompleted(volatile uint32_t addr) = 0;
+    void resumeController();
+#endif
 
     /**
     * Find a memory section for a new ED
@@ -151,7 +243,11 @@ protected:
     void freeTD(volatile uint8_t * td);
 
 private:
+#if (USBHOST_CONTROLLER_NUM > 1)
+    static void _usbisr(uint32_t controller);
+#else
     static void _usbisr(void);
+#endif
     void UsbIrqhandler();
 
     void memInit();
@@ -160,13 +256,18 @@ private:
     uint8_t volatile  * usb_edBuf;      //4 bytes aligned
     uint8_t volatile  * usb_tdBuf;      //4 bytes aligned
 
-    static USBHALHost * instHost;
+    uint8_t controller;
+    static USBHALHost * instHost[USBHOST_CONTROLLER_NUM];
 
     bool volatile  edBufAlloc[MAX_ENDPOINT];
     bool volatile tdBufAlloc[MAX_TD];
 #ifdef USBHOST_OTHER
     int control_disable;
 #endif
+#if defined(TARGET_RZ_A1H) || defined(TARGET_VK_RZ_A1H)
+    // the OHCI wrapper has no start of frame interrupt
+    Ticker frame_ticker;
+#endif
 
 };
 
@@ -17,7 +17,7 @@
 #if defined(TARGET_LPC1768) || defined(TARGET_LPC2460)
 
 #include "mbed.h"
-#include "USBHALHost.h"
+#include "USBHost.h"
 #include "dbg.h"
 
 // bits of the USB/OTG clock control register
@@ -43,10 +43,11 @@
 
 static volatile uint8_t usb_buf[TOTAL_SIZE] __attribute((section("AHBSRAM1"),aligned(256)));  //256 bytes aligned!
 
-USBHALHost * USBHALHost::instHost;
+USBHALHost * USBHALHost::instHost[USBHOST_CONTROLLER_NUM];
 
-USBHALHost::USBHALHost() {
-    instHost = this;
+USBHALHost::USBHALHost(uint8_t controller) {
+    this->controller = controller;
+    instHost[controller] = this;
     memInit();
     memset((void*)usb_hcca, 0, HCCA_SIZE);
     for (int i = 0; i < MAX_ENDPOINT; i++) {
@@ -60,9 +61,11 @@ USBHALHost::USBHALHost() {
 void USBHALHost::init() {
     NVIC_DisableIRQ(USB_IRQn);
 
-    //Cut power
-    LPC_SC->PCONP &= ~(1UL<<31);
-    wait_ms(100);
+    // Cut power, at a cold start the block is not powered yet
+    if (LPC_SC->PCONP & (1UL<<31)) {
+        LPC_SC->PCONP &= ~(1UL<<31);
+        Thread::wait(100);
+    }
 
     // turn on power for USB
     LPC_SC->PCONP       |= (1UL<<31);
@@ -95,8 +98,8 @@ void USBHALHost::init() {
     LPC_USB->HcControlHeadED = 0; // Initialize Control list head to Zero
     LPC_USB->HcBulkHeadED    = 0; // Initialize Bulk list head to Zero
 
-    // Wait 100 ms before apply reset
-    wait_ms(100);
+    // Wait 100 ms before apply reset, the other threads (BLE) run meanwhile
+    Thread::wait(100);
 
     // software reset
     LPC_USB->HcCommandStatus = OR_CMD_STATUS_HCR;
@@ -127,7 +130,7 @@ void USBHALHost::init() {
     // Check for any connected devices
     if (LPC_USB->HcRhPortStatus1 & OR_RH_PORT_CCS) {
         //Device connected
-        wait_ms(150);
+        Thread::wait(150);
         USB_DBG("Device connected (%08x)\n\r", LPC_USB->HcRhPortStatus1);
         deviceConnected(0, 1, LPC_USB->HcRhPortStatus1 & OR_RH_PORT_LSDA);
     }
@@ -178,6 +181,33 @@ void USBHALHost::enableList(ENDPOINT_TYPE type) {
 }
 
 
+void USBHALHost::fillList(ENDPOINT_TYPE type) {
+    switch(type) {
+        case CONTROL_ENDPOINT:
+            if (!(LPC_USB->HcControl & OR_CONTROL_CLE)) {
+                enableList(type);
+                return;
+            }
+            LPC_USB->HcCommandStatus = OR_CMD_STATUS_CLF;
+            break;
+        case BULK_ENDPOINT:
+            if (!(LPC_USB->HcControl & OR_CONTROL_BLE)) {
+                enableList(type);
+                return;
+            }
+            LPC_USB->HcCommandStatus = OR_CMD_STATUS_BLF;
+            break;
+        case INTERRUPT_ENDPOINT:
+            if (!(LPC_USB->HcControl & OR_CONTROL_PLE)) {
+                enableList(type);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
 bool USBHALHost::disableList(ENDPOINT_TYPE type) {
     switch(type) {
         case CONTROL_ENDPOINT:
@@ -258,10 +288,53 @@ void USBHALHost::resetRootHub() {
     LPC_USB->HcRhPortStatus1 = OR_RH_PORT_PRSC;
 }
 
+uint32_t USBHALHost::frameNumber() {
+    return LPC_USB->HcFmNumber & FRAME_NUMBER_MASK;
+}
+
+void USBHALHost::enableFrameInterrupt(bool enable) {
+    if (enable) {
+        LPC_USB->HcInterruptStatus = OR_INTR_STATUS_SF;
+        LPC_USB->HcInterruptEnable = OR_INTR_ENABLE_SF;
+    } else {
+        LPC_USB->HcInterruptDisable = OR_INTR_ENABLE_SF;
+    }
+}
+
+#if USBHOST_SUSPEND
+bool USBHALHost::suspendRootPort() {
+    LPC_USB->HcRhPortStatus1 = OR_RH_PORT_PSS;
+    return true;
+}
+
+bool USBHALHost::resumeRootPort() {
+    // the controller drives the resume signaling for 20 ms, then sets PSSC
+    LPC_USB->HcRhPortStatus1 = OR_RH_PORT_POCI;
+    return true;
+}
+
+bool USBHALHost::suspendController() {
+    // a remote wakeup of the root port is reported with the resume detected interrupt
+    LPC_USB->HcInterruptStatus = OR_INTR_STATUS_RD;
+    LPC_USB->HcInterruptEnable = OR_INTR_ENABLE_RD;
+    LPC_USB->HcControl = (LPC_USB->HcControl & ~OR_CONTROL_HCFS) | OR_CONTROL_HC_SUSP | OR_CONTROL_RWE;
+    return true;
+}
+
+void USBHALHost::resumeController() {
+    LPC_USB->HcInterruptDisable = OR_INTR_ENABLE_RD;
+    // 20 ms of resume signaling before going back to the operational state
+    LPC_USB->HcControl = (LPC_USB->HcControl & ~(OR_CONTROL_HCFS | OR_CONTROL_RWE)) | OR_CONTROL_HC_RES;
+    Thread::wait(20);
+    LPC_USB->HcControl = (LPC_USB->HcControl & ~OR_CONTROL_HCFS) | OR_CONTROL_HC_OPER;
+}
+#endif
+
 
 void USBHALHost::_usbisr(void) {
-    if (instHost) {
-        instHost->UsbIrqhandler();
+    USB_TRACE_SCOPE("usb_isr");
+    if (instHost[0]) {
+        instHost[0]->UsbIrqhandler();
     }
 }
 
@@ -312,6 +385,13 @@ void USBHALHost::UsbIrqhandler() {
             if (LPC_USB->HcRhPortStatus1 & OR_RH_PORT_PRSC) {
                 LPC_USB->HcRhPortStatus1 = OR_RH_PORT_PRSC;
             }
+#if USBHOST_SUSPEND
+            // end of the resume of the root port
+            if (LPC_USB->HcRhPortStatus1 & OR_RH_PORT_PSSC) {
+                LPC_USB->HcRhPortStatus1 = OR_RH_PORT_PSSC;
+                deviceResumed(0, 1, NULL);
+            }
+#endif
             LPC_USB->HcInterruptStatus = OR_INTR_STATUS_RHSC;
         }
 
@@ -320,6 +400,21 @@ void USBHALHost::UsbIrqhandler() {
             transferCompleted(usb_hcca->DoneHead & 0xFFFFFFFE);
             LPC_USB->HcInterruptStatus = OR_INTR_STATUS_WDH;
         }
+
+        // Start of frame interrupt
+        if (int_status & OR_INTR_STATUS_SF) {
+            LPC_USB->HcInterruptStatus = OR_INTR_STATUS_SF;
+            frameStarted();
+        }
+
+#if USBHOST_SUSPEND
+        // Resume detected while the controller is suspended
+        if (int_status & OR_INTR_STATUS_RD) {
+            LPC_USB->HcInterruptDisable = OR_INTR_ENABLE_RD;
+            LPC_USB->HcInterruptStatus = OR_INTR_STATUS_RD;
+            resumeDetected();
+        }
+#endif
     }
 }
 #endif
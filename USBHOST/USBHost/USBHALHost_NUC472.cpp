@@ -17,7 +17,7 @@
 #if defined(TARGET_NUC472)
 
 #include "mbed.h"
-#include "USBHALHost.h"
+#include "USBHost.h"
 #include "dbg.h"
 #include "pinmap.h"
 
@@ -29,11 +29,12 @@
 
 static volatile MBED_ALIGN(256) uint8_t usb_buf[TOTAL_SIZE];  // 256 bytes aligned!
 
-USBHALHost * USBHALHost::instHost;
+USBHALHost * USBHALHost::instHost[USBHOST_CONTROLLER_NUM];
 
-USBHALHost::USBHALHost()
+USBHALHost::USBHALHost(uint8_t controller)
 {
-    instHost = this;
+    this->controller = controller;
+    instHost[controller] = this;
     memInit();
     memset((void*)usb_hcca, 0, HCCA_SIZE);
     for (int i = 0; i < MAX_ENDPOINT; i++) {
@@ -106,8 +107,8 @@ void USBHALHost::init()
 
     // Put HC in reset state
     USBH->HcControl = (USBH->HcControl & ~OR_CONTROL_HCFS) | OR_CONTROL_HC_RSET;
-    // HCD must wait 10ms for HC reset complete
-    wait_ms(100);
+    // HCD must wait 10ms for HC reset complete, the other threads (BLE) run meanwhile
+    Thread::wait(100);
     
     USBH->HcControlHeadED = 0;                      // Initialize Control ED list head to 0
     USBH->HcBulkHeadED = 0;                         // Initialize Bulk ED list head to 0
@@ -126,7 +127,7 @@ void USBHALHost::init()
     // Issue SetGlobalPower command
     USBH->HcRhStatus = USBH_HcRhStatus_LPSC_Msk;
     // Power On To Power Good Time, in 2 ms units
-    wait_ms(((USBH->HcRhDescriptorA & USBH_HcRhDescriptorA_POTPGT_Msk) >> USBH_HcRhDescriptorA_POTPGT_Pos) * 2);
+    Thread::wait(((USBH->HcRhDescriptorA & USBH_HcRhDescriptorA_POTPGT_Msk) >> USBH_HcRhDescriptorA_POTPGT_Pos) * 2);
     
     // Clear Interrrupt Status
     USBH->HcInterruptStatus |= USBH->HcInterruptStatus;
@@ -149,7 +150,7 @@ void USBHALHost::init()
     // Check for any connected devices
     if (USBH->HcRhPortStatus[0] & OR_RH_PORT_CCS) {
         // Device connected
-        wait_ms(150);
+        Thread::wait(150);
         deviceConnected(0, 1, USBH->HcRhPortStatus[0] & OR_RH_PORT_LSDA);
     }
 }
@@ -209,6 +210,34 @@ void USBHALHost::enableList(ENDPOINT_TYPE type)
 }
 
 
+void USBHALHost::fillList(ENDPOINT_TYPE type)
+{
+    switch(type) {
+        case CONTROL_ENDPOINT:
+            if (!(USBH->HcControl & OR_CONTROL_CLE)) {
+                enableList(type);
+                return;
+            }
+            USBH->HcCommandStatus = OR_CMD_STATUS_CLF;
+            break;
+        case BULK_ENDPOINT:
+            if (!(USBH->HcControl & OR_CONTROL_BLE)) {
+                enableList(type);
+                return;
+            }
+            USBH->HcCommandStatus = OR_CMD_STATUS_BLF;
+            break;
+        case INTERRUPT_ENDPOINT:
+            if (!(USBH->HcControl & OR_CONTROL_PLE)) {
+                enableList(type);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
 bool USBHALHost::disableList(ENDPOINT_TYPE type)
 {
     switch(type) {
@@ -294,11 +323,60 @@ void USBHALHost::resetRootHub()
     USBH->HcRhPortStatus[0] = OR_RH_PORT_PRSC;
 }
 
+uint32_t USBHALHost::frameNumber()
+{
+    return USBH->HcFmNumber & FRAME_NUMBER_MASK;
+}
+
+void USBHALHost::enableFrameInterrupt(bool enable)
+{
+    if (enable) {
+        USBH->HcInterruptStatus = OR_INTR_STATUS_SF;
+        USBH->HcInterruptEnable = OR_INTR_ENABLE_SF;
+    } else {
+        USBH->HcInterruptDisable = OR_INTR_ENABLE_SF;
+    }
+}
+
+#if USBHOST_SUSPEND
+bool USBHALHost::suspendRootPort()
+{
+    USBH->HcRhPortStatus[0] = OR_RH_PORT_PSS;
+    return true;
+}
+
+bool USBHALHost::resumeRootPort()
+{
+    // the controller drives the resume signaling for 20 ms, then sets PSSC
+    USBH->HcRhPortStatus[0] = OR_RH_PORT_POCI;
+    return true;
+}
+
+bool USBHALHost::suspendController()
+{
+    // a remote wakeup of the root port is reported with the resume detected interrupt
+    USBH->HcInterruptStatus = OR_INTR_STATUS_RD;
+    USBH->HcInterruptEnable = OR_INTR_ENABLE_RD;
+    USBH->HcControl = (USBH->HcControl & ~OR_CONTROL_HCFS) | OR_CONTROL_HC_SUSP | OR_CONTROL_RWE;
+    return true;
+}
+
+void USBHALHost::resumeController()
+{
+    USBH->HcInterruptDisable = OR_INTR_ENABLE_RD;
+    // 20 ms of resume signaling before going back to the operational state
+    USBH->HcControl = (USBH->HcControl & ~(OR_CONTROL_HCFS | OR_CONTROL_RWE)) | OR_CONTROL_HC_RES;
+    Thread::wait(20);
+    USBH->HcControl = (USBH->HcControl & ~OR_CONTROL_HCFS) | OR_CONTROL_HC_OPER;
+}
+#endif
+
 
 void USBHALHost::_usbisr(void)
 {
-    if (instHost) {
-        instHost->UsbIrqhandler();
+    USB_TRACE_SCOPE("usb_isr");
+    if (instHost[0]) {
+        instHost[0]->UsbIrqhandler();
     }
 }
 
@@ -352,6 +430,13 @@ void USBHALHost::UsbIrqhandler()
         if (ints_port1 & OR_RH_PORT_PESC) {
             USBH->HcRhPortStatus[0] = OR_RH_PORT_PESC;
         }
+#if USBHOST_SUSPEND
+        // Port1: end of the resume
+        if (ints_port1 & OR_RH_PORT_PSSC) {
+            USBH->HcRhPortStatus[0] = OR_RH_PORT_PSSC;
+            deviceResumed(0, 1, NULL);
+        }
+#endif
         
         USBH->HcInterruptStatus = OR_INTR_STATUS_RHSC;
     }
@@ -361,5 +446,20 @@ void USBHALHost::UsbIrqhandler()
         transferCompleted(usb_hcca->DoneHead & 0xFFFFFFFE);
         USBH->HcInterruptStatus = OR_INTR_STATUS_WDH;
     }
+
+    // Start of frame interrupt (the status bit is set at each frame, even when not enabled)
+    if ((ints & OR_INTR_STATUS_SF) && (USBH->HcInterruptEnable & OR_INTR_ENABLE_SF)) {
+        USBH->HcInterruptStatus = OR_INTR_STATUS_SF;
+        frameStarted();
+    }
+
+#if USBHOST_SUSPEND
+    // Resume detected while the controller is suspended
+    if ((ints & OR_INTR_STATUS_RD) && (USBH->HcInterruptEnable & OR_INTR_ENABLE_RD)) {
+        USBH->HcInterruptDisable = OR_INTR_ENABLE_RD;
+        USBH->HcInterruptStatus = OR_INTR_STATUS_RD;
+        resumeDetected();
+    }
+#endif
 }
 #endif
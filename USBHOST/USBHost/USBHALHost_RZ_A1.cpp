@@ -17,7 +17,7 @@
 #if defined(TARGET_RZ_A1H) || defined(TARGET_VK_RZ_A1H)
 
 #include "mbed.h"
-#include "USBHALHost.h"
+#include "USBHost.h"
 #include "dbg.h"
 
 #include "ohci_wrapp_RZ_A1.h"
@@ -30,12 +30,33 @@
 #define TOTAL_SIZE (HCCA_SIZE + (MAX_ENDPOINT*ED_SIZE) + (MAX_TD*TD_SIZE))
 #define ALIGNE_MSK (0x0000000F)
 
-static volatile uint8_t usb_buf[TOTAL_SIZE + ALIGNE_MSK];  //16 bytes aligned!
+static volatile uint8_t usb_buf[USBHOST_CONTROLLER_NUM][TOTAL_SIZE + ALIGNE_MSK];  //16 bytes aligned!
 
-USBHALHost * USBHALHost::instHost;
+// one OHCI wrapper per controller: USB0, USB1
+typedef struct {
+    void     (*init)(usbisr_fnc_t *p_usbisr_fnc);
+    uint32_t (*reg_r)(uint32_t reg_ofs);
+    void     (*reg_w)(uint32_t reg_ofs, uint32_t set_data);
+} ohciwrapp_func_t;
 
-USBHALHost::USBHALHost() {
-    instHost = this;
+static const ohciwrapp_func_t ohciwrapp_func[OHCIWRAPP_CH_NUM] = {
+    {ohciwrapp0_init, ohciwrapp0_reg_r, ohciwrapp0_reg_w},
+    {ohciwrapp1_init, ohciwrapp1_reg_r, ohciwrapp1_reg_w}
+};
+
+static inline uint32_t ohciwrapp_reg_r(uint8_t ch, uint32_t reg_ofs) {
+    return ohciwrapp_func[ch].reg_r(reg_ofs);
+}
+
+static inline void ohciwrapp_reg_w(uint8_t ch, uint32_t reg_ofs, uint32_t set_data) {
+    ohciwrapp_func[ch].reg_w(reg_ofs, set_data);
+}
+
+USBHALHost * USBHALHost::instHost[USBHOST_CONTROLLER_NUM];
+
+USBHALHost::USBHALHost(uint8_t controller) {
+    this->controller = controller;
+    instHost[controller] = this;
     memInit();
     memset((void*)usb_hcca, 0, HCCA_SIZE);
     for (int i = 0; i < MAX_ENDPOINT; i++) {
@@ -47,53 +68,53 @@ USBHALHost::USBHALHost() {
 }
 
 void USBHALHost::init() {
-    ohciwrapp_init(&_usbisr);
+    ohciwrapp_func[controller].init(&_usbisr);
 
-    ohciwrapp_reg_w(OHCI_REG_CONTROL, 1);       // HARDWARE RESET
-    ohciwrapp_reg_w(OHCI_REG_CONTROLHEADED, 0); // Initialize Control list head to Zero
-    ohciwrapp_reg_w(OHCI_REG_BULKHEADED, 0);    // Initialize Bulk list head to Zero
+    ohciwrapp_reg_w(controller, OHCI_REG_CONTROL, 1);       // HARDWARE RESET
+    ohciwrapp_reg_w(controller, OHCI_REG_CONTROLHEADED, 0); // Initialize Control list head to Zero
+    ohciwrapp_reg_w(controller, OHCI_REG_BULKHEADED, 0);    // Initialize Bulk list head to Zero
 
-    // Wait 100 ms before apply reset
-    wait_ms(100);
+    // Wait 100 ms before apply reset, the other threads (BLE) run meanwhile
+    Thread::wait(100);
 
     // software reset
-    ohciwrapp_reg_w(OHCI_REG_COMMANDSTATUS, OR_CMD_STATUS_HCR);
+    ohciwrapp_reg_w(controller, OHCI_REG_COMMANDSTATUS, OR_CMD_STATUS_HCR);
 
     // Write Fm Interval and Largest Data Packet Counter
-    ohciwrapp_reg_w(OHCI_REG_FMINTERVAL, DEFAULT_FMINTERVAL);
-    ohciwrapp_reg_w(OHCI_REG_PERIODICSTART,  FI * 90 / 100);
+    ohciwrapp_reg_w(controller, OHCI_REG_FMINTERVAL, DEFAULT_FMINTERVAL);
+    ohciwrapp_reg_w(controller, OHCI_REG_PERIODICSTART,  FI * 90 / 100);
 
     // Put HC in operational state
-    ohciwrapp_reg_w(OHCI_REG_CONTROL, (ohciwrapp_reg_r(OHCI_REG_CONTROL) & (~OR_CONTROL_HCFS)) | OR_CONTROL_HC_OPER);
+    ohciwrapp_reg_w(controller, OHCI_REG_CONTROL, (ohciwrapp_reg_r(controller, OHCI_REG_CONTROL) & (~OR_CONTROL_HCFS)) | OR_CONTROL_HC_OPER);
     // Set Global Power
-    ohciwrapp_reg_w(OHCI_REG_RHSTATUS, OR_RH_STATUS_LPSC);
+    ohciwrapp_reg_w(controller, OHCI_REG_RHSTATUS, OR_RH_STATUS_LPSC);
 
-    ohciwrapp_reg_w(OHCI_REG_HCCA, (uint32_t)(usb_hcca));
+    ohciwrapp_reg_w(controller, OHCI_REG_HCCA, (uint32_t)(usb_hcca));
 
     // Clear Interrrupt Status
-    ohciwrapp_reg_w(OHCI_REG_INTERRUPTSTATUS, ohciwrapp_reg_r(OHCI_REG_INTERRUPTSTATUS));
+    ohciwrapp_reg_w(controller, OHCI_REG_INTERRUPTSTATUS, ohciwrapp_reg_r(controller, OHCI_REG_INTERRUPTSTATUS));
 
-    ohciwrapp_reg_w(OHCI_REG_INTERRUPTENABLE, OR_INTR_ENABLE_MIE | OR_INTR_ENABLE_WDH | OR_INTR_ENABLE_RHSC);
+    ohciwrapp_reg_w(controller, OHCI_REG_INTERRUPTENABLE, OR_INTR_ENABLE_MIE | OR_INTR_ENABLE_WDH | OR_INTR_ENABLE_RHSC);
 
     // Enable the USB Interrupt
-    ohciwrapp_reg_w(OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_CSC);
-    ohciwrapp_reg_w(OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_PRSC);
+    ohciwrapp_reg_w(controller, OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_CSC);
+    ohciwrapp_reg_w(controller, OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_PRSC);
 
     // Check for any connected devices
-    if (ohciwrapp_reg_r(OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_CCS) {
+    if (ohciwrapp_reg_r(controller, OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_CCS) {
         //Device connected
-        wait_ms(150);
-        USB_DBG("Device connected (%08x)\n\r", ohciwrapp_reg_r(OHCI_REG_RHPORTSTATUS1));
-        deviceConnected(0, 1, ohciwrapp_reg_r(OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_LSDA);
+        Thread::wait(150);
+        USB_DBG("Device connected (%08x)\n\r", ohciwrapp_reg_r(controller, OHCI_REG_RHPORTSTATUS1));
+        deviceConnected(0, 1, ohciwrapp_reg_r(controller, OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_LSDA);
     }
 }
 
 uint32_t USBHALHost::controlHeadED() {
-    return ohciwrapp_reg_r(OHCI_REG_CONTROLHEADED);
+    return ohciwrapp_reg_r(controller, OHCI_REG_CONTROLHEADED);
 }
 
 uint32_t USBHALHost::bulkHeadED() {
-    return ohciwrapp_reg_r(OHCI_REG_BULKHEADED);
+    return ohciwrapp_reg_r(controller, OHCI_REG_BULKHEADED);
 }
 
 uint32_t USBHALHost::interruptHeadED() {
@@ -101,12 +122,12 @@ uint32_t USBHALHost::interruptHeadED() {
 }
 
 void USBHALHost::updateBulkHeadED(uint32_t addr) {
-    ohciwrapp_reg_w(OHCI_REG_BULKHEADED, addr);
+    ohciwrapp_reg_w(controller, OHCI_REG_BULKHEADED, addr);
 }
 
 
 void USBHALHost::updateControlHeadED(uint32_t addr) {
-    ohciwrapp_reg_w(OHCI_REG_CONTROLHEADED, addr);
+    ohciwrapp_reg_w(controller, OHCI_REG_CONTROLHEADED, addr);
 }
 
 void USBHALHost::updateInterruptHeadED(uint32_t addr) {
@@ -119,20 +140,49 @@ void USBHALHost::enableList(ENDPOINT_TYPE type) {
 
     switch(type) {
         case CONTROL_ENDPOINT:
-            ohciwrapp_reg_w(OHCI_REG_COMMANDSTATUS, OR_CMD_STATUS_CLF);
-            wk_data = (ohciwrapp_reg_r(OHCI_REG_CONTROL) | OR_CONTROL_CLE);
-            ohciwrapp_reg_w(OHCI_REG_CONTROL, wk_data);
+            ohciwrapp_reg_w(controller, OHCI_REG_COMMANDSTATUS, OR_CMD_STATUS_CLF);
+            wk_data = (ohciwrapp_reg_r(controller, OHCI_REG_CONTROL) | OR_CONTROL_CLE);
+            ohciwrapp_reg_w(controller, OHCI_REG_CONTROL, wk_data);
             break;
         case ISOCHRONOUS_ENDPOINT:
             break;
         case BULK_ENDPOINT:
-            ohciwrapp_reg_w(OHCI_REG_COMMANDSTATUS, OR_CMD_STATUS_BLF);
-            wk_data = (ohciwrapp_reg_r(OHCI_REG_CONTROL) | OR_CONTROL_BLE);
-            ohciwrapp_reg_w(OHCI_REG_CONTROL, wk_data);
+            ohciwrapp_reg_w(controller, OHCI_REG_COMMANDSTATUS, OR_CMD_STATUS_BLF);
+            wk_data = (ohciwrapp_reg_r(controller, OHCI_REG_CONTROL) | OR_CONTROL_BLE);
+            ohciwrapp_reg_w(controller, OHCI_REG_CONTROL, wk_data);
+            break;
+        case INTERRUPT_ENDPOINT:
+            wk_data = (ohciwrapp_reg_r(controller, OHCI_REG_CONTROL) | OR_CONTROL_PLE);
+            ohciwrapp_reg_w(controller, OHCI_REG_CONTROL, wk_data);
+            break;
+    }
+}
+
+
+void USBHALHost::fillList(ENDPOINT_TYPE type) {
+    uint32_t wk_data = ohciwrapp_reg_r(controller, OHCI_REG_CONTROL);
+
+    switch(type) {
+        case CONTROL_ENDPOINT:
+            if (!(wk_data & OR_CONTROL_CLE)) {
+                enableList(type);
+                return;
+            }
+            ohciwrapp_reg_w(controller, OHCI_REG_COMMANDSTATUS, OR_CMD_STATUS_CLF);
+            break;
+        case BULK_ENDPOINT:
+            if (!(wk_data & OR_CONTROL_BLE)) {
+                enableList(type);
+                return;
+            }
+            ohciwrapp_reg_w(controller, OHCI_REG_COMMANDSTATUS, OR_CMD_STATUS_BLF);
             break;
         case INTERRUPT_ENDPOINT:
-            wk_data = (ohciwrapp_reg_r(OHCI_REG_CONTROL) | OR_CONTROL_PLE);
-            ohciwrapp_reg_w(OHCI_REG_CONTROL, wk_data);
+            if (!(wk_data & OR_CONTROL_PLE)) {
+                enableList(type);
+            }
+            break;
+        default:
             break;
     }
 }
@@ -143,28 +193,28 @@ bool USBHALHost::disableList(ENDPOINT_TYPE type) {
 
     switch(type) {
         case CONTROL_ENDPOINT:
-            wk_data = ohciwrapp_reg_r(OHCI_REG_CONTROL);
+            wk_data = ohciwrapp_reg_r(controller, OHCI_REG_CONTROL);
             if(wk_data & OR_CONTROL_CLE) {
                 wk_data &= ~OR_CONTROL_CLE;
-                ohciwrapp_reg_w(OHCI_REG_CONTROL, wk_data);
+                ohciwrapp_reg_w(controller, OHCI_REG_CONTROL, wk_data);
                 return true;
             }
             return false;
         case ISOCHRONOUS_ENDPOINT:
             return false;
         case BULK_ENDPOINT:
-            wk_data = ohciwrapp_reg_r(OHCI_REG_CONTROL);
+            wk_data = ohciwrapp_reg_r(controller, OHCI_REG_CONTROL);
             if(wk_data & OR_CONTROL_BLE) {
                 wk_data &= ~OR_CONTROL_BLE;
-                ohciwrapp_reg_w(OHCI_REG_CONTROL, wk_data);
+                ohciwrapp_reg_w(controller, OHCI_REG_CONTROL, wk_data);
                 return true;
             }
             return false;
         case INTERRUPT_ENDPOINT:
-            wk_data = ohciwrapp_reg_r(OHCI_REG_CONTROL);
+            wk_data = ohciwrapp_reg_r(controller, OHCI_REG_CONTROL);
             if(wk_data & OR_CONTROL_PLE) {
                 wk_data &= ~OR_CONTROL_PLE;
-                ohciwrapp_reg_w(OHCI_REG_CONTROL, wk_data);
+                ohciwrapp_reg_w(controller, OHCI_REG_CONTROL, wk_data);
                 return true;
             }
             return false;
@@ -174,7 +224,7 @@ bool USBHALHost::disableList(ENDPOINT_TYPE type) {
 
 
 void USBHALHost::memInit() {
-    volatile uint8_t *p_wk_buf = (uint8_t *)(((uint32_t)usb_buf + ALIGNE_MSK) & ~ALIGNE_MSK);
+    volatile uint8_t *p_wk_buf = (uint8_t *)(((uint32_t)usb_buf[controller] + ALIGNE_MSK) & ~ALIGNE_MSK);
 
     usb_hcca = (volatile HCCA *)p_wk_buf;
     usb_edBuf = (volatile uint8_t *)(p_wk_buf + HCCA_SIZE);
@@ -220,42 +270,78 @@ void USBHALHost::freeTD(volatile uint8_t * td) {
 
 void USBHALHost::resetRootHub() {
     // Initiate port reset
-    ohciwrapp_reg_w(OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_PRS);
+    ohciwrapp_reg_w(controller, OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_PRS);
 
-    while (ohciwrapp_reg_r(OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_PRS);
+    while (ohciwrapp_reg_r(controller, OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_PRS);
 
     // ...and clear port reset signal
-    ohciwrapp_reg_w(OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_PRSC);
+    ohciwrapp_reg_w(controller, OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_PRSC);
+}
+
+
+uint32_t USBHALHost::frameNumber() {
+    // the OHCI wrapper does not count HcFmNumber: read the frame number of the USB module
+    if (controller == 0) {
+        return USB200.FRMNUM & FRAME_NUMBER_MASK;
+    }
+    return USB201.FRMNUM & FRAME_NUMBER_MASK;
+}
+
+void USBHALHost::enableFrameInterrupt(bool enable) {
+    // 1 ms ticker, not synchronized with the start of frames
+    if (enable) {
+        frame_ticker.attach_us(callback(this, &USBHALHost::frameStarted), 1000);
+    } else {
+        frame_ticker.detach();
+    }
+}
+
+#if USBHOST_SUSPEND
+// the OHCI wrapper does not emulate the suspend of the root port and of the controller
+bool USBHALHost::suspendRootPort() {
+    return false;
+}
+
+bool USBHALHost::resumeRootPort() {
+    return false;
 }
 
+bool USBHALHost::suspendController() {
+    return false;
+}
+
+void USBHALHost::resumeController() {
+}
+#endif
 
-void USBHALHost::_usbisr(void) {
-    if (instHost) {
-        instHost->UsbIrqhandler();
+void USBHALHost::_usbisr(uint32_t controller) {
+    USB_TRACE_SCOPE("usb_isr");
+    if ((controller < USBHOST_CONTROLLER_NUM) && (instHost[controller])) {
+        instHost[controller]->UsbIrqhandler();
     }
 }
 
 void USBHALHost::UsbIrqhandler() {
-    uint32_t int_status = ohciwrapp_reg_r(OHCI_REG_INTERRUPTSTATUS) & ohciwrapp_reg_r(OHCI_REG_INTERRUPTENABLE);
+    uint32_t int_status = ohciwrapp_reg_r(controller, OHCI_REG_INTERRUPTSTATUS) & ohciwrapp_reg_r(controller, OHCI_REG_INTERRUPTENABLE);
     uint32_t data;
 
     if (int_status != 0) { //Is there something to actually process?
         // Root hub status change interrupt
         if (int_status & OR_INTR_STATUS_RHSC) {
-            if (ohciwrapp_reg_r(OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_CSC) {
-                if (ohciwrapp_reg_r(OHCI_REG_RHSTATUS) & OR_RH_STATUS_DRWE) {
+            if (ohciwrapp_reg_r(controller, OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_CSC) {
+                if (ohciwrapp_reg_r(controller, OHCI_REG_RHSTATUS) & OR_RH_STATUS_DRWE) {
                     // When DRWE is on, Connect Status Change
                     // means a remote wakeup event.
                 } else {
 
                     //Root device connected
-                    if (ohciwrapp_reg_r(OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_CCS) {
+                    if (ohciwrapp_reg_r(controller, OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_CCS) {
 
                         // wait 150ms to avoid bounce
                         wait_ms(150);
 
                         //Hub 0 (root hub), Port 1 (count starts at 1), Low or High speed
-                        data = ohciwrapp_reg_r(OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_LSDA;
+                        data = ohciwrapp_reg_r(controller, OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_LSDA;
                         deviceConnected(0, 1, data);
                     }
 
@@ -264,18 +350,18 @@ void USBHALHost::UsbIrqhandler() {
                         deviceDisconnected(0, 1, NULL, usb_hcca->DoneHead & 0xFFFFFFFE);
                     }
                 }
-                ohciwrapp_reg_w(OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_CSC);
+                ohciwrapp_reg_w(controller, OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_CSC);
             }
-            if (ohciwrapp_reg_r(OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_PRSC) {
-                ohciwrapp_reg_w(OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_PRSC);
+            if (ohciwrapp_reg_r(controller, OHCI_REG_RHPORTSTATUS1) & OR_RH_PORT_PRSC) {
+                ohciwrapp_reg_w(controller, OHCI_REG_RHPORTSTATUS1, OR_RH_PORT_PRSC);
             }
-            ohciwrapp_reg_w(OHCI_REG_INTERRUPTSTATUS, OR_INTR_STATUS_RHSC);
+            ohciwrapp_reg_w(controller, OHCI_REG_INTERRUPTSTATUS, OR_INTR_STATUS_RHSC);
         }
 
         // Writeback Done Head interrupt
         if (int_status & OR_INTR_STATUS_WDH) {
             transferCompleted(usb_hcca->DoneHead & 0xFFFFFFFE);
-            ohciwrapp_reg_w(OHCI_REG_INTERRUPTSTATUS, OR_INTR_STATUS_WDH);
+            ohciwrapp_reg_w(controller, OHCI_REG_INTERRUPTSTATUS, OR_INTR_STATUS_WDH);
         }
     }
 }
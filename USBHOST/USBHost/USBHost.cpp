@@ -18,14 +18,34 @@
 #include "USBHost.h"
 #include "USBHostHub.h"
 
-USBHost * USBHost::instHost = NULL;
+USBHost * USBHost::instHost[USBHOST_CONTROLLER_NUM];
 
 #define DEVICE_CONNECTED_EVENT      (1 << 0)
 #define DEVICE_DISCONNECTED_EVENT   (1 << 1)
 #define TD_PROCESSED_EVENT          (1 << 2)
+#define FRAME_EVENT                 (1 << 3)
+#define DEVICE_RESUMED_EVENT        (1 << 4)
+#define CONTROLLER_RESUME_EVENT     (1 << 5)
+#define IDLE_CHECK_EVENT            (1 << 6)
 
 #define MAX_TRY_ENUMERATE_HUB       3
 
+// ms, before addressing a device which has been reset by a hub
+#define RESET_RECOVERY_TIME         10
+
+// ms, resume signaling of a port then resume recovery before the device is used again
+#define RESUME_TIME                 20
+#define RESUME_RECOVERY_TIME        10
+
+// us, period of the frame clock update: half the wrap period of the frame number
+#define FRAME_CLOCK_UPDATE          (((FRAME_NUMBER_MASK + 1) / 2) * 1000)
+
+// deviceState flags
+#define DEVICE_STATE_IN_USE         (1 << 0)
+#define DEVICE_STATE_RESET          (1 << 1)
+#define DEVICE_STATE_INITED         (1 << 2)
+#define DEVICE_STATE_SUSPENDED      (1 << 3)
+
 #define MIN(a, b) ((a > b) ? b : a)
 
 /**
@@ -45,6 +65,20 @@ USBHost * USBHost::instHost = NULL;
 *       - a message is queued in queue_usb_event with the id TD_PROCESSED_EVENT
 *       - when the usb_thread receives the event, it:
 *           - call the callback attached to the endpoint where the td is attached
+*   - frame handler period elapsed
+*       - a message is queued in queue_usb_event with the id FRAME_EVENT
+*       - when the usb_thread receives the event, it:
+*           - call the frame handler
+*   - suspended port resumed (remote wakeup)
+*       - a message is queued in queue_usb_event with the id DEVICE_RESUMED_EVENT
+*       - when the usb_thread receives the event, it:
+*           - polls the endpoints of the device again after the resume recovery
+*   - resume detected while the controller is suspended
+*       - a message is queued in queue_usb_event with the id CONTROLLER_RESUME_EVENT
+*       - when the usb_thread receives the event, it:
+*           - resumes the controller
+*   - idle devices
+*       - when the idle check period elapses, the usb_thread suspends the idle devices
 */
 void USBHost::usb_process()
 {
@@ -57,6 +91,7 @@ void USBHost::usb_process()
     uint8_t buf[8];
     bool too_many_hub;
     int idx;
+    frame_handler_t * frame_handler;
 
 #if DEBUG_TRANSFER
     uint8_t * buf_transfer;
@@ -67,9 +102,18 @@ void USBHost::usb_process()
 #endif
 
     while(1) {
+#if USBHOST_SUSPEND
+        osEvent evt = mail_usb_event.get(idleCheckTimeout());
+
+        if (idleCheckTimeout() == 0) {
+            checkIdle();
+        }
+#else
         osEvent evt = mail_usb_event.get();
+#endif
 
         if (evt.status == osEventMail) {
+            USB_TRACE_SCOPE("usb_event");
 
             message_t * usb_msg = (message_t*)evt.value.p;
 
@@ -88,21 +132,20 @@ void USBHost::usb_process()
                         /*  check that hub is connected to root port  */
                         if (usb_msg->hub_parent) {
                             /*  a hub device must be present */
-                            for (k = 0; k < MAX_HUB_NB; k++) {
-                                if ((&hubs[k] == usb_msg->hub_parent) && (hub_in_use[k]))
-                                    hub_unplugged=false;
-                            }
+#if MAX_HUB_NB
+                            int hub_idx = findHub((USBHostHub *)(usb_msg->hub_parent));
+                            if ((hub_idx > 0) && hub_in_use[hub_idx - 1])
+                                hub_unplugged = false;
+#endif
                         } else hub_unplugged = false;
 
-                        if (((idx!=-1) && deviceInUse[idx] ) || ((idx == -1) && hub_unplugged))
+                        if (((idx!=-1) && (deviceState[idx] & DEVICE_STATE_IN_USE)) || ((idx == -1) && hub_unplugged))
                             break;
 
                         for (i =0 ; i < MAX_DEVICE_CONNECTED; i++) {
-                            if (!deviceInUse[i]) {
+                            if (!(deviceState[i] & DEVICE_STATE_IN_USE)) {
                                 USB_DBG_EVENT("new device connected: %p\r\n", &devices[i]);
-                                devices[i].init(usb_msg->hub, usb_msg->port, usb_msg->lowSpeed);
-                                deviceReset[i] = false;
-                                deviceInited[i] = true;
+                                bindDevice(i, usb_msg->hub, usb_msg->port, usb_msg->lowSpeed, (USBHostHub *)(usb_msg->hub_parent));
                                 break;
                             }
                         }
@@ -118,14 +161,18 @@ void USBHost::usb_process()
                             controlEndpointAllocated = true;
                         }
 
-#if MAX_HUB_NB
-                        if (usb_msg->hub_parent)
-                            devices[i].setHubParent((USBHostHub *)(usb_msg->hub_parent));
-#endif
-
                         for (j = 0; j < timeout_set_addr; j++) {
 
-                            resetDevice(&devices[i]);
+                            // a hub resets its port before reporting the device: only the retries reset it again
+                            if ((j == 0) && usb_msg->hub_parent) {
+                                Thread::wait(RESET_RECOVERY_TIME);
+                            } else {
+                                // the connection is debounced by the controller driver: only the retries wait
+                                if (j > 0) {
+                                    Thread::wait(100);
+                                }
+                                resetDevice(&devices[i]);
+                            }
 
                             // set size of control endpoint
                             devices[i].setSizeControlEndpoint(8);
@@ -167,6 +214,7 @@ void USBHost::usb_process()
                         }
 
                         USB_INFO("New device connected: %p [hub: %d - port: %d]", &devices[i], usb_msg->hub, usb_msg->port);
+                        USB_BOOT_MARK("device_addressed");
 
 #if MAX_HUB_NB
                         if (buf[4] == HUB_CLASS) {
@@ -195,11 +243,23 @@ void USBHost::usb_process()
 #endif
 
                         if ((i < MAX_DEVICE_CONNECTED) && !too_many_hub) {
-                            deviceInUse[i] = true;
+                            deviceState[i] |= DEVICE_STATE_IN_USE;
                         }
 
                     } while(0);
 
+#if MAX_HUB_NB
+                    // the device is no longer on the default address, the hub can reset its next port
+                    if (usb_msg->hub_parent) {
+                        Lock lock(this);
+                        int hub_idx = findHub((USBHostHub *)(usb_msg->hub_parent));
+                        releaseDefaultAddress((USBHostHub *)(usb_msg->hub_parent), usb_msg->port);
+                        if ((hub_idx > 0) && hub_in_use[hub_idx - 1]) {
+                            ((USBHostHub *)(usb_msg->hub_parent))->portEnumerated(usb_msg->port);
+                        }
+                    }
+#endif
+
                     break;
 
                 // a device has been disconnected
@@ -215,7 +275,6 @@ void USBHost::usb_process()
                         idx = findDevice(usb_msg->hub, usb_msg->port, (USBHostHub *)(usb_msg->hub_parent));
                         if (idx != -1) {
                             freeDevice((USBDeviceConnected*)&devices[idx]);
-                            deviceInited[idx]=false;
                         }
 
                         if (controlListState) enableList(CONTROL_ENDPOINT);
@@ -231,6 +290,12 @@ void USBHost::usb_process()
                 // we are not in ISR -> users can use printf in their callback method
                 case TD_PROCESSED_EVENT:
                     ep = (USBEndpoint *) ((HCTD *)usb_msg->td_addr)->ep;
+#if USBHOST_STATS
+                    idx = findDevice(ep->dev);
+                    if (idx != -1) {
+                        countLatency(deviceStats[idx].callback, us_ticker_read() - ep->getCompletionTime());
+                    }
+#endif
                     if (usb_msg->td_state == USB_TYPE_IDLE) {
                         USB_DBG_EVENT("call callback on td %p [ep: %p state: %s - dev: %p - %s]", usb_msg->td_addr, ep, ep->getStateString(), ep->dev, ep->dev->getName(ep->getIntfNb()));
 
@@ -243,11 +308,13 @@ void USBHost::usb_process()
                             printf("\r\n\r\n");
                         }
 #endif
+                        USB_TRACE_BEGIN("ep_callback");
                         ep->call();
+                        USB_TRACE_END("ep_callback");
                     } else {
                         idx = findDevice(ep->dev);
                         if (idx != -1) {
-                            if (deviceInUse[idx]) {
+                            if (deviceState[idx] & DEVICE_STATE_IN_USE) {
                                 USB_WARN("td %p processed but not in idle state: %s [ep: %p - dev: %p - %s]", usb_msg->td_addr, ep->getStateString(), ep, ep->dev, ep->dev->getName(ep->getIntfNb()));
                                 ep->setState(USB_TYPE_IDLE);
                                 /* as error, on interrupt endpoint can be
@@ -260,14 +327,56 @@ void USBHost::usb_process()
                         }
                     }
                     break;
+
+                // the period of a frame handler has elapsed
+                case FRAME_EVENT:
+                    frame_handler = (frame_handler_t *)usb_msg->td_addr;
+                    frame_handler->pending = false;
+                    if (frame_handler->period) {
+                        USB_TRACE_BEGIN("frame_handler");
+                        frame_handler->fn.call();
+                        USB_TRACE_END("frame_handler");
+                    }
+                    break;
+
+#if USBHOST_SUSPEND
+                // a suspended port has been resumed by its device
+                case DEVICE_RESUMED_EVENT:
+                    do {
+                        Lock lock(this);
+
+                        idx = findDevice(usb_msg->hub, usb_msg->port, (USBHostHub *)(usb_msg->hub_parent));
+                        if ((idx != -1) && (deviceState[idx] & DEVICE_STATE_SUSPENDED)) {
+                            USB_DBG_EVENT("remote wakeup of dev: %p\r\n", &devices[idx]);
+                            Thread::wait(RESUME_RECOVERY_TIME);
+                            resumeCompleted(idx);
+                        }
+                    } while(0);
+                    break;
+
+                // resume signaling on the bus while the controller is suspended
+                case CONTROLLER_RESUME_EVENT:
+                    do {
+                        Lock lock(this);
+                        wakeController();
+                    } while(0);
+                    break;
+
+                // the idle check timeout has been changed
+                case IDLE_CHECK_EVENT:
+                    break;
+#endif
             }
 
-            mail_usb_event.free(usb_msg);
+            freeMessage(usb_msg);
         }
     }
 }
 
-USBHost::USBHost() : usbThread(osPriorityNormal, USB_THREAD_STACK)
+USBHost::USBHost(uint8_t controller) : USBHALHost(controller), usbThread(osPriorityNormal, USB_THREAD_STACK, NULL, "usb_thread")
+#if MAX_HUB_NB
+    , hubThread(osPriorityNormal, HUB_THREAD_STACK, NULL, "hub_thread")
+#endif
 {
 #ifndef USBHOST_OTHER
     headControlEndpoint = NULL;
@@ -282,24 +391,130 @@ USBHost::USBHost() : usbThread(osPriorityNormal, USB_THREAD_STACK)
     controlEndpointAllocated = false;
 
     for (uint8_t i = 0; i < MAX_DEVICE_CONNECTED; i++) {
-        deviceInUse[i] = false;
-        devices[i].setAddress(i + 1);
-        deviceReset[i] = false;
-        deviceInited[i] = false;
-        for (uint8_t j = 0; j < MAX_INTF; j++)
-            deviceAttachedDriver[i][j] = false;
+        deviceState[i] = 0;
+        deviceAttachedDriver[i] = 0;
     }
+    memset(addressDevice, 0, sizeof(addressDevice));
+    memset(portDevice, 0, sizeof(portDevice));
+    memset(addressBitmap, 0, sizeof(addressBitmap));
+    // address 0 is the default address, it is never assigned
+    addressBitmap[0] = 1;
+    lastAddress = 0;
+
+    frameClock = 0;
+    lastFrame = 0;
+    nbFrameHandlers = 0;
+    for (uint8_t i = 0; i < MAX_FRAME_HANDLERS; i++) {
+        frameHandlers[i].period = 0;
+        frameHandlers[i].pending = false;
+    }
+
+#if USBHOST_STATS
+    memset(deviceStats, 0, sizeof(deviceStats));
+    memset(&poolStats, 0, sizeof(poolStats));
+#endif
+
+#if USBHOST_CHURN
+    churnRunning = false;
+    churnTransfers = 0;
+    churnErrors = 0;
+#endif
+
+#if USBHOST_SUSPEND
+    memset(deviceActivity, 0, sizeof(deviceActivity));
+    suspendIdleTime = 0;
+    nextIdleCheck = 0;
+    idleCheckArmed = false;
+    controllerIdle = false;
+    controllerSuspended = false;
+#endif
 
 #if MAX_HUB_NB
     for (uint8_t i = 0; i < MAX_HUB_NB; i++) {
         hubs[i].setHost(this);
         hub_in_use[i] = false;
+        hub_queued[i] = false;
     }
+    defaultAddressHub = NULL;
+    defaultAddressPort = 0;
+#endif
+
+#if (DEBUG_DEFERRED)
+    USBHostLog::start();
 #endif
 
     usbThread.start(this, &USBHost::usb_process);
+#if MAX_HUB_NB
+    hubThread.start(this, &USBHost::hub_process);
+#endif
+}
+
+#if MAX_HUB_NB
+// may be called in ISR (hub wake-up timeout)
+void USBHost::hubChanged(USBHostHub * hub)
+{
+    int hub_idx = findHub(hub);
+    if (hub_idx <= 0) {
+        return;
+    }
+    // a hub already queued will see this event when serviced
+    bool queued;
+    core_util_critical_section_enter();
+    queued = hub_queued[hub_idx - 1];
+    hub_queued[hub_idx - 1] = true;
+    core_util_critical_section_exit();
+    if (!queued) {
+        queue_hub_event.put(hub);
+    }
+}
+
+bool USBHost::lockDefaultAddress(USBHostHub * hub, uint8_t port)
+{
+    // the other ports of the same hub wait too: their devices would answer together
+    if ((defaultAddressHub != NULL) && ((defaultAddressHub != hub) || (defaultAddressPort != port))) {
+        return false;
+    }
+    defaultAddressHub = hub;
+    defaultAddressPort = port;
+    return true;
+}
+
+void USBHost::releaseDefaultAddress(USBHostHub * hub, uint8_t port)
+{
+    if ((defaultAddressHub != hub) || ((port != 0) && (defaultAddressPort != port))) {
+        return;
+    }
+    defaultAddressHub = NULL;
+    defaultAddressPort = 0;
+    for (uint8_t i = 0; i < MAX_HUB_NB; i++) {
+        if (hub_in_use[i]) {
+            hubChanged(&hubs[i]);
+        }
+    }
 }
 
+/**
+* Hub status changes: the port requests are sent from this thread, the lock
+* prevents the hub from being freed by the usb_thread while it is serviced
+*/
+void USBHost::hub_process()
+{
+    while(1) {
+        osEvent evt = queue_hub_event.get();
+
+        if (evt.status == osEventMessage) {
+            Lock lock(this);
+            USBHostHub * hub = (USBHostHub *)evt.value.p;
+            // cleared before servicing: a change from now on queues the hub again
+            core_util_critical_section_enter();
+            hub_queued[findHub(hub) - 1] = false;
+            core_util_critical_section_exit();
+            hub->serviceChanges();
+        }
+    }
+}
+#endif
+
 USBHost::Lock::Lock(USBHost* pHost) : m_pHost(pHost)
 {
     m_pHost->usb_mutex.lock();
@@ -313,17 +528,24 @@ USBHost::Lock::~Lock()
 void USBHost::transferCompleted(volatile uint32_t addr)
 {
     uint8_t state;
+    uint32_t frame;
 
     if(addr == 0)
         return;
 
+    // the TDs of the done list are stamped with the same frame
+    frame = getFrameNumber();
+#if USBHOST_STATS
+    uint32_t now = us_ticker_read();
+#endif
+
     volatile HCTD* tdList = NULL;
 
     //First we must reverse the list order and dequeue each TD
     do {
         volatile HCTD* td = (volatile HCTD*)addr;
         addr = (uint32_t)td->nextTD; //Dequeue from physical list
-        td->nextTD = (hcTd*)tdList; //Enqueue into reversed list
+        td->nextTD = (HCTD*)tdList; //Enqueue into reversed list
         tdList = td;
     } while(addr);
 
@@ -339,40 +561,725 @@ void USBHost::transferCompleted(volatile uint32_t addr)
                 ep->setLengthTransferred((uint32_t)td->currBufPtr - (uint32_t)ep->getBufStart());
 
 #else
-            if (((HCTD *)td)->control >> 28) {
-                state = ((HCTD *)td)->control >> 28;
-            } else {
+            state = ((HCTD *)td)->control >> 28;
+            if (!ep->isLastTD(td)) {
+                if (state == 0) {
+                    // intermediate TD of a transfer: reported with its last TD, in this done list or a later one
+                    continue;
+                }
+                // the ED is halted on this TD: the transfer ends here, short when the device sent a short packet
+                if (state == USB_TYPE_DATA_UNDERRUN_ERROR) {
+                    state = 0;
+                }
+            }
+            if (state == 0) {
+                // the current buffer pointer is cleared when the whole buffer has been transferred
                 if (td->currBufPtr)
                     ep->setLengthTransferred((uint32_t)td->currBufPtr - (uint32_t)ep->getBufStart());
+                else
+                    ep->setLengthTransferred((uint32_t)td->bufEnd + 1 - (uint32_t)ep->getBufStart());
                 state = 16 /*USB_TYPE_IDLE*/;
             }
 #endif
-            if (state == USB_TYPE_IDLE)
-                ep->setLengthTransferred((uint32_t)td->currBufPtr - (uint32_t)ep->getBufStart());
 
+            ep->setCompletionFrame(frame);
+#if USBHOST_STATS
+            countTransfer(ep, td, state, now);
+#endif
+#if USBHOST_CAPTURE
+            // the transfer is identified by its first TD
+            USBHostCapture::complete(getController(), ep, ep->getProcessedTD(), state, frame);
+#endif
+#if USBHOST_SUSPEND
+            int idx = findDevice(ep->dev);
+            if (idx != -1) {
+                deviceActivity[idx] = frame;
+            }
+#endif
             ep->unqueueTransfer(td);
 
             if (ep->getType() != CONTROL_ENDPOINT) {
                 // callback on the processed td will be called from the usb_thread (not in ISR)
-                message_t * usb_msg = mail_usb_event.alloc();
-                usb_msg->event_id = TD_PROCESSED_EVENT;
-                usb_msg->td_addr = (void *)td;
-                usb_msg->td_state = state;
-                mail_usb_event.put(usb_msg);
+                message_t * usb_msg = allocMessage();
+                if (usb_msg != NULL) {
+                    usb_msg->event_id = TD_PROCESSED_EVENT;
+                    usb_msg->td_addr = (void *)td;
+                    usb_msg->td_state = state;
+                    mail_usb_event.put(usb_msg);
+                }
             }
             ep->setState((USB_TYPE)state);
-            ep->ep_queue.put((uint8_t*)1);
+            ep->signalTransfer();
+        }
+    }
+}
+
+#if USBHOST_STATS
+/*
+ * Count a processed TD on its endpoint and on its device
+ * Called in ISR!!!! (no printf)
+ */
+void USBHost::countTransfer(USBEndpoint * ep, volatile HCTD * td, uint8_t state, uint32_t now)
+{
+    USBEndpointStats * stats[2];
+    uint8_t nb = 0;
+
+    stats[nb++] = ep->getStats();
+    int idx = findDevice(ep->dev);
+    if (idx != -1) {
+        stats[nb++] = &deviceStats[idx].total;
+        countLatency(deviceStats[idx].completion, now - ep->getSubmitTime());
+    }
+    ep->setCompletionTime(now);
+
+    for (uint8_t i = 0; i < nb; i++) {
+        stats[i]->transfers++;
+        if (state == USB_TYPE_IDLE) {
+            stats[i]->bytes += ep->getLengthTransferred();
+        } else {
+            stats[i]->errors++;
+            if (state == USB_TYPE_STALL_ERROR) {
+                stats[i]->stalls++;
+            }
+        }
+#ifdef USBHOST_OTHER
+        stats[i]->naks += td->naks;
+#endif
+    }
+}
+
+void USBHost::countTimeout(USBEndpoint * ep)
+{
+    core_util_critical_section_enter();
+    ep->getStats()->timeouts++;
+    int idx = findDevice(ep->dev);
+    if (idx != -1) {
+        deviceStats[idx].total.timeouts++;
+    }
+    core_util_critical_section_exit();
+}
+
+void USBHost::countLatency(uint32_t * histogram, uint32_t us)
+{
+    // index of the most significant bit + 1
+    uint8_t bucket = (us == 0) ? 0 : 32 - __CLZ(us);
+    if (bucket >= USB_LATENCY_BUCKETS) {
+        bucket = USB_LATENCY_BUCKETS - 1;
+    }
+    histogram[bucket]++;
+}
+
+bool USBHost::getDeviceStats(USBDeviceConnected * dev, USBDeviceStats * stats)
+{
+    int idx = findDevice(dev);
+    if ((idx == -1) || (stats == NULL)) {
+        return false;
+    }
+    // the counters are updated in ISR
+    core_util_critical_section_enter();
+    *stats = deviceStats[idx];
+    core_util_critical_section_exit();
+    return true;
+}
+
+bool USBHost::getEndpointStats(USBEndpoint * ep, USBEndpointStats * stats)
+{
+    if ((ep == NULL) || (stats == NULL)) {
+        return false;
+    }
+    core_util_critical_section_enter();
+    *stats = *ep->getStats();
+    core_util_critical_section_exit();
+    return true;
+}
+
+void USBHost::resetStats(USBDeviceConnected * dev)
+{
+    Lock lock(this);
+
+    int idx = findDevice(dev);
+    if (idx == -1) {
+        return;
+    }
+    core_util_critical_section_enter();
+    memset(&deviceStats[idx], 0, sizeof(USBDeviceStats));
+    for (uint8_t i = 0; i < MAX_INTF; i++) {
+        for (uint8_t j = 0; j < MAX_ENDPOINT_PER_INTERFACE; j++) {
+            USBEndpoint * ep = dev->getEndpoint(i, j);
+            if (ep != NULL) {
+                memset(ep->getStats(), 0, sizeof(USBEndpointStats));
+            }
+        }
+    }
+    core_util_critical_section_exit();
+}
+
+void USBHost::getPoolStats(USBPoolStats * stats)
+{
+    core_util_critical_section_enter();
+    *stats = poolStats;
+    core_util_critical_section_exit();
+}
+
+// may be called in ISR
+void USBHost::countPool(USBPoolUsage * pool, int delta)
+{
+    core_util_critical_section_enter();
+    pool->used += delta;
+    if (pool->used > pool->max) {
+        pool->max = pool->used;
+    }
+    core_util_critical_section_exit();
+}
+#endif
+
+#if USBHOST_CHURN
+int USBHost::devicesInUse()
+{
+    int nb = 0;
+    for (uint8_t i = 0; i < MAX_DEVICE_CONNECTED; i++) {
+        if (deviceState[i] & DEVICE_STATE_IN_USE) {
+            nb++;
+        }
+    }
+    return nb;
+}
+
+// load of the churn: the descriptor of each device in use is read again and again
+void USBHost::churnLoad()
+{
+    uint8_t buf[DEVICE_DESCRIPTOR_LENGTH];
+
+    while (churnRunning) {
+        for (uint8_t i = 0; (i < MAX_DEVICE_CONNECTED) && churnRunning; i++) {
+            // the lock keeps the device from being freed by the usb_thread during the transfer
+            Lock lock(this);
+            if (!(deviceState[i] & DEVICE_STATE_IN_USE)) {
+                continue;
+            }
+            USB_TYPE res = controlRead(&devices[i],
+                                       USB_DEVICE_TO_HOST | USB_RECIPIENT_DEVICE,
+                                       GET_DESCRIPTOR,
+                                       (DEVICE_DESCRIPTOR << 8) | (0),
+                                       0, buf, DEVICE_DESCRIPTOR_LENGTH);
+            churnTransfers++;
+            if (res != USB_TYPE_OK) {
+                churnErrors++;
+            }
         }
+        Thread::wait(1);
     }
 }
 
+bool USBHost::churn(uint32_t cycles, USBChurnStats * stats)
+{
+    Thread load(osPriorityNormal, USB_CHURN_LOAD_STACK, NULL, "churn_load");
+
+    memset(stats, 0, sizeof(USBChurnStats));
+
+    int idx = findDevice(0, 1, NULL);
+    if ((idx == -1) || !(deviceState[idx] & DEVICE_STATE_IN_USE)) {
+        return false;
+    }
+
+    churnTransfers = 0;
+    churnErrors = 0;
+    churnRunning = true;
+    load.start(this, &USBHost::churnLoad);
+
+    bool res = churnCycles(cycles, stats);
+
+    churnRunning = false;
+    load.join();
+    stats->load_transfers = churnTransfers;
+    stats->load_errors = churnErrors;
+
+    printf("[USB_CHURN] %lu cycles, %lu failures, load %lu transfers, %lu errors\r\n",
+           (unsigned long)stats->cycles, (unsigned long)stats->failures,
+           (unsigned long)stats->load_transfers, (unsigned long)stats->load_errors);
+    printf("[USB_CHURN] enumeration (us): first %lu, last %lu, max %lu\r\n",
+           (unsigned long)stats->enum_first, (unsigned long)stats->enum_last, (unsigned long)stats->enum_max);
+    printf("[USB_CHURN] ED %d -> %d (max %d/%d, trend %+ld), TD %d -> %d (max %d/%d, trend %+ld), mail max %d/%d, lost events %lu%s\r\n",
+           stats->first.eds.used, stats->last.eds.used, stats->last.eds.max, MAX_ENDPOINT, (long)stats->ed_growth,
+           stats->first.tds.used, stats->last.tds.used, stats->last.tds.max, MAX_TD, (long)stats->td_growth,
+           stats->last.mails.max, USB_MAIL_SIZE, (unsigned long)stats->last.mail_failures,
+           stats->growing ? " - GROWING" : "");
+    return res;
+}
+
+// growth over n cycles of a pool, from the least squares slope of its samples (sum of x, x * x, y, x * y)
+static int32_t churnGrowth(int64_t n, int64_t sx, int64_t sxx, int64_t sy, int64_t sxy)
+{
+    int64_t den = n * sxx - sx * sx;
+    if (den == 0) {
+        return 0;
+    }
+    return (int32_t)(((n * sxy - sx * sy) * (n - 1)) / den);
+}
+
+bool USBHost::churnCycles(uint32_t cycles, USBChurnStats * stats)
+{
+    USBPoolStats pool;
+    int64_t sx = 0, sxx = 0, sy_ed = 0, sxy_ed = 0, sy_td = 0, sxy_td = 0;
+
+    int idx = findDevice(0, 1, NULL);
+    int nb = devicesInUse();
+    bool lowSpeed = devices[idx].getSpeed();
+
+    for (uint32_t c = 0; c < cycles; c++) {
+        // unplug: the device on the root port and the devices behind it are freed by the usb_thread
+        deviceDisconnected(0, 1, NULL, 0);
+        uint32_t start = us_ticker_read();
+        while (findDevice(0, 1, NULL) != -1) {
+            if ((us_ticker_read() - start) > USB_CHURN_TIMEOUT * 1000) {
+                USB_ERR("churn: device not freed after %d cycles", c);
+                return false;
+            }
+            Thread::wait(1);
+        }
+
+        // plug: back when all the devices are enumerated again, behind the hubs too
+        start = us_ticker_read();
+        deviceConnected(0, 1, lowSpeed);
+        while (devicesInUse() < nb) {
+            if ((us_ticker_read() - start) > USB_CHURN_TIMEOUT * 1000) {
+                break;
+            }
+            Thread::wait(1);
+        }
+        uint32_t time = us_ticker_read() - start;
+        if (devicesInUse() < nb) {
+            // counted as a failure, the next cycles unplug what was enumerated
+            stats->failures++;
+            nb = devicesInUse();
+            if (findDevice(0, 1, NULL) == -1) {
+                USB_ERR("churn: device lost after %d cycles", c);
+                return false;
+            }
+        }
+
+        // the drivers connect to the devices and queue their transfers after the enumeration
+        Thread::wait(USB_CHURN_SETTLE);
+
+        getPoolStats(&pool);
+        if (c == 0) {
+            stats->enum_first = time;
+            stats->first = pool;
+        }
+        if (time > stats->enum_max) {
+            stats->enum_max = time;
+        }
+        stats->enum_last = time;
+        stats->last = pool;
+        stats->cycles++;
+
+        sx += c;
+        sxx += (int64_t)c * c;
+        sy_ed += pool.eds.used;
+        sxy_ed += (int64_t)c * pool.eds.used;
+        sy_td += pool.tds.used;
+        sxy_td += (int64_t)c * pool.tds.used;
+    }
+
+    // a leak grows the settled pools over the cycles, a late driver only moves one sample
+    stats->ed_growth = churnGrowth(stats->cycles, sx, sxx, sy_ed, sxy_ed);
+    stats->td_growth = churnGrowth(stats->cycles, sx, sxx, sy_td, sxy_td);
+    stats->growing = (stats->cycles >= USB_CHURN_TREND_CYCLES) &&
+                     ((stats->ed_growth >= USB_CHURN_LEAK) || (stats->td_growth >= USB_CHURN_LEAK));
+    return true;
+}
+#endif
+
+USBHost::message_t * USBHost::allocMessage()
+{
+    message_t * usb_msg = mail_usb_event.alloc();
+#if USBHOST_STATS
+    if (usb_msg == NULL) {
+        core_util_critical_section_enter();
+        poolStats.mail_failures++;
+        core_util_critical_section_exit();
+    } else {
+        countPool(&poolStats.mails, 1);
+    }
+#endif
+    return usb_msg;
+}
+
+void USBHost::freeMessage(message_t * usb_msg)
+{
+    mail_usb_event.free(usb_msg);
+#if USBHOST_STATS
+    countPool(&poolStats.mails, -1);
+#endif
+}
+
+void USBHost::startFrameClock()
+{
+    lastFrame = frameNumber();
+    frameClockTicker.attach_us(callback(this, &USBHost::updateFrameClock), FRAME_CLOCK_UPDATE);
+}
+
+void USBHost::updateFrameClock()
+{
+    getFrameNumber();
+}
+
+// may be called in ISR
+uint32_t USBHost::getFrameNumber()
+{
+    uint32_t frame;
+
+    core_util_critical_section_enter();
+    frame = frameNumber();
+    frameClock += (frame - lastFrame) & FRAME_NUMBER_MASK;
+    lastFrame = frame;
+    frame = frameClock;
+    core_util_critical_section_exit();
+
+    return frame;
+}
+
+bool USBHost::attachFrameHandler(Callback<void()> fn, uint16_t frames)
+{
+    Lock lock(this);
+
+    if (!fn || (frames == 0)) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < MAX_FRAME_HANDLERS; i++) {
+        // a detached handler may still have a FRAME_EVENT queued
+        if ((frameHandlers[i].period == 0) && !frameHandlers[i].pending) {
+            frameHandlers[i].fn = fn;
+            frameHandlers[i].count = frames;
+            frameHandlers[i].period = frames;
+            if (nbFrameHandlers++ == 0) {
+                enableFrameInterrupt(true);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void USBHost::detachFrameHandler(Callback<void()> fn)
+{
+    Lock lock(this);
+
+    for (uint8_t i = 0; i < MAX_FRAME_HANDLERS; i++) {
+        if ((frameHandlers[i].period != 0) && (frameHandlers[i].fn == fn)) {
+            frameHandlers[i].period = 0;
+            if (--nbFrameHandlers == 0) {
+                enableFrameInterrupt(false);
+            }
+        }
+    }
+}
+
+/*
+ * Called at each start of frame while a frame handler is attached
+ * Called in ISR!!!! (no printf)
+ */
+void USBHost::frameStarted()
+{
+    getFrameNumber();
+
+    for (uint8_t i = 0; i < MAX_FRAME_HANDLERS; i++) {
+        frame_handler_t * handler = &frameHandlers[i];
+        if ((handler->period == 0) || (--handler->count != 0)) {
+            continue;
+        }
+        handler->count = handler->period;
+        if (handler->pending) {
+            continue;
+        }
+        message_t * usb_msg = allocMessage();
+        if (usb_msg == NULL) {
+            continue;
+        }
+        handler->pending = true;
+        usb_msg->event_id = FRAME_EVENT;
+        usb_msg->td_addr = (void *)handler;
+        mail_usb_event.put(usb_msg);
+    }
+}
+
+#if USBHOST_SUSPEND
+/*
+ * Called when a suspended port has been resumed by its device
+ * Called in ISR (root port) or in the hub thread
+ */
+void USBHost::deviceResumed(int hub, int port, USBHostHub * hub_parent)
+{
+    message_t * usb_msg = allocMessage();
+    if (usb_msg == NULL) {
+        return;
+    }
+    usb_msg->event_id = DEVICE_RESUMED_EVENT;
+    usb_msg->hub = hub;
+    usb_msg->port = port;
+    usb_msg->hub_parent = (void *)hub_parent;
+    mail_usb_event.put(usb_msg);
+}
+
+/*
+ * Called when a device signals a resume while the controller is suspended
+ * Called in ISR!!!! (no printf)
+ */
+void USBHost::resumeDetected()
+{
+    message_t * usb_msg = allocMessage();
+    if (usb_msg == NULL) {
+        return;
+    }
+    usb_msg->event_id = CONTROLLER_RESUME_EVENT;
+    mail_usb_event.put(usb_msg);
+}
+
+USB_TYPE USBHost::suspendDevice(USBDeviceConnected * dev)
+{
+    Lock lock(this);
+    USB_TYPE res;
+
+    int idx = findDevice(dev);
+    if ((idx == -1) || !(deviceState[idx] & DEVICE_STATE_IN_USE)) {
+        return USB_TYPE_ERROR;
+    }
+    if (deviceState[idx] & DEVICE_STATE_SUSPENDED) {
+        return USB_TYPE_OK;
+    }
+
+    if (dev->canRemoteWakeup()) {
+        res = controlWrite(dev, USB_HOST_TO_DEVICE | USB_RECIPIENT_DEVICE, SET_FEATURE, DEVICE_REMOTE_WAKEUP, 0, NULL, 0);
+        if (res != USB_TYPE_OK) {
+            USB_WARN("dev: %p remote wakeup not enabled", dev);
+            return res;
+        }
+    }
+
+    // the endpoints are no more polled: the device stops seeing any traffic
+    skipEndpoints(dev, true);
+
+    bool suspended;
+#if MAX_HUB_NB
+    if (dev->getHubParent() != NULL) {
+        suspended = dev->getHubParent()->suspendPort(dev->getPort());
+    } else
+#endif
+    suspended = suspendRootPort();
+
+    if (!suspended) {
+        skipEndpoints(dev, false);
+        return USB_TYPE_ERROR;
+    }
+
+    USB_DBG("dev: %p suspended", dev);
+    deviceState[idx] |= DEVICE_STATE_SUSPENDED;
+    return USB_TYPE_OK;
+}
+
+USB_TYPE USBHost::resumeDevice(USBDeviceConnected * dev)
+{
+    Lock lock(this);
+    USB_TYPE res;
+
+    int idx = findDevice(dev);
+    if ((idx == -1) || !(deviceState[idx] & DEVICE_STATE_IN_USE)) {
+        return USB_TYPE_ERROR;
+    }
+    if (!(deviceState[idx] & DEVICE_STATE_SUSPENDED)) {
+        return USB_TYPE_OK;
+    }
+
+    wakeController();
+
+    bool resumed;
+#if MAX_HUB_NB
+    USBHostHub * hub_parent = dev->getHubParent();
+    if (hub_parent != NULL) {
+        // the hub has to be active to resume one of its ports
+        for (int i = 0; i < MAX_DEVICE_CONNECTED; i++) {
+            if ((deviceState[i] & DEVICE_STATE_IN_USE) && (devices[i].getClass() == HUB_CLASS) && (devices[i].hub == hub_parent)) {
+                res = resumeDevice(&devices[i]);
+                if (res != USB_TYPE_OK) {
+                    return res;
+                }
+                break;
+            }
+        }
+        resumed = hub_parent->resumePort(dev->getPort());
+    } else
+#endif
+    resumed = resumeRootPort();
+
+    if (!resumed) {
+        return USB_TYPE_ERROR;
+    }
+
+    Thread::wait(RESUME_TIME + RESUME_RECOVERY_TIME);
+    resumeCompleted(idx);
+
+    USB_DBG("dev: %p resumed", dev);
+    return USB_TYPE_OK;
+}
+
+bool USBHost::isSuspended(USBDeviceConnected * dev)
+{
+    int idx = findDevice(dev);
+    return (idx != -1) && (deviceState[idx] & DEVICE_STATE_SUSPENDED);
+}
+
+void USBHost::setSuspendIdleTime(uint32_t ms)
+{
+    Lock lock(this);
+
+    suspendIdleTime = ms;
+    idleCheckArmed = (ms != 0);
+    nextIdleCheck = getFrameNumber() + ms / 2;
+
+    // the usb_thread may be blocked without timeout
+    message_t * usb_msg = allocMessage();
+    if (usb_msg != NULL) {
+        usb_msg->event_id = IDLE_CHECK_EVENT;
+        mail_usb_event.put(usb_msg);
+    }
+}
+
+void USBHost::setControllerIdle(bool enable)
+{
+    Lock lock(this);
+
+    controllerIdle = enable;
+    if (!enable) {
+        wakeController();
+    }
+}
+
+// ms before the next idle check
+uint32_t USBHost::idleCheckTimeout()
+{
+    if ((suspendIdleTime == 0) || !idleCheckArmed) {
+        return osWaitForever;
+    }
+    int32_t delay = nextIdleCheck - getFrameNumber();
+    return (delay > 0) ? delay : 0;
+}
+
+// suspend the devices without any completed transfer since suspendIdleTime
+// and the controller once all the devices are suspended
+void USBHost::checkIdle()
+{
+    Lock lock(this);
+    uint32_t now = getFrameNumber();
+    bool candidate = false;
+    bool all_suspended = true;
+    bool root_device = false;
+
+    for (int i = 0; i < MAX_DEVICE_CONNECTED; i++) {
+        if (!(deviceState[i] & DEVICE_STATE_IN_USE)) {
+            continue;
+        }
+        if (deviceState[i] & DEVICE_STATE_SUSPENDED) {
+            if (devices[i].getHubParent() == NULL) {
+                root_device = true;
+            }
+            continue;
+        }
+        all_suspended = false;
+
+        // a device which cannot wake up the host would miss its events
+        if (!devices[i].isEnumerated() || !devices[i].canRemoteWakeup()) {
+            continue;
+        }
+        candidate = true;
+
+        if (((now - deviceActivity[i]) >= suspendIdleTime) && childrenSuspended(&devices[i])) {
+            suspendDevice(&devices[i]);
+        }
+    }
+
+    if (controllerIdle && all_suspended && root_device && !controllerSuspended) {
+        USB_DBG("suspend controller");
+        controllerSuspended = suspendController();
+    }
+
+    idleCheckArmed = candidate;
+    nextIdleCheck = now + (suspendIdleTime + 1) / 2;
+}
+
+// a hub is only suspended when all its devices are suspended
+bool USBHost::childrenSuspended(USBDeviceConnected * dev)
+{
+#if MAX_HUB_NB
+    if (dev->getClass() != HUB_CLASS) {
+        return true;
+    }
+    for (int i = 0; i < MAX_DEVICE_CONNECTED; i++) {
+        if ((deviceState[i] & DEVICE_STATE_IN_USE) && (devices[i].getHubParent() == dev->hub) && !(deviceState[i] & DEVICE_STATE_SUSPENDED)) {
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+void USBHost::skipEndpoints(USBDeviceConnected * dev, bool skip)
+{
+    for (uint8_t i = 0; i < dev->getNbIntf(); i++) {
+        for (uint8_t j = 0; j < MAX_ENDPOINT_PER_INTERFACE; j++) {
+            USBEndpoint * ep = dev->getEndpoint(i, j);
+            if (ep != NULL) {
+                ep->setSkip(skip);
+            }
+        }
+    }
+}
+
+// the port of a device has been resumed: its endpoints can be polled again
+void USBHost::resumeCompleted(int idx)
+{
+    skipEndpoints(&devices[idx], false);
+    deviceState[idx] &= ~DEVICE_STATE_SUSPENDED;
+    deviceActivity[idx] = getFrameNumber();
+    idleCheckArmed = true;
+
+    // bulk transfers may have been queued while the device was suspended
+    fillList(BULK_ENDPOINT);
+}
+
+void USBHost::wakeController()
+{
+    if (controllerSuspended) {
+        USB_DBG("resume controller");
+        resumeController();
+        controllerSuspended = false;
+    }
+}
+#endif
+
 USBHost * USBHost::getHostInst()
 {
-    if (instHost == NULL) {
-        instHost = new USBHost();
-        instHost->init();
+    for (uint8_t i = 0; i < USBHOST_CONTROLLER_NUM; i++) {
+        if (instHost[i] != NULL) {
+            return instHost[i];
+        }
+    }
+    return getHostInst(USBHOST_DEFAULT_CONTROLLER);
+}
+
+USBHost * USBHost::getHostInst(uint8_t controller)
+{
+    if (controller >= USBHOST_CONTROLLER_NUM) {
+        return NULL;
+    }
+    if (instHost[controller] == NULL) {
+        USB_BOOT_MARK("usb_host_init");
+        instHost[controller] = new USBHost(controller);
+        instHost[controller]->init();
+        USB_BOOT_MARK("usb_host_ready");
+        instHost[controller]->startFrameClock();
     }
-    return instHost;
+    return instHost[controller];
 }
 
 
@@ -380,20 +1287,25 @@ USBHost * USBHost::getHostInst()
  * Called when a device has been connected
  * Called in ISR!!!! (no printf)
  */
-/* virtual */ void USBHost::deviceConnected(int hub, int port, bool lowSpeed, USBHostHub * hub_parent)
+bool USBHost::deviceConnected(int hub, int port, bool lowSpeed, USBHostHub * hub_parent)
 {
     // be sure that the new device connected is not already connected...
     disableList(CONTROL_ENDPOINT);
 
     int idx = findDevice(hub, port, hub_parent);
     if (idx != -1) {
-        if (deviceInited[idx]) {
+        if (deviceState[idx] & DEVICE_STATE_INITED) {
             enableList(CONTROL_ENDPOINT);
 
-            return;
+            return false;
         }
     }
-    message_t * usb_msg = mail_usb_event.alloc();
+    message_t * usb_msg = allocMessage();
+    if (usb_msg == NULL) {
+        enableList(CONTROL_ENDPOINT);
+        return false;
+    }
+    USB_BOOT_MARK("device_connected");
     usb_msg->event_id = DEVICE_CONNECTED_EVENT;
     usb_msg->hub = hub;
     usb_msg->port = port;
@@ -402,14 +1314,14 @@ USBHost * USBHost::getHostInst()
     mail_usb_event.put(usb_msg);
     enableList(CONTROL_ENDPOINT);
 
-
+    return true;
 }
 
 /*
  * Called when a device has been disconnected
  * Called in ISR!!!! (no printf)
  */
-/* virtual */ void USBHost::deviceDisconnected(int hub, int port, USBHostHub * hub_parent, volatile uint32_t addr)
+void USBHost::deviceDisconnected(int hub, int port, USBHostHub * hub_parent, volatile uint32_t addr)
 {
     // be sure that the device disconnected is connected...
 
@@ -417,7 +1329,7 @@ USBHost * USBHost::getHostInst()
 
     int idx = findDevice(hub, port, hub_parent);
     if (idx != -1) {
-        if (!deviceInUse[idx]) {
+        if (!(deviceState[idx] & DEVICE_STATE_IN_USE)) {
             enableList(CONTROL_ENDPOINT);
             return;
         }
@@ -426,7 +1338,11 @@ USBHost * USBHost::getHostInst()
         return;
     }
 
-    message_t * usb_msg = mail_usb_event.alloc();
+    message_t * usb_msg = allocMessage();
+    if (usb_msg == NULL) {
+        enableList(CONTROL_ENDPOINT);
+        return;
+    }
     usb_msg->event_id = DEVICE_DISCONNECTED_EVENT;
     usb_msg->hub = hub;
     usb_msg->port = port;
@@ -447,12 +1363,11 @@ void USBHost::freeDevice(USBDeviceConnected * dev)
         if (dev->hub == NULL) {
             USB_ERR("HUB NULL!!!!!\r\n");
         } else {
+            releaseDefaultAddress(dev->hub, 0);
             dev->hub->hubDisconnected();
-            for (uint8_t i = 0; i < MAX_HUB_NB; i++) {
-                if (dev->hub == &hubs[i]) {
-                    hub_in_use[i] = false;
-                    break;
-                }
+            int hub_idx = findHub(dev->hub);
+            if (hub_idx > 0) {
+                hub_in_use[hub_idx - 1] = false;
             }
         }
     }
@@ -465,11 +1380,9 @@ void USBHost::freeDevice(USBDeviceConnected * dev)
 
     int idx = findDevice(dev);
     if (idx != -1) {
-        deviceInUse[idx] = false;
-        deviceReset[idx] = false;
+        deviceAttachedDriver[idx] = 0;
 
         for (uint8_t j = 0; j < MAX_INTF; j++) {
-            deviceAttachedDriver[idx][j] = false;
             if (dev->getInterface(j) != NULL) {
                 USB_DBG("FREE INTF %d on dev: %p, %p, nb_endpot: %d, %s", j, (void *)dev->getInterface(j), dev, dev->getInterface(j)->nb_endpoint, dev->getName(j));
                 for (int i = 0; i < dev->getInterface(j)->nb_endpoint; i++) {
@@ -480,10 +1393,15 @@ void USBHost::freeDevice(USBDeviceConnected * dev)
 #endif
                         unqueueEndpoint(ep);
 
-                        freeTD((volatile uint8_t*)ep->getTDList()[0]);
-                        freeTD((volatile uint8_t*)ep->getTDList()[1]);
+                        for (uint8_t k = 0; k < ep->getNbTD(); k++) {
+                            freeTD((volatile uint8_t*)ep->getTDList()[k]);
+                        }
 
                         freeED((uint8_t *)ep->getHCED());
+#if USBHOST_STATS
+                        countPool(&poolStats.tds, -ep->getNbTD());
+                        countPool(&poolStats.eds, -1);
+#endif
                     }
                     printList(BULK_ENDPOINT);
                     printList(INTERRUPT_ENDPOINT);
@@ -492,6 +1410,7 @@ void USBHost::freeDevice(USBDeviceConnected * dev)
             }
         }
         dev->disconnect();
+        unbindDevice(idx);
     }
 }
 
@@ -556,32 +1475,77 @@ void USBHost::unqueueEndpoint(USBEndpoint * ep)
 
 USBDeviceConnected * USBHost::getDevice(uint8_t index)
 {
-    if ((index >= MAX_DEVICE_CONNECTED) || (!deviceInUse[index])) {
+    if ((index >= MAX_DEVICE_CONNECTED) || !(deviceState[index] & DEVICE_STATE_IN_USE)) {
         return NULL;
     }
     return (USBDeviceConnected*)&devices[index];
 }
 
+USBDeviceConnected * USBHost::getDeviceByAddress(uint8_t addr)
+{
+    if ((addr == 0) || (addr > MAX_DEVICE_ADDRESS) || (addressDevice[addr] == 0)) {
+        return NULL;
+    }
+    return getDevice(addressDevice[addr] - 1);
+}
+
 // create an USBEndpoint descriptor. the USBEndpoint is not linked
 USBEndpoint * USBHost::newEndpoint(ENDPOINT_TYPE type, ENDPOINT_DIRECTION dir, uint32_t size, uint8_t addr)
 {
     int i = 0;
+
+    // search a free USBEndpoint
+    for (i = 0; i < MAX_ENDPOINT; i++) {
+        if (endpoints[i].getState() == USB_TYPE_FREE) {
+            break;
+        }
+    }
+    if (i == MAX_ENDPOINT) {
+        USB_ERR("could not allocate more endpoints!!!!");
+        return NULL;
+    }
+
     HCED * ed = (HCED *)getED();
     HCTD* td_list[2] = { (HCTD*)getTD(), (HCTD*)getTD() };
 
+    // the descriptors are given back if one of them is missing
+    if ((ed == NULL) || (td_list[0] == NULL) || (td_list[1] == NULL)) {
+        USB_ERR("could not allocate the ED and TDs of an endpoint");
+        if (ed != NULL) {
+            freeED((uint8_t *)ed);
+        }
+        for (uint8_t j = 0; j < 2; j++) {
+            if (td_list[j] != NULL) {
+                freeTD((volatile uint8_t *)td_list[j]);
+            }
+        }
+        return NULL;
+    }
+#if USBHOST_STATS
+    countPool(&poolStats.eds, 1);
+    countPool(&poolStats.tds, 2);
+#endif
+
     memset((void *)td_list[0], 0x00, sizeof(HCTD));
     memset((void *)td_list[1], 0x00, sizeof(HCTD));
 
-    // search a free USBEndpoint
-    for (i = 0; i < MAX_ENDPOINT; i++) {
-        if (endpoints[i].getState() == USB_TYPE_FREE) {
-            endpoints[i].init(ed, type, dir, size, addr, td_list);
-            USB_DBG("USBEndpoint created (%p): type: %d, dir: %d, size: %d, addr: %d, state: %s", &endpoints[i], type, dir, size, addr, endpoints[i].getStateString());
-            return &endpoints[i];
+    endpoints[i].init(ed, type, dir, size, addr, td_list);
+
+#ifndef USBHOST_OTHER
+    // the bulk endpoints queue the long transfers on several TDs, while the pool has some
+    for (uint8_t j = 2; (type == BULK_ENDPOINT) && (j < USB_BULK_TDS); j++) {
+        HCTD * td = (HCTD *)getTD();
+        if (td == NULL) {
+            break;
         }
+        endpoints[i].addTD(td);
+#if USBHOST_STATS
+        countPool(&poolStats.tds, 1);
+#endif
     }
-    USB_ERR("could not allocate more endpoints!!!!");
-    return NULL;
+#endif
+    USB_DBG("USBEndpoint created (%p): type: %d, dir: %d, size: %d, addr: %d, state: %s", &endpoints[i], type, dir, size, addr, endpoints[i].getStateString());
+    return &endpoints[i];
 }
 
 
@@ -590,7 +1554,6 @@ USB_TYPE USBHost::resetDevice(USBDeviceConnected * dev)
     int index = findDevice(dev);
     if (index != -1) {
         USB_DBG("Resetting hub %d, port %d\n", dev->getHub(), dev->getPort());
-        Thread::wait(100);
         if (dev->getHub() == 0) {
             resetRootHub();
         }
@@ -599,8 +1562,8 @@ USB_TYPE USBHost::resetDevice(USBDeviceConnected * dev)
             dev->getHubParent()->portReset(dev->getPort());
         }
 #endif
-        Thread::wait(100);
-        deviceReset[index] = true;
+        Thread::wait(RESET_RECOVERY_TIME);
+        deviceState[index] |= DEVICE_STATE_RESET;
         return USB_TYPE_OK;
     }
 
@@ -690,29 +1653,111 @@ bool USBHost::addEndpoint(USBDeviceConnected * dev, uint8_t intf_nb, USBEndpoint
 
 int USBHost::findDevice(USBDeviceConnected * dev)
 {
-    for (int i = 0; i < MAX_DEVICE_CONNECTED; i++) {
-        if (dev == &devices[i]) {
-            return i;
-        }
+    // devices only live in the devices table: the index is given by the pointer
+    if ((dev < &devices[0]) || (dev >= &devices[MAX_DEVICE_CONNECTED])) {
+        return -1;
     }
-    return -1;
+    return dev - &devices[0];
 }
 
 int USBHost::findDevice(uint8_t hub, uint8_t port, USBHostHub * hub_parent)
 {
-    for (int i = 0; i < MAX_DEVICE_CONNECTED; i++) {
-        if (devices[i].getHub() == hub && devices[i].getPort() == port) {
-            if (hub_parent != NULL) {
-                if (hub_parent == devices[i].getHubParent())
-                    return i;
-            } else {
-                return i;
-            }
-        }
+    int hub_idx = findHub(hub_parent);
+    if ((hub_idx == -1) || (port == 0) || (port > MAX_HUB_PORT)) {
+        return -1;
+    }
+    int idx = portDevice[hub_idx][port - 1] - 1;
+    if ((idx == -1) || (devices[idx].getHub() != hub)) {
+        return -1;
     }
+    return idx;
+}
+
+// index of the port table of a hub: 0 for the root hub, k + 1 for hubs[k], -1 if unknown
+int USBHost::findHub(USBHostHub * hub_parent)
+{
+    if (hub_parent == NULL) {
+        return 0;
+    }
+#if MAX_HUB_NB
+    if ((hub_parent >= &hubs[0]) && (hub_parent < &hubs[MAX_HUB_NB])) {
+        return hub_parent - &hubs[0] + 1;
+    }
+#endif
     return -1;
 }
 
+// find a free address, starting after the last assigned one so that a device
+// which has just been unplugged does not get its address reused right away
+uint8_t USBHost::allocAddress()
+{
+    uint8_t addr = lastAddress;
+
+    for (int i = 0; i < MAX_DEVICE_ADDRESS; i++) {
+        addr = (addr >= MAX_DEVICE_ADDRESS) ? 1 : addr + 1;
+        uint32_t word = addressBitmap[addr / 32];
+        if (word == 0xFFFFFFFF) {
+            // whole word in use, go to the last address of this word
+            i += 31 - (addr % 32);
+            addr |= 31;
+            continue;
+        }
+        if (!(word & (1UL << (addr % 32)))) {
+            addressBitmap[addr / 32] |= (1UL << (addr % 32));
+            lastAddress = addr;
+            return addr;
+        }
+    }
+    return 0;
+}
+
+// give a device slot to a new device: address and lookup tables
+void USBHost::bindDevice(int idx, uint8_t hub, uint8_t port, bool lowSpeed, USBHostHub * hub_parent)
+{
+    // the slot may still be bound to a device which has not been completely enumerated
+    unbindDevice(idx);
+
+    devices[idx].init(hub, port, lowSpeed);
+    devices[idx].setHubParent(hub_parent);
+    deviceState[idx] = DEVICE_STATE_INITED;
+#if USBHOST_STATS
+    memset(&deviceStats[idx], 0, sizeof(USBDeviceStats));
+#endif
+#if USBHOST_SUSPEND
+    deviceActivity[idx] = getFrameNumber();
+    idleCheckArmed = true;
+#endif
+
+    // a slot owns at most one address: there are always enough addresses for MAX_DEVICE_CONNECTED devices
+    uint8_t addr = allocAddress();
+    devices[idx].setAddress(addr);
+    addressDevice[addr] = idx + 1;
+
+    int hub_idx = findHub(hub_parent);
+    if ((hub_idx != -1) && (port != 0) && (port <= MAX_HUB_PORT)) {
+        portDevice[hub_idx][port - 1] = idx + 1;
+    }
+}
+
+// release the address and the lookup table entries of a device slot
+void USBHost::unbindDevice(int idx)
+{
+    uint8_t addr = devices[idx].getAddress();
+    if (addr != 0) {
+        addressBitmap[addr / 32] &= ~(1UL << (addr % 32));
+        addressDevice[addr] = 0;
+        devices[idx].setAddress(0);
+    }
+
+    int hub_idx = findHub(devices[idx].getHubParent());
+    uint8_t port = devices[idx].getPort();
+    if ((hub_idx != -1) && (port != 0) && (port <= MAX_HUB_PORT) && (portDevice[hub_idx][port - 1] == idx + 1)) {
+        portDevice[hub_idx][port - 1] = 0;
+    }
+
+    deviceState[idx] = 0;
+}
+
 void USBHost::printList(ENDPOINT_TYPE type)
 {
 #if defined(DEBUG_EP_STATE) && !defined(USBHOST_OTHER)
@@ -764,6 +1809,13 @@ USB_TYPE USBHost::addTransfer(USBEndpoint * ed, uint8_t * buf, uint32_t len)
         return USB_TYPE_ERROR;
     }
 
+#if USBHOST_STATS
+    ed->setSubmitTime(us_ticker_read());
+#endif
+#if USBHOST_CAPTURE
+    USBHostCapture::submit(getController(), ed, td, buf, len, getFrameNumber());
+#endif
+
 #ifndef USBHOST_OTHER
     uint32_t token = (ed->isSetup() ? TD_SETUP : ( (ed->getDir() == IN) ? TD_IN : TD_OUT ));
 
@@ -779,16 +1831,33 @@ USB_TYPE USBHost::addTransfer(USBEndpoint * ed, uint8_t * buf, uint32_t len)
         td_toggle = 0;
     }
 
-    td->control      = (TD_ROUNDING | token | TD_DELAY_INT(0) | td_toggle | TD_CC);
-    td->currBufPtr   = buf;
-    td->bufEnd       = (buf + (len - 1));
-
     ENDPOINT_TYPE type = ed->getType();
 
-    disableList(type);
-    ed->queueTransfer();
+    // a long bulk transfer is split in TDs of USB_BULK_TD_LEN bytes, the last one takes the rest.
+    // Only the last TD interrupts: the intermediate TDs are reported with it in the done list.
+    // A short packet ends an intermediate TD (no rounding) in error and halts the ED
+    uint8_t nb = 1;
+    if ((type == BULK_ENDPOINT) && (len > USB_BULK_TD_LEN)) {
+        nb = MIN((len + USB_BULK_TD_LEN - 1) / USB_BULK_TD_LEN, ed->getMaxTDs());
+    }
+    for (uint8_t i = 0; i < nb; i++) {
+        uint32_t td_len = (i == nb - 1) ? len : USB_BULK_TD_LEN;
+        td = ed->getNextTD(i);
+        if (i == nb - 1) {
+            td->control  = (TD_ROUNDING | token | TD_DELAY_INT(0) | td_toggle | TD_CC);
+        } else {
+            td->control  = (token | TD_DELAY_INT(TD_DELAY_INT_NONE) | td_toggle | TD_CC);
+        }
+        td->currBufPtr   = buf;
+        td->bufEnd       = (buf + (td_len - 1));
+        buf += td_len;
+        len -= td_len;
+    }
+
+    // the TDs are appended behind the dummy tail TD: the list keeps running
+    ed->queueTransfer(nb);
     printList(type);
-    enableList(type);
+    fillList(type);
 #else
     /*  call method specific for endpoint  */
     td->currBufPtr   = buf;
@@ -874,7 +1943,7 @@ uint8_t USBHost::numberDriverAttached(USBDeviceConnected * dev)
     if (index == -1)
         return 0;
     for (uint8_t i = 0; i < MAX_INTF; i++) {
-        if (deviceAttachedDriver[index][i])
+        if (deviceAttachedDriver[index] & (1 << i))
             cnt++;
     }
     return cnt;
@@ -923,20 +1992,25 @@ USB_TYPE USBHost::enumerate(USBDeviceConnected * dev, IUSBEnumerator* pEnumerato
 
         pEnumerator->setVidPid( data[8] | (data[9] << 8), data[10] | (data[11] << 8) );
 
-        res = getConfigurationDescriptor(dev, data, sizeof(data), &total_conf_descr_length);
+        // fourth step: get the beginning of the configuration descriptor to have its total length
+        res = controlRead(  dev,
+                            USB_DEVICE_TO_HOST | USB_RECIPIENT_DEVICE,
+                            GET_DESCRIPTOR,
+                            (CONFIGURATION_DESCRIPTOR << 8) | (0),
+                            0, data, CONFIGURATION_DESCRIPTOR_LENGTH);
         if (res != USB_TYPE_OK) {
+            USB_ERR("GET CONF 1 DESCR FAILED");
             return res;
         }
+        total_conf_descr_length = data[2] | (data[3] << 8);
+        USB_DBG("TOTAL_LENGTH: %d \t NUM_INTERF: %d", total_conf_descr_length, data[4]);
 
-#if (DEBUG > 3)
-        USB_DBG("CONFIGURATION DESCRIPTOR:\r\n");
-        for (int i = 0; i < total_conf_descr_length; i++)
-            printf("%02X ", data[i]);
-        printf("\r\n\r\n");
-#endif
-
-        // Parse the configuration descriptor
-        parseConfDescr(dev, data, total_conf_descr_length, pEnumerator);
+        // fifth step: parse the whole configuration descriptor while it is read
+        res = readConfDescr(dev, total_conf_descr_length, pEnumerator);
+        if (res != USB_TYPE_OK) {
+            USB_ERR("GET CONF DESCR FAILED");
+            return res;
+        }
 
         // only set configuration if not enumerated before
         if (!dev->isEnumerated()) {
@@ -963,72 +2037,143 @@ USB_TYPE USBHost::enumerate(USBDeviceConnected * dev, IUSBEnumerator* pEnumerato
 
     return USB_TYPE_OK;
 }
+// read the configuration descriptor in chunks of CONF_DESCR_CHUNK_SIZE bytes, each chunk is parsed when received
+USB_TYPE USBHost::readConfDescr(USBDeviceConnected * dev, uint16_t len, IUSBEnumerator* pEnumerator)
+{
+    Lock lock(this);
+    conf_parser_t parser;
+    uint32_t offset = 0;
+    uint32_t chunk_len;
+    USB_TYPE res;
+
+    memset(&parser, 0, sizeof(parser));
+
+    res = controlSetup(dev, USB_DEVICE_TO_HOST | USB_RECIPIENT_DEVICE, GET_DESCRIPTOR, (CONFIGURATION_DESCRIPTOR << 8) | (0), 0, len);
+    if (res != USB_TYPE_IDLE) {
+        return res;
+    }
+
+    // data stage split in several TDs, each chunk is parsed before the next one is read in the same buffer
+    while (offset < len) {
+        chunk_len = MIN(sizeof(data), len - offset);
+        res = controlStage(TD_IN, data, chunk_len);
+        if (res != USB_TYPE_IDLE) {
+            return res;
+        }
+
+#if (DEBUG > 3)
+        USB_DBG("CONFIGURATION DESCRIPTOR [%d - %d]:\r\n", offset, offset + control->getLengthTransferred());
+        for (int i = 0; i < control->getLengthTransferred(); i++)
+            printf("%02X ", data[i]);
+        printf("\r\n\r\n");
+#endif
+
+        parseConfDescr(dev, &parser, data, control->getLengthTransferred(), pEnumerator);
+        if (parser.error) {
+            USB_ERR("BAD CONF DESCR [offset: %d]", offset);
+            return USB_TYPE_ERROR;
+        }
+        offset += chunk_len;
+
+        // short packet: end of the data stage
+        if ((uint32_t)control->getLengthTransferred() < chunk_len) {
+            break;
+        }
+    }
+
+    res = controlStage(TD_OUT, NULL, 0);
+    if (res != USB_TYPE_IDLE) {
+        return res;
+    }
+
+    return USB_TYPE_OK;
+}
+
+// split the bytes read in descriptors, a descriptor may be spread over two chunks
+void USBHost::parseConfDescr(USBDeviceConnected * dev, conf_parser_t * parser, uint8_t * buf, uint32_t len, IUSBEnumerator* pEnumerator)
+{
+    if (parser->error) {
+        return;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        if (parser->read == 0) {
+            parser->len = buf[i];
+            memset(parser->descr, 0, sizeof(parser->descr));
+            // bad descriptor length: the next descriptors cannot be found, the enumeration fails
+            if (parser->len < 2) {
+                parser->error = true;
+                return;
+            }
+        }
+        // only the beginning of a descriptor is used
+        if (parser->read < sizeof(parser->descr)) {
+            parser->descr[parser->read] = buf[i];
+        }
+        parser->read++;
+        if (parser->read == parser->len) {
+            parseDescr(dev, parser, pEnumerator);
+            parser->read = 0;
+        }
+    }
+}
+
 // this method fills the USBDeviceConnected object: class,.... . It also add endpoints found in the descriptor.
-void USBHost::parseConfDescr(USBDeviceConnected * dev, uint8_t * conf_descr, uint32_t len, IUSBEnumerator* pEnumerator)
+void USBHost::parseDescr(USBDeviceConnected * dev, conf_parser_t * parser, IUSBEnumerator* pEnumerator)
 {
-    uint32_t index = 0;
-    uint32_t len_desc = 0;
-    uint8_t id = 0;
-    int nb_endpoints_used = 0;
+    uint8_t id = parser->descr[1];
     USBEndpoint * ep = NULL;
-    uint8_t intf_nb = 0;
-    bool parsing_intf = false;
-    uint8_t current_intf = 0;
-
-    while (index < len) {
-        len_desc = conf_descr[index];
-        id = conf_descr[index+1];
-        switch (id) {
-            case CONFIGURATION_DESCRIPTOR:
-                USB_DBG("dev: %p has %d intf", dev, conf_descr[4]);
-                dev->setNbIntf(conf_descr[4]);
-                break;
-            case INTERFACE_DESCRIPTOR:
-                if(pEnumerator->parseInterface(conf_descr[index + 2], conf_descr[index + 5], conf_descr[index + 6], conf_descr[index + 7])) {
-                    if (intf_nb++ <= MAX_INTF) {
-                        current_intf = conf_descr[index + 2];
-                        dev->addInterface(current_intf, conf_descr[index + 5], conf_descr[index + 6], conf_descr[index + 7]);
-                        nb_endpoints_used = 0;
-                        USB_DBG("ADD INTF %d on device %p: class: %d, subclass: %d, proto: %d", current_intf, dev, conf_descr[index + 5],conf_descr[index + 6],conf_descr[index + 7]);
-                    } else {
-                        USB_DBG("Drop intf...");
-                    }
-                    parsing_intf = true;
+
+    switch (id) {
+        case CONFIGURATION_DESCRIPTOR:
+            USB_DBG("dev: %p has %d intf", dev, parser->descr[4]);
+            dev->setNbIntf(parser->descr[4]);
+            // bmAttributes
+            dev->setRemoteWakeup(parser->descr[7] & (1 << 5));
+            break;
+        case INTERFACE_DESCRIPTOR:
+            if(pEnumerator->parseInterface(parser->descr[2], parser->descr[5], parser->descr[6], parser->descr[7])) {
+                if (parser->intf_nb++ <= MAX_INTF) {
+                    parser->current_intf = parser->descr[2];
+                    dev->addInterface(parser->current_intf, parser->descr[5], parser->descr[6], parser->descr[7]);
+                    parser->nb_endpoints_used = 0;
+                    USB_DBG("ADD INTF %d on device %p: class: %d, subclass: %d, proto: %d", parser->current_intf, dev, parser->descr[5],parser->descr[6],parser->descr[7]);
                 } else {
-                    parsing_intf = false;
+                    USB_DBG("Drop intf...");
                 }
-                break;
-            case ENDPOINT_DESCRIPTOR:
-                if (parsing_intf && (intf_nb <= MAX_INTF) ) {
-                    if (nb_endpoints_used < MAX_ENDPOINT_PER_INTERFACE) {
-                        if( pEnumerator->useEndpoint(current_intf, (ENDPOINT_TYPE)(conf_descr[index + 3] & 0x03), (ENDPOINT_DIRECTION)((conf_descr[index + 2] >> 7) + 1)) ) {
-                            // if the USBEndpoint is isochronous -> skip it (TODO: fix this)
-                            if ((conf_descr[index + 3] & 0x03) != ISOCHRONOUS_ENDPOINT) {
-                                ep = newEndpoint((ENDPOINT_TYPE)(conf_descr[index+3] & 0x03),
-                                                 (ENDPOINT_DIRECTION)((conf_descr[index + 2] >> 7) + 1),
-                                                 conf_descr[index + 4] | (conf_descr[index + 5] << 8),
-                                                 conf_descr[index + 2] & 0x0f);
-                                USB_DBG("ADD USBEndpoint %p, on interf %d on device %p", ep, current_intf, dev);
-                                if (ep != NULL && dev != NULL) {
-                                    addEndpoint(dev, current_intf, ep);
-                                } else {
-                                    USB_DBG("EP NULL");
-                                }
-                                nb_endpoints_used++;
+                parser->parsing_intf = true;
+            } else {
+                parser->parsing_intf = false;
+            }
+            break;
+        case ENDPOINT_DESCRIPTOR:
+            if (parser->parsing_intf && (parser->intf_nb <= MAX_INTF) ) {
+                if (parser->nb_endpoints_used < MAX_ENDPOINT_PER_INTERFACE) {
+                    if( pEnumerator->useEndpoint(parser->current_intf, (ENDPOINT_TYPE)(parser->descr[3] & 0x03), (ENDPOINT_DIRECTION)((parser->descr[2] >> 7) + 1)) ) {
+                        // if the USBEndpoint is isochronous -> skip it (TODO: fix this)
+                        if ((parser->descr[3] & 0x03) != ISOCHRONOUS_ENDPOINT) {
+                            ep = newEndpoint((ENDPOINT_TYPE)(parser->descr[3] & 0x03),
+                                             (ENDPOINT_DIRECTION)((parser->descr[2] >> 7) + 1),
+                                             parser->descr[4] | (parser->descr[5] << 8),
+                                             parser->descr[2] & 0x0f);
+                            USB_DBG("ADD USBEndpoint %p, on interf %d on device %p", ep, parser->current_intf, dev);
+                            if (ep != NULL && dev != NULL) {
+                                addEndpoint(dev, parser->current_intf, ep);
                             } else {
-                                USB_DBG("ISO USBEndpoint NOT SUPPORTED");
+                                USB_DBG("EP NULL");
                             }
+                            parser->nb_endpoints_used++;
+                        } else {
+                            USB_DBG("ISO USBEndpoint NOT SUPPORTED");
                         }
                     }
                 }
-                break;
-            case HID_DESCRIPTOR:
-                lenReportDescr = conf_descr[index + 7] | (conf_descr[index + 8] << 8);
-                break;
-            default:
-                break;
-        }
-        index += len_desc;
+            }
+            break;
+        case HID_DESCRIPTOR:
+            lenReportDescr = parser->descr[7] | (parser->descr[8] << 8);
+            break;
+        default:
+            break;
     }
 }
 
@@ -1071,6 +2216,15 @@ USB_TYPE USBHost::generalTransfer(USBDeviceConnected * dev, USBEndpoint * ep, ui
         return USB_TYPE_ERROR;
     }
 
+#if USBHOST_SUSPEND
+    if (isSuspended(dev)) {
+        res = resumeDevice(dev);
+        if (res != USB_TYPE_OK) {
+            return res;
+        }
+    }
+#endif
+
     if (ep == NULL) {
         USB_ERR("ep NULL");
         return USB_TYPE_ERROR;
@@ -1103,18 +2257,19 @@ USB_TYPE USBHost::generalTransfer(USBDeviceConnected * dev, USBEndpoint * ep, ui
 
     if ((blocking)&& (res == USB_TYPE_PROCESSING)) {
 #ifdef USBHOST_OTHER
-        osEvent  event = ep->ep_queue.get(TD_TIMEOUT);
-        if (event.status == osEventTimeout)
+        if (!ep->waitTransfer(TD_TIMEOUT))
         {
+#if USBHOST_STATS
+            countTimeout(ep);
+#endif
             /*  control endpoint is confusing for merge on b */
             disableList(CONTROL_ENDPOINT);
             ep->setState(USB_TYPE_ERROR);
-            ep->ep_queue.get(0);
             ep->unqueueTransfer(ep->getProcessedTD());
             enableList(CONTROL_ENDPOINT);
         }
 #else
-        ep->ep_queue.get();
+        ep->waitTransfer();
 #endif
         res = ep->getState();
 
@@ -1147,74 +2302,25 @@ USB_TYPE USBHost::controlTransfer(USBDeviceConnected * dev, uint8_t requestType,
     Lock lock(this);
     USB_DBG_TRANSFER("----- CONTROL %s [dev: %p - hub: %d - port: %d] ------", (write) ? "WRITE" : "READ", dev, dev->getHub(), dev->getPort());
 
-    int length_transfer = len;
     USB_TYPE res;
-    uint32_t token;
-
-    control->setSpeed(dev->getSpeed());
-    control->setSize(dev->getSizeControlEndpoint());
-    if (dev->isActiveAddress()) {
-        control->setDeviceAddress(dev->getAddress());
-    } else {
-        control->setDeviceAddress(0);
-    }
-
-    USB_DBG_TRANSFER("Control transfer on device: %d\r\n", control->getDeviceAddress());
-    fillControlBuf(requestType, request, value, index, len);
-
-#if DEBUG_TRANSFER
-    USB_DBG_TRANSFER("SETUP PACKET: ");
-    for (int i = 0; i < 8; i++)
-        printf("%01X ", setupPacket[i]);
-    printf("\r\n");
-#endif
 
-    control->setNextToken(TD_SETUP);
-    res = addTransfer(control, (uint8_t*)setupPacket, 8);
-
-    if (res == USB_TYPE_PROCESSING)
-#ifdef USBHOST_OTHER
-    {   osEvent  event = control->ep_queue.get(TD_TIMEOUT_CTRL);
-        if (event.status == osEventTimeout) {
-            disableList(CONTROL_ENDPOINT);
-            control->setState(USB_TYPE_ERROR);
-            control->ep_queue.get(0);
-            control->unqueueTransfer(control->getProcessedTD());
-            enableList(CONTROL_ENDPOINT);
+#if USBHOST_SUSPEND
+    if (isSuspended(dev)) {
+        res = resumeDevice(dev);
+        if (res != USB_TYPE_OK) {
+            return res;
         }
     }
-#else
-        control->ep_queue.get();
 #endif
-    res = control->getState();
 
-    USB_DBG_TRANSFER("CONTROL setup stage %s", control->getStateString());
+    res = controlSetup(dev, requestType, request, value, index, len);
 
     if (res != USB_TYPE_IDLE) {
         return res;
     }
 
-    if (length_transfer) {
-        token = (write) ? TD_OUT : TD_IN;
-        control->setNextToken(token);
-        res = addTransfer(control, (uint8_t *)buf, length_transfer);
-
-        if (res == USB_TYPE_PROCESSING)
-#ifdef USBHOST_OTHER
-        {   osEvent  event = control->ep_queue.get(TD_TIMEOUT_CTRL);
-            if (event.status == osEventTimeout)
-            {
-                disableList(CONTROL_ENDPOINT);
-                control->setState(USB_TYPE_ERROR);
-                control->ep_queue.get(0);
-                control->unqueueTransfer(control->getProcessedTD());
-                enableList(CONTROL_ENDPOINT);
-            }
-        }
-#else
-        control->ep_queue.get();
-#endif
-        res = control->getState();
+    if (len) {
+        res = controlStage((write) ? TD_OUT : TD_IN, buf, len);
 
 #if DEBUG_TRANSFER
         USB_DBG_TRANSFER("CONTROL %s stage %s", (write) ? "WRITE" : "READ", control->getStateString());
@@ -1236,33 +2342,75 @@ USB_TYPE USBHost::controlTransfer(USBDeviceConnected * dev, uint8_t requestType,
         }
     }
 
-    token = (write) ? TD_IN : TD_OUT;
+    res = controlStage((write) ? TD_IN : TD_OUT, NULL, 0);
+
+    USB_DBG_TRANSFER("CONTROL ack stage %s", control->getStateString());
+
+    if (res != USB_TYPE_IDLE)
+        return res;
+
+    return USB_TYPE_OK;
+}
+
+// address the control endpoint to dev and run the setup stage (called with the lock held)
+USB_TYPE USBHost::controlSetup(USBDeviceConnected * dev, uint8_t requestType, uint8_t request, uint32_t value, uint32_t index, uint32_t len)
+{
+    USB_TYPE res;
+
+    control->setSpeed(dev->getSpeed());
+    control->setSize(dev->getSizeControlEndpoint());
+    if (dev->isActiveAddress()) {
+        control->setDeviceAddress(dev->getAddress());
+    } else {
+        control->setDeviceAddress(0);
+    }
+
+    // the control endpoint is shared: its TDs are accounted to the device being addressed
+    control->dev = dev;
+
+    USB_DBG_TRANSFER("Control transfer on device: %d\r\n", control->getDeviceAddress());
+    fillControlBuf(requestType, request, value, index, len);
+
+#if DEBUG_TRANSFER
+    USB_DBG_TRANSFER("SETUP PACKET: ");
+    for (int i = 0; i < 8; i++)
+        printf("%01X ", setupPacket[i]);
+    printf("\r\n");
+#endif
+
+    res = controlStage(TD_SETUP, (uint8_t*)setupPacket, 8);
+
+    USB_DBG_TRANSFER("CONTROL setup stage %s", control->getStateString());
+
+    return res;
+}
+
+// run one stage of a control transfer and wait for its end (called with the lock held)
+USB_TYPE USBHost::controlStage(uint32_t token, uint8_t * buf, uint32_t len)
+{
+    USB_TYPE res;
+
     control->setNextToken(token);
-    res = addTransfer(control, NULL, 0);
+    res = addTransfer(control, buf, len);
+
     if (res == USB_TYPE_PROCESSING)
 #ifdef USBHOST_OTHER
     {
-        osEvent  event = control->ep_queue.get(TD_TIMEOUT_CTRL);
-        if (event.status == osEventTimeout)
-        {
+        if (!control->waitTransfer(TD_TIMEOUT_CTRL)) {
+#if USBHOST_STATS
+            countTimeout(control);
+#endif
             disableList(CONTROL_ENDPOINT);
             control->setState(USB_TYPE_ERROR);
-            control->ep_queue.get(0);
             control->unqueueTransfer(control->getProcessedTD());
             enableList(CONTROL_ENDPOINT);
         }
     }
 #else
-        control->ep_queue.get();
+        control->waitTransfer();
 #endif
-    res = control->getState();
-
-    USB_DBG_TRANSFER("CONTROL ack stage %s", control->getStateString());
 
-    if (res != USB_TYPE_IDLE)
-        return res;
-
-    return USB_TYPE_OK;
+    return control->getState();
 }
 
 
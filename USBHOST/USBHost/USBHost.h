@@ -25,19 +25,36 @@
 #include "USBHostConf.h"
 #include "rtos.h"
 #include "dbg.h"
+#include "USBHostCapture.h"
+#include "USBHostTrace.h"
+#include "USBHostLatency.h"
+#include "USBHostBoot.h"
 #include "USBHostHub.h"
 
 /**
 * USBHost class
-*   This class is a singleton. All drivers have a reference on the static USBHost instance
+*   There is one instance per host controller, each one with its own devices and usb_thread.
+*   A driver has a reference on the USBHost instance it has been bound to
 */
 class USBHost : public USBHALHost {
 public:
     /**
-    * Static method to create or retrieve the single USBHost instance
+    * Static method to retrieve the first USBHost instance running, the instance of the
+    * default controller (USBHOST_DEFAULT_CONTROLLER) is created if none is running
+    *
+    * @returns pointer on the USBHost instance
     */
     static USBHost * getHostInst();
 
+    /**
+    * Static method to create or retrieve the USBHost instance of a host controller
+    *
+    * @param controller index of the host controller (0 to USBHOST_CONTROLLER_NUM - 1)
+    *
+    * @returns pointer on the USBHost instance, NULL if there is no such controller
+    */
+    static USBHost * getHostInst(uint8_t controller);
+
     /**
     * Control read: setup stage, data stage and status stage
     *
@@ -130,7 +147,7 @@ public:
     USB_TYPE enumerate(USBDeviceConnected * dev, IUSBEnumerator* pEnumerator);
 
     /**
-    * reset a specific device
+    * reset a specific device, the connection must have been debounced
     *
     * @param dev device which will be resetted
     */
@@ -145,6 +162,191 @@ public:
     */
     USBDeviceConnected * getDevice(uint8_t index);
 
+    /**
+    * Get a device by its USB address
+    *
+    * @param addr address assigned to the device (1 to MAX_DEVICE_ADDRESS)
+    *
+    * @returns pointer on the device, NULL if no device uses this address
+    */
+    USBDeviceConnected * getDeviceByAddress(uint8_t addr);
+
+#if MAX_HUB_NB
+    /**
+    * Called by a hub when its status change endpoint has reported changes.
+    * The hub is serviced by the hub thread so that the blocking port requests
+    * do not delay the callbacks of the other devices in the usb_thread
+    *
+    * @param hub hub to be serviced
+    */
+    void hubChanged(USBHostHub * hub);
+
+    /**
+    * Called by a hub before resetting one of its ports: a single device can
+    * answer on the default address at a time, the token is held by one port
+    * of one hub from its reset until its device is addressed
+    *
+    * @param hub hub which will reset a port
+    * @param port port which will be reset
+    *
+    * @returns true if the port can be reset, false if a port (of this hub or another one) is being reset or addressed
+    */
+    bool lockDefaultAddress(USBHostHub * hub, uint8_t port);
+
+    /**
+    * Called when the device reset by a hub has left the default address (or could not be addressed).
+    * The hubs waiting for the default address are serviced again
+    *
+    * @param hub hub which has reset the device
+    * @param port port of the device, 0 for any port of the hub (hub disconnected)
+    */
+    void releaseDefaultAddress(USBHostHub * hub, uint8_t port);
+#endif
+
+    /**
+    * Get the frame clock of the host controller: one frame per ms, counted since
+    * the controller has been started. The frame number of the controller is
+    * extended to 32 bits, so the clock does not wrap for 49 days
+    *
+    * @returns current frame number
+    */
+    uint32_t getFrameNumber();
+
+    /**
+    * Attach a handler called every N frames, in phase with the frames of the bus.
+    * The handler is called from the usb_thread (not in ISR), a call is skipped if the
+    * previous one is still pending. The start of frame interrupt is only enabled
+    * while a handler is attached
+    *
+    * @param fn handler
+    * @param frames period in frames (1 ms)
+    *
+    * @returns true if the handler has been attached, false if MAX_FRAME_HANDLERS handlers are attached
+    */
+    bool attachFrameHandler(Callback<void()> fn, uint16_t frames);
+
+    /**
+    * Attach a member function called every N frames, see attachFrameHandler(Callback<void()>, uint16_t)
+    *
+    * @param tptr pointer to the object to call the member function on
+    * @param mptr pointer to the member function to be called
+    * @param frames period in frames (1 ms)
+    *
+    * @returns true if the handler has been attached
+    */
+    template<typename T>
+    inline bool attachFrameHandler(T* tptr, void (T::*mptr)(void), uint16_t frames) {
+        return attachFrameHandler(Callback<void()>(tptr, mptr), frames);
+    }
+
+    /**
+    * Detach a handler attached with attachFrameHandler
+    *
+    * @param fn handler
+    */
+    void detachFrameHandler(Callback<void()> fn);
+
+#if USBHOST_STATS
+    /**
+    * Get a snapshot of the transfer counters and latency histograms of a device
+    *
+    * @param dev device
+    * @param stats filled with the statistics of the device since its enumeration (or resetStats)
+    *
+    * @returns false if dev is not a connected device
+    */
+    bool getDeviceStats(USBDeviceConnected * dev, USBDeviceStats * stats);
+
+    /**
+    * Get a snapshot of the transfer counters of an endpoint
+    *
+    * @param ep endpoint
+    * @param stats filled with the counters of the endpoint since its allocation (or resetStats)
+    *
+    * @returns false if ep is NULL
+    */
+    bool getEndpointStats(USBEndpoint * ep, USBEndpointStats * stats);
+
+    /**
+    * Clear the statistics of a device and of its endpoints
+    *
+    * @param dev device
+    */
+    void resetStats(USBDeviceConnected * dev);
+
+    /**
+    * Get the usage and high-water marks of the ED, TD and mail pools
+    *
+    * @param stats filled with the usage of the pools
+    */
+    void getPoolStats(USBPoolStats * stats);
+#endif
+
+#if USBHOST_CHURN
+    /**
+    * Stress the hotplug: the device on the root port is unplugged and plugged
+    * again by software, with the devices behind it when it is a hub. Each cycle
+    * waits until all the devices are enumerated again and their drivers connected
+    * (USB_CHURN_SETTLE). The transfers of the drivers stay queued and a thread
+    * loads the devices in use with control transfers during the cycles.
+    * A leak is reported from the trend of the pools over the cycles, not from
+    * two samples. A summary is printed at the end
+    *
+    * @param cycles number of unplug/plug cycles
+    * @param stats filled with the enumeration times, the pools and their growth, the load
+    *
+    * @returns false if no device is on the root port or if it is lost
+    */
+    bool churn(uint32_t cycles, USBChurnStats * stats);
+#endif
+
+#if USBHOST_SUSPEND
+    /**
+    * Suspend a device: remote wakeup is enabled if the device supports it, then
+    * its port (on a hub or the root port) is suspended and its endpoints are no
+    * more polled. A transfer requested on a suspended device resumes it first
+    *
+    * @param dev device to be suspended
+    *
+    * @returns USB_TYPE_OK if the device is suspended
+    */
+    USB_TYPE suspendDevice(USBDeviceConnected * dev);
+
+    /**
+    * Resume a suspended device (blocking until the end of the resume recovery)
+    *
+    * @param dev device to be resumed
+    *
+    * @returns USB_TYPE_OK if the device is active
+    */
+    USB_TYPE resumeDevice(USBDeviceConnected * dev);
+
+    /**
+    * Check if a device is suspended
+    *
+    * @param dev device
+    *
+    * @returns true if the device is suspended
+    */
+    bool isSuspended(USBDeviceConnected * dev);
+
+    /**
+    * Set the idle time after which a device is suspended by the usb_thread. Only the
+    * devices supporting remote wakeup are suspended, a hub once all its devices are
+    *
+    * @param ms time without any completed transfer, 0 to disable the selective suspend
+    */
+    void setSuspendIdleTime(uint32_t ms);
+
+    /**
+    * When enabled, the controller itself is suspended once every device is
+    * suspended. It is resumed by a remote wakeup or by a transfer request
+    *
+    * @param enable true to suspend the controller when all the devices are suspended
+    */
+    void setControllerIdle(bool enable);
+#endif
+
     /*
     * If there is a HID device connected, the host stores the length of the report descriptor.
     * This avoid to the driver to re-ask the configuration descriptor to request the report descriptor
@@ -168,7 +370,7 @@ public:
         int index = findDevice(dev);
         if ((index != -1) && (mptr != NULL) && (tptr != NULL)) {
             USB_DBG("register driver for dev: %p on intf: %d", dev, intf);
-            deviceAttachedDriver[index][intf] = true;
+            deviceAttachedDriver[index] |= (1 << intf);
             dev->onDisconnect(intf, tptr, mptr);
         }
     }
@@ -184,7 +386,7 @@ public:
         int index = findDevice(dev);
         if ((index != -1) && (fn != NULL)) {
             USB_DBG("register driver for dev: %p on intf: %d", dev, intf);
-            deviceAttachedDriver[index][intf] = true;
+            deviceAttachedDriver[index] |= (1 << intf);
             dev->onDisconnect(intf, fn);
         }
     }
@@ -202,40 +404,64 @@ public:
     };
 
     friend class USBHostHub;
+    friend class USBHALHost;
 
 protected:
 
     /**
-    * Virtual method called when a transfer has been completed
+    * Method called when a transfer has been completed
     *
     * @param addr list of the TDs which have been completed
     */
-    virtual void transferCompleted(volatile uint32_t addr);
+    void transferCompleted(volatile uint32_t addr);
+
+    /**
+    * Method called at each start of frame when a frame handler is attached (ISR context)
+    */
+    void frameStarted();
+
+#if USBHOST_SUSPEND
+    /**
+    * Method called when a suspended port has been resumed (ISR context or hub thread)
+    *
+    * @param hub hub number of the device
+    * @param port port number of the device
+    * @param hub_parent reference on the parent hub
+    */
+    void deviceResumed(int hub, int port, USBHostHub * hub_parent);
+
+    /**
+    * Method called when a resume has been detected while the controller is suspended (ISR context)
+    */
+    void resumeDetected();
+#endif
 
     /**
-    * Virtual method called when a device has been connected
+    * Method called when a device has been connected
     *
     * @param hub hub number of the device
     * @param port port number of the device
     * @param lowSpeed 1 if low speed, 0 otherwise
     * @param hub_parent reference on the parent hub
+    *
+    * @returns true if the device will be enumerated by the usb_thread, false otherwise
     */
-    virtual void deviceConnected(int hub, int port, bool lowSpeed, USBHostHub * hub_parent = NULL);
+    bool deviceConnected(int hub, int port, bool lowSpeed, USBHostHub * hub_parent = NULL);
 
     /**
-    * Virtuel method called when a device has been disconnected
+    * Method called when a device has been disconnected
     *
     * @param hub hub number of the device
     * @param port port number of the device
     * @param addr list of the TDs which have been completed to dequeue freed TDs
     */
-    virtual void deviceDisconnected(int hub, int port, USBHostHub * hub_parent, volatile uint32_t addr);
+    void deviceDisconnected(int hub, int port, USBHostHub * hub_parent, volatile uint32_t addr);
 
 
 private:
-    // singleton class -> constructor is private
-    USBHost();
-    static USBHost * instHost;
+    // one instance per controller -> constructor is private
+    USBHost(uint8_t controller);
+    static USBHost * instHost[USBHOST_CONTROLLER_NUM];
     uint16_t  lenReportDescr;
 
     // endpoints
@@ -255,10 +481,16 @@ private:
 
     // devices connected
     USBDeviceConnected devices[MAX_DEVICE_CONNECTED];
-    bool  deviceInUse[MAX_DEVICE_CONNECTED];
-    bool  deviceAttachedDriver[MAX_DEVICE_CONNECTED][MAX_INTF];
-    bool  deviceReset[MAX_DEVICE_CONNECTED];
-    bool  deviceInited[MAX_DEVICE_CONNECTED];
+    uint8_t deviceState[MAX_DEVICE_CONNECTED];              // DEVICE_STATE_* flags
+    uint8_t deviceAttachedDriver[MAX_DEVICE_CONNECTED];     // one bit per interface
+
+    // lookup tables, a device is stored as its index + 1 (0: no device)
+    uint8_t addressDevice[MAX_DEVICE_ADDRESS + 1];
+    uint8_t portDevice[MAX_HUB_NB + 1][MAX_HUB_PORT];      // [0]: root hub, [k + 1]: hubs[k]
+
+    // addresses in use (bit n: address n), allocation starts after the last assigned one
+    uint32_t addressBitmap[(MAX_DEVICE_ADDRESS + 32) / 32];
+    uint8_t lastAddress;
 
 #if MAX_HUB_NB
     USBHostHub hubs[MAX_HUB_NB];
@@ -268,6 +500,58 @@ private:
     // to store a setup packet
     uint8_t  setupPacket[8];
 
+    // frame clock, extended from the frame number of the controller
+    uint32_t frameClock;
+    uint32_t lastFrame;
+    // reads the frame number at least twice per wrap of the controller counter
+    Ticker frameClockTicker;
+    void startFrameClock();
+    void updateFrameClock();
+
+    // handlers called every N frames (period 0: free)
+    typedef struct {
+        Callback<void()> fn;
+        uint16_t period;
+        uint16_t count;
+        volatile bool pending;      // a FRAME_EVENT is queued for this handler
+    } frame_handler_t;
+    frame_handler_t frameHandlers[MAX_FRAME_HANDLERS];
+    uint8_t nbFrameHandlers;
+
+#if USBHOST_STATS
+    USBDeviceStats deviceStats[MAX_DEVICE_CONNECTED];
+    void countTransfer(USBEndpoint * ep, volatile HCTD * td, uint8_t state, uint32_t now);
+    void countTimeout(USBEndpoint * ep);
+    static void countLatency(uint32_t * histogram, uint32_t us);
+    USBPoolStats poolStats;
+    void countPool(USBPoolUsage * pool, int delta);
+#endif
+
+#if USBHOST_CHURN
+    int devicesInUse();
+    bool churnCycles(uint32_t cycles, USBChurnStats * stats);
+    void churnLoad();
+    volatile bool churnRunning;
+    volatile uint32_t churnTransfers;
+    volatile uint32_t churnErrors;
+#endif
+
+#if USBHOST_SUSPEND
+    // selective suspend
+    uint32_t deviceActivity[MAX_DEVICE_CONNECTED];         // frame of the last completed transfer
+    uint32_t suspendIdleTime;
+    uint32_t nextIdleCheck;
+    bool idleCheckArmed;                                   // a device may still be suspended
+    bool controllerIdle;
+    bool controllerSuspended;
+    uint32_t idleCheckTimeout();
+    void checkIdle();
+    bool childrenSuspended(USBDeviceConnected * dev);
+    void skipEndpoints(USBDeviceConnected * dev, bool skip);
+    void resumeCompleted(int idx);
+    void wakeController();
+#endif
+
     typedef struct {
         uint8_t event_id;
         void * td_addr;
@@ -280,15 +564,39 @@ private:
 
     Thread usbThread;
     void usb_process();
-    Mail<message_t, 10> mail_usb_event;
+    Mail<message_t, USB_MAIL_SIZE> mail_usb_event;
+    message_t * allocMessage();
+    void freeMessage(message_t * usb_msg);
+#if MAX_HUB_NB
+    // a hub is queued at most once: its status change endpoint is polled again once serviced
+    Thread hubThread;
+    void hub_process();
+    Queue<USBHostHub, MAX_HUB_NB> queue_hub_event;
+    volatile bool hub_queued[MAX_HUB_NB];
+    USBHostHub * defaultAddressHub;
+    uint8_t defaultAddressPort;
+#endif
     Mutex usb_mutex;
     Mutex td_mutex;
 
-    // buffer for conf descriptor
-    uint8_t data[415];
+    // buffer for the device descriptor and the chunks of the conf descriptor
+    uint8_t data[CONF_DESCR_CHUNK_SIZE];
+
+    // parsing state of the conf descriptor, kept from one chunk to the next one
+    typedef struct {
+        uint8_t descr[9];       // beginning of the current descriptor (fields used by the parser)
+        uint8_t len;            // length of the current descriptor
+        uint8_t read;           // bytes of the current descriptor already received
+        uint8_t intf_nb;
+        uint8_t current_intf;
+        bool parsing_intf;
+        bool error;             // malformed descriptor: the following bytes are not parsed
+        int nb_endpoints_used;
+    } conf_parser_t;
 
     /**
-    * Add a transfer on the TD linked list associated to an ED
+    * Add a transfer on the TD linked list associated to an ED, split on several TDs
+    * when it is a long bulk transfer (OHCI, USB_BULK_TD_LEN)
     *
     * @param ed the transfer is associated to this ed
     * @param buf pointer on a buffer where will be read/write data to send or receive
@@ -381,9 +689,17 @@ private:
                                 bool write) ;
 
     void fillControlBuf(uint8_t requestType, uint8_t request, uint16_t value, uint16_t index, int len) ;
-    void parseConfDescr(USBDeviceConnected * dev, uint8_t * conf_descr, uint32_t len, IUSBEnumerator* pEnumerator) ;
+    USB_TYPE controlSetup(USBDeviceConnected * dev, uint8_t requestType, uint8_t request, uint32_t value, uint32_t index, uint32_t len) ;
+    USB_TYPE controlStage(uint32_t token, uint8_t * buf, uint32_t len) ;
+    USB_TYPE readConfDescr(USBDeviceConnected * dev, uint16_t len, IUSBEnumerator* pEnumerator) ;
+    void parseConfDescr(USBDeviceConnected * dev, conf_parser_t * parser, uint8_t * buf, uint32_t len, IUSBEnumerator* pEnumerator) ;
+    void parseDescr(USBDeviceConnected * dev, conf_parser_t * parser, IUSBEnumerator* pEnumerator) ;
     int findDevice(USBDeviceConnected * dev) ;
     int findDevice(uint8_t hub, uint8_t port, USBHostHub * hub_parent = NULL) ;
+    int findHub(USBHostHub * hub_parent);
+    uint8_t allocAddress();
+    void bindDevice(int idx, uint8_t hub, uint8_t port, bool lowSpeed, USBHostHub * hub_parent);
+    void unbindDevice(int idx);
     uint8_t numberDriverAttached(USBDeviceConnected * dev);
 
     /////////////////////////
@@ -393,4 +709,40 @@ private:
 
 };
 
+/*
+ * Controller events: USBHost is the only class derived from USBHALHost, they are
+ * dispatched at compile time instead of through a vtable (called in ISR)
+ */
+inline void USBHALHost::deviceConnected(int hub, int port, bool lowSpeed, USBHostHub * hub_parent)
+{
+    static_cast<USBHost *>(this)->deviceConnected(hub, port, lowSpeed, hub_parent);
+}
+
+inline void USBHALHost::deviceDisconnected(int hub, int port, USBHostHub * hub_parent, volatile uint32_t addr)
+{
+    static_cast<USBHost *>(this)->deviceDisconnected(hub, port, hub_parent, addr);
+}
+
+inline void USBHALHost::transferCompleted(volatile uint32_t addr)
+{
+    static_cast<USBHost *>(this)->transferCompleted(addr);
+}
+
+inline void USBHALHost::frameStarted()
+{
+    static_cast<USBHost *>(this)->frameStarted();
+}
+
+#if USBHOST_SUSPEND
+inline void USBHALHost::deviceResumed(int hub, int port, USBHostHub * hub_parent)
+{
+    static_cast<USBHost *>(this)->deviceResumed(hub, port, hub_parent);
+}
+
+inline void USBHALHost::resumeDetected()
+{
+    static_cast<USBHost *>(this)->resumeDetected();
+}
+#endif
+
 #endif
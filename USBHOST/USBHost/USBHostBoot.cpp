@@ -0,0 +1,70 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBHostBoot.h"
+
+#if USBHOST_BOOT_TIMELINE
+
+#include "mbed.h"
+
+typedef struct {
+    const char * name;
+    uint32_t time;                  // us
+} boot_mark_t;
+
+static boot_mark_t marks[USB_BOOT_MARKS];
+static volatile uint32_t count;
+static volatile bool closed;
+
+void USBHostBoot::mark(const char * name)
+{
+    if (closed) {
+        return;
+    }
+    uint32_t now = us_ticker_read();
+
+    core_util_critical_section_enter();
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        if (marks[i].name == name) {
+            break;
+        }
+    }
+    if ((i == count) && (count < USB_BOOT_MARKS)) {
+        marks[count].name = name;
+        marks[count].time = now;
+        count++;
+    }
+    core_util_critical_section_exit();
+}
+
+void USBHostBoot::print()
+{
+    if (closed) {
+        return;
+    }
+    closed = true;
+
+    printf("[USB_BOOT] %-20s %10s %10s\r\n", "step", "ms", "+ms");
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t delta = i ? marks[i].time - marks[i - 1].time : marks[i].time;
+        printf("[USB_BOOT] %-20s %6lu.%03lu %6lu.%03lu\r\n", marks[i].name,
+               (unsigned long)(marks[i].time / 1000), (unsigned long)(marks[i].time % 1000),
+               (unsigned long)(delta / 1000), (unsigned long)(delta % 1000));
+    }
+}
+
+#endif
@@ -0,0 +1,58 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef USBHOSTBOOT_H
+#define USBHOSTBOOT_H
+
+#include "USBHostConf.h"
+
+#if USBHOST_BOOT_TIMELINE
+
+#include <stdint.h>
+
+// the name must be a literal: only its address is recorded
+#define USB_BOOT_MARK(name)         USBHostBoot::mark(name)
+
+/**
+* Timeline of the cold start: the first time each step is reached (BLE init,
+* advertising, host controller init, device connection and enumeration,
+* keyboard driver, ...) is stamped from the us ticker, which starts at boot.
+* The timeline is printed once and then closed, a closed timeline costs a test.
+* It is printed from the event queue of the application, not from the USB threads.
+*/
+class USBHostBoot
+{
+public:
+    /**
+    * Stamp a step of the boot (ISR safe), only the first mark of a step is kept
+    *
+    * @param name name of the step
+    */
+    static void mark(const char * name);
+
+    /**
+    * Print the timeline and close it, the next calls do nothing
+    */
+    static void print();
+};
+
+#else
+
+#define USB_BOOT_MARK(name)
+
+#endif
+
+#endif
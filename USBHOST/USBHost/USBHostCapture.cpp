@@ -0,0 +1,212 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBHostCapture.h"
+
+#if USBHOST_CAPTURE
+
+#include "mbed.h"
+
+#if (USB_CAPTURE_RECORDS & (USB_CAPTURE_RECORDS - 1))
+#error "USB_CAPTURE_RECORDS: must be a power of 2"
+#endif
+
+// pcap link type of the Linux usbmon packets (48 bytes header)
+#define LINKTYPE_USB_LINUX      189
+
+// usbmon status of the URBs
+#define URB_STATUS_OK           0
+#define URB_STATUS_STALL        (-32)   // -EPIPE
+#define URB_STATUS_ERROR        (-71)   // -EPROTO
+#define URB_STATUS_SUBMITTED    (-115)  // -EINPROGRESS
+
+// usbmon transfer types
+static const uint8_t xfer_type[] = {
+    2,  // CONTROL_ENDPOINT
+    0,  // ISOCHRONOUS_ENDPOINT
+    3,  // BULK_ENDPOINT
+    1,  // INTERRUPT_ENDPOINT
+};
+
+typedef struct {
+    uint64_t id;            // URB tag, the TD address
+    uint8_t type;           // 'S' submit, 'C' complete
+    uint8_t xfer_type;
+    uint8_t epnum;          // endpoint number, bit 7 set for IN
+    uint8_t devnum;
+    uint16_t busnum;
+    uint8_t flag_setup;     // 0 when setup holds a setup packet
+    uint8_t flag_data;      // 0 when data has been captured
+    int64_t ts_sec;
+    int32_t ts_usec;
+    int32_t status;
+    uint32_t length;        // length of the data
+    uint32_t len_cap;       // length of the captured data
+    uint8_t setup[8];
+} PACKED usbmon_packet_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} PACKED pcap_header_t;
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} PACKED pcap_record_t;
+
+typedef struct {
+    volatile uint32_t seq;  // index of the record + 1 once it has been written
+    usbmon_packet_t packet;
+    uint8_t data[USB_CAPTURE_PAYLOAD];
+} capture_record_t;
+
+static capture_record_t records[USB_CAPTURE_RECORDS];
+// index of the next record to write and of the next record to save
+static volatile uint32_t head;
+static volatile uint32_t tail;
+static volatile uint32_t dropped;
+static volatile bool enabled;
+
+void USBHostCapture::enable(bool enable)
+{
+    enabled = enable;
+}
+
+uint32_t USBHostCapture::getDropped()
+{
+    return dropped;
+}
+
+void USBHostCapture::submit(uint8_t bus, USBEndpoint * ep, volatile void * td, uint8_t * buf, uint32_t len, uint32_t frame)
+{
+    if (!enabled) {
+        return;
+    }
+    // the data of an IN transfer is only known at completion
+    record('S', bus, ep, td, (ep->getDir() == IN) ? NULL : buf, len, URB_STATUS_SUBMITTED, frame);
+}
+
+void USBHostCapture::complete(uint8_t bus, USBEndpoint * ep, volatile void * td, uint8_t state, uint32_t frame)
+{
+    if (!enabled) {
+        return;
+    }
+    int32_t status = URB_STATUS_OK;
+    uint32_t len = ep->getLengthTransferred();
+    if (state != USB_TYPE_IDLE) {
+        status = (state == USB_TYPE_STALL_ERROR) ? URB_STATUS_STALL : URB_STATUS_ERROR;
+        len = 0;
+    }
+    record('C', bus, ep, td, (ep->getDir() == IN) ? ep->getBufStart() : NULL, len, status, frame);
+}
+
+void USBHostCapture::record(char type, uint8_t bus, USBEndpoint * ep, volatile void * td, uint8_t * buf, uint32_t len, int32_t status, uint32_t frame)
+{
+    uint32_t idx;
+
+    // reserve a record: events are recorded from the threads and from the ISR
+    do {
+        idx = head;
+        if ((idx - tail) >= USB_CAPTURE_RECORDS) {
+            core_util_atomic_incr_u32(&dropped, 1);
+            return;
+        }
+    } while (!core_util_atomic_cas_u32(&head, &idx, idx + 1));
+
+    capture_record_t * rec = &records[idx & (USB_CAPTURE_RECORDS - 1)];
+    usbmon_packet_t * p = &rec->packet;
+
+    memset(p, 0, sizeof(usbmon_packet_t));
+    p->id = (uintptr_t)td;
+    p->type = type;
+    p->xfer_type = xfer_type[ep->getType()];
+    p->epnum = (ep->getAddress() & 0x7F) | ((ep->getDir() == IN) ? 0x80 : 0);
+    p->devnum = ep->getDeviceAddress();
+    p->busnum = bus + 1;
+    p->ts_sec = frame / 1000;
+    p->ts_usec = (frame % 1000) * 1000;
+    p->status = status;
+    p->flag_setup = '-';
+
+    if (ep->isSetup()) {
+        // the setup stage is reported as a control URB without data
+        if ((type == 'S') && (buf != NULL)) {
+            p->flag_setup = 0;
+            memcpy(p->setup, buf, 8);
+        }
+        p->flag_data = '=';
+    } else if (buf != NULL) {
+        p->length = len;
+        p->len_cap = (len > USB_CAPTURE_PAYLOAD) ? USB_CAPTURE_PAYLOAD : len;
+        p->flag_data = 0;
+        memcpy(rec->data, buf, p->len_cap);
+    } else {
+        p->length = len;
+        p->flag_data = (ep->getDir() == IN) ? '<' : '>';
+    }
+
+    // the record is complete before it can be saved
+    __DMB();
+    rec->seq = idx + 1;
+}
+
+int USBHostCapture::dump(FILE * file)
+{
+    pcap_header_t header = {
+        0xa1b2c3d4, 2, 4, 0, 0,
+        sizeof(usbmon_packet_t) + USB_CAPTURE_PAYLOAD,
+        LINKTYPE_USB_LINUX
+    };
+    int nb = 0;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        return -1;
+    }
+
+    while (tail != head) {
+        capture_record_t * rec = &records[tail & (USB_CAPTURE_RECORDS - 1)];
+        // reserved but still being written
+        if (rec->seq != tail + 1) {
+            break;
+        }
+        __DMB();
+
+        usbmon_packet_t * p = &rec->packet;
+        pcap_record_t hdr = {
+            (uint32_t)p->ts_sec, (uint32_t)p->ts_usec,
+            (uint32_t)sizeof(usbmon_packet_t) + p->len_cap,
+            (uint32_t)sizeof(usbmon_packet_t) + p->length
+        };
+        if ((fwrite(&hdr, sizeof(hdr), 1, file) != 1) ||
+            (fwrite(p, sizeof(usbmon_packet_t), 1, file) != 1) ||
+            (p->len_cap && (fwrite(rec->data, p->len_cap, 1, file) != 1))) {
+            return -1;
+        }
+        tail = tail + 1;
+        nb++;
+    }
+    return nb;
+}
+
+#endif
@@ -0,0 +1,89 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef USBHOSTCAPTURE_H
+#define USBHOSTCAPTURE_H
+
+#include "USBHostConf.h"
+
+#if USBHOST_CAPTURE
+
+#include <stdio.h>
+#include "USBEndpoint.h"
+
+/**
+* Capture of the USB traffic, saved as a pcap file (usbmon link type) readable by Wireshark
+*
+* Each TD queued by USBHost::addTransfer is recorded as a submit event and each
+* TD processed as a complete event. The events are stored with their frame
+* timestamp and the first USB_CAPTURE_PAYLOAD bytes of their data in a
+* ring of USB_CAPTURE_RECORDS records, until they are saved by dump().
+* When the ring is full, the new events are dropped and counted.
+*/
+class USBHostCapture
+{
+public:
+    /**
+    * Start or stop recording the events
+    *
+    * @param enable true to record the events
+    */
+    static void enable(bool enable);
+
+    /**
+    * Save the recorded events and remove them from the ring
+    *
+    * @param file file opened for writing, the pcap header is written at its start
+    *
+    * @returns number of events saved, -1 on a write error
+    */
+    static int dump(FILE * file);
+
+    /**
+    * Number of events dropped because the ring was full
+    */
+    static uint32_t getDropped();
+
+    /**
+    * Record the submission of a TD (ISR safe)
+    *
+    * @param bus host controller index
+    * @param ep endpoint of the TD
+    * @param td TD queued
+    * @param buf data of the TD (setup packet or OUT data)
+    * @param len length of the TD
+    * @param frame frame number
+    */
+    static void submit(uint8_t bus, USBEndpoint * ep, volatile void * td, uint8_t * buf, uint32_t len, uint32_t frame);
+
+    /**
+    * Record the completion of a TD (ISR safe)
+    *
+    * @param bus host controller index
+    * @param ep endpoint of the TD
+    * @param td TD processed
+    * @param state completion state of the TD
+    * @param frame frame number
+    */
+    static void complete(uint8_t bus, USBEndpoint * ep, volatile void * td, uint8_t state, uint32_t frame);
+
+private:
+    static void record(char type, uint8_t bus, USBEndpoint * ep, volatile void * td, uint8_t * buf, uint32_t len, int32_t status, uint32_t frame);
+};
+
+#endif
+
+#endif
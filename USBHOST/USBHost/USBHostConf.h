@@ -19,7 +19,7 @@
 #if defined(TARGET_STM)
 /*
 * Maximum number of devices that can be connected
-* to the usb host
+* to the usb host (up to 127)
 */
 /*   hub + 2 devices */
 #define MAX_DEVICE_CONNECTED        5
@@ -74,15 +74,27 @@
 */
 #define MAX_ENDPOINT_PER_INTERFACE  2
 
+/*
+* Maximum number of host channels of the controller (USB FS 11 channel).
+* An endpoint only owns a channel while one of its transfers is in flight
+*/
+#define MAX_HOST_CHANNEL           11
+
+/*
+* Selective suspend of the idle devices: not supported, the
+* transfers of a suspended device cannot be held back
+*/
+#define USBHOST_SUSPEND             0
+
 /*
 * Maximum number of endpoint descriptors that can be allocated
 */
-#define MAX_ENDPOINT               11 /*  USB FS 11 channel */
+#define MAX_ENDPOINT                (MAX_DEVICE_CONNECTED * MAX_INTF * MAX_ENDPOINT_PER_INTERFACE)
 
 #else
 /*
 * Maximum number of devices that can be connected
-* to the usb host
+* to the usb host (up to 127)
 */
 #define MAX_DEVICE_CONNECTED        5
 
@@ -136,19 +148,261 @@
 */
 #define MAX_ENDPOINT_PER_INTERFACE  3
 
+/*
+* Enable the selective suspend of the idle devices (USBHost::setSuspendIdleTime)
+*/
+#define USBHOST_SUSPEND             1
+
 /*
 * Maximum number of endpoint descriptors that can be allocated
 */
 #define MAX_ENDPOINT                (MAX_DEVICE_CONNECTED * MAX_INTF * MAX_ENDPOINT_PER_INTERFACE)
 #endif
 /*
-* Maximum number of transfer descriptors that can be allocated
+* Transfer descriptors of a bulk endpoint (OHCI): a bulk transfer is queued on up
+* to USB_BULK_TDS - 1 TDs of USB_BULK_TD_LEN bytes, only the last one interrupts.
+* 2 queues every transfer on a single TD
+*/
+#define USB_BULK_TDS                4
+
+#if USB_BULK_TDS < 2
+#error "USB_BULK_TDS: an endpoint needs a TD and the dummy tail TD"
+#endif
+
+/*
+* Maximum length of a TD of a bulk transfer: a multiple of the packet size whose
+* buffer never crosses more than one 4 kB page
+*/
+#define USB_BULK_TD_LEN             4096
+
+/*
+* Maximum number of transfer descriptors that can be allocated: two per endpoint,
+* and the extra ones of a pair of bulk endpoints
+*/
+#define MAX_TD                      (MAX_ENDPOINT*2 + 2*(USB_BULK_TDS - 2))
+
+/*
+* Highest address assigned to a device (0 is the default address).
+* The RZ_A1H USB module only has the DEVADD registers of the addresses 0 to 10
+*/
+#if defined(TARGET_RZ_A1H) || defined(TARGET_VK_RZ_A1H)
+#define MAX_DEVICE_ADDRESS          10
+#else
+#define MAX_DEVICE_ADDRESS          127
+#endif
+
+#if (MAX_DEVICE_CONNECTED > MAX_DEVICE_ADDRESS)
+#error "MAX_DEVICE_CONNECTED: more devices than addresses"
+#endif
+
+#if (MAX_INTF > 8)
+#error "MAX_INTF: the drivers attached to a device are stored in an 8 bits mask"
+#endif
+
+/*
+* Size of the chunks in which the configuration descriptor is read and parsed.
+* A multiple of 2 * 64 bytes: every chunk starts with a DATA1 packet
+*/
+#define CONF_DESCR_CHUNK_SIZE       128
+
+#if (CONF_DESCR_CHUNK_SIZE % 128)
+#error "CONF_DESCR_CHUNK_SIZE: must be a multiple of 128 bytes"
+#endif
+
+/*
+* Keep transfer counters and latency histograms (USBHost::getDeviceStats, USBHost::getEndpointStats),
+* turned on by the diagnostics service
+*/
+#define USBHOST_STATS               0
+
+/*
+* Capture of the USB traffic to a pcap file (see USBHostCapture.h)
+*/
+#define USBHOST_CAPTURE             0
+
+/*
+* Number of events kept by the capture until they are saved, a power of 2
+*/
+#define USB_CAPTURE_RECORDS         64
+
+/*
+* Maximum number of data bytes captured for each event
+*/
+#define USB_CAPTURE_PAYLOAD         32
+
+/*
+* File of the capture, saved by the application on the first mass storage device
+* connected (mounted as "usb")
+*/
+#define USB_CAPTURE_FILE            "/usb/usb.pcap"
+
+/*
+* Timing probes saved as a Chrome trace (see USBHostTrace.h)
+*/
+#define USBHOST_TRACE               0
+
+/*
+* Number of trace buffers: one for the ISRs and one for each traced thread
+*/
+#define USB_TRACE_BUFFERS           6
+
+/*
+* Number of events kept by each trace buffer
+*/
+#define USB_TRACE_EVENTS            128
+
+/*
+* Stack and CPU load monitor of the threads (see USBHostMonitor.h)
+*/
+#define USBHOST_MONITOR             0
+
+/*
+* Maximum number of threads followed by the monitor
+*/
+#define USB_MONITOR_THREADS         12
+
+/*
+* us, sampling period of the running thread (not a multiple of the 1 ms RTOS tick)
+*/
+#define USB_MONITOR_SAMPLE_US       997
+
+/*
+* Latency of the key events from the USB ISR to the BLE notification (see USBHostLatency.h).
+* The ISR stage is read from the transfer statistics (USBHOST_STATS)
 */
-#define MAX_TD                      (MAX_ENDPOINT*2)
+#define USBHOST_LATENCY             0
+
+/*
+* Record of the keyboard reports and their replay (see USBHostKeyboard::dumpReports)
+*/
+#define USBHOST_REPLAY              0
+
+/*
+* Number of keyboard reports kept by the record until they are saved
+*/
+#define USB_REPLAY_REPORTS          256
+
+/*
+* Hotplug churn stress mode (see USBHost::churn), it reads the pool statistics
+*/
+#define USBHOST_CHURN               0
+
+/*
+* ms, maximum time for a device to be freed or enumerated again in a churn cycle
+*/
+#define USB_CHURN_TIMEOUT           5000
+
+/*
+* ms, wait after the devices are enumerated again, for the drivers to connect, before the pools are read
+*/
+#define USB_CHURN_SETTLE            500
+
+/*
+* Pool entries (EDs or TDs) gained over the cycles, from the trend of the pools, reported as a leak
+*/
+#define USB_CHURN_LEAK              2
+
+/*
+* Minimum number of cycles for a leak to be reported
+*/
+#define USB_CHURN_TREND_CYCLES      4
+
+/*
+* Stack of the thread loading the devices with control transfers during the churn
+*/
+#define USB_CHURN_LOAD_STACK        1024
+
+/*
+* BLE GATT service of the performance counters, next to the HID service (see DiagnosticsService.h)
+*/
+#define USBHOST_DIAGNOSTICS         0
+
+/*
+* ms, period of the notifications of the diagnostics service
+*/
+#define USB_DIAGNOSTICS_PERIOD      5000
+
+#if USBHOST_DIAGNOSTICS
+#undef USBHOST_STATS
+#define USBHOST_STATS               1
+#endif
+
+#if USBHOST_CHURN && !USBHOST_STATS
+#error "USBHOST_CHURN: needs USBHOST_STATS"
+#endif
+
+/*
+* Timeline of the cold start, printed by the application once the keyboard is enumerated (see USBHostBoot.h)
+*/
+#define USBHOST_BOOT_TIMELINE       1
+
+/*
+* Maximum number of steps of the boot timeline
+*/
+#define USB_BOOT_MARKS              16
+
+/*
+* ms, the timeline is printed at this time after the start when no keyboard is enumerated
+*/
+#define USB_BOOT_DEADLINE           10000
+
+/*
+* Number of events queued to the usb_thread
+*/
+#define USB_MAIL_SIZE               10
+
+/*
+* Maximum number of handlers called every N frames (see USBHost::attachFrameHandler)
+*/
+#define MAX_FRAME_HANDLERS          2
+
+/*
+* Number of host controllers, each one is driven by its own USBHost instance
+*/
+#if defined(TARGET_RZ_A1H) || defined(TARGET_VK_RZ_A1H)
+#define USBHOST_CONTROLLER_NUM      2
+#else
+#define USBHOST_CONTROLLER_NUM      1
+#endif
+
+/*
+* Host controller started by USBHost::getHostInst() when no USBHost instance is running
+*/
+#define USBHOST_DEFAULT_CONTROLLER  0
+
+/*
+* Thread signal used to wake up a thread blocked on a transfer, must not be used by the application threads
+*/
+#define USB_EP_SIGNAL               0x40000000
+
+/*
+* Number of records of the deferred log ring (see dbg.h), a power of 2
+*/
+#define USB_LOG_RECORDS             32
+
+/*
+* Thread signal used to wake up the deferred log thread
+*/
+#define USB_LOG_SIGNAL              0x20000000
+
+/*
+* deferred log thread stack size (printf)
+*/
+#define USB_LOG_THREAD_STACK        (256*4 + 256*4)
+
+/*
+* monitor report thread stack size (printf)
+*/
+#define USB_MONITOR_THREAD_STACK    (256*4 + 256*4)
 
 /*
 * usb_thread stack size
 */
 #define USB_THREAD_STACK            (256*4 + 2*256*4)
 
+/*
+* hub thread stack size (port status requests of the hubs)
+*/
+#define HUB_THREAD_STACK            (256*4 + 256*4)
+
 #endif
@@ -0,0 +1,116 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBHostLatency.h"
+
+#if USBHOST_LATENCY
+
+#include "mbed.h"
+
+static const char * const stage_names[USB_LATENCY_STAGES] = {
+    "total", "isr->rx", "rx->key", "key->report", "report->ble"
+};
+
+// the statistics of the ISR stage are those of the whole path
+static USBLatencyStats stats[USB_LATENCY_STAGES];
+
+// key event in flight
+static bool in_flight;
+static uint8_t last;                        // last stage stamped
+static uint32_t times[USB_LATENCY_STAGES];
+
+static void count(USBLatencyStats * s, uint32_t us)
+{
+    // index of the most significant bit + 1
+    uint8_t bucket = (us == 0) ? 0 : 32 - __CLZ(us);
+    if (bucket >= USB_LATENCY_BUCKETS) {
+        bucket = USB_LATENCY_BUCKETS - 1;
+    }
+    s->histogram[bucket]++;
+    s->count++;
+    s->sum += us;
+    if (us > s->max) {
+        s->max = us;
+    }
+}
+
+void USBHostLatency::begin(uint32_t isr_us)
+{
+    uint32_t now = us_ticker_read();
+
+    core_util_critical_section_enter();
+    in_flight = true;
+    times[USB_LATENCY_RX] = now;
+    if (isr_us) {
+        times[USB_LATENCY_ISR] = isr_us;
+        count(&stats[USB_LATENCY_RX], now - isr_us);
+    } else {
+        times[USB_LATENCY_ISR] = now;
+    }
+    last = USB_LATENCY_RX;
+    core_util_critical_section_exit();
+}
+
+void USBHostLatency::stamp(USBLatencyStage stage)
+{
+    uint32_t now = us_ticker_read();
+
+    core_util_critical_section_enter();
+    if (in_flight && (stage > last)) {
+        times[stage] = now;
+        count(&stats[stage], now - times[last]);
+        last = stage;
+        if (stage == USB_LATENCY_BLE) {
+            count(&stats[USB_LATENCY_ISR], now - times[USB_LATENCY_ISR]);
+            in_flight = false;
+        }
+    }
+    core_util_critical_section_exit();
+}
+
+void USBHostLatency::getStats(USBLatencyStage stage, USBLatencyStats * s)
+{
+    core_util_critical_section_enter();
+    *s = stats[stage];
+    core_util_critical_section_exit();
+}
+
+void USBHostLatency::reset()
+{
+    core_util_critical_section_enter();
+    memset(stats, 0, sizeof(stats));
+    core_util_critical_section_exit();
+}
+
+void USBHostLatency::report()
+{
+    USBLatencyStats s;
+
+    printf("[USB_LATENCY] %-12s %8s %8s %8s  histogram (bucket i: < 2^i us)\r\n", "stage", "count", "avg", "max");
+    for (uint8_t i = 0; i < USB_LATENCY_STAGES; i++) {
+        // the stages in order, the total last
+        uint8_t stage = (i + 1) % USB_LATENCY_STAGES;
+        getStats((USBLatencyStage)stage, &s);
+        printf("[USB_LATENCY] %-12s %8lu %8lu %8lu ", stage_names[stage], (unsigned long)s.count,
+               (unsigned long)(s.count ? s.sum / s.count : 0), (unsigned long)s.max);
+        for (uint8_t j = 0; j < USB_LATENCY_BUCKETS; j++) {
+            printf(" %lu", (unsigned long)s.histogram[j]);
+        }
+        printf("\r\n");
+    }
+}
+
+#endif
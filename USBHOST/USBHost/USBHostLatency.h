@@ -0,0 +1,104 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef USBHOSTLATENCY_H
+#define USBHOSTLATENCY_H
+
+#include "USBHostConf.h"
+
+#if USBHOST_LATENCY
+
+#include "USBHostTypes.h"
+
+// stages of a key event, in the order they are crossed
+enum USBLatencyStage {
+    USB_LATENCY_ISR = 0,        // transfer completed in the controller ISR
+    USB_LATENCY_RX,             // USBHostKeyboard::rxHandler
+    USB_LATENCY_KEY,            // onKey callback of the application
+    USB_LATENCY_REPORT,         // HIDService::updateReport
+    USB_LATENCY_BLE,            // notification accepted by the BLE stack
+    USB_LATENCY_STAGES
+};
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;                               // us
+    uint64_t sum;                               // us
+    uint32_t histogram[USB_LATENCY_BUCKETS];    // bucket i: [2^(i-1), 2^i[ us
+} USBLatencyStats;
+
+#if USBHOST_STATS
+// no ISR stage for a NULL endpoint (replayed report)
+#define USB_LATENCY_BEGIN(ep)       USBHostLatency::begin((ep) ? (ep)->getCompletionTime() : 0)
+#else
+#define USB_LATENCY_BEGIN(ep)       USBHostLatency::begin(0)
+#endif
+#define USB_LATENCY_STAMP(stage)    USBHostLatency::stamp(stage)
+
+/**
+* Latency of the key events along the bridge, from the USB ISR to the BLE notification
+*
+* A key event is opened by the keyboard driver when a report holds a key and
+* is stamped at each stage it crosses. The latency of a stage (from the previous
+* one) is counted when it is stamped, the total latency when the BLE stack has
+* accepted the notification. A key buffered by the application and not notified
+* only counts in the first stages: it is replaced by the next key event.
+*/
+class USBHostLatency
+{
+public:
+    /**
+    * Open a key event (USB_LATENCY_BEGIN)
+    *
+    * @param isr_us completion time of the transfer in the ISR, 0 if not known (the RX stage is then the start)
+    */
+    static void begin(uint32_t isr_us);
+
+    /**
+    * Stamp the key event at a stage (USB_LATENCY_STAMP), nothing done if the
+    * event is closed or already went past this stage
+    *
+    * @param stage stage crossed
+    */
+    static void stamp(USBLatencyStage stage);
+
+    /**
+    * Get the latency of a stage
+    *
+    * @param stage stage, USB_LATENCY_ISR for the total latency (ISR to BLE)
+    * @param stats filled with the statistics of the stage
+    */
+    static void getStats(USBLatencyStage stage, USBLatencyStats * stats);
+
+    /**
+    * Clear the statistics
+    */
+    static void reset();
+
+    /**
+    * Print the statistics of the stages and the total
+    */
+    static void report();
+};
+
+#else
+
+#define USB_LATENCY_BEGIN(ep)
+#define USB_LATENCY_STAMP(stage)
+
+#endif
+
+#endif
@@ -0,0 +1,128 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dbg.h"
+
+#if (DEBUG_DEFERRED)
+
+#include <stdarg.h>
+#include "mbed.h"
+#include "rtos.h"
+#include "USBHostConf.h"
+#include "USBHostLog.h"
+
+#if (USB_LOG_RECORDS & (USB_LOG_RECORDS - 1))
+#error "USB_LOG_RECORDS: must be a power of 2"
+#endif
+
+typedef struct {
+    volatile uint32_t seq;          // index of the record + 1 once it has been written
+    const char * fmt;
+    uint8_t nargs;
+    uint32_t args[USB_LOG_MAX_ARGS];
+} log_record_t;
+
+static log_record_t records[USB_LOG_RECORDS];
+// index of the next record to write and of the next record to print
+static volatile uint32_t head;
+static volatile uint32_t tail;
+static volatile uint32_t dropped;
+
+static Thread * logThread;
+static volatile osThreadId logThreadId;
+
+void USBHostLog::write(const char * fmt, uint8_t nargs, ...)
+{
+    uint32_t idx;
+
+    // reserve a record: several threads and ISRs may log at the same time
+    do {
+        idx = head;
+        if ((idx - tail) >= USB_LOG_RECORDS) {
+            core_util_atomic_incr_u32(&dropped, 1);
+            return;
+        }
+    } while (!core_util_atomic_cas_u32(&head, &idx, idx + 1));
+
+    log_record_t * rec = &records[idx & (USB_LOG_RECORDS - 1)];
+    va_list ap;
+
+    rec->fmt = fmt;
+    rec->nargs = (nargs > USB_LOG_MAX_ARGS) ? USB_LOG_MAX_ARGS : nargs;
+    va_start(ap, nargs);
+    for (uint8_t i = 0; i < rec->nargs; i++) {
+        rec->args[i] = va_arg(ap, uint32_t);
+    }
+    va_end(ap);
+    // the record is complete before it is seen by the thread
+    __DMB();
+    rec->seq = idx + 1;
+
+    // the thread only blocks when the ring is empty
+    if ((idx == tail) && (logThreadId != NULL)) {
+        osSignalSet(logThreadId, USB_LOG_SIGNAL);
+    }
+}
+
+void USBHostLog::start()
+{
+    if (logThread != NULL) {
+        return;
+    }
+    logThread = new Thread(osPriorityLow, USB_LOG_THREAD_STACK, NULL, "usb_log");
+    logThread->start(&USBHostLog::process);
+}
+
+uint32_t USBHostLog::getDropped()
+{
+    return dropped;
+}
+
+void USBHostLog::process()
+{
+    uint32_t reported = 0;
+
+    logThreadId = Thread::gettid();
+
+    while(1) {
+        if (tail == head) {
+            Thread::signal_wait(USB_LOG_SIGNAL);
+            continue;
+        }
+
+        log_record_t * rec = &records[tail & (USB_LOG_RECORDS - 1)];
+        if (rec->seq != tail + 1) {
+            // reserved but still being written by a preempted writer
+            Thread::wait(1);
+            continue;
+        }
+        __DMB();
+
+        uint32_t a[USB_LOG_MAX_ARGS];
+        for (uint8_t i = 0; i < USB_LOG_MAX_ARGS; i++) {
+            a[i] = (i < rec->nargs) ? rec->args[i] : 0;
+        }
+        std::printf(rec->fmt, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8], a[9], a[10], a[11]);
+        tail = tail + 1;
+
+        if (dropped != reported) {
+            std::printf("[USB_LOG] %lu records dropped\r\n", (unsigned long)(dropped - reported));
+            reported = dropped;
+        }
+    }
+}
+
+#endif
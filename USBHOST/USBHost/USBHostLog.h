@@ -0,0 +1,73 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef USBHOSTLOG_H
+#define USBHOSTLOG_H
+
+#include <stdint.h>
+#include "mbed_assert.h"
+
+/*
+* Maximum number of arguments of a log record (file and line included)
+*/
+#define USB_LOG_MAX_ARGS            12
+
+// number of arguments of a log call, counted up to 16: a call with more arguments
+// than USB_LOG_MAX_ARGS does not build (wrong count or count not a constant)
+#define USB_LOG_NARGS(...)          USB_LOG_NARGS_(0, ##__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define USB_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ...) N
+
+#define USB_LOG(x, ...)             do { \
+                                        MBED_STATIC_ASSERT(USB_LOG_NARGS(__VA_ARGS__) <= USB_LOG_MAX_ARGS, "USB_LOG: too many arguments"); \
+                                        USBHostLog::write(x, USB_LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__); \
+                                    } while (0)
+
+/**
+* Deferred logging of the dbg.h macros
+*
+* A log call only stores the format string and its arguments in a ring of records,
+* the records are formatted and printed by a low priority thread. It can be called in ISR.
+*
+* The arguments are stored as 32 bits words: a %s argument must point to a string
+* which is still valid when the record is printed (literal, name of a device, ...).
+* When the ring is full, the new records are dropped and counted.
+*/
+class USBHostLog
+{
+public:
+    /**
+    * Store a log record (ISR safe)
+    *
+    * @param fmt printf format string, must be a literal
+    * @param nargs number of arguments following
+    */
+    static void write(const char * fmt, uint8_t nargs, ...);
+
+    /**
+    * Start the thread printing the records, the records written before are kept
+    */
+    static void start();
+
+    /**
+    * Number of records dropped because the ring was full
+    */
+    static uint32_t getDropped();
+
+private:
+    static void process();
+};
+
+#endif
@@ -0,0 +1,155 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBHostMonitor.h"
+
+#if USBHOST_MONITOR
+
+#include "mbed.h"
+#include "rtos.h"
+
+// wakes up the report thread when the report period is changed
+#define REPORT_SIGNAL   0x1
+
+typedef struct {
+    osThreadId_t id;            // NULL if the entry is free
+    uint32_t samples;
+    uint32_t switches;
+} thread_samples_t;
+
+static thread_samples_t threads[USB_MONITOR_THREADS];
+static uint32_t total;
+static osThreadId_t running;
+
+static Ticker sampler;
+static Thread * reportThread;
+static volatile uint32_t reportPeriod;
+
+void USBHostMonitor::start(uint32_t report_ms)
+{
+    sampler.attach_us(&USBHostMonitor::sample, USB_MONITOR_SAMPLE_US);
+
+    reportPeriod = report_ms;
+    if (report_ms && (reportThread == NULL)) {
+        reportThread = new Thread(osPriorityLow, USB_MONITOR_THREAD_STACK, NULL, "usb_monitor");
+        reportThread->start(&USBHostMonitor::process);
+    } else if (reportThread != NULL) {
+        reportThread->signal_set(REPORT_SIGNAL);
+    }
+}
+
+void USBHostMonitor::stop()
+{
+    sampler.detach();
+    reportPeriod = 0;
+}
+
+/*
+ * Record the running thread
+ * Called in ISR!!!! (no printf)
+ */
+void USBHostMonitor::sample()
+{
+    osThreadId_t id = osThreadGetId();
+
+    total++;
+    for (uint8_t i = 0; i < USB_MONITOR_THREADS; i++) {
+        if (threads[i].id == NULL) {
+            threads[i].id = id;
+        }
+        if (threads[i].id == id) {
+            threads[i].samples++;
+            if (id != running) {
+                threads[i].switches++;
+            }
+            break;
+        }
+    }
+    running = id;
+}
+
+int USBHostMonitor::getStats(USBThreadStats * stats, int max, uint32_t * total_samples)
+{
+    osThreadId_t ids[USB_MONITOR_THREADS];
+    int nb = osThreadEnumerate(ids, USB_MONITOR_THREADS);
+
+    if (nb > max) {
+        nb = max;
+    }
+    for (int i = 0; i < nb; i++) {
+        uint32_t space = osThreadGetStackSpace(ids[i]);
+        stats[i].name = osThreadGetName(ids[i]);
+        stats[i].stack_size = osThreadGetStackSize(ids[i]);
+        // no space reported without watermarking
+        stats[i].stack_max = space ? stats[i].stack_size - space : 0;
+        stats[i].samples = 0;
+        stats[i].switches = 0;
+
+        core_util_critical_section_enter();
+        for (uint8_t j = 0; j < USB_MONITOR_THREADS; j++) {
+            if (threads[j].id == ids[i]) {
+                stats[i].samples = threads[j].samples;
+                stats[i].switches = threads[j].switches;
+                break;
+            }
+        }
+        core_util_critical_section_exit();
+    }
+    if (total_samples) {
+        *total_samples = total;
+    }
+    return nb;
+}
+
+void USBHostMonitor::report()
+{
+    USBThreadStats stats[USB_MONITOR_THREADS];
+    uint32_t samples;
+    int nb = getStats(stats, USB_MONITOR_THREADS, &samples);
+
+    printf("[USB_MONITOR] %-16s %6s %6s %6s %8s\r\n", "thread", "stack", "max", "cpu%", "switches");
+    for (int i = 0; i < nb; i++) {
+        // cpu share in 0.1%
+        uint32_t load = samples ? (uint32_t)(((uint64_t)stats[i].samples * 1000) / samples) : 0;
+        printf("[USB_MONITOR] %-16s %6lu %6lu %4lu.%lu %8lu\r\n",
+               stats[i].name ? stats[i].name : "?",
+               (unsigned long)stats[i].stack_size, (unsigned long)stats[i].stack_max,
+               (unsigned long)(load / 10), (unsigned long)(load % 10),
+               (unsigned long)stats[i].switches);
+    }
+
+    // the CPU load of the next report is measured from now, the dead threads are forgotten
+    core_util_critical_section_enter();
+    memset(threads, 0, sizeof(threads));
+    total = 0;
+    core_util_critical_section_exit();
+}
+
+void USBHostMonitor::process()
+{
+    while(1) {
+        if (reportPeriod == 0) {
+            Thread::signal_wait(REPORT_SIGNAL);
+            continue;
+        }
+        Thread::wait(reportPeriod);
+        if (reportPeriod) {
+            report();
+        }
+    }
+}
+
+#endif
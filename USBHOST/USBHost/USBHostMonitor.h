@@ -0,0 +1,83 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef USBHOSTMONITOR_H
+#define USBHOSTMONITOR_H
+
+#include "USBHostConf.h"
+
+#if USBHOST_MONITOR
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    const char * name;
+    uint32_t stack_size;        // bytes
+    uint32_t stack_max;         // high-water mark in bytes, 0 if the stacks are not watermarked
+    uint32_t samples;           // samples where the thread was running
+    uint32_t switches;          // switches to the thread seen between two samples
+} USBThreadStats;
+
+/**
+* Monitor of the stack usage and CPU load of all the threads (USB, BLE, application)
+*
+* The stack high-water marks are read from the RTOS, they need the stack
+* watermarking of mbed OS (platform.stack-stats-enabled).
+* The CPU time share is sampled: every USB_MONITOR_SAMPLE_US a ticker records
+* the running thread. The context switches are those seen between two samples:
+* a lower bound of the real count.
+*/
+class USBHostMonitor
+{
+public:
+    /**
+    * Start sampling the threads
+    *
+    * @param report_ms period of the report printed by a low priority thread, 0 for no report
+    */
+    static void start(uint32_t report_ms = 0);
+
+    /**
+    * Stop sampling the threads and the periodic report
+    */
+    static void stop();
+
+    /**
+    * Get a snapshot of the statistics of the threads, the stack of the
+    * running threads is measured now
+    *
+    * @param stats array filled with the statistics of each thread
+    * @param max size of the array
+    * @param total if not NULL, filled with the total number of samples
+    *
+    * @returns number of threads filled
+    */
+    static int getStats(USBThreadStats * stats, int max, uint32_t * total = NULL);
+
+    /**
+    * Print the statistics of the threads
+    */
+    static void report();
+
+private:
+    static void sample();
+    static void process();
+};
+
+#endif
+
+#endif
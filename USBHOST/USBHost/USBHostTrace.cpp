@@ -0,0 +1,195 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "USBHostTrace.h"
+
+#if USBHOST_TRACE
+
+#if defined(__linux__)
+#include <time.h>
+#include <pthread.h>
+
+static inline bool core_util_atomic_cas_u32(volatile uint32_t * ptr, uint32_t * expected, uint32_t desired)
+{
+    return __sync_bool_compare_and_swap(ptr, *expected, desired);
+}
+
+static inline uint32_t core_util_atomic_incr_u32(volatile uint32_t * ptr, uint32_t delta)
+{
+    return __sync_add_and_fetch(ptr, delta);
+}
+#else
+#include "mbed.h"
+#include "rtos.h"
+#endif
+
+// buffer of the events recorded in ISR
+#define ISR_BUFFER      0
+
+typedef struct {
+    const char * name;
+    uint32_t time;
+    char phase;
+} trace_event_t;
+
+typedef struct {
+    volatile uint32_t owner;            // thread recording in this buffer, 0 if free
+    volatile uint32_t count;            // number of events recorded, the last ones are kept
+    trace_event_t events[USB_TRACE_EVENTS];
+} trace_buffer_t;
+
+static trace_buffer_t buffers[USB_TRACE_BUFFERS];
+static volatile bool enabled;
+
+static inline uint32_t trace_time()
+{
+#if defined(__linux__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#elif defined(DWT_CTRL_CYCCNTENA_Msk)
+    return DWT->CYCCNT;
+#else
+    return us_ticker_read();
+#endif
+}
+
+// timestamp ticks per us
+static inline uint32_t trace_ticks_per_us()
+{
+#if !defined(__linux__) && defined(DWT_CTRL_CYCCNTENA_Msk)
+    return SystemCoreClock / 1000000;
+#else
+    return 1;
+#endif
+}
+
+static inline trace_buffer_t * trace_buffer()
+{
+#if defined(__linux__)
+    uint32_t self = (uint32_t)(uintptr_t)pthread_self();
+#else
+    if (core_util_is_isr_active()) {
+        return &buffers[ISR_BUFFER];
+    }
+    uint32_t self = (uint32_t)Thread::gettid();
+#endif
+
+    for (uint8_t i = ISR_BUFFER + 1; i < USB_TRACE_BUFFERS; i++) {
+        if (buffers[i].owner == self) {
+            return &buffers[i];
+        }
+    }
+    // first event of this thread
+    for (uint8_t i = ISR_BUFFER + 1; i < USB_TRACE_BUFFERS; i++) {
+        uint32_t free = 0;
+        if (core_util_atomic_cas_u32(&buffers[i].owner, &free, self)) {
+            return &buffers[i];
+        }
+    }
+    return NULL;
+}
+
+void USBHostTrace::enable(bool enable)
+{
+#if !defined(__linux__) && defined(DWT_CTRL_CYCCNTENA_Msk)
+    if (enable) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+#endif
+    enabled = enable;
+}
+
+void USBHostTrace::record(const char * name, char phase)
+{
+    if (!enabled) {
+        return;
+    }
+    trace_buffer_t * buf = trace_buffer();
+    if (buf == NULL) {
+        return;
+    }
+    // the ISR buffer is shared by nested interrupts
+    uint32_t idx = core_util_atomic_incr_u32(&buf->count, 1) - 1;
+    trace_event_t * ev = &buf->events[idx % USB_TRACE_EVENTS];
+    ev->name = name;
+    ev->phase = phase;
+    ev->time = trace_time();
+}
+
+int USBHostTrace::dump(FILE * file)
+{
+    enabled = false;
+
+    // the events are placed on the timeline from their age: the counter may have wrapped
+    uint32_t now = trace_time();
+    uint32_t tpu = trace_ticks_per_us();
+    uint32_t oldest = 0;
+    int nb = 0;
+
+    for (uint8_t i = 0; i < USB_TRACE_BUFFERS; i++) {
+        uint32_t count = buffers[i].count;
+        uint32_t first = (count > USB_TRACE_EVENTS) ? count - USB_TRACE_EVENTS : 0;
+        if (first < count) {
+            uint32_t age = now - buffers[i].events[first % USB_TRACE_EVENTS].time;
+            if (age > oldest) {
+                oldest = age;
+            }
+        }
+    }
+
+    const char * sep = "";
+
+    if (fprintf(file, "{\"traceEvents\":[") < 0) {
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < USB_TRACE_BUFFERS; i++) {
+        trace_buffer_t * buf = &buffers[i];
+        uint32_t count = buf->count;
+        if (count == 0) {
+            continue;
+        }
+
+        if (i == ISR_BUFFER) {
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"ISR\"}}", sep, i);
+        } else {
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread 0x%08lx\"}}", sep, i, (unsigned long)buf->owner);
+        }
+        sep = ",";
+
+        for (uint32_t j = (count > USB_TRACE_EVENTS) ? count - USB_TRACE_EVENTS : 0; j < count; j++) {
+            trace_event_t * ev = &buf->events[j % USB_TRACE_EVENTS];
+            // ns since the oldest event
+            uint64_t ns = ((uint64_t)(oldest - (now - ev->time)) * 1000) / tpu;
+            if (fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%lu.%03lu}",
+                        ev->name, ev->phase, i, (unsigned long)(ns / 1000), (unsigned long)(ns % 1000)) < 0) {
+                return -1;
+            }
+            nb++;
+        }
+        buf->count = 0;
+        buf->owner = 0;
+    }
+
+    if (fprintf(file, "\n]}\n") < 0) {
+        return -1;
+    }
+    return nb;
+}
+
+#endif
@@ -0,0 +1,97 @@
+/* mbed USBHost Library
+ * Copyright (c) 2006-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef USBHOSTTRACE_H
+#define USBHOSTTRACE_H
+
+#include "USBHostConf.h"
+
+#if USBHOST_TRACE
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define USB_TRACE_CONCAT_(a, b)     a##b
+#define USB_TRACE_CONCAT(a, b)      USB_TRACE_CONCAT_(a, b)
+
+// the name must be a literal: only its address is recorded
+#define USB_TRACE_BEGIN(name)       USBHostTrace::record(name, 'B')
+#define USB_TRACE_END(name)         USBHostTrace::record(name, 'E')
+// from this line to the end of the enclosing block
+#define USB_TRACE_SCOPE(name)       USBTraceScope USB_TRACE_CONCAT(usb_trace_scope_, __LINE__)(name)
+
+/**
+* Timing probes saved as a Chrome trace (JSON), readable by chrome://tracing or Perfetto
+*
+* The begin and end events of the probes are timestamped with the cycle counter
+* (DWT) on Cortex-M3/M4, clock_gettime on Linux and us_ticker_read otherwise.
+* Each thread records in its own buffer (the ISRs share one), a buffer keeps the
+* last USB_TRACE_EVENTS events. A trace must be shorter than a wrap of the
+* timestamp counter (about 40 s at 100 MHz).
+*/
+class USBHostTrace
+{
+public:
+    /**
+    * Start or stop recording the probes
+    *
+    * @param enable true to record the probes
+    */
+    static void enable(bool enable);
+
+    /**
+    * Stop recording and save the recorded events, the buffers are then cleared
+    *
+    * @param file file opened for writing
+    *
+    * @returns number of events saved, -1 on a write error
+    */
+    static int dump(FILE * file);
+
+    /**
+    * Record a probe event (ISR safe)
+    *
+    * @param name name of the probe
+    * @param phase 'B' (begin) or 'E' (end)
+    */
+    static void record(const char * name, char phase);
+};
+
+/**
+* Probe recording a begin event when created and an end event when destroyed
+*/
+class USBTraceScope
+{
+public:
+    USBTraceScope(const char * name) : name(name) {
+        USBHostTrace::record(name, 'B');
+    }
+    ~USBTraceScope() {
+        USBHostTrace::record(name, 'E');
+    }
+private:
+    const char * name;
+};
+
+#else
+
+#define USB_TRACE_BEGIN(name)
+#define USB_TRACE_END(name)
+#define USB_TRACE_SCOPE(name)
+
+#endif
+
+#endif
@@ -77,16 +77,21 @@ enum ENDPOINT_TYPE {
 #define  OR_CONTROL_HC_RES              0x00000040
 #define  OR_CONTROL_HC_OPER             0x00000080
 #define  OR_CONTROL_HC_SUSP             0x000000C0
+#define  OR_CONTROL_RWE                 0x00000400
 // ----------------- HcCommandStatus Register -----------------
 #define  OR_CMD_STATUS_HCR              0x00000001
 #define  OR_CMD_STATUS_CLF              0x00000002
 #define  OR_CMD_STATUS_BLF              0x00000004
 // --------------- HcInterruptStatus Register -----------------
 #define  OR_INTR_STATUS_WDH             0x00000002
+#define  OR_INTR_STATUS_SF              0x00000004
+#define  OR_INTR_STATUS_RD              0x00000008
 #define  OR_INTR_STATUS_RHSC            0x00000040
 #define  OR_INTR_STATUS_UE              0x00000010
 // --------------- HcInterruptEnable Register -----------------
 #define  OR_INTR_ENABLE_WDH             0x00000002
+#define  OR_INTR_ENABLE_SF              0x00000004
+#define  OR_INTR_ENABLE_RD              0x00000008
 #define  OR_INTR_ENABLE_RHSC            0x00000040
 #define  OR_INTR_ENABLE_MIE             0x80000000
 // ---------------- HcRhDescriptorA Register ------------------
@@ -94,23 +99,32 @@ enum ENDPOINT_TYPE {
 #define  OR_RH_STATUS_DRWE              0x00008000
 // -------------- HcRhPortStatus[1:NDP] Register --------------
 #define  OR_RH_PORT_CCS                 0x00000001
+#define  OR_RH_PORT_PSS                 0x00000004
+#define  OR_RH_PORT_POCI                0x00000008
 #define  OR_RH_PORT_PRS                 0x00000010
 #define  OR_RH_PORT_CSC                 0x00010000
 #define  OR_RH_PORT_PRSC                0x00100000
 #define  OR_RH_PORT_LSDA                0x00000200
 #define  OR_RH_PORT_PESC                0x00020000
+#define  OR_RH_PORT_PSSC                0x00040000
 #define  OR_RH_PORT_OCIC                0x00080000
 
 #define  FI                     0x2EDF           // 12000 bits per frame (-1)
 #define  DEFAULT_FMINTERVAL     ((((6 * (FI - 210)) / 7) << 16) | FI)
+#if defined(TARGET_RZ_A1H) || defined(TARGET_VK_RZ_A1H)
+#define  FRAME_NUMBER_MASK      0x07FF           // FRMNUM of the USB module: 11 bits
+#else
+#define  FRAME_NUMBER_MASK      0xFFFF           // HcFmNumber: 16 bits
+#endif
 
-#define  ED_SKIP            (uint32_t) (0x00001000)        // Skip this ep in queue
+#define  ED_SKIP            (uint32_t) (0x00004000)        // Skip this ep in queue
 
 #define  TD_ROUNDING        (uint32_t) (0x00040000)        // Buffer Rounding
 #define  TD_SETUP           (uint32_t)(0)                  // Direction of Setup Packet
 #define  TD_IN              (uint32_t)(0x00100000)         // Direction In
 #define  TD_OUT             (uint32_t)(0x00080000)         // Direction Out
 #define  TD_DELAY_INT(x)    (uint32_t)((x) << 21)          // Delay Interrupt
+#define  TD_DELAY_INT_NONE  7                              // No interrupt: reported with the next TD interrupting
 #define  TD_TOGGLE_0        (uint32_t)(0x02000000)         // Toggle 0
 #define  TD_TOGGLE_1        (uint32_t)(0x03000000)         // Toggle 1
 #define  TD_CC              (uint32_t)(0xF0000000)         // Completion Code
@@ -119,6 +133,7 @@ enum ENDPOINT_TYPE {
 
 #define TD_TIMEOUT_CTRL  100
 #define TD_TIMEOUT  2000
+#define FRAME_NUMBER_MASK  0x3FFF                          // HFNUM counts to 0x3FFF at full speed
 #define  TD_SETUP           (uint32_t)(0)                  // Direction of Setup Packet
 #define  TD_IN              (uint32_t)(0x00100000)         // Direction In
 #define  TD_OUT             (uint32_t)(0x00080000)         // Direction Out
@@ -145,60 +160,123 @@ enum ENDPOINT_TYPE {
 #define  SET_CONFIGURATION          0x09
 #define  SET_INTERFACE              0x0b
 #define  CLEAR_FEATURE              0x01
+#define  SET_FEATURE                0x03
+
+// -------------- USB Feature Selectors  --------------
+#define  DEVICE_REMOTE_WAKEUP       0x01
 
 // -------------- USB Descriptor Length  --------------
 #define DEVICE_DESCRIPTOR_LENGTH            0x12
 #define CONFIGURATION_DESCRIPTOR_LENGTH     0x09
 
-// ------------ HostController Transfer Descriptor ------------
-#if defined(USBHOST_OTHER)
-
-typedef struct hcTd {
-	__IO  uint32_t state;
-	__IO  uint8_t *  currBufPtr;    // Physical address of current buffer pointer
-	__IO  hcTd *     nextTD;         // Physical pointer to next Transfer Descriptor
-	__IO  uint32_t   size;        // size of buffer
-	void * ep;                      // ep address where a td is linked in
-	__IO  uint32_t retry;
-	__IO  uint32_t setup;
-} PACKED HCTD;
-// ----------- HostController EndPoint Descriptor -------------
-typedef struct hcEd {
-  uint8_t ch_num;
-  void *hhcd;
-} PACKED HCED;
-// ----------- Host Controller Communication Area ------------
-#define HCCA   void
-
-
-#else 
-// -------------OHCI register --------------------------------
-// ------------ HostController Transfer Descriptor ------------
-typedef struct hcTd {
+// ---------- OHCI HostController Transfer Descriptor ----------
+typedef struct ohciTd {
     __IO  uint32_t   control;        // Transfer descriptor control
     __IO  uint8_t *  currBufPtr;    // Physical address of current buffer pointer
-    __IO  hcTd *     nextTD;         // Physical pointer to next Transfer Descriptor
+    __IO  ohciTd *   nextTD;         // Physical pointer to next Transfer Descriptor
     __IO  uint8_t *  bufEnd;        // Physical address of end of buffer
     void * ep;                      // ep address where a td is linked in
     uint32_t dummy[3];              // padding
-} PACKED HCTD;
-// ----------- HostController EndPoint Descriptor -------------
-typedef struct hcEd {
-    __IO  uint32_t  control;        // Endpoint descriptor control
-    __IO  HCTD *  tailTD;           // Physical address of tail in Transfer descriptor list
-    __IO  HCTD *  headTD;           // Physcial address of head in Transfer descriptor list
-    __IO  hcEd *  nextED;         // Physical address of next Endpoint descriptor
-} PACKED HCED;
-// ----------- Host Controller Communication Area ------------
-typedef struct hcca {
+} PACKED OHCI_HCTD;
+// ----------- OHCI HostController EndPoint Descriptor ----------
+typedef struct ohciEd {
+    __IO  uint32_t    control;      // Endpoint descriptor control
+    __IO  OHCI_HCTD * tailTD;       // Physical address of tail in Transfer descriptor list
+    __IO  OHCI_HCTD * headTD;       // Physcial address of head in Transfer descriptor list
+    __IO  ohciEd *    nextED;       // Physical address of next Endpoint descriptor
+} PACKED OHCI_HCED;
+// --------- OHCI Host Controller Communication Area ------------
+typedef struct ohciHcca {
     __IO  uint32_t  IntTable[32];   // Interrupt Table
     __IO  uint32_t  FrameNumber;    // Frame Number
     __IO  uint32_t  DoneHead;       // Done Head
     volatile  uint8_t   Reserved[116];  // Reserved for future use
     volatile  uint8_t   Unknown[4];     // Unused
-} PACKED HCCA;
+} PACKED OHCI_HCCA;
+
+// ------- STM HAL HostController Transfer Descriptor -----------
+typedef struct stmTd {
+	__IO  uint32_t state;
+	__IO  uint8_t *  currBufPtr;    // Physical address of current buffer pointer
+	__IO  stmTd *    nextTD;         // Physical pointer to next Transfer Descriptor
+	__IO  uint32_t   size;        // size of buffer
+	void * ep;                      // ep address where a td is linked in
+	__IO  uint32_t retry;
+	__IO  uint32_t setup;
+	__IO  uint32_t naks;            // NAK retries of the transfer
+} PACKED STM_HCTD;
+// -------- STM HAL HostController EndPoint Descriptor ----------
+#define HC_NO_CHANNEL  0xFF
+
+typedef struct stmEd {
+  uint8_t ch_num;                 // host channel, HC_NO_CHANNEL when no transfer in flight
+  uint8_t toggle_in;              // data toggles saved while the channel is released
+  uint8_t toggle_out;
+  uint8_t periodic;               // served first when waiting for a channel
+  void *hhcd;
+  void *ep;                       // USBEndpoint owning this descriptor
+  stmEd *next_wait;               // next endpoint waiting for a channel
+} PACKED STM_HCED;
+
+// ------------ Descriptors of the selected controller ----------
+#if defined(USBHOST_OTHER)
+typedef STM_HCTD  HCTD;
+typedef STM_HCED  HCED;
+// the STM HAL handle is stored in place of the HCCA
+#define HCCA   void
+#else
+typedef OHCI_HCTD HCTD;
+typedef OHCI_HCED HCED;
+typedef OHCI_HCCA HCCA;
 #endif
 
+// ------------ Transfer statistics ----------
+// number of buckets of the latency histograms: bucket 0 counts the latencies
+// under 1 us, bucket n those in [2^(n-1), 2^n[ us and the last one the longer ones
+#define USB_LATENCY_BUCKETS     16
+
+typedef struct {
+    uint32_t transfers;         // processed transfers (one per stage of a control transfer)
+    uint32_t bytes;             // bytes transferred by the successful transfers
+    uint32_t errors;            // transfers completed with an error (stalls included)
+    uint32_t stalls;            // reported as errors by the STM HAL driver
+    uint32_t naks;              // NAK retries, always 0 on OHCI: NAKs are retried by the controller
+    uint32_t timeouts;          // blocking transfers aborted by a timeout
+} USBEndpointStats;
+
+typedef struct {
+    USBEndpointStats total;                         // endpoints and control transfers of the device
+    uint32_t completion[USB_LATENCY_BUCKETS];       // submit to completion
+    uint32_t callback[USB_LATENCY_BUCKETS];         // completion to callback (usb_thread)
+} USBDeviceStats;
+
+typedef struct {
+    uint16_t used;
+    uint16_t max;               // high-water mark
+} USBPoolUsage;
+
+typedef struct {
+    USBPoolUsage eds;           // EDs of the endpoints (MAX_ENDPOINT)
+    USBPoolUsage tds;           // TDs of the endpoints (MAX_TD)
+    USBPoolUsage mails;         // events queued to the usb_thread (USB_MAIL_SIZE)
+    uint32_t mail_failures;     // events lost: no free mail
+} USBPoolStats;
+
+typedef struct {
+    uint32_t cycles;            // unplug/plug cycles done
+    uint32_t failures;          // cycles where not all the devices were enumerated again
+    uint32_t enum_first;        // us, enumeration time of the first cycle
+    uint32_t enum_last;         // us, enumeration time of the last cycle
+    uint32_t enum_max;          // us
+    USBPoolStats first;         // pools after the first cycle
+    USBPoolStats last;          // pools after the last cycle
+    int32_t ed_growth;          // EDs gained over the cycles, from the trend of the settled pools
+    int32_t td_growth;          // TDs gained over the cycles
+    bool growing;               // a growth reaches USB_CHURN_LEAK
+    uint32_t load_transfers;    // control transfers of the load during the cycles
+    uint32_t load_errors;       // control transfers of the load failed
+} USBChurnStats;
+
 typedef struct {
     uint8_t bLength;
     uint8_t bDescriptorType;
@@ -27,9 +27,9 @@
 #include "WANDongle.h"
 #include "WANDongleInitializer.h"
 
-WANDongle::WANDongle() : m_pInitializer(NULL), m_serialCount(0), m_totalInitializers(0)
+WANDongle::WANDongle(USBHost * host_inst) : m_pInitializer(NULL), m_serialCount(0), m_totalInitializers(0)
 {
-    host = USBHost::getHostInst();
+    host = (host_inst != NULL) ? host_inst : USBHost::getHostInst();
     init();
 }
 
@@ -43,9 +43,9 @@ public:
     /*
     * Constructor
     *
-    * @param rootdir mount name
+    * @param host_inst USBHost instance to bind to, the first available one if NULL
     */
-    WANDongle();
+    WANDongle(USBHost * host_inst = NULL);
 
     /*
     * Destructor
@@ -18,6 +18,27 @@
 
 #if USBHOST_KEYBOARD
 
+#if USBHOST_REPLAY
+typedef struct {
+    uint32_t time;              // us
+    uint8_t len;
+    uint8_t data[9];
+} replay_report_t;
+
+// record of the reports of all the keyboards, the last ones are kept
+static replay_report_t replay_reports[USB_REPLAY_REPORTS];
+static volatile uint32_t replay_count;
+
+static void recordReport(uint8_t * data, int len)
+{
+    replay_report_t * r = &replay_reports[replay_count % USB_REPLAY_REPORTS];
+    r->time = us_ticker_read();
+    r->len = len;
+    memcpy(r->data, data, len);
+    replay_count++;
+}
+#endif
+
 static uint8_t keymap[4][0x39] = {
     { 0, 0, 0, 0, 'a', 'b' /*0x05*/,
       'c', 'd', 'e', 'f', 'g' /*0x0a*/,
@@ -77,8 +98,8 @@ static uint8_t keymap[4][0x39] = {
 };
 
 
-USBHostKeyboard::USBHostKeyboard() {
-    host = USBHost::getHostInst();
+USBHostKeyboard::USBHostKeyboard(USBHost * host_inst) {
+    host = (host_inst != NULL) ? host_inst : USBHost::getHostInst();
     init();
 }
 
@@ -92,6 +113,8 @@ void USBHostKeyboard::init() {
     dev_connected = false;
     keyboard_intf = -1;
     keyboard_device_found = false;
+    memset(last_keys, 0, sizeof(last_keys));
+    last_modifier = 0;
 }
 
 bool USBHostKeyboard::connected() {
@@ -126,6 +149,7 @@ bool USBHostKeyboard::connect()
 
                     USB_INFO("New Keyboard device: VID:%04x PID:%04x [dev: %p - intf: %d]", dev->getVid(), dev->getPid(), dev, keyboard_intf);
                     dev->setName("Keyboard", keyboard_intf);
+                    USB_BOOT_MARK("keyboard_connected");
                     host->registerDriver(dev, keyboard_intf, this, &USBHostKeyboard::init);
 
                     int_in->attach(this, &USBHostKeyboard::rxHandler);
@@ -142,24 +166,142 @@ bool USBHostKeyboard::connect()
 }
 
 void USBHostKeyboard::rxHandler() {
+    USB_TRACE_SCOPE("keyboard_rx");
     int len = int_in->getLengthTransferred();
-    int index = (len == 9) ? 1 : 0;
     int len_listen = int_in->getSize();
-    uint8_t key = 0;
     if (len == 8 || len == 9) {
-        uint8_t modifier = (report[index] == 4) ? 3 : report[index];
         len_listen = len;
-        key = keymap[modifier][report[index + 2]];
+#if USBHOST_REPLAY
+        recordReport(report, len);
+#endif
+        parseReport(report, len, int_in);
+    }
+    if (dev && int_in)
+        host->interruptRead(dev, int_in, report, len_listen, false);
+}
+
+/*
+* Decode a report and call the callbacks for the keys pressed since the previous report,
+* in the order of the report (several keys are held during fast typing)
+* ep: endpoint the report was received on, NULL if replayed
+* returns the number of keys passed to onKey
+*/
+int USBHostKeyboard::parseReport(uint8_t * data, int len, USBEndpoint * ep) {
+    int index = (len == 9) ? 1 : 0;
+    uint8_t modifier = (data[index] == 4) ? 3 : data[index];
+    uint8_t * keys = &data[index + 2];
+    bool pressed = false;
+    int nb = 0;
+
+    // ErrorRollOver: too many keys pressed, the report does not tell which ones
+    if (keys[0] == 0x01) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < sizeof(last_keys); i++) {
+        uint8_t code = keys[i];
+        uint8_t key = 0;
+        if ((code == 0) || (memchr(last_keys, code, sizeof(last_keys)) != NULL)) {
+            continue;
+        }
+        pressed = true;
+        // only the modifiers and keys of the keymap are decoded
+        if ((modifier < 4) && (code < sizeof(keymap[0]))) {
+            key = keymap[modifier][code];
+        }
         if (key && onKey) {
+            USB_LATENCY_BEGIN(ep);
             (*onKey)(key);
+            nb++;
         }
-        if ((report[index + 2] || modifier) && onKeyCode) {
-            (*onKeyCode)(report[index + 2], modifier);
+        if (onKeyCode) {
+            (*onKeyCode)(code, modifier);
         }
     }
-    if (dev && int_in)
-        host->interruptRead(dev, int_in, report, len_listen, false);
+    if (!pressed && modifier && (modifier != last_modifier) && onKeyCode) {
+        (*onKeyCode)(0, modifier);
+    }
+
+    memcpy(last_keys, keys, sizeof(last_keys));
+    last_modifier = modifier;
+    return nb;
+}
+
+#if USBHOST_REPLAY
+int USBHostKeyboard::dumpReports(FILE * file)
+{
+    uint32_t count = replay_count;
+    uint32_t first = (count > USB_REPLAY_REPORTS) ? count - USB_REPLAY_REPORTS : 0;
+    uint32_t last_time = replay_reports[first % USB_REPLAY_REPORTS].time;
+    int nb = 0;
+
+    for (uint32_t i = first; i < count; i++) {
+        replay_report_t * r = &replay_reports[i % USB_REPLAY_REPORTS];
+        if (fprintf(file, "%lu %d", (unsigned long)(r->time - last_time), r->len) < 0) {
+            return -1;
+        }
+        for (uint8_t j = 0; j < r->len; j++) {
+            fprintf(file, " %02x", r->data[j]);
+        }
+        if (fprintf(file, "\n") < 0) {
+            return -1;
+        }
+        last_time = r->time;
+        nb++;
+    }
+
+    // the reports received while saving are lost
+    replay_count = 0;
+    return nb;
+}
+
+int USBHostKeyboard::replay(FILE * file, bool realtime, USBReplayStats * stats)
+{
+    uint8_t data[9];
+    unsigned long delta;
+    int len;
+    int nb = 0;
+    uint32_t keys = 0;
+    uint32_t start = us_ticker_read();
+    uint32_t at = 0;
+
+    memset(last_keys, 0, sizeof(last_keys));
+    last_modifier = 0;
+
+    while (fscanf(file, "%lu %d", &delta, &len) == 2) {
+        if ((len != 8) && (len != 9)) {
+            return -1;
+        }
+        for (int i = 0; i < len; i++) {
+            unsigned int byte;
+            if (fscanf(file, "%x", &byte) != 1) {
+                return -1;
+            }
+            data[i] = byte;
+        }
+
+        if (realtime) {
+            // from the start of the replay: the time spent in the callbacks is not added up
+            at += delta;
+            int32_t ahead = at - (us_ticker_read() - start);
+            if (ahead > 1000) {
+                Thread::wait(ahead / 1000);
+            }
+            while ((int32_t)(at - (us_ticker_read() - start)) > 0);
+        }
+
+        keys += parseReport(data, len, NULL);
+        nb++;
+    }
+
+    if (stats) {
+        stats->reports = nb;
+        stats->keys = keys;
+        stats->elapsed = us_ticker_read() - start;
+    }
+    return nb;
 }
+#endif
 
 /*virtual*/ void USBHostKeyboard::setVidPid(uint16_t vid, uint16_t pid)
 {
@@ -23,6 +23,14 @@
 
 #include "USBHost.h"
 
+#if USBHOST_REPLAY
+typedef struct {
+    uint32_t reports;           // reports replayed
+    uint32_t keys;              // keys passed to the onKey callback
+    uint32_t elapsed;           // us, duration of the replay
+} USBReplayStats;
+#endif
+
 /**
  * A class to communicate a USB keyboard
  */
@@ -31,8 +39,10 @@ public:
 
     /**
     * Constructor
+    *
+    * @param host_inst USBHost instance to bind to, the first available one if NULL
     */
-    USBHostKeyboard();
+    USBHostKeyboard(USBHost * host_inst = NULL);
 
     /**
      * Try to connect a keyboard device
@@ -70,6 +80,32 @@ public:
         }
     }
 
+#if USBHOST_REPLAY
+    /**
+    * Save the keyboard reports recorded since the last call and clear them.
+    * One line per report: the time from the previous report in us, the length
+    * and the bytes of the report in hex
+    *
+    * @param file file opened for writing
+    *
+    * @returns number of reports saved, -1 on a write error
+    */
+    static int dumpReports(FILE * file);
+
+    /**
+    * Replay reports saved by dumpReports through the decoding of the reports
+    * and the attached callbacks, as if they were received from the keyboard.
+    * The replay starts with no key pressed
+    *
+    * @param file file opened for reading
+    * @param realtime true to keep the time between the reports, false to replay at the maximum rate
+    * @param stats if not NULL, filled with the statistics of the replay
+    *
+    * @returns number of reports replayed, -1 on a malformed line
+    */
+    int replay(FILE * file, bool realtime, USBReplayStats * stats = NULL);
+#endif
+
 protected:
     //From IUSBEnumerator
     virtual void setVidPid(uint16_t vid, uint16_t pid);
@@ -87,10 +123,15 @@ private:
     bool dev_connected;
 
     void rxHandler();
+    int parseReport(uint8_t * data, int len, USBEndpoint * ep);
 
     void (*onKey)(uint8_t key);
     void (*onKeyCode)(uint8_t key, uint8_t modifier);
 
+    // keys and modifier of the previous report: only the keys pressed since are decoded
+    uint8_t last_keys[6];
+    uint8_t last_modifier;
+
     int report_id;
 
     void init();
@@ -18,8 +18,8 @@
 
 #if USBHOST_MOUSE
 
-USBHostMouse::USBHostMouse() {
-    host = USBHost::getHostInst();
+USBHostMouse::USBHostMouse(USBHost * host_inst) {
+    host = (host_inst != NULL) ? host_inst : USBHost::getHostInst();
     init();
 }
 
@@ -94,6 +94,7 @@ bool USBHostMouse::connect()
 }
 
 void USBHostMouse::rxHandler() {
+    USB_TRACE_SCOPE("mouse_rx");
     int len_listen = int_in->getLengthTransferred();
     if (len_listen !=0) {
 
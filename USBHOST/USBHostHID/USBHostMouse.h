@@ -31,8 +31,10 @@ public:
 
     /**
     * Constructor
+    *
+    * @param host_inst USBHost instance to bind to, the first available one if NULL
     */
-    USBHostMouse();
+    USBHostMouse(USBHost * host_inst = NULL);
 
     /**
      * Try to connect a mouse device
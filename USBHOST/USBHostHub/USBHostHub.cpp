@@ -29,11 +29,16 @@
 
 #define PORT_CONNECTION_FEATURE     (0x00)
 #define PORT_ENABLE_FEATURE         (0x01)
+#define PORT_SUSPEND_FEATURE        (0x02)
 #define PORT_RESET_FEATURE          (0x04)
 #define PORT_POWER_FEATURE          (0x08)
 
+#define C_HUB_LOCAL_POWER_FEATURE     (0)
+#define C_HUB_OVER_CURRENT_FEATURE    (1)
+
 #define C_PORT_CONNECTION_FEATURE     (16)
 #define C_PORT_ENABLE_FEATURE         (17)
+#define C_PORT_OVER_CURRENT_FEATURE   (19)
 #define C_PORT_RESET_FEATURE          (20)
 
 #define PORT_CONNECTION   (1 << 0)
@@ -50,6 +55,20 @@
 #define C_PORT_OVER_CURRENT (1 << 19)
 #define C_PORT_RESET        (1 << 20)
 
+#define C_HUB_LOCAL_POWER   (1 << 16)
+#define C_HUB_OVER_CURRENT  (1 << 17)
+
+// port enumeration states
+#define PORT_STATE_IDLE         0   // no device
+#define PORT_STATE_DEBOUNCE     1   // device connected, waiting before the reset
+#define PORT_STATE_RESETTING    2   // reset requested, waiting for C_PORT_RESET
+#define PORT_STATE_ADDRESSING   3   // reported to USBHost, device on the default address
+#define PORT_STATE_READY        4   // device addressed by USBHost
+
+// ms
+#define PORT_DEBOUNCE_TIME      100
+#define PORT_RESET_TIMEOUT      500
+
 USBHostHub::USBHostHub() {
     host = NULL;
     init();
@@ -64,9 +83,17 @@ void USBHostHub::init() {
     hub_device_found = false;
     nb_port = 0;
     hub_characteristics = 0;
+    changes_pending = false;
+    power_good_time = 0;
+    ready_time = -1;
+
+    wakeup.detach();
+    hub_timer.stop();
 
     for (int i = 0; i < MAX_HUB_PORT; i++) {
         device_children[i] = NULL;
+        port_state[i] = PORT_STATE_IDLE;
+        port_deadline[i] = 0;
     }
 }
 
@@ -92,6 +119,8 @@ bool USBHostHub::connect(USBDeviceConnected * dev)
 
     if (hub_device_found) {
         this->dev = dev;
+        hub_timer.reset();
+        hub_timer.start();
 
         int_in = dev->getEndpoint(hub_intf, INTERRUPT_ENDPOINT, IN);
 
@@ -115,13 +144,18 @@ bool USBHostHub::connect(USBDeviceConnected * dev)
         hub_characteristics = buf[3];
 
         USB_DBG("Hub has %d port", nb_port);
+        if (nb_port > MAX_HUB_PORT) {
+            USB_WARN("Only the first %d ports of the hub are used", MAX_HUB_PORT);
+            nb_port = MAX_HUB_PORT;
+        }
 
         for (uint8_t j = 1; j <= nb_port; j++) {
             setPortFeature(PORT_POWER_FEATURE, j);
         }
-        wait_ms(buf[5]*2);
+        // no port is reset before its power is good (bPwrOn2PwrGood, 2 ms units)
+        power_good_time = hub_timer.read_ms() + buf[5]*2;
 
-        host->interruptRead(dev, int_in, buf, 1, false);
+        readStatusChange();
         dev_connected = true;
         return true;
     }
@@ -165,6 +199,41 @@ void USBHostHub::deviceConnected(USBDeviceConnected * dev) {
     device_children[dev->getPort() - 1] = dev;
 }
 
+void USBHostHub::portEnumerated(uint8_t port) {
+    if ((port == 0) || (port > nb_port)) {
+        return;
+    }
+    if (port_state[port - 1] == PORT_STATE_ADDRESSING) {
+        port_state[port - 1] = PORT_STATE_READY;
+    }
+    checkReady();
+}
+
+bool USBHostHub::suspendPort(uint8_t port) {
+    return host->controlWrite( dev,
+                               USB_HOST_TO_DEVICE | USB_REQUEST_TYPE_CLASS | USB_RECIPIENT_INTERFACE | USB_RECIPIENT_ENDPOINT,
+                               SET_FEATURE,
+                               PORT_SUSPEND_FEATURE,
+                               port,
+                               NULL,
+                               0) == USB_TYPE_OK;
+}
+
+bool USBHostHub::resumePort(uint8_t port) {
+    // the hub reports C_PORT_SUSPEND at the end of the resume signaling
+    return host->controlWrite( dev,
+                               USB_HOST_TO_DEVICE | USB_REQUEST_TYPE_CLASS | USB_RECIPIENT_INTERFACE | USB_RECIPIENT_ENDPOINT,
+                               CLEAR_FEATURE,
+                               PORT_SUSPEND_FEATURE,
+                               port,
+                               NULL,
+                               0) == USB_TYPE_OK;
+}
+
+int USBHostHub::getReadyTime() {
+    return ready_time;
+}
+
 void USBHostHub::deviceDisconnected(USBDeviceConnected * dev) {
     device_children[dev->getPort() - 1] = NULL;
 }
@@ -178,45 +247,200 @@ void USBHostHub::hubDisconnected() {
 }
 
 void USBHostHub::rxHandler() {
-    uint32_t status;
+    USB_TRACE_SCOPE("hub_rx");
     if (int_in) {
         if ((int_in->getLengthTransferred())&&(int_in->getState() == USB_TYPE_IDLE)) {
-            for (int port = 1; port <= nb_port; port++) {
-                status = getPortStatus(port);
-                USB_DBG("[hub handler hub: %d] status port %d [hub: %p]: 0x%X", dev->getHub(), port, dev, status);
-
-                // if connection status has changed
-                if (status & C_PORT_CONNECTION) {
-                    if (status & PORT_CONNECTION) {
-                        USB_DBG("[hub handler hub: %d - port: %d] new device connected", dev->getHub(), port);
-                        host->deviceConnected(dev->getHub() + 1, port, status & PORT_LOW_SPEED, this);
-                    } else {
-                        USB_DBG("[hub handler hub: %d - port: %d] device disconnected", dev->getHub(), port);
-                        host->deviceDisconnected(dev->getHub() + 1, port, this, 0);
-                    }
-
-                    clearPortFeature(C_PORT_CONNECTION_FEATURE, port);
-                }
+            // the ports are queried from the hub thread, which polls the status change endpoint again
+            changes_pending = true;
+            host->hubChanged(this);
+            return;
+        }
+        readStatusChange();
+    }
+}
 
-                if (status & C_PORT_RESET) {
-                    clearPortFeature(C_PORT_RESET_FEATURE, port);
-                }
+void USBHostHub::serviceChanges() {
+    if (!dev_connected || !int_in) {
+        return;
+    }
+
+    if (changes_pending) {
+        changes_pending = false;
+        processChanges();
+        readStatusChange();
+    }
+
+    processPorts();
+}
+
+void USBHostHub::processChanges() {
+    uint32_t status;
+
+    if (status_change[0] & 0x01) {
+        status = getHubStatus();
+        USB_DBG("[hub handler hub: %d] hub status [hub: %p]: 0x%X", dev->getHub(), dev, status);
+        if (status & C_HUB_LOCAL_POWER) {
+            clearHubFeature(C_HUB_LOCAL_POWER_FEATURE);
+        }
+        if (status & C_HUB_OVER_CURRENT) {
+            USB_ERR("HUB OVER CURRENT DETECTED\r\n");
+            clearHubFeature(C_HUB_OVER_CURRENT_FEATURE);
+        }
+    }
 
-                if (status & C_PORT_ENABLE) {
-                    clearPortFeature(C_PORT_ENABLE_FEATURE, port);
+    // only the ports flagged in the bitmap are queried
+    for (int port = 1; port <= nb_port; port++) {
+        if (!(status_change[port / 8] & (1 << (port % 8)))) {
+            continue;
+        }
+
+        status = getPortStatus(port);
+        USB_DBG("[hub handler hub: %d] status port %d [hub: %p]: 0x%X", dev->getHub(), port, dev, status);
+
+        // acknowledge all the changes at once before reporting them
+        clearPortChanges(port, status);
+
+        // if connection status has changed
+        if (status & C_PORT_CONNECTION) {
+            if (status & PORT_CONNECTION) {
+                USB_DBG("[hub handler hub: %d - port: %d] new device connected", dev->getHub(), port);
+                // the port is reset by processPorts() once the connection is stable
+                setPortIdle(port);
+                port_state[port - 1] = PORT_STATE_DEBOUNCE;
+                port_deadline[port - 1] = hub_timer.read_ms() + PORT_DEBOUNCE_TIME;
+                if (port_deadline[port - 1] < power_good_time) {
+                    port_deadline[port - 1] = power_good_time;
                 }
+            } else {
+                USB_DBG("[hub handler hub: %d - port: %d] device disconnected", dev->getHub(), port);
+                setPortIdle(port);
+                host->deviceDisconnected(dev->getHub() + 1, port, this, 0);
+            }
+        }
 
-                if ((status & PORT_OVER_CURRENT)) {
-                    USB_ERR("OVER CURRENT DETECTED\r\n");
-                    clearPortFeature(PORT_OVER_CURRENT, port);
-                    host->deviceDisconnected(dev->getHub() + 1, port, this, 0);
+        // end of the reset started by processPorts(): the device is on the default address
+        if ((status & C_PORT_RESET) && (port_state[port - 1] == PORT_STATE_RESETTING)) {
+            if ((status & (PORT_CONNECTION | PORT_ENABLE)) == (PORT_CONNECTION | PORT_ENABLE)) {
+                USB_DBG("[hub handler hub: %d - port: %d] port reset", dev->getHub(), port);
+                port_state[port - 1] = PORT_STATE_ADDRESSING;
+                if (!host->deviceConnected(dev->getHub() + 1, port, status & PORT_LOW_SPEED, this)) {
+                    setPortIdle(port);
                 }
+            } else {
+                USB_ERR("[hub handler hub: %d - port: %d] port not enabled by reset", dev->getHub(), port);
+                setPortIdle(port);
             }
         }
-        host->interruptRead(dev, int_in, buf, 1, false);
+
+#if USBHOST_SUSPEND
+        // end of the resume of a suspended port (remote wakeup or resumePort)
+        if ((status & C_PORT_SUSPEND) && !(status & PORT_SUSPEND)) {
+            host->deviceResumed(dev->getHub() + 1, port, this);
+        }
+#endif
+
+        if ((status & C_PORT_OVER_CURRENT) && (status & PORT_OVER_CURRENT)) {
+            USB_ERR("OVER CURRENT DETECTED\r\n");
+            setPortIdle(port);
+            host->deviceDisconnected(dev->getHub() + 1, port, this, 0);
+        }
     }
 }
 
+// start the resets which are due, a single port of the bus is reset at a time
+void USBHostHub::processPorts() {
+    int now = hub_timer.read_ms();
+    int next = -1;
+
+    for (int port = 1; port <= nb_port; port++) {
+        int delay = port_deadline[port - 1] - now;
+
+        switch (port_state[port - 1]) {
+            case PORT_STATE_DEBOUNCE:
+                if (delay > 0) {
+                    break;
+                }
+                if (!host->lockDefaultAddress(this, port)) {
+                    // serviced again when the default address is released
+                    delay = -1;
+                    break;
+                }
+                USB_DBG("[hub handler hub: %d - port: %d] reset port", dev->getHub(), port);
+                setPortFeature(PORT_RESET_FEATURE, port);
+                port_state[port - 1] = PORT_STATE_RESETTING;
+                port_deadline[port - 1] = now + PORT_RESET_TIMEOUT;
+                delay = PORT_RESET_TIMEOUT;
+                break;
+
+            case PORT_STATE_RESETTING:
+                if (delay > 0) {
+                    break;
+                }
+                USB_ERR("[hub handler hub: %d - port: %d] port reset timeout", dev->getHub(), port);
+                setPortIdle(port);
+                delay = -1;
+                break;
+
+            default:
+                delay = -1;
+                break;
+        }
+
+        if ((delay > 0) && ((next == -1) || (delay < next))) {
+            next = delay;
+        }
+    }
+
+    // the hub thread is woken up for the next deadline
+    if (next > 0) {
+        wakeup.attach_us(callback(this, &USBHostHub::wakeUp), next * 1000);
+    }
+
+    checkReady();
+}
+
+void USBHostHub::setPortIdle(uint8_t port) {
+    // the port holds the default address from its reset until its device is addressed
+    if ((port_state[port - 1] == PORT_STATE_RESETTING) || (port_state[port - 1] == PORT_STATE_ADDRESSING)) {
+        host->releaseDefaultAddress(this, port);
+    }
+    port_state[port - 1] = PORT_STATE_IDLE;
+}
+
+void USBHostHub::wakeUp() {
+    host->hubChanged(this);
+}
+
+// report the time from the hub connection until all its devices have been addressed
+void USBHostHub::checkReady() {
+    uint8_t nb_ready = 0;
+
+    if (ready_time != -1) {
+        return;
+    }
+    for (int port = 1; port <= nb_port; port++) {
+        switch (port_state[port - 1]) {
+            case PORT_STATE_DEBOUNCE:
+            case PORT_STATE_RESETTING:
+            case PORT_STATE_ADDRESSING:
+                return;
+            case PORT_STATE_READY:
+                nb_ready++;
+                break;
+            default:
+                break;
+        }
+    }
+    if (nb_ready) {
+        ready_time = hub_timer.read_ms();
+        USB_INFO("Hub %p: %d device(s) ready %d ms after the hub has been connected", dev, nb_ready, ready_time);
+    }
+}
+
+void USBHostHub::readStatusChange() {
+    host->interruptRead(dev, int_in, status_change, (nb_port + 8) / 8, false);
+}
+
 void USBHostHub::portReset(uint8_t port) {
     // reset port
     uint32_t status;
@@ -234,7 +458,7 @@ void USBHostHub::portReset(uint8_t port) {
             break;
         if (status & PORT_OVER_CURRENT) {
             USB_ERR("OVER CURRENT DETECTED\r\n");
-            clearPortFeature(PORT_OVER_CURRENT, port);
+            clearPortFeature(C_PORT_OVER_CURRENT_FEATURE, port);
             host->deviceDisconnected(dev->getHub() + 1, port, this, 0);
             break;
         }
@@ -262,6 +486,37 @@ void USBHostHub::clearPortFeature(uint32_t feature, uint8_t port) {
                         0);
 }
 
+// the change bits of the port status are numbered as their C_PORT_* feature selectors
+void USBHostHub::clearPortChanges(uint8_t port, uint32_t status) {
+    for (uint32_t feature = C_PORT_CONNECTION_FEATURE; feature <= C_PORT_RESET_FEATURE; feature++) {
+        if (status & (1UL << feature)) {
+            clearPortFeature(feature, port);
+        }
+    }
+}
+
+void USBHostHub::clearHubFeature(uint32_t feature) {
+    host->controlWrite( dev,
+                        USB_HOST_TO_DEVICE | USB_REQUEST_TYPE_CLASS | USB_RECIPIENT_DEVICE,
+                        CLEAR_FEATURE,
+                        feature,
+                        0,
+                        NULL,
+                        0);
+}
+
+uint32_t USBHostHub::getHubStatus() {
+    uint32_t st;
+    host->controlRead(  dev,
+                        USB_DEVICE_TO_HOST | USB_REQUEST_TYPE_CLASS | USB_RECIPIENT_DEVICE,
+                        GET_STATUS,
+                        0,
+                        0,
+                        (uint8_t *)&st,
+                        4);
+    return st;
+}
+
 uint32_t USBHostHub::getPortStatus(uint8_t port) {
     uint32_t st;
     host->controlRead(  dev,
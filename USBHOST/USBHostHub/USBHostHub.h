@@ -88,6 +88,45 @@ public:
     */
     void hubDisconnected();
 
+    /**
+    * Called by USBHost in the hub thread to query and acknowledge the ports
+    * flagged in the status change bitmap
+    */
+    void serviceChanges();
+
+    /**
+    * Called by USBHost when it is done with the device reported on a port,
+    * whether it could be addressed or not
+    *
+    * @param port port number
+    */
+    void portEnumerated(uint8_t port);
+
+    /**
+    * Suspend a port (selective suspend of the device connected to it)
+    *
+    * @param port port number
+    *
+    * @returns true if the request has been accepted by the hub
+    */
+    bool suspendPort(uint8_t port);
+
+    /**
+    * Resume a suspended port, USBHost::deviceResumed is called when the hub reports the end of the resume
+    *
+    * @param port port number
+    *
+    * @returns true if the request has been accepted by the hub
+    */
+    bool resumePort(uint8_t port);
+
+    /**
+    * Time from the hub connection until its first devices have all been addressed
+    *
+    * @returns time in ms, -1 if not all the devices are addressed yet
+    */
+    int getReadyTime();
+
 protected:
     //From IUSBEnumerator
     virtual void setVidPid(uint16_t vid, uint16_t pid);
@@ -106,12 +145,33 @@ private:
 
     uint8_t buf[sizeof(HubDescriptor)];
 
+    // status change bitmap: bit 0 for the hub, bit n for port n
+    uint8_t status_change[(MAX_HUB_PORT + 8) / 8];
+    volatile bool changes_pending;
+
+    // port enumeration, driven by the status changes and the wakeup timeout
+    uint8_t port_state[MAX_HUB_PORT];
+    int port_deadline[MAX_HUB_PORT];
+    int power_good_time;
+    int ready_time;
+    Timer hub_timer;
+    Timeout wakeup;
+
     int hub_intf;
     bool hub_device_found;
 
     void setPortFeature(uint32_t feature, uint8_t port);
     void clearPortFeature(uint32_t feature, uint8_t port);
+    void clearPortChanges(uint8_t port, uint32_t status);
     uint32_t getPortStatus(uint8_t port);
+    void clearHubFeature(uint32_t feature);
+    uint32_t getHubStatus();
+    void readStatusChange();
+    void processChanges();
+    void processPorts();
+    void setPortIdle(uint8_t port);
+    void wakeUp();
+    void checkReady();
 
     USBDeviceConnected * device_children[MAX_HUB_PORT];
 
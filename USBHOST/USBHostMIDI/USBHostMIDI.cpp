@@ -24,8 +24,8 @@
 
 #define SET_LINE_CODING 0x20
 
-USBHostMIDI::USBHostMIDI() {
-    host = USBHost::getHostInst();
+USBHostMIDI::USBHostMIDI(USBHost * host_inst) {
+    host = (host_inst != NULL) ? host_inst : USBHost::getHostInst();
     size_bulk_in = 0;
     size_bulk_out = 0;
     init();
@@ -32,8 +32,10 @@ class USBHostMIDI : public IUSBEnumerator {
 public:
     /**
      * Constructor
+     *
+     * @param host_inst USBHost instance to bind to, the first available one if NULL
      */
-    USBHostMIDI();
+    USBHostMIDI(USBHost * host_inst = NULL);
 
     /**
      * Check if a USB MIDI device is connected
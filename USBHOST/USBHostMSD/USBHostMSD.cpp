@@ -28,9 +28,9 @@
 #define GET_MAX_LUN             (0xFE)
 #define BO_MASS_STORAGE_RESET   (0xFF)
 
-USBHostMSD::USBHostMSD()
+USBHostMSD::USBHostMSD(USBHost * host_inst)
 {
-    host = USBHost::getHostInst();
+    host = (host_inst != NULL) ? host_inst : USBHost::getHostInst();
     /*  register an object in FAT */
 
     init_usb();
@@ -169,18 +169,21 @@ int USBHostMSD::inquiry(uint8_t lun, uint8_t page_code)
     uint8_t result[36];
     int status = SCSITransfer(cmd, 6, DEVICE_TO_HOST, result, 36);
     if (status == 0) {
-        char vid_pid[17];
-        memcpy(vid_pid, &result[8], 8);
-        vid_pid[8] = 0;
-        USB_INFO("MSD [dev: %p] - Vendor ID: %s", dev, vid_pid);
-
-        memcpy(vid_pid, &result[16], 16);
-        vid_pid[16] = 0;
-        USB_INFO("MSD [dev: %p] - Product ID: %s", dev, vid_pid);
-
-        memcpy(vid_pid, &result[32], 4);
-        vid_pid[4] = 0;
-        USB_INFO("MSD [dev: %p] - Product rev: %s", dev, vid_pid);
+        // the log may be printed later: the strings must outlive this call
+        static char vid[9];
+        static char pid[17];
+        static char rev[5];
+        memcpy(vid, &result[8], 8);
+        vid[8] = 0;
+        USB_INFO("MSD [dev: %p] - Vendor ID: %s", dev, vid);
+
+        memcpy(pid, &result[16], 16);
+        pid[16] = 0;
+        USB_INFO("MSD [dev: %p] - Product ID: %s", dev, pid);
+
+        memcpy(rev, &result[32], 4);
+        rev[4] = 0;
+        USB_INFO("MSD [dev: %p] - Product rev: %s", dev, rev);
     }
     return status;
 }
@@ -308,6 +311,14 @@ int USBHostMSD::dataTransfer(uint8_t * buf, uint32_t block, uint8_t nbBlock, int
     return SCSITransfer(cmd, 10, direction, buf, blockSize*nbBlock);
 }
 
+// blocks of a READ(10)/WRITE(10): the data stage is queued at once on the TDs of the bulk endpoints
+uint8_t USBHostMSD::maxBlocks()
+{
+    uint8_t tds = (bulk_in->getMaxTDs() < bulk_out->getMaxTDs()) ? bulk_in->getMaxTDs() : bulk_out->getMaxTDs();
+    uint32_t nb = (USB_BULK_TD_LEN * tds) / blockSize;
+    return (nb == 0) ? 1 : ((nb > 0xff) ? 0xff : nb);
+}
+
 int USBHostMSD::getMaxLun()
 {
     uint8_t buf[1], res;
@@ -350,10 +361,13 @@ int USBHostMSD::program(const void *buffer, bd_addr_t addr, bd_size_t size)
     block_number =  addr / blockSize;
     count = size /blockSize;
 
-    for (uint32_t b = block_number; b < block_number + count; b++) {
-        if (dataTransfer(buf, b, 1, HOST_TO_DEVICE))
+    while (count) {
+        uint8_t nb = (count < maxBlocks()) ? count : maxBlocks();
+        if (dataTransfer(buf, block_number, nb, HOST_TO_DEVICE))
             return -1;
-        buf += blockSize;
+        block_number += nb;
+        count -= nb;
+        buf += nb * blockSize;
     }
     return 0;
 }
@@ -370,10 +384,13 @@ int USBHostMSD::read(void *buffer, bd_addr_t addr, bd_size_t size)
     block_number =  addr / blockSize;
     count = size /blockSize;
 
-    for (uint32_t b = block_number; b < block_number + count; b++) {
-        if (dataTransfer((uint8_t*)buf, b, 1, DEVICE_TO_HOST))
+    while (count) {
+        uint8_t nb = (count < maxBlocks()) ? count : maxBlocks();
+        if (dataTransfer(buf, block_number, nb, DEVICE_TO_HOST))
             return -1;
-        buf += blockSize;
+        block_number += nb;
+        count -= nb;
+        buf += nb * blockSize;
     }
     return 0;
 }
@@ -34,9 +34,9 @@ public:
     /**
      * Constructor
      *
-     * @param rootdir mount name
+     * @param host_inst USBHost instance to bind to, the first available one if NULL
      */
-    USBHostMSD();
+    USBHostMSD(USBHost * host_inst = NULL);
 
     /**
      * Check if a MSD device is connected
@@ -109,6 +109,7 @@ private:
     int inquiry(uint8_t lun, uint8_t page_code);
     int SCSIRequestSense();
     int dataTransfer(uint8_t * buf, uint32_t block, uint8_t nbBlock, int direction);
+    uint8_t maxBlocks();
     int checkResult(uint8_t res, USBEndpoint * ep);
     int getMaxLun();
 
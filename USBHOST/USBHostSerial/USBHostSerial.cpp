@@ -26,9 +26,9 @@
 
 #if (USBHOST_SERIAL <= 1)
 
-USBHostSerial::USBHostSerial()
+USBHostSerial::USBHostSerial(USBHost * host_inst)
 {
-    host = USBHost::getHostInst();
+    host = (host_inst != NULL) ? host_inst : USBHost::getHostInst();
     ports_found = 0;
     dev_connected = false;
 }
@@ -107,9 +107,9 @@ bool USBHostSerial::connect() {
 
 //------------------------------------------------------------------------------
 
-USBHostMultiSerial::USBHostMultiSerial()
+USBHostMultiSerial::USBHostMultiSerial(USBHost * host_inst)
 {
-    host = USBHost::getHostInst();
+    host = (host_inst != NULL) ? host_inst : USBHost::getHostInst();
     dev = NULL;
     memset(ports, NULL, sizeof(ports));
     ports_found = 0;
@@ -149,7 +149,7 @@ private:
 class USBHostSerial : public IUSBEnumerator, public USBHostSerialPort
 {
 public:
-    USBHostSerial();
+    USBHostSerial(USBHost * host_inst = NULL);
 
     /**
      * Try to connect a serial device
@@ -186,7 +186,7 @@ private:
 
 class USBHostMultiSerial : public IUSBEnumerator {
 public:
-    USBHostMultiSerial();
+    USBHostMultiSerial(USBHost * host_inst = NULL);
     virtual ~USBHostMultiSerial();
 
     USBHostSerialPort* getPort(int port)
@@ -0,0 +1,102 @@
+#ifndef __KEY_REPORTS_H__
+#define __KEY_REPORTS_H__
+
+#include "mbed.h"
+#include "HIDService.h"
+
+// maximum number of reports of a line
+#define KEY_REPORTS_MAX     50
+
+/**
+* @class Key Reports
+* @brief BLE HID reports of a line typed on the USB keyboard.<br>
+* Each key adds the report of its scan code followed by a dummy one (0x73), the
+* keys which are not converted add a report with no key. The reports are sent at
+* the end of a line (enter), the last one releases the keys. The keys which do not
+* fit in the line are dropped and counted.
+*/
+class KeyReports {
+public:
+    KeyReports(): dropped(0) {
+        clear();
+    }
+
+    /**
+    * Convert a key into the reports to send
+    *
+    * @param key character decoded by USBHostKeyboard
+    *
+    * @returns true at the end of a line: the reports can be sent
+    */
+    bool add(uint8_t key) {
+        uint8_t modifier = 0x00;
+        uint8_t scan = 0x00;
+
+        if (key <= 0x39 && key >= 0x30) {
+            // number
+            scan = (key == 0x30) ? 0x27 : key - 0x13;
+        } else if (key <= 0x7a && key >= 0x61) {
+            // lowercase letters
+            scan = key - 0x5d;
+        } else if (key <= 0x5a && key >= 0x41) {
+            // uppercase letters
+            modifier = 0x02;
+            scan = key - 0x3d;
+        } else if (key == 0x20) {
+            // space
+            scan = 0x2c;
+        }
+
+        // the last report of the line is kept for the release
+        if (scan) {
+            if (nb + 2 < KEY_REPORTS_MAX) {
+                put(modifier, scan);
+                put(0x00, 0x73);
+            } else {
+                dropped++;
+            }
+        } else if ((key == 0x0a) || (nb + 1 < KEY_REPORTS_MAX)) {
+            put(0x00, 0x00);
+        } else {
+            dropped++;
+        }
+        return key == 0x0a;
+    }
+
+    /**
+    * Notify the reports of the line, 30 ms apart
+    *
+    * @param hid HID service of the connection
+    */
+    void send(HIDService *hid) {
+        for (int i = 0; i < nb; i++) {
+            hid->updateReport(modifyKey[i], key_press_scan_buff[i]);
+            wait(0.03);
+        }
+    }
+
+    /** Start a new line */
+    void clear() {
+        memset(modifyKey, 0, sizeof(modifyKey));
+        memset(key_press_scan_buff, 0, sizeof(key_press_scan_buff));
+        nb = 0;
+    }
+
+    /** Number of keys dropped because their line was full */
+    uint32_t getDropped() const { return dropped; }
+
+private:
+    void put(uint8_t modifier, uint8_t scan) {
+        modifyKey[nb] = modifier;
+        key_press_scan_buff[nb] = scan;
+        nb++;
+    }
+
+private:
+    uint8_t     key_press_scan_buff[KEY_REPORTS_MAX];
+    uint8_t     modifyKey[KEY_REPORTS_MAX];
+    int         nb;
+    uint32_t    dropped;
+};
+
+#endif /* #ifndef __KEY_REPORTS_H__*/
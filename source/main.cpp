@@ -9,7 +9,10 @@
 #include "USBHostKeyboard.h"
 #include "FATFileSystem.h"
 #include "HIDService.h"
+#include "KeyReports.h"
 #include "DeviceInformationService.h"
+#include "DiagnosticsService.h"
+#include "USBHostMonitor.h"
 
 const static char DEVICE_NAME[] = "USB Device";
 
@@ -19,9 +22,7 @@ class USB_Device ;
 
 static const uint16_t uuid16_list[]        = {GattService::UUID_HUMAN_INTERFACE_DEVICE_SERVICE};
 static char msg[25] = {'\0'};
-static uint8_t key_press_scan_buff[50] = {'\0'};
-static uint8_t modifyKey[50] = {'\0'};
-static char keyData;
+static KeyReports keyReports;
 USB_Device* demoPtr = NULL;
 
 void passkeyDisplayCallback(Gap::Handle_t handle, const SecurityManager::Passkey_t passkey)
@@ -54,6 +55,9 @@ class USB_Device : ble::Gap::EventHandler {
       _hid_uuid(GattService::UUID_HUMAN_INTERFACE_DEVICE_SERVICE),
       _hid_service(ble),
       _deviceInfo(ble, "ARM", "CYNTEC", "SN1", "hw-rev1", "fw-rev1", "soft-rev1"),
+#if USBHOST_DIAGNOSTICS
+      _diagnostics(ble, &_hid_service),
+#endif
       _adv_data_builder(_adv_buffer) { }
 
     void start() {
@@ -77,17 +81,15 @@ class USB_Device : ble::Gap::EventHandler {
       _ble.gap().setAdvertisingInterval(1000);
 
       _event_queue.call_every(500, this, &USB_Device::blink);
-
-      _event_queue.dispatch_forever();
-
-      public_startAdvertising();
-
+#if USBHOST_DIAGNOSTICS
+      _event_queue.call_every(USB_DIAGNOSTICS_PERIOD, &_diagnostics, &DiagnosticsService::update);
+#endif
 
     }    
 
-    void update_keyboard_value(int i) {
+    void update_keyboard_value(KeyReports &reports) {
       if (_connected) {
-        _hid_service.updateReport(modifyKey[i], key_press_scan_buff[i]);
+        reports.send(&_hid_service);
       }
     }
 
@@ -107,9 +109,11 @@ class USB_Device : ble::Gap::EventHandler {
         return;
       }
 
+      USB_BOOT_MARK("ble_init");
       print_mac_address();
 
       start_advertising();
+      USB_BOOT_MARK("advertising");
     }
 
     void start_advertising()
@@ -133,6 +137,7 @@ class USB_Device : ble::Gap::EventHandler {
     virtual void onConnectionComplete(const ble::ConnectionCompleteEvent &event) {
       if (event.getStatus() == BLE_ERROR_NONE) {
         _connected = true;
+        USB_BOOT_MARK("ble_connected");
       }
       printf( "connected.\r\n" );
     }
@@ -150,13 +155,23 @@ class USB_Device : ble::Gap::EventHandler {
 
     DeviceInformationService _deviceInfo;
 
+#if USBHOST_DIAGNOSTICS
+    DiagnosticsService _diagnostics;
+#endif
+
     uint8_t _adv_buffer[ble::LEGACY_ADVERTISING_MAX_SIZE];
     ble::AdvertisingDataBuilder _adv_data_builder;
 };
 
+/** Process the events of the BLE middleware (event queue) */
+void process_ble_events(BLE *ble) {
+  USB_TRACE_SCOPE("ble_events");
+  ble->processEvents();
+}
+
 /** Schedule processing of events from the BLE middleware in the event queue. */
 void schedule_ble_events(BLE::OnEventsToProcessCallbackContext *context) {
-  event_queue.call(Callback<void()>(&context->ble, &BLE::processEvents));
+  event_queue.call(process_ble_events, &context->ble);
 }
 
 void disconnectionCallback(const Gap::DisconnectionCallbackParams_t *params)
@@ -166,75 +181,16 @@ void disconnectionCallback(const Gap::DisconnectionCallbackParams_t *params)
 
 void onKey(uint8_t key)
 {
+  USB_LATENCY_STAMP(USB_LATENCY_KEY);
   printf("Key: %c\r\n", key);
 
-  int index_w, index_b;
-  index_w = index_b = 0;
-
-  keyData = key;
+  msg[0] = key;
 
-  msg[index_w++] = keyData;
-  if (keyData <= 0x39 && keyData >= 0x30)
-  { //number
-    if (keyData == 0x30)
-    {
-      modifyKey[index_b] = 0x00;
-      key_press_scan_buff[index_b] = 0x27;
-      index_b++;
-      key_press_scan_buff[index_b] = 0x73;
-    }
-    else
-    {
-      modifyKey[index_b] = 0x00;
-      key_press_scan_buff[index_b] = keyData - 0x13;
-      index_b++;
-      key_press_scan_buff[index_b] = 0x73;
-    }
-  }
-  else if (keyData <= 0x7a && keyData >= 0x61)
-  { //lowercase letters
-    modifyKey[index_b] = 0x00;
-    key_press_scan_buff[index_b] = keyData - 0x5d;
-    index_b++;
-    key_press_scan_buff[index_b] = 0x73;
-  }
-  else if (keyData <= 0x5a && keyData >= 0x41)
-  { //uppercase letters
-    modifyKey[index_b] = 0x02;
-    key_press_scan_buff[index_b] = keyData - 0x3d;
-    index_b++;
-    key_press_scan_buff[index_b] = 0x73;
-  }
-  else if (keyData == 0x20)
-  { //space
-    modifyKey[index_b] = 0x00;
-    key_press_scan_buff[index_b] = 0x2c;
-    index_b++;
-    key_press_scan_buff[index_b] = 0x73;
-  }
-  else
+  if (keyReports.add(key) && demoPtr != NULL && demoPtr -> connected())
   {
-    modifyKey[index_b] = 0x00;
-    //key_press_scan_buff[index_b] = 0x73;          //this is dummy data.
-    //msg[index_w+1] = '\0';
-  }
-
-  // TODO 
-
-  index_b++;
-
-  if (keyData == 0x0a && demoPtr != NULL && demoPtr -> connected())
-  {
-    for (int i = 0; i < index_b; i++)
-    {
-      demoPtr -> update_keyboard_value(i);
-      wait(0.03);
-    }
-    index_b = 0;
-    index_w = 0;
-    memset(modifyKey, 0, 50);
+    demoPtr -> update_keyboard_value(keyReports);
+    keyReports.clear();
     memset(msg, 0, 25);
-    memset(key_press_scan_buff, 0, 50);
   }
 }
 
@@ -247,11 +203,15 @@ void keyboard_task(void const *) {
   while(1) {
     // try to connect a USB keyboard
     while(!keyboard.connect())
-      Thread::wait(500);
+      Thread::wait(100);
 
     // when connected, attach handler called on keyboard event
     printf("Keyboard has been detected\r\n");
     keyboard.attach(onKey);
+#if USBHOST_BOOT_TIMELINE
+    // the boot is over once the keyboard is enumerated
+    event_queue.call(USBHostBoot::print);
+#endif
 
     // wait until the keyboard is disconnected
     while(keyboard.connected())
@@ -259,17 +219,70 @@ void keyboard_task(void const *) {
   }
 }
 
+#if USBHOST_CAPTURE
+/** Save the USB capture on the first mass storage device connected */
+void capture_task(void const *) {
+  USBHostMSD msd;
+
+  while(!msd.connect())
+    Thread::wait(500);
+
+  // the writes of the file are not captured
+  USBHostCapture::enable(false);
+  FATFileSystem fs("usb");
+  if (fs.mount(&msd) != 0) {
+    printf("USB capture: mount failed\r\n");
+    return;
+  }
+  FILE *file = fopen(USB_CAPTURE_FILE, "wb");
+  if (file != NULL) {
+    int nb = USBHostCapture::dump(file);
+    fclose(file);
+    printf("USB capture: %d events saved to %s, %lu dropped\r\n", nb, USB_CAPTURE_FILE, (unsigned long)USBHostCapture::getDropped());
+  } else {
+    printf("USB capture: cannot open %s\r\n", USB_CAPTURE_FILE);
+  }
+  fs.unmount();
+}
+#endif
+
 int main()
 {
+  USB_BOOT_MARK("main");
+
+#if USBHOST_MONITOR
+  // stack high-water marks and CPU load of the threads every 10 s
+  USBHostMonitor::start(10000);
+#endif
+#if USBHOST_LATENCY
+  // keystroke latency, from the USB ISR to the BLE notification
+  event_queue.call_every(10000, USBHostLatency::report);
+#endif
 
-  Thread keyboardTask(keyboard_task, NULL, osPriorityNormal, 1024 * 4);
   BLE &ble = BLE::Instance();
   ble.onEventsToProcess(schedule_ble_events);
   USB_Device demo(ble, event_queue);
   demoPtr = &demo;
 
+  // the BLE init completes from the event queue, advertising starts when it is done
   demo.start();
+#if USBHOST_BOOT_TIMELINE
+  // without keyboard
+  event_queue.call_in(USB_BOOT_DEADLINE, USBHostBoot::print);
+#endif
+
+#if USBHOST_CAPTURE
+  // from the enumeration of the keyboard until a mass storage device is connected
+  USBHostCapture::enable(true);
+#endif
+
+  // the USB host powers up and enumerates the keyboard meanwhile
+  Thread keyboardTask(keyboard_task, NULL, osPriorityNormal, 1024 * 4);
+#if USBHOST_CAPTURE
+  Thread captureTask(capture_task, NULL, osPriorityNormal, 1024 * 4);
+#endif
 
+  event_queue.dispatch_forever();
 
   return 0;
 }
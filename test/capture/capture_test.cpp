@@ -0,0 +1,151 @@
+/*
+* Host test of the USB capture: a known sequence of TD events is recorded,
+* saved by USBHostCapture::dump and compared byte for byte with usbmon.pcap,
+* written from the usbmon header of Linux by usbmon_pcap.py.
+*
+* usage: capture_test <expected pcap>
+*/
+
+#include <stdlib.h>
+#include <vector>
+#include "USBHostCapture.h"
+
+#define PCAP_HEADER_LEN     24
+#define RECORD_HEADER_LEN   16
+#define USBMON_HEADER_LEN   48
+
+// fields of the usbmon header, to name a mismatch
+static const struct {
+    int offset;
+    const char * name;
+} fields[] = {
+    { 0, "id" }, { 8, "type" }, { 9, "xfer_type" }, { 10, "epnum" }, { 11, "devnum" },
+    { 12, "busnum" }, { 14, "flag_setup" }, { 15, "flag_data" }, { 16, "ts_sec" },
+    { 24, "ts_usec" }, { 28, "status" }, { 32, "length" }, { 36, "len_cap" },
+    { 40, "setup" }, { 48, "data" },
+};
+
+static const char * fieldName(int offset)
+{
+    const char * name = fields[0].name;
+    for (unsigned i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (fields[i].offset <= offset) {
+            name = fields[i].name;
+        }
+    }
+    return name;
+}
+
+static bool readFile(FILE * file, std::vector<uint8_t> &bytes)
+{
+    int c;
+    if (file == NULL) {
+        return false;
+    }
+    rewind(file);
+    while ((c = fgetc(file)) != EOF) {
+        bytes.push_back(c);
+    }
+    return true;
+}
+
+static void record()
+{
+    uint8_t setup[8] = { 0x80, 0x06, 0x00, 0x01, 0x00, 0x00, 0x12, 0x00 };
+    uint8_t report[8] = { 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    uint8_t data[40];
+    USBEndpoint control(CONTROL_ENDPOINT, OUT, 0, 0, true);
+    USBEndpoint keyboard(INTERRUPT_ENDPOINT, IN, 1, 2);
+    USBEndpoint bulk(BULK_ENDPOINT, OUT, 2, 3);
+    USBEndpoint iso(ISOCHRONOUS_ENDPOINT, IN, 3, 4);
+
+    for (int i = 0; i < 40; i++) {
+        data[i] = i;
+    }
+
+    USBHostCapture::submit(0, &control, (volatile void *)0x20001000, setup, 8, 1500);
+    USBHostCapture::complete(0, &control, (volatile void *)0x20001000, USB_TYPE_IDLE, 1501);
+
+    USBHostCapture::submit(0, &keyboard, (volatile void *)0x20001040, report, 8, 2000);
+    keyboard.setTransferred(report, 8);
+    USBHostCapture::complete(0, &keyboard, (volatile void *)0x20001040, USB_TYPE_IDLE, 2010);
+
+    USBHostCapture::submit(0, &bulk, (volatile void *)0x20001080, data, 40, 3000);
+    bulk.setTransferred(NULL, 40);
+    USBHostCapture::complete(0, &bulk, (volatile void *)0x20001080, USB_TYPE_STALL_ERROR, 3001);
+
+    USBHostCapture::submit(1, &iso, (volatile void *)0x200010c0, NULL, 192, 4000);
+
+    USBHostCapture::complete(0, &keyboard, (volatile void *)0x20001040, USB_TYPE_DEVICE_NOT_RESPONDING_ERROR, 5000);
+}
+
+int main(int argc, char ** argv)
+{
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> produced;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <expected pcap>\n", argv[0]);
+        return 2;
+    }
+    FILE * file = fopen(argv[1], "rb");
+    if (!readFile(file, expected)) {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[1]);
+        return 2;
+    }
+    fclose(file);
+
+    // not recorded until enabled
+    USBEndpoint control(CONTROL_ENDPOINT, OUT, 0, 0, true);
+    USBHostCapture::complete(0, &control, (volatile void *)0x20000000, USB_TYPE_IDLE, 1000);
+
+    USBHostCapture::enable(true);
+    record();
+
+    file = tmpfile();
+    int nb = USBHostCapture::dump(file);
+    if ((nb < 0) || !readFile(file, produced)) {
+        fprintf(stderr, "%s: dump failed\n", argv[0]);
+        return 1;
+    }
+    fclose(file);
+
+    int errors = 0;
+    if (nb != 8) {
+        fprintf(stderr, "%s: %d events saved, expected 8\n", argv[0], nb);
+        errors++;
+    }
+    if (produced.size() != expected.size()) {
+        fprintf(stderr, "%s: %u bytes, expected %u\n", argv[0], (unsigned)produced.size(), (unsigned)expected.size());
+        errors++;
+    }
+
+    // walk the records of the expected file to locate a difference
+    size_t pos = PCAP_HEADER_LEN;
+    int index = 0;
+    for (size_t i = 0; (i < produced.size()) && (i < expected.size()); i++) {
+        while ((i >= pos + RECORD_HEADER_LEN) && (pos + 12 <= expected.size())) {
+            uint32_t incl_len = expected[pos + 8] | (expected[pos + 9] << 8) | (expected[pos + 10] << 16) | (expected[pos + 11] << 24);
+            if (i < pos + RECORD_HEADER_LEN + incl_len) {
+                break;
+            }
+            pos += RECORD_HEADER_LEN + incl_len;
+            index++;
+        }
+        if (produced[i] != expected[i]) {
+            if (i < PCAP_HEADER_LEN) {
+                fprintf(stderr, "offset %u: pcap header\n", (unsigned)i);
+            } else if (i < pos + RECORD_HEADER_LEN) {
+                fprintf(stderr, "offset %u: record %d, pcap record header\n", (unsigned)i, index);
+            } else {
+                int offset = i - pos - RECORD_HEADER_LEN;
+                fprintf(stderr, "offset %u: record %d, usbmon %s (byte %d): %02x, expected %02x\n",
+                        (unsigned)i, index, fieldName(offset), offset, produced[i], expected[i]);
+            }
+            errors++;
+        }
+    }
+
+    printf("%s: %s\n", argv[1], errors ? "FAIL" : "ok");
+    return errors ? 1 : 0;
+}
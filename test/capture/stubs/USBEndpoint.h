@@ -0,0 +1,57 @@
+/* Host stand-in of USBEndpoint.h for the capture test: the state read by the capture is set by the test */
+#ifndef USBENDPOINT_H
+#define USBENDPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum USB_TYPE {
+    USB_TYPE_OK = 0,
+    USB_TYPE_STALL_ERROR = 4,
+    USB_TYPE_DEVICE_NOT_RESPONDING_ERROR = 5,
+    USB_TYPE_IDLE = 16,
+};
+
+enum ENDPOINT_DIRECTION {
+    OUT = 1,
+    IN
+};
+
+enum ENDPOINT_TYPE {
+    CONTROL_ENDPOINT = 0,
+    ISOCHRONOUS_ENDPOINT,
+    BULK_ENDPOINT,
+    INTERRUPT_ENDPOINT
+};
+
+class USBEndpoint {
+public:
+    USBEndpoint(ENDPOINT_TYPE _type, ENDPOINT_DIRECTION _dir, uint8_t _address, uint8_t _device_address, bool _setup = false):
+        type(_type), dir(_dir), address(_address), device_address(_device_address), setup(_setup),
+        transferred(0), buf_start(NULL) {
+    }
+
+    void setTransferred(uint8_t * buf, int len) {
+        buf_start = buf;
+        transferred = len;
+    }
+
+    ENDPOINT_TYPE getType() { return type; }
+    uint8_t getDeviceAddress() { return device_address; }
+    int getLengthTransferred() { return transferred; }
+    uint8_t * getBufStart() { return buf_start; }
+    uint8_t getAddress() { return address; }
+    ENDPOINT_DIRECTION getDir() { return dir; }
+    bool isSetup() { return setup; }
+
+private:
+    ENDPOINT_TYPE type;
+    ENDPOINT_DIRECTION dir;
+    uint8_t address;
+    uint8_t device_address;
+    bool setup;
+    int transferred;
+    uint8_t * buf_start;
+};
+
+#endif
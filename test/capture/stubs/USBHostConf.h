@@ -0,0 +1,9 @@
+/* Host configuration of the capture test */
+#ifndef USBHOST_CONF_H
+#define USBHOST_CONF_H
+
+#define USBHOST_CAPTURE             1
+#define USB_CAPTURE_RECORDS         64
+#define USB_CAPTURE_PAYLOAD         32
+
+#endif
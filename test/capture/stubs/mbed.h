@@ -0,0 +1,23 @@
+/* Host stand-in of mbed.h for the capture test: the parts used by the capture */
+#ifndef MBED_H
+#define MBED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PACKED __attribute__((packed))
+
+static inline void __DMB(void) {
+    __sync_synchronize();
+}
+
+static inline bool core_util_atomic_cas_u32(volatile uint32_t *ptr, uint32_t *expected, uint32_t desired) {
+    return __atomic_compare_exchange_n(ptr, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t core_util_atomic_incr_u32(volatile uint32_t *ptr, uint32_t delta) {
+    return __atomic_add_fetch(ptr, delta, __ATOMIC_SEQ_CST);
+}
+
+#endif
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Write usbmon.pcap, the capture expected from the events of capture_test.cpp.
+
+The packets follow the usbmon binary header of Linux (48 bytes, link type 189,
+Documentation/usb/usbmon.rst):
+
+    u64 id, u8 type, u8 xfer_type, u8 epnum, u8 devnum, u16 busnum,
+    s8 flag_setup, s8 flag_data, s64 ts_sec, s32 ts_usec, s32 status,
+    u32 length, u32 len_cap, u8 setup[8]
+
+xfer_type: 0 isochronous, 1 interrupt, 2 control, 3 bulk
+"""
+
+import struct
+
+SNAPLEN_DATA = 32
+
+ISO, INTR, CTRL, BULK = 0, 1, 2, 3
+EPIPE, EPROTO, EINPROGRESS = -32, -71, -115
+
+SETUP = bytes([0x80, 0x06, 0x00, 0x01, 0x00, 0x00, 0x12, 0x00])
+REPORT = bytes([0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00])
+BULK_DATA = bytes(range(40))
+
+
+def packet(td, kind, xfer, epnum, devnum, busnum, frame, status, length,
+           data=b'', setup=None, flag_data=None):
+    flag_setup = 0 if setup is not None else ord('-')
+    if flag_data is None:
+        flag_data = 0
+    header = struct.pack('<QBBBBHbbqiiII8s', td, ord(kind), xfer, epnum, devnum, busnum,
+                         flag_setup, flag_data, frame // 1000, (frame % 1000) * 1000,
+                         status, length, len(data), setup or bytes(8))
+    assert len(header) == 48
+    return frame, header + data, length
+
+
+events = [
+    # setup stage of GET_DESCRIPTOR on the default address
+    packet(0x20001000, 'S', CTRL, 0x00, 0, 1, 1500, EINPROGRESS, 0, setup=SETUP, flag_data=ord('=')),
+    packet(0x20001000, 'C', CTRL, 0x00, 0, 1, 1501, 0, 0, flag_data=ord('=')),
+    # keyboard report on the interrupt IN endpoint 1 of device 2
+    packet(0x20001040, 'S', INTR, 0x81, 2, 1, 2000, EINPROGRESS, 8, flag_data=ord('<')),
+    packet(0x20001040, 'C', INTR, 0x81, 2, 1, 2010, 0, 8, data=REPORT),
+    # bulk OUT endpoint 2 of device 3: data cut to the snap length, then stalled
+    packet(0x20001080, 'S', BULK, 0x02, 3, 1, 3000, EINPROGRESS, 40, data=BULK_DATA[:SNAPLEN_DATA]),
+    packet(0x20001080, 'C', BULK, 0x02, 3, 1, 3001, EPIPE, 0, flag_data=ord('>')),
+    # isochronous IN endpoint 3 of device 4 on the second controller
+    packet(0x200010c0, 'S', ISO, 0x83, 4, 2, 4000, EINPROGRESS, 192, flag_data=ord('<')),
+    # interrupt IN transfer failed
+    packet(0x20001040, 'C', INTR, 0x81, 2, 1, 5000, EPROTO, 0),
+]
+
+with open('usbmon.pcap', 'wb') as f:
+    f.write(struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 48 + SNAPLEN_DATA, 189))
+    for frame, pkt, length in events:
+        f.write(struct.pack('<IIII', frame // 1000, (frame % 1000) * 1000, len(pkt), 48 + length))
+        f.write(pkt)
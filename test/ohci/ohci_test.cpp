@@ -0,0 +1,411 @@
+/*
+* Host test of the OHCI list handling: the transfers are queued on the bulk EDs by
+* the real USBEndpoint (as USBHost::addTransfer) while a model of the controller, in
+* another thread, consumes the TDs at the head of the EDs, retires them to the done
+* queue and reports it as the controller does with HccaDoneHead. The done queue is
+* processed as USBHost::transferCompleted.
+*
+* Checked for each transfer: its TDs are consumed in order, none of them is skipped
+* or consumed twice, the dummy tail TD is never consumed, the TDs left on a halted ED
+* are never consumed, the transfer is completed once, with its state and length, and
+* the toggle carry of the ED is kept.
+*
+* usage: ohci_test [transfers per endpoint] [seed]
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "USBEndpoint.h"
+
+#define MAX_PACKET      64
+#define PIPES           3
+#define TDS             (PIPES * USB_BULK_TDS)
+// the descriptors are 16 bytes aligned on the controller
+#define TD_STRIDE       64
+#define BUF_LEN         ((USB_BULK_TDS - 1) * USB_BULK_TD_LEN + 2 * MAX_PACKET)
+
+// OHCI ED headP bits
+#define ED_HALTED       0x1
+#define ED_CARRY        0x2
+
+typedef struct {
+    uint8_t nb;                         // TDs queued
+    uint8_t consumed;                   // TDs retired by the controller
+    bool ended;                         // retired its last TD, or halted the ED
+    uint8_t state;                      // expected state of the completion
+    uint32_t actual;                    // bytes transferred
+    uint8_t * cbp[USB_BULK_TDS];        // buffers of the TDs
+    uint8_t * be[USB_BULK_TDS];
+} transfer_t;
+
+typedef struct {
+    USBEndpoint ep;
+    HCED * ed;
+    uint8_t * buf;
+    ENDPOINT_DIRECTION dir;
+    transfer_t t;
+    volatile bool busy;                 // transfer queued and not completed
+    uint32_t queued;
+    uint32_t completed;
+    uint32_t carry;                     // toggle carry expected on the ED
+} pipe_t;
+
+static pipe_t pipes[PIPES];
+static HCED * bulk_head;
+static volatile bool running;
+
+static uint32_t errors;
+static uint32_t tds_consumed;
+static uint32_t interrupts;
+static uint32_t shorts;
+static uint32_t stalls;
+
+static uint32_t seed = 1;
+
+// xorshift: the sequence of the controller and the driver depends on the seed only
+static uint32_t random_u32(uint32_t * state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void fail(pipe_t * p, const char * what)
+{
+    fprintf(stderr, "pipe %d, transfer %u: %s\n", (int)(p - pipes), (unsigned)p->queued, what);
+    errors++;
+}
+
+static pipe_t * pipeOf(volatile HCTD * td)
+{
+    for (int i = 0; i < PIPES; i++) {
+        if (td->ep == &pipes[i].ep) {
+            return &pipes[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+* Driver side of the completion, as USBHost::transferCompleted on OHCI, with the checks
+* of the test. Called by the controller thread in place of the interrupt
+*/
+static void transferCompleted(uint32_t addr)
+{
+    volatile HCTD * tdList = NULL;
+
+    do {
+        volatile HCTD * td = (volatile HCTD *)(uintptr_t)addr;
+        addr = (uint32_t)(uintptr_t)td->nextTD;
+        td->nextTD = (HCTD *)tdList;
+        tdList = td;
+    } while (addr);
+
+    while (tdList != NULL) {
+        volatile HCTD * td = tdList;
+        tdList = (volatile HCTD *)td->nextTD;
+        USBEndpoint * ep = (USBEndpoint *)td->ep;
+        pipe_t * p = pipeOf(td);
+
+        if (p == NULL) {
+            fprintf(stderr, "TD %p of no endpoint in the done queue\n", td);
+            errors++;
+            continue;
+        }
+
+        uint8_t state = td->control >> 28;
+        if (!ep->isLastTD(td)) {
+            if (state == 0) {
+                continue;
+            }
+            if (state == USB_TYPE_DATA_UNDERRUN_ERROR) {
+                state = 0;
+            }
+        }
+        if (state == 0) {
+            if (td->currBufPtr)
+                ep->setLengthTransferred((uint32_t)(uintptr_t)td->currBufPtr - (uint32_t)(uintptr_t)ep->getBufStart());
+            else
+                ep->setLengthTransferred((uint32_t)(uintptr_t)td->bufEnd + 1 - (uint32_t)(uintptr_t)ep->getBufStart());
+            state = USB_TYPE_IDLE;
+        }
+        ep->unqueueTransfer(td);
+
+        if (!p->busy) {
+            fail(p, "completed twice");
+        } else if (!p->t.ended) {
+            fail(p, "completed before its last TD");
+        } else if (state != p->t.state) {
+            fail(p, "wrong state");
+        } else if ((state == USB_TYPE_IDLE) && ((uint32_t)ep->getLengthTransferred() != p->t.actual)) {
+            fail(p, "wrong length");
+        }
+        if (((uint32_t)(uintptr_t)p->ed->headTD & ED_CARRY) != p->carry) {
+            fail(p, "toggle carry lost");
+        }
+        p->completed++;
+
+        // the interrupt ends before the thread sees the endpoint idle
+        __DMB();
+        ep->setState((USB_TYPE)state);
+        p->busy = false;
+    }
+}
+
+/*
+* Controller side: a frame serves one TD of each ED of the bulk list, a TD is retired
+* to the done queue with its completion code, the done queue is written back when the
+* delay of a retired TD expires (at once on an error)
+*/
+static void * controller(void * arg)
+{
+    uint32_t rnd = seed * 2654435761u + 1;
+    uint32_t done_head = 0;
+    uint8_t counter = TD_DELAY_INT_NONE;
+
+    while (running) {
+        bool served = false;
+        for (HCED * ed = bulk_head; ed != NULL; ed = (HCED *)ed->nextED) {
+            uint32_t head = (uint32_t)(uintptr_t)ed->headTD;
+            volatile HCTD * td = (volatile HCTD *)(uintptr_t)(head & ~0xF);
+
+            if ((ed->control & ED_SKIP) || (head & ED_HALTED) || (td == ed->tailTD)) {
+                continue;
+            }
+            pipe_t * p = pipeOf(td);
+            if (p == NULL) {
+                fprintf(stderr, "TD %p of no endpoint on ED %p\n", td, ed);
+                errors++;
+                running = false;
+                break;
+            }
+            if ((head & ED_CARRY) != p->carry) {
+                fail(p, "toggle carry changed by the driver");
+            }
+
+            transfer_t * t = &p->t;
+            uint8_t i = t->consumed;
+            if (!p->busy || t->ended || (i >= t->nb) || (td->currBufPtr != t->cbp[i]) || (td->bufEnd != t->be[i])) {
+                fail(p, "TD skipped, consumed twice or not queued");
+                running = false;
+                break;
+            }
+
+            uint8_t * cbp = (uint8_t *)td->currBufPtr;
+            uint32_t len = (uint32_t)(uintptr_t)td->bufEnd + 1 - (uint32_t)(uintptr_t)cbp;
+            uint32_t bytes = len;
+            uint8_t cc = 0;
+            uint32_t r = random_u32(&rnd) % 100;
+
+            if (r < 3) {
+                // stall before any data
+                cc = USB_TYPE_STALL_ERROR;
+                bytes = 0;
+                stalls++;
+            } else if ((r < 15) && (p->dir == IN) && (len > 0)) {
+                // short packet
+                bytes = random_u32(&rnd) % len;
+                shorts++;
+                if (!(td->control & TD_ROUNDING)) {
+                    cc = USB_TYPE_DATA_UNDERRUN_ERROR;
+                }
+            }
+            uint32_t packets = (bytes + MAX_PACKET - 1) / MAX_PACKET + ((bytes < len) && (cc != USB_TYPE_STALL_ERROR) && (bytes % MAX_PACKET == 0));
+            p->carry ^= (packets & 1) ? ED_CARRY : 0;
+
+            t->consumed++;
+            t->actual += bytes;
+            if (cc || (bytes < len) || (t->consumed == t->nb)) {
+                t->ended = true;
+                // a short packet ends the transfer without error
+                t->state = (cc && (cc != USB_TYPE_DATA_UNDERRUN_ERROR)) ? cc : USB_TYPE_IDLE;
+            }
+            tds_consumed++;
+            served = true;
+
+            // retire the TD: the ED moves to the next one, halted on an error
+            td->currBufPtr = ((bytes == len) && (cc == 0)) ? NULL : cbp + bytes;
+            td->control = (td->control & 0x0FFFFFFF) | ((uint32_t)cc << 28);
+            uint32_t next = (uint32_t)(uintptr_t)td->nextTD;
+            td->nextTD = (HCTD *)(uintptr_t)done_head;
+            done_head = (uint32_t)(uintptr_t)td;
+            ed->headTD = (HCTD *)(uintptr_t)(next | p->carry | (cc ? ED_HALTED : 0));
+
+            uint8_t delay = cc ? 0 : ((td->control >> 21) & 0x7);
+            if (delay < counter) {
+                counter = delay;
+            }
+        }
+
+        // end of frame, the driver runs when the lists are empty (single core host)
+        if (!served && (counter == TD_DELAY_INT_NONE)) {
+            sched_yield();
+        }
+        if (counter != TD_DELAY_INT_NONE) {
+            if (counter == 0) {
+                uint32_t done = done_head;
+                done_head = 0;
+                counter = TD_DELAY_INT_NONE;
+                interrupts++;
+                transferCompleted(done);
+            } else {
+                counter--;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+* Driver side of the submission, as USBHost::addTransfer on OHCI for a bulk endpoint
+*/
+static void addTransfer(pipe_t * p, uint8_t * buf, uint32_t len)
+{
+    USBEndpoint * ed = &p->ep;
+    uint32_t token = (p->dir == IN) ? TD_IN : TD_OUT;
+    transfer_t * t = &p->t;
+
+    uint8_t nb = 1;
+    if (len > USB_BULK_TD_LEN) {
+        nb = (len + USB_BULK_TD_LEN - 1) / USB_BULK_TD_LEN;
+        nb = (nb > ed->getMaxTDs()) ? ed->getMaxTDs() : nb;
+    }
+    memset(t, 0, sizeof(transfer_t));
+    t->nb = nb;
+    for (uint8_t i = 0; i < nb; i++) {
+        uint32_t td_len = (i == nb - 1) ? len : USB_BULK_TD_LEN;
+        volatile HCTD * td = ed->getNextTD(i);
+        if (i == nb - 1) {
+            td->control  = (TD_ROUNDING | token | TD_DELAY_INT(0) | TD_CC);
+        } else {
+            td->control  = (token | TD_DELAY_INT(TD_DELAY_INT_NONE) | TD_CC);
+        }
+        td->currBufPtr   = buf;
+        td->bufEnd       = (buf + (td_len - 1));
+        t->cbp[i] = buf;
+        t->be[i] = buf + (td_len - 1);
+        buf += td_len;
+        len -= td_len;
+    }
+
+    p->busy = true;
+    p->queued++;
+    ed->queueTransfer(nb);
+}
+
+static uint8_t * map32(size_t len)
+{
+    void * mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        exit(2);
+    }
+    memset(mem, 0, len);
+    return (uint8_t *)mem;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t transfers = (argc > 1) ? strtoul(argv[1], NULL, 0) : 20000;
+    pthread_t thread;
+    uint32_t rnd;
+
+    if (argc > 2) {
+        seed = strtoul(argv[2], NULL, 0);
+    }
+    rnd = seed;
+
+    // the descriptors and the buffers are addressed on 32 bits by the driver
+    uint8_t * eds = map32(PIPES * TD_STRIDE);
+    uint8_t * tds = map32(TDS * TD_STRIDE);
+    uint8_t * bufs = map32(PIPES * BUF_LEN);
+
+    // bulk IN and OUT endpoints with all their TDs, a bulk IN one left with two TDs (pool empty)
+    const ENDPOINT_DIRECTION dirs[PIPES] = { IN, OUT, IN };
+    const uint8_t nb_tds[PIPES] = { USB_BULK_TDS, USB_BULK_TDS, 2 };
+    uint32_t td_idx = 0;
+    for (int i = 0; i < PIPES; i++) {
+        pipe_t * p = &pipes[i];
+        HCTD * td_list[2] = { (HCTD *)(tds + td_idx++ * TD_STRIDE), (HCTD *)(tds + td_idx++ * TD_STRIDE) };
+
+        p->ed = (HCED *)(eds + i * TD_STRIDE);
+        p->dir = dirs[i];
+        p->buf = bufs + i * BUF_LEN;
+        p->ep.init(p->ed, BULK_ENDPOINT, p->dir, MAX_PACKET, i + 1, td_list);
+        for (uint8_t j = 2; j < nb_tds[i]; j++) {
+            p->ep.addTD((HCTD *)(tds + td_idx++ * TD_STRIDE));
+        }
+        if (i > 0) {
+            pipes[i - 1].ep.queueEndpoint(&p->ep);
+        }
+    }
+    bulk_head = pipes[0].ed;
+
+    running = true;
+    pthread_create(&thread, NULL, controller, NULL);
+
+    // queue the transfers while the controller runs, as soon as the endpoint is idle
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct timespec progress_time = start;
+    bool pending = true;
+    while (running && pending) {
+        pending = false;
+        bool progress = false;
+        for (int i = 0; i < PIPES; i++) {
+            pipe_t * p = &pipes[i];
+            if (p->busy) {
+                pending = true;
+                continue;
+            }
+            __DMB();
+            if (p->queued == transfers) {
+                continue;
+            }
+            // up to two packets more than the TDs hold, zero length transfers included
+            uint32_t len = random_u32(&rnd) % (p->ep.getMaxTDs() * USB_BULK_TD_LEN + 2 * MAX_PACKET + 1);
+            if (len > p->ep.getMaxTDs() * USB_BULK_TD_LEN) {
+                len = p->ep.getMaxTDs() * USB_BULK_TD_LEN;
+            }
+            addTransfer(p, p->buf, len);
+            pending = true;
+            progress = true;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (progress) {
+            progress_time = now;
+        } else if (now.tv_sec - progress_time.tv_sec > 2) {
+            fprintf(stderr, "no progress: a transfer is never completed\n");
+            errors++;
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+    running = false;
+    pthread_join(thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (int i = 0; i < PIPES; i++) {
+        if (pipes[i].completed != pipes[i].queued) {
+            fail(&pipes[i], "queued transfers not completed");
+        }
+    }
+
+    double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+    uint32_t total = pipes[0].completed + pipes[1].completed + pipes[2].completed;
+    printf("ohci_test: %s\n", errors ? "FAIL" : "ok");
+    printf("  %u transfers on %d endpoints, %u TDs, %u short, %u stalled\n",
+           (unsigned)total, PIPES, (unsigned)tds_consumed, (unsigned)shorts, (unsigned)stalls);
+    printf("  %u done queue interrupts, %.2f TDs and %.2f transfers per interrupt, %.0f transfers/s\n",
+           (unsigned)interrupts,
+           interrupts ? (double)tds_consumed / interrupts : 0.0,
+           interrupts ? (double)total / interrupts : 0.0,
+           elapsed > 0 ? total / elapsed : 0.0);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,10 @@
+/* Host configuration of the OHCI list test: short bulk TDs, a long transfer takes all the TDs */
+#ifndef USBHOST_CONF_H
+#define USBHOST_CONF_H
+
+#define USBHOST_STATS               0
+#define USB_BULK_TDS                4
+#define USB_BULK_TD_LEN             128
+#define USB_EP_SIGNAL               0x40000000
+
+#endif
@@ -0,0 +1,16 @@
+/* Host stand-in of mbed.h for the OHCI list test: the parts used by USBEndpoint */
+#ifndef MBED_H
+#define MBED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define __IO volatile
+
+static inline void __DMB(void) {
+    __sync_synchronize();
+}
+
+#endif
@@ -0,0 +1,7 @@
+/* Host stand-in of mbed_toolchain.h for the OHCI list test */
+#ifndef MBED_TOOLCHAIN_H
+#define MBED_TOOLCHAIN_H
+
+#define PACKED __attribute__((packed))
+
+#endif
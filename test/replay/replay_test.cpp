@@ -0,0 +1,124 @@
+/*
+* Host test of the keyboard decoding: a record saved by USBHostKeyboard::dumpReports
+* is replayed through the decoding and the application (KeyReports) down to a
+* recording HIDService, the notified reports are compared with the expected ones.
+* The throughput of the replay and the latency of the keys, from the decoding to
+* the notification of their line, are printed.
+*
+* usage: replay_test [-r] <record> <expected>
+*   -r: replay at the pace of the record instead of the maximum rate
+*
+* expected file, '#' starts a comment line:
+*   reports <replayed> keys <passed to onKey> dropped <dropped by KeyReports>
+*   one line per notified report, 8 bytes in hex
+*/
+
+#include <string>
+#include <vector>
+#include "USBHostKeyboard.h"
+#include "KeyReports.h"
+
+static KeyReports keyReports;
+static HIDService hid;
+
+// us, decoding time of the keys of the current line
+static std::vector<uint32_t> pending;
+static uint64_t latency_sum;
+static uint32_t latency_max;
+static uint32_t latency_count;
+
+// as the application, always connected
+static void onKey(uint8_t key)
+{
+    pending.push_back(us_ticker_read());
+    if (keyReports.add(key)) {
+        keyReports.send(&hid);
+        keyReports.clear();
+
+        uint32_t now = us_ticker_read();
+        for (size_t i = 0; i < pending.size(); i++) {
+            uint32_t latency = now - pending[i];
+            latency_sum += latency;
+            latency_max = (latency > latency_max) ? latency : latency_max;
+            latency_count++;
+        }
+        pending.clear();
+    }
+}
+
+static bool readExpected(const char * name, std::vector<std::string> &lines)
+{
+    char line[128];
+    FILE * file = fopen(name, "r");
+
+    if (file == NULL) {
+        return false;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if ((line[0] != '\0') && (line[0] != '#')) {
+            lines.push_back(line);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    std::vector<std::string> expected;
+    std::vector<std::string> produced;
+    USBReplayStats stats;
+    USBHostKeyboard keyboard;
+    char line[128];
+    bool realtime = false;
+
+    if ((argc > 1) && (strcmp(argv[1], "-r") == 0)) {
+        realtime = true;
+        argc--;
+        argv++;
+    }
+    if (argc != 3) {
+        fprintf(stderr, "usage: replay_test [-r] <record> <expected>\n");
+        return 2;
+    }
+    FILE * record = fopen(argv[1], "r");
+    if ((record == NULL) || !readExpected(argv[2], expected)) {
+        fprintf(stderr, "replay_test: cannot open %s\n", (record == NULL) ? argv[1] : argv[2]);
+        return 2;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    keyboard.attach(onKey);
+    int nb = keyboard.replay(record, realtime, &stats);
+    fclose(record);
+
+    snprintf(line, sizeof(line), "reports %d keys %u dropped %u", nb, (unsigned)stats.keys, (unsigned)keyReports.getDropped());
+    produced.push_back(line);
+    for (uint32_t i = 0; i < hid.getNotifications() && i < HID_SERVICE_REPORTS; i++) {
+        const uint8_t * r = hid.getReport(i);
+        snprintf(line, sizeof(line), "%02x %02x %02x %02x %02x %02x %02x %02x", r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7]);
+        produced.push_back(line);
+    }
+
+    int errors = 0;
+    for (size_t i = 0; i < produced.size() || i < expected.size(); i++) {
+        const char * got = (i < produced.size()) ? produced[i].c_str() : "(none)";
+        const char * want = (i < expected.size()) ? expected[i].c_str() : "(none)";
+        if (strcmp(got, want) != 0) {
+            fprintf(stderr, "%s: line %u: expected \"%s\", got \"%s\"\n", argv[1], (unsigned)i + 1, want, got);
+            errors++;
+        }
+    }
+    printf("%s: %s\n", argv[1], errors ? "FAIL" : "ok");
+    if (nb > 0) {
+        printf("  %u us, %.0f reports/s, %.0f keys/s, key to notification: %u keys, mean %u us, max %u us\n",
+               (unsigned)stats.elapsed,
+               stats.elapsed ? stats.reports * 1e6 / stats.elapsed : 0.0,
+               stats.elapsed ? stats.keys * 1e6 / stats.elapsed : 0.0,
+               (unsigned)latency_count,
+               latency_count ? (unsigned)(latency_sum / latency_count) : 0,
+               (unsigned)latency_max);
+    }
+    return errors ? 1 : 0;
+}
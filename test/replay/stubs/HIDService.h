@@ -0,0 +1,34 @@
+/* Host stand-in of HIDService.h for the replay test: the reports are recorded instead of notified */
+#ifndef __BLE_HID_SERVICE_H__
+#define __BLE_HID_SERVICE_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define HID_SERVICE_REPORTS         256
+
+class HIDService {
+public:
+    HIDService(): notifications(0) {
+    }
+
+    void updateReport(uint8_t modifydata, uint8_t data) {
+        if (notifications < HID_SERVICE_REPORTS) {
+            memset(reports[notifications], 0, 8);
+            reports[notifications][0] = modifydata;
+            reports[notifications][2] = data;
+        }
+        notifications++;
+    }
+
+    uint32_t getNotifications() const { return notifications; }
+
+    /** Report notified, in the order of the notifications */
+    const uint8_t *getReport(uint32_t i) const { return reports[i]; }
+
+private:
+    uint8_t     reports[HID_SERVICE_REPORTS][8];
+    uint32_t    notifications;
+};
+
+#endif
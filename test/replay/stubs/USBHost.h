@@ -0,0 +1,71 @@
+/* Host stand-in of USBHost.h for the replay test: the keyboard driver is built, never connected */
+#ifndef USBHOST_H
+#define USBHOST_H
+
+#include "mbed.h"
+#include "rtos.h"
+#include "USBHostConf.h"
+
+#define HID_CLASS                   0x03
+
+#define USB_INFO(...)
+#define USB_BOOT_MARK(name)
+#define USB_TRACE_SCOPE(name)
+#define USB_LATENCY_BEGIN(ep)
+
+enum USB_TYPE {
+    USB_TYPE_OK = 0,
+    USB_TYPE_ERROR,
+};
+
+enum ENDPOINT_DIRECTION {
+    OUT = 1,
+    IN
+};
+
+enum ENDPOINT_TYPE {
+    CONTROL_ENDPOINT = 0,
+    ISOCHRONOUS_ENDPOINT,
+    BULK_ENDPOINT,
+    INTERRUPT_ENDPOINT
+};
+
+class IUSBEnumerator {
+public:
+    virtual void setVidPid(uint16_t vid, uint16_t pid) = 0;
+    virtual bool parseInterface(uint8_t intf_nb, uint8_t intf_class, uint8_t intf_subclass, uint8_t intf_protocol) = 0;
+    virtual bool useEndpoint(uint8_t intf_nb, ENDPOINT_TYPE type, ENDPOINT_DIRECTION dir) = 0;
+};
+
+class USBEndpoint {
+public:
+    template<typename T>
+    void attach(T* tptr, void (T::*mptr)(void)) {}
+    int getLengthTransferred() { return 0; }
+    int getSize() { return 0; }
+};
+
+class USBDeviceConnected {
+public:
+    USBEndpoint * getEndpoint(uint8_t intf_nb, ENDPOINT_TYPE type, ENDPOINT_DIRECTION dir) { return NULL; }
+    uint16_t getVid() { return 0; }
+    uint16_t getPid() { return 0; }
+    void setName(const char * name, uint8_t intf_nb) {}
+};
+
+class USBHost {
+public:
+    static USBHost * getHostInst() { return NULL; }
+    USBDeviceConnected * getDevice(uint8_t index) { return NULL; }
+    USB_TYPE enumerate(USBDeviceConnected * dev, IUSBEnumerator* pEnumerator) { return USB_TYPE_ERROR; }
+    USB_TYPE interruptRead(USBDeviceConnected * dev, USBEndpoint * ep, uint8_t * buf, uint32_t len, bool blocking = true) { return USB_TYPE_ERROR; }
+    template<typename T>
+    void registerDriver(USBDeviceConnected * dev, uint8_t intf, T * tptr, void (T::*mptr)(void)) {}
+
+    class Lock {
+    public:
+        Lock(USBHost* pHost) {}
+    };
+};
+
+#endif
@@ -0,0 +1,10 @@
+/* Host configuration of the replay test: the keyboard driver with the record and the replay */
+#ifndef USBHOST_CONF_H
+#define USBHOST_CONF_H
+
+#define MAX_DEVICE_CONNECTED        1
+#define USBHOST_KEYBOARD            1
+#define USBHOST_REPLAY              1
+#define USB_REPLAY_REPORTS          256
+
+#endif
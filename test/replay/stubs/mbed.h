@@ -0,0 +1,20 @@
+/* Host stand-in of mbed.h for the replay test: the parts used by the keyboard decoding */
+#ifndef MBED_H
+#define MBED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static inline uint32_t us_ticker_read() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+// the reports are not paced on the host
+static inline void wait(float s) {
+}
+
+#endif
@@ -0,0 +1,14 @@
+/* Host stand-in of rtos.h for the replay test */
+#ifndef RTOS_H
+#define RTOS_H
+
+#include <unistd.h>
+
+class Thread {
+public:
+    static void wait(uint32_t ms) {
+        usleep(ms * 1000);
+    }
+};
+
+#endif